@@ -1,10 +1,12 @@
 // TODO: set all default parameters to sane values. check mdll&mcpd docs for limits and defaults.
+#include <algorithm>
 #include <cstdlib>
 #include <filesystem>
 #include <fstream>
 #include <iostream>
 #include <map>
 #include <signal.h>
+#include <sstream>
 
 #include <lyra/lyra.hpp>
 #include <mesytec-mcpd/mesytec-mcpd.h>
@@ -26,6 +28,7 @@ namespace
 {
 
 static std::atomic<bool> g_interrupted(false);
+static std::atomic<bool> g_flightRecorderTrigger(false);
 
 void signal_handler(int signum)
 {
@@ -33,6 +36,11 @@ void signal_handler(int signum)
     g_interrupted = true;
 }
 
+void flight_recorder_signal_handler(int)
+{
+    g_flightRecorderTrigger = true;
+}
+
 bool file_exists(const char *path) { return std::filesystem::exists(path); }
 
 } // namespace
@@ -54,6 +62,20 @@ void setup_signal_handlers()
 #endif
 }
 
+// SIGUSR1 requests a flight recorder dump during readout.
+void setup_flight_recorder_signal()
+{
+#ifdef SOCKET_PLATFORM_POSIX
+    struct sigaction new_action;
+    new_action.sa_handler = flight_recorder_signal_handler;
+    sigemptyset(&new_action.sa_mask);
+    new_action.sa_flags = SA_RESTART;
+
+    if (sigaction(SIGUSR1, &new_action, NULL) != 0)
+        throw std::system_error(errno, std::generic_category(), "setup_flight_recorder_signal");
+#endif
+}
+
 #ifdef MESYTEC_MCPD_ENABLE_PYTHON
 #include <pybind11/embed.h>
 namespace py = pybind11;
@@ -108,7 +130,28 @@ bool setup_python_context(PyCliContext &pyCtx, const std::string &pythonScriptPa
     return true;
 }
 
-bool python_context_handle_packet(PyCliContext &pyCtx, const DataPacket &packet)
+bool python_context_handle_event(PyCliContext &pyCtx, const DecodedEvent &event)
+{
+    if (pyCtx.eventCallback)
+    {
+        try
+        {
+            pyCtx.eventCallback(event);
+        }
+        catch (const std::exception &e)
+        {
+            spdlog::error("readout: Error in Python event callback: {}", e.what());
+            return false;
+        }
+    }
+
+    return true;
+}
+
+// If handleEvents is false only the packet callback is invoked. Used when the
+// events are delivered separately, e.g. after time ordering.
+bool python_context_handle_packet(PyCliContext &pyCtx, const DataPacket &packet,
+                                  bool handleEvents = true)
 {
     if (pyCtx.packetCallback)
     {
@@ -123,22 +166,14 @@ bool python_context_handle_packet(PyCliContext &pyCtx, const DataPacket &packet)
         }
     }
 
-    if (pyCtx.eventCallback)
+    if (pyCtx.eventCallback && handleEvents)
     {
         const auto eventCount = get_event_count(packet);
 
         for (size_t ei = 0; ei < eventCount; ++ei)
         {
-            auto event = decode_event(packet, ei);
-            try
-            {
-                pyCtx.eventCallback(event);
-            }
-            catch (const std::exception &e)
-            {
-                spdlog::error("readout: Error in Python event callback: {}", e.what());
+            if (!python_context_handle_event(pyCtx, decode_event(packet, ei)))
                 return false;
-            }
         }
     }
 
@@ -1346,6 +1381,123 @@ struct DaqCommand: public BaseCommand
     }
 };
 
+struct MultiDaqCommand: public BaseCommand
+{
+    std::string subCommand_;
+    std::vector<std::string> devices_;
+
+    MultiDaqCommand(lyra::cli &cli)
+    {
+        // The command creates its own sockets, one per listed device.
+        offline_ = true;
+
+        cli.add_argument(
+            lyra::command("multi_daq", [this](const lyra::group &) { this->run_ = true; })
+                .help("Synchronized DAQ control of multiple MCPDs")
+
+                .add_argument(lyra::arg(subCommand_, "command")
+                                  .required()
+                                  .choices("start", "stop", "continue")
+                                  .help("start|stop|continue"))
+
+                .add_argument(lyra::arg(devices_, "devices")
+                                  .cardinality(1, 256)
+                                  .help("List of MCPDs in the form address[:id]. The mcpd id "
+                                        "defaults to 0. The global --port is used as the "
+                                        "command port.")));
+    }
+
+    int runCommand(CliContext &ctx) override
+    {
+        spdlog::debug("{} {} [{}]", PRETTY_FUNCTION, subCommand_, fmt::join(devices_, ", "));
+
+        std::vector<McpdGroupMember> members;
+
+        auto close_sockets = [&members]
+        {
+            for (auto &member: members)
+                close_socket(member.sock);
+        };
+
+        for (const auto &device: devices_)
+        {
+            auto address = device;
+            unsigned long mcpdId = 0;
+
+            if (auto colon = device.find(':'); colon != std::string::npos)
+            {
+                address = device.substr(0, colon);
+                const auto idStr = device.substr(colon + 1);
+
+                try
+                {
+                    size_t end = 0;
+                    mcpdId = std::stoul(idStr, &end, 0);
+
+                    if (end != idStr.size() || mcpdId > 0xffu)
+                        throw std::out_of_range(idStr);
+                }
+                catch (const std::exception &)
+                {
+                    spdlog::error("multi_daq: invalid mcpd id '{}' in '{}'", idStr, device);
+                    close_sockets();
+                    return 1;
+                }
+            }
+
+            std::error_code ec;
+            int sock = connect_udp_socket(address, ctx.mcpdPort, &ec);
+
+            if (ec)
+            {
+                spdlog::error("multi_daq: error connecting to mcpd@{}:{}: {}", address,
+                              ctx.mcpdPort, ec.message());
+                close_sockets();
+                return 1;
+            }
+
+            members.push_back({sock, static_cast<u8>(mcpdId)});
+        }
+
+        McpdGroupCommandResult result;
+
+        if (subCommand_ == "start")
+            result = mcpd_group_start_daq(members);
+        else if (subCommand_ == "stop")
+            result = mcpd_group_stop_daq(members);
+        else if (subCommand_ == "continue")
+            result = mcpd_group_continue_daq(members);
+
+        close_sockets();
+
+        spdlog::info("multi_daq {}: {} devices, send skew={} us, total time={} us, retried={}",
+                     subCommand_, members.size(),
+                     std::chrono::duration_cast<std::chrono::microseconds>(result.sendSkew).count(),
+                     std::chrono::duration_cast<std::chrono::microseconds>(result.totalTime).count(),
+                     result.retriedCount);
+
+        for (size_t i = 0; i < result.errors.size(); ++i)
+        {
+            const auto &ec = result.errors[i];
+
+            if (ec)
+            {
+                spdlog::error("multi_daq {}: {} did not confirm: {} (code={}, category={})",
+                              subCommand_, devices_[i], ec.message(), ec.value(),
+                              ec.category().name());
+            }
+            else
+            {
+                spdlog::debug("multi_daq {}: {} ok, send offset={} us", subCommand_, devices_[i],
+                              std::chrono::duration_cast<std::chrono::microseconds>(
+                                  result.sendOffsets[i]).count());
+            }
+        }
+
+        return result.ok() ? 0 : 1;
+    }
+};
+
 struct ReadoutCounters
 {
     size_t packets = 0u;
@@ -1464,6 +1616,275 @@ void report_counters(const ReadoutCounters &counters, const std::string &title =
     report_counters(info, title);
 }
 
+void report_device_counters(const DeviceStatsTable &deviceStats,
+                            const std::vector<DeviceCounters> &prevDevices,
+                            std::chrono::microseconds dt, const std::string &title = "readout")
+{
+    for (size_t i = 0; i < deviceStats.size(); ++i)
+    {
+        const auto &dc = deviceStats.device(i);
+        const auto prev = i < prevDevices.size() ? prevDevices[i] : DeviceCounters{};
+        const auto rates = calculate_rates(dc, prev, dt);
+
+        spdlog::info("{}: device {} id={}: packets={}, events={} (trigger={}, mcpd={}, mdll={}), "
+                     "lost={}, outOfOrder={}, packets/s={:.2f}, events/s={:.0f}, MiB/s={:.2f}",
+                     title, format_ipv4(dc.srcAddr), dc.deviceId, dc.packets, dc.events,
+                     dc.eventsByType[static_cast<unsigned>(EventType::Trigger)],
+                     dc.eventsByType[static_cast<unsigned>(EventType::Neutron)],
+                     dc.eventsByType[static_cast<unsigned>(EventType::MdllNeutron)],
+                     dc.packetsLost, dc.outOfOrder, rates.packetsPerSecond, rates.eventsPerSecond,
+                     rates.bytesPerSecond / (1u << 20));
+    }
+}
+
+// Returns the listfile path for a single device when splitting the output per
+// device: <stem>_<srcAddr>_id<deviceId><extension>.
+std::string make_device_listfile_path(const std::string &listfilePath, const DeviceCounters &dc)
+{
+    std::filesystem::path path(listfilePath);
+    auto filename = fmt::format("{}_{}_id{}{}", path.stem().string(), format_ipv4(dc.srcAddr),
+                                dc.deviceId, path.extension().string());
+    return (path.parent_path() / filename).string();
+}
+
+// Returns the first unused flight recorder dump path <prefix>-<n>.mcpdlst,
+// counting up from n.
+std::string next_flight_recorder_path(const std::string &prefix, unsigned &n)
+{
+    std::string path;
+
+    do
+        path = fmt::format("{}-{:03}.mcpdlst", prefix, n++);
+    while (file_exists(path.c_str()));
+
+    return path;
+}
+
+// Parses a byte size with an optional binary unit suffix, e.g. "512M" or "2G".
+bool parse_byte_size(const std::string &str, u64 &dest)
+{
+    char *end = nullptr;
+    const auto value = std::strtoull(str.c_str(), &end, 10);
+
+    if (end == str.c_str())
+        return false;
+
+    unsigned shift = 0;
+
+    switch (*end)
+    {
+        case '\0': break;
+        case 'k': case 'K': shift = 10; break;
+        case 'm': case 'M': shift = 20; break;
+        case 'g': case 'G': shift = 30; break;
+        case 't': case 'T': shift = 40; break;
+        default: return false;
+    }
+
+    if (*end && end[1] != '\0')
+        return false;
+
+    dest = value << shift;
+    return true;
+}
+
+// Returns the path under which the output of SplitListfileWriter can be found.
+// Used to refuse overwriting existing files.
+std::string listfile_output_path(const std::string &basePath, const SplitListfileWriter::Options &options)
+{
+    if (options.splitSize || options.splitTime.count())
+        return make_listfile_manifest_path(basePath);
+    return basePath;
+}
+
+// Parses "<triggerId>[:<dataId>]" into the TOF trigger selection.
+bool parse_tof_trigger(const std::string &str, TofHistogrammer::Options &options)
+{
+    unsigned triggerId = 0, dataId = 0;
+    char sep = 0;
+    std::istringstream ss(str);
+
+    if (!(ss >> triggerId))
+        return false;
+
+    if (ss >> sep && (sep != ':' || !(ss >> dataId)))
+        return false;
+
+    if (triggerId > event_constants::trigger::TriggerIdMask
+        || dataId > event_constants::trigger::DataIdMask)
+        return false;
+
+    options.triggerId = triggerId;
+    options.dataId = dataId;
+    return true;
+}
+
+// Creates the TOF histogrammer if a TOF trigger was specified.
+std::unique_ptr<TofHistogrammer> make_tof_histogrammer(const std::string &tofTrigger,
+                                                       TofHistogrammer::Options options,
+                                                       const char *title)
+{
+    if (tofTrigger.empty())
+        return {};
+
+    if (!parse_tof_trigger(tofTrigger, options))
+    {
+        spdlog::error("{}: invalid --tof-trigger '{}', expected <triggerId>[:<dataId>]", title,
+                      tofTrigger);
+        return {};
+    }
+
+    try
+    {
+        auto result = std::make_unique<TofHistogrammer>(options);
+        spdlog::info("{}: TOF histograms: triggerId={}, dataId={}, bins={}, binWidth={}, "
+                     "offset={}, positionBins={}",
+                     title, options.triggerId, options.dataId, options.bins, options.binWidth,
+                     options.offset, options.positionBins);
+        return result;
+    }
+    catch (const std::invalid_argument &e)
+    {
+        spdlog::error("{}: {}", title, e.what());
+    }
+
+    return {};
+}
+
+void report_tof_counters(const TofHistogrammer &tof, const char *title)
+{
+    const auto &tc = tof.counters();
+    spdlog::info("{}: tof: triggers={}, neutrons={}, filled={}, noTrigger={}, underflow={}, "
+                 "overflow={}, histograms={}",
+                 title, tc.triggers, tc.neutrons, tc.filled, tc.noTrigger, tc.underflow,
+                 tc.overflow, tof.rowCount());
+}
+
+std::unique_ptr<ShmLiveHistos> make_shm_live_histos(const std::string &shmName, const char *title)
+{
+    if (shmName.empty())
+        return {};
+
+    auto result = std::make_unique<ShmLiveHistos>(shmName);
+
+    // Create the (empty) segment right away so that viewers can attach early.
+    if (auto ec = result->publish())
+    {
+        spdlog::error("{}: could not create shared memory histograms '{}': {}", title, shmName,
+                      ec.message());
+        return {};
+    }
+
+    spdlog::info("{}: publishing live histograms to shared memory segment '{}'", title, shmName);
+    return result;
+}
+
+void publish_shm_live_histos(ShmLiveHistos &histos, const char *title)
+{
+    if (auto ec = histos.publish())
+        spdlog::warn("{}: error publishing shared memory histograms: {}", title, ec.message());
+}
+
+std::unique_ptr<PacketForwarder> make_packet_forwarder(const std::vector<std::string> &specs,
+                                                       size_t queueSize, const char *title)
+{
+    if (specs.empty())
+        return {};
+
+    std::vector<ForwardDestination> destinations;
+
+    for (const auto &spec: specs)
+    {
+        ForwardDestination dest;
+
+        if (parse_forward_destination(spec, dest))
+        {
+            spdlog::error("{}: invalid forward destination '{}', expected "
+                          "host[:port][/dev=id,...][/type=bufferType,...]",
+                          title, spec);
+            return {};
+        }
+
+        destinations.emplace_back(dest);
+    }
+
+    PacketForwarder::Options options;
+    options.queueSize = queueSize;
+
+    auto result = std::make_unique<PacketForwarder>();
+
+    if (auto ec = result->start(destinations, options))
+    {
+        spdlog::error("{}: could not start packet forwarding: {}", title, ec.message());
+        return {};
+    }
+
+    for (const auto &dest: destinations)
+        spdlog::info("{}: forwarding packets to {}", title, to_string(dest));
+
+    return result;
+}
+
+void report_forwarder_counters(const PacketForwarder &fwd, const char *title,
+                               bool perDestination = false)
+{
+    auto counters = fwd.counters();
+
+    spdlog::info("{}: forward: queued={}, dropped={}, sendCalls={}, lag mean={}us, max={}us",
+                 title, counters.packetsQueued, counters.packetsDropped, counters.sendCalls,
+                 counters.lagMean().count(), counters.lagMax.count());
+
+    if (!perDestination)
+        return;
+
+    for (size_t i = 0; i < counters.destinations.size(); ++i)
+    {
+        const auto &dc = counters.destinations[i];
+
+        spdlog::info("{}: forward to {}: packets={}, bytes={}, filtered={}, errors={}", title,
+                     to_string(fwd.destinations()[i]), dc.packets, dc.bytes, dc.filtered,
+                     dc.errors);
+    }
+}
+
+std::unique_ptr<EventFilter> make_event_filter(const std::string &expression, const char *title)
+{
+    if (expression.empty())
+        return {};
+
+    try
+    {
+        auto result = std::make_unique<EventFilter>(expression);
+        spdlog::info("{}: filtering events: {}", title, result->toString());
+        return result;
+    }
+    catch (const std::invalid_argument &e)
+    {
+        spdlog::error("{}: {}", title, e.what());
+        return {};
+    }
+}
+
+void report_filter_counters(const EventFilter &filter, const char *title)
+{
+    const auto &counters = filter.counters();
+    const double ratio = counters.eventsIn ? counters.eventsOut * 100.0 / counters.eventsIn : 0.0;
+
+    spdlog::info("{}: filter: packetsIn={}, packetsOut={}, eventsIn={}, eventsOut={} ({:.2f}%)",
+                 title, counters.packetsIn, counters.packetsOut, counters.eventsIn,
+                 counters.eventsOut, ratio);
+}
+
+// Filters the events of the packet in place. Packets left without events are
+// still written and sent as header only packets: dropping them would leave
+// gaps in the buffer numbers which show up as packet loss when the output is
+// read again.
+void apply_event_filter(EventFilter &filter, DataPacket &packet)
+{
+    if (packet.bufferType == McpdDataBufferType || packet.bufferType == MdllDataBufferType)
+        filter.filterPacket(packet, packet);
+}
+
 struct ReadoutCommand: public BaseCommand
 {
     u16 dataPort_ = McpdDefaultPort;
@@ -1476,12 +1897,46 @@ struct ReadoutCommand: public BaseCommand
     bool printRawPacketData_ = false;
     bool overwriteListfile_ = false;
     bool sendStartDaqCommand_ = true;
+    bool perDeviceStats_ = false;
+    bool perDeviceListfiles_ = false;
+    std::string listfileEncoding_ = "legacy";
+    std::string listfileCompression_ = "none";
+    unsigned compressionThreads_ = 0u;
+    std::string splitSize_;
+    unsigned splitTime_ = 0u;
+    int runId_ = -1;
+    size_t listfileFlushInterval_ms_ = 1000u;
+
+    std::string tofTrigger_;
+    TofHistogrammer::Options tofOptions_;
+
+    std::string shmHistoName_;
+    size_t shmPublishInterval_ms_ = 40u;
+
+    std::string shmRingName_;
+    size_t shmRingSlots_ = shm_ring::DefaultSlotCount;
+    std::string shmRingInput_;
+
+    std::string flightRecorderSize_;
+    unsigned flightRecorderTime_s_ = 0u;
+    std::string flightRecorderPrefix_ = "flight-recorder";
+    double flightRecorderRate_ = 0.0;
+    std::string flightRecorderTriggerFile_;
+
+    std::vector<std::string> forwardDestinations_;
+    size_t forwardQueueSize_ = PacketForwarder::Options{}.queueSize;
+
+    std::string filterExpression_;
 
 #ifdef MESYTEC_MCPD_ENABLE_ROOT
     RootHistoContext rootHistoContext_ = {};
     std::string rootHistoPath_;
     size_t rootFlushInterval_ms_ = 500u;
     bool rootEnableMdllGraphs_ = false;
+    size_t rootMdllGraphPoints_ = 4096u;
+    std::string rootTimestampMode_ = "full";
+    u32 rootTimestampBins_ = 1024u;
+    u32 rootTimestampShift_ = 9u;
 #endif
 
 #ifdef MESYTEC_MCPD_ENABLE_PYTHON
@@ -1537,77 +1992,419 @@ struct ReadoutCommand: public BaseCommand
                                   .optional()
                                   .help("Print raw packet event data as 16 bit hex values"))
 
-#ifdef MESYTEC_MCPD_ENABLE_ROOT
+                .add_argument(lyra::opt([this](const bool &b)
+                                        { perDeviceStats_ = b; })["--per-device-stats"]
+                                  .optional()
+                                  .help("Report counters and rates per (source address, deviceId)"))
+
                 .add_argument(
-                    lyra::opt(rootHistoPath_, "rootfile")["--root-histo-file"].optional().help(
-                        "ROOT histo output file path"))
+                    lyra::opt([this](const bool &b)
+                              { perDeviceListfiles_ = b; })["--per-device-listfiles"]
+                        .optional()
+                        .help("Write one listfile per (source address, deviceId) instead of a "
+                              "single combined listfile. Names are derived from --listfile."))
 
                 .add_argument(
-                    lyra::opt(rootFlushInterval_ms_, "flushInterval [ms]")["--root-flush-interval"]
+                    lyra::opt(listfileEncoding_, "encoding")["--listfile-encoding"]
                         .optional()
-                        .help("ROOT file flush interval in ms"))
+                        .choices("legacy", "packet", "coded")
+                        .help("Listfile format: 'legacy' (fixed size packets, default), 'packet' "
+                              "(framed, actual packet sizes) or 'coded' (framed, compact event "
+                              "encoding)"))
 
-                .add_argument(lyra::opt([this](const bool &b)
-                                        { rootEnableMdllGraphs_ = b; })["--root-enable-mdll-graphs"]
-                                  .optional()
-                                  .help("Create TGraphs of MDLL amplitude and position values vs "
-                                        "time in the ROOT ouptut file. Eats lots of memory!"))
-#endif
+                .add_argument(
+                    lyra::opt(listfileCompression_, "compression")["--listfile-compression"]
+                        .optional()
+                        .choices("none", "lz4")
+                        .help("Block compression of the listfile. Requires --listfile-encoding "
+                              "packet or coded."))
 
-#ifdef MESYTEC_MCPD_ENABLE_PYTHON
                 .add_argument(
-                    lyra::opt(pythonScriptPath_, "python file")["--python-script"].optional().help(
-                        "Path to a Python script to execute for each event."))
-#endif
-        );
-    }
+                    lyra::opt(compressionThreads_, "threads")["--compression-threads"]
+                        .optional()
+                        .help("Number of listfile compression threads (default: number of cores, "
+                              "at most 4)"))
 
-    int runCommand(CliContext &ctx) override
-    {
-        if (listfilePath_.empty() && !noListfile_)
-        {
-            spdlog::error("readout: no listfile name given (use --no-listfile to ignore)");
-            return 1;
-        }
+                .add_argument(
+                    lyra::opt(splitSize_, "size")["--split-size"]
+                        .optional()
+                        .help("Start a new listfile part once the current part reaches the given "
+                              "size, e.g. 2G. Parts are listed in <listfile>.manifest which can be "
+                              "passed to replay."))
 
-        spdlog::debug("{} {} {}", PRETTY_FUNCTION, dataPort_, listfilePath_);
+                .add_argument(
+                    lyra::opt(splitTime_, "seconds")["--split-time"]
+                        .optional()
+                        .help("Start a new listfile part after the given number of seconds"))
 
-        std::error_code ec;
-        // Creates an unconnected UDP socket listening on the dataPort.
-        int dataSock = create_bound_udp_socket(dataPort_, &ec);
+                .add_argument(
+                    lyra::opt(listfileFlushInterval_ms_, "interval [ms]")["--listfile-flush-interval"]
+                        .optional()
+                        .help("Time in ms between flushing buffered listfile data to disk, "
+                              "bounds the latency of 'replay --follow' (0 disables)"))
 
-        if (ec)
-        {
-            spdlog::error("readout: error listening on data port {}: {} (code={}, category={})",
-                          dataPort_, ec.message(), ec.value(), ec.category().name());
-            return 1;
-        }
+                .add_argument(
+                    lyra::opt(runId_, "runId")["--run-id"]
+                        .optional()
+                        .help("Set the mcpd runId before starting the DAQ and record it in the "
+                              "listfile run info. Only the device given by --address/--id is "
+                              "configured and recorded in the run info."))
 
-        {
-            u16 localPort = get_local_socket_port(dataSock);
-            spdlog::info("readout: listening for data on port {}", localPort);
+                .add_argument(
+                    lyra::opt(tofTrigger_, "triggerId[:dataId]")["--tof-trigger"]
+                        .optional()
+                        .help("Histogram the time-of-flight of neutrons relative to the last "
+                              "trigger event with the given trigger and data ids."))
+
+                .add_argument(lyra::opt(tofOptions_.bins, "bins")["--tof-bins"]
+                                  .optional()
+                                  .help("Number of TOF histogram bins"))
+
+                .add_argument(lyra::opt(tofOptions_.binWidth, "ticks")["--tof-bin-width"]
+                                  .optional()
+                                  .help("TOF bin width in timestamp units (100ns)"))
+
+                .add_argument(lyra::opt(tofOptions_.offset, "ticks")["--tof-offset"]
+                                  .optional()
+                                  .help("TOF value of the lower edge of the first bin"))
+
+                .add_argument(lyra::opt(tofOptions_.positionBins, "bins")["--tof-position-bins"]
+                                  .optional()
+                                  .help("Split each channel into this many position pixels, "
+                                        "each with its own TOF histogram"))
+
+                .add_argument(lyra::opt(shmHistoName_, "name")["--shm-histos"]
+                                  .optional()
+                                  .help("Publish live histograms to the named POSIX shared "
+                                        "memory segment, e.g. /mcpd-histos"))
+
+                .add_argument(lyra::opt(shmPublishInterval_ms_, "ms")["--shm-publish-interval"]
+                                  .optional()
+                                  .help("Shared memory histogram update interval in ms"))
+
+                .add_argument(lyra::opt(shmRingName_, "name")["--shm-ring"]
+                                  .optional()
+                                  .help("Copy each received packet into the named shared memory "
+                                        "ring for other local consumers, e.g. /mcpd-packets"))
+
+                .add_argument(lyra::opt(shmRingSlots_, "slots")["--shm-ring-slots"]
+                                  .optional()
+                                  .help("Number of packet slots in the shared memory ring"))
+
+                .add_argument(
+                    lyra::opt(flightRecorderSize_, "size")["--flight-recorder"].optional().help(
+                        "Keep the most recently received packets in memory, e.g. 512M, and "
+                        "write them to a listfile on SIGUSR1, --flight-recorder-trigger-file or "
+                        "--flight-recorder-rate"))
+
+                .add_argument(
+                    lyra::opt(flightRecorderTime_s_, "seconds")["--flight-recorder-time"]
+                        .optional()
+                        .help("--flight-recorder: only keep packets received within this time"))
+
+                .add_argument(
+                    lyra::opt(flightRecorderPrefix_, "prefix")["--flight-recorder-prefix"]
+                        .optional()
+                        .help("--flight-recorder: dumps are written to <prefix>-<n>.mcpdlst"))
+
+                .add_argument(
+                    lyra::opt(flightRecorderRate_, "events/s")["--flight-recorder-rate"]
+                        .optional()
+                        .help("--flight-recorder: dump once the event rate, measured over "
+                              "100 ms, reaches this value. Rearmed when the rate drops below."))
+
+                .add_argument(
+                    lyra::opt(flightRecorderTriggerFile_, "path")["--flight-recorder-trigger-file"]
+                        .optional()
+                        .help("--flight-recorder: dump when this file is created, e.g. by a "
+                              "control system. The file is removed."))
+
+                .add_argument(
+                    lyra::opt(
+                        [this](const std::string &name)
+                        {
+                            shmRingInput_ = name;
+                            // Packets come from another readout process.
+                            offline_ = true;
+                        },
+                        "name")["--shm-ring-input"]
+                        .optional()
+                        .help("Read packets from the named shared memory ring instead of the "
+                              "network. Implies --no-start-daq."))
+
+                .add_argument(
+                    lyra::opt(forwardDestinations_,
+                              "host[:port][/dev=id,...][/type=bufferType,...]")["--forward"]
+                        .cardinality(0, 32)
+                        .help("Re-send received packets to an additional destination. Can be "
+                              "given multiple times. Optionally only packets of the listed "
+                              "deviceIds and buffer types are forwarded."))
+
+                .add_argument(lyra::opt(forwardQueueSize_, "packets")["--forward-queue-size"]
+                                  .optional()
+                                  .help("Packets buffered for forwarding. Packets are dropped "
+                                        "from forwarding if the queue is full."))
+
+                .add_argument(lyra::opt(filterExpression_, "expression")["--filter"].optional().help(
+                    "Only keep events matching the filter expression, e.g. "
+                    "'mpsd in 0..3 and amplitude > 100 or type == trigger'. Applied before "
+                    "writing, forwarding and histogramming."))
+
+#ifdef MESYTEC_MCPD_ENABLE_ROOT
+                .add_argument(
+                    lyra::opt(rootHistoPath_, "rootfile")["--root-histo-file"].optional().help(
+                        "ROOT histo output file path"))
+
+                .add_argument(
+                    lyra::opt(rootFlushInterval_ms_, "flushInterval [ms]")["--root-flush-interval"]
+                        .optional()
+                        .help("ROOT file flush interval in ms"))
+
+                .add_argument(lyra::opt([this](const bool &b)
+                                        { rootEnableMdllGraphs_ = b; })["--root-enable-mdll-graphs"]
+                                  .optional()
+                                  .help("Create TGraphs of MDLL amplitude and position values vs "
+                                        "time in the ROOT ouptut file."))
+
+                .add_argument(lyra::opt(rootMdllGraphPoints_, "points")["--root-mdll-graph-points"]
+                                  .optional()
+                                  .help("Maximum number of points per MDLL graph. Values are "
+                                        "downsampled into time buckets (mean, min, max)."))
+
+                .add_argument(
+                    lyra::opt(rootTimestampMode_, "full|coarse|none")["--root-timestamp-histos"]
+                        .optional()
+                        .choices("full", "coarse", "none")
+                        .help("Per channel timestamp histograms: full (2^19 bins), coarse "
+                              "(rebinned) or none"))
+
+                .add_argument(lyra::opt(rootTimestampBins_, "bins")["--root-timestamp-bins"]
+                                  .optional()
+                                  .help("Number of coarse timestamp histogram bins"))
+
+                .add_argument(lyra::opt(rootTimestampShift_, "shift")["--root-timestamp-shift"]
+                                  .optional()
+                                  .help("Coarse timestamp histograms: timestamps are divided by "
+                                        "2^shift before binning"))
+#endif
+
+#ifdef MESYTEC_MCPD_ENABLE_PYTHON
+                .add_argument(
+                    lyra::opt(pythonScriptPath_, "python file")["--python-script"].optional().help(
+                        "Path to a Python script to execute for each event."))
+#endif
+        );
+    }
+
+    int runCommand(CliContext &ctx) override
+    {
+        if (listfilePath_.empty() && !noListfile_)
+        {
+            spdlog::error("readout: no listfile name given (use --no-listfile to ignore)");
+            return 1;
         }
 
-        std::ofstream listfile;
-        listfile.exceptions(std::ios::failbit | std::ios::badbit);
+        spdlog::debug("{} {} {}", PRETTY_FUNCTION, dataPort_, listfilePath_);
+
+        std::error_code ec;
+        int dataSock = -1;
+        std::unique_ptr<ShmPacketRingReader> ringInput;
 
-        if (!noListfile_)
+        if (!shmRingInput_.empty())
         {
-            if (!overwriteListfile_ && file_exists(listfilePath_.c_str()))
+            ringInput = std::make_unique<ShmPacketRingReader>();
+
+            if (auto ec = ringInput->open(shmRingInput_))
             {
-                spdlog::error("readout: Output listfile '{}' already exists", listfilePath_);
+                spdlog::error("readout: error attaching to shared memory ring '{}': {}",
+                              shmRingInput_, ec.message());
                 return 1;
             }
 
-            try
+            spdlog::info("readout: reading packets from shared memory ring '{}'", shmRingInput_);
+            sendStartDaqCommand_ = false;
+        }
+        else
+        {
+            // Creates an unconnected UDP socket listening on the dataPort.
+            dataSock = create_bound_udp_socket(dataPort_, &ec);
+
+            if (ec)
             {
-                listfile.open(listfilePath_, std::ios_base::out | std::ios::binary);
+                spdlog::error("readout: error listening on data port {}: {} (code={}, category={})",
+                              dataPort_, ec.message(), ec.value(), ec.category().name());
+                return 1;
             }
-            catch (const std::exception &e)
+
+            u16 localPort = get_local_socket_port(dataSock);
+            spdlog::info("readout: listening for data on port {}", localPort);
+        }
+
+        auto filter = make_event_filter(filterExpression_, "readout");
+
+        if (!filterExpression_.empty() && !filter)
+            return 1;
+
+        auto forwarder = make_packet_forwarder(forwardDestinations_, forwardQueueSize_, "readout");
+
+        if (!forwardDestinations_.empty() && !forwarder)
+            return 1;
+
+        std::unique_ptr<ShmPacketRingWriter> ringOutput;
+
+        if (!shmRingName_.empty())
+        {
+            ringOutput = std::make_unique<ShmPacketRingWriter>();
+
+            if (auto ec = ringOutput->create(shmRingName_, shmRingSlots_))
+            {
+                spdlog::error("readout: error creating shared memory ring '{}': {}", shmRingName_,
+                              ec.message());
+                return 1;
+            }
+
+            spdlog::info("readout: copying packets to shared memory ring '{}'", shmRingName_);
+        }
+
+        FlightRecorder flightRecorder;
+
+        if (!flightRecorderSize_.empty())
+        {
+            FlightRecorder::Options recorderOptions;
+            u64 capacity = 0u;
+
+            if (!parse_byte_size(flightRecorderSize_, capacity) || !capacity)
+            {
+                spdlog::error("readout: invalid --flight-recorder size '{}'", flightRecorderSize_);
+                return 1;
+            }
+
+            recorderOptions.capacity = capacity;
+            recorderOptions.maxAge = std::chrono::seconds(flightRecorderTime_s_);
+
+            if (auto ec = flightRecorder.init(recorderOptions))
+            {
+                spdlog::error("readout: error allocating the flight recorder: {}", ec.message());
+                return 1;
+            }
+
+            setup_flight_recorder_signal();
+
+            spdlog::info("readout: flight recorder keeping the last {} MiB{} of packets, huge "
+                         "pages: {}, dumps: '{}-<n>.mcpdlst'",
+                         flightRecorder.capacity() >> 20,
+                         flightRecorderTime_s_ ? fmt::format(" / {} s", flightRecorderTime_s_) : "",
+                         flightRecorder.usesHugePages() ? "yes" : "no", flightRecorderPrefix_);
+        }
+
+        SplitListfileWriter listfile;
+        SplitListfileWriter::Options splitOptions;
+        auto &listfileOptions = splitOptions.listfile;
+
+        if (!parse_listfile_encoding(listfileEncoding_, listfileOptions.encoding))
+        {
+            spdlog::error("readout: invalid listfile encoding '{}'", listfileEncoding_);
+            return 1;
+        }
+
+        if (!parse_listfile_compression(listfileCompression_, listfileOptions.compression))
+        {
+            spdlog::error("readout: invalid listfile compression '{}'", listfileCompression_);
+            return 1;
+        }
+
+        if (listfileOptions.compression != ListfileCompression::None
+            && listfileOptions.encoding == ListfileEncoding::Legacy)
+        {
+            spdlog::error("readout: --listfile-compression requires --listfile-encoding packet or coded");
+            return 1;
+        }
+
+        listfileOptions.compressionThreads = compressionThreads_;
+
+        if (!splitSize_.empty() && !parse_byte_size(splitSize_, splitOptions.splitSize))
+        {
+            spdlog::error("readout: invalid --split-size '{}'", splitSize_);
+            return 1;
+        }
+
+        splitOptions.splitTime = std::chrono::seconds(splitTime_);
+
+        if (runId_ < -1 || runId_ > 0xffff)
+        {
+            spdlog::error("readout: invalid --run-id '{}' (valid range: 0-65535)", runId_);
+            return 1;
+        }
+
+        if (perDeviceListfiles_ && noListfile_)
+        {
+            spdlog::error("readout: --per-device-listfiles requires --listfile");
+            return 1;
+        }
+
+        // Snapshot of the device configuration stored at the start of framed
+        // listfiles.
+        auto runInfo = make_run_info();
+
+        if (!ringInput)
+        {
+            if (runId_ >= 0)
+            {
+                if (auto ec = mcpd_set_run_id(ctx.cmdSock, ctx.mcpdId, runId_))
+                {
+                    spdlog::error("readout: error setting runId: {} (code={}, category={})",
+                                  ec.message(), ec.value(), ec.category().name());
+                    return 1;
+                }
+
+                runInfo.hasRunId = true;
+                runInfo.runId = runId_;
+            }
+
+            McpdRunInfo mcpdInfo;
+
+            if (auto ec = query_mcpd_run_info(ctx.cmdSock, ctx.mcpdId, mcpdInfo))
+            {
+                spdlog::warn("readout: could not read the device configuration for the run info: {}",
+                             ec.message());
+            }
+            else
+            {
+                mcpdInfo.address = ctx.mcpdAddress;
+                runInfo.mcpds.emplace_back(std::move(mcpdInfo));
+            }
+        }
+
+        const bool writeRunInfo = listfileOptions.encoding != ListfileEncoding::Legacy;
+
+        if (!noListfile_ && !perDeviceListfiles_)
+        {
+            const auto outputPath = listfile_output_path(listfilePath_, splitOptions);
+
+            if (!overwriteListfile_ && file_exists(outputPath.c_str()))
+            {
+                spdlog::error("readout: Output listfile '{}' already exists", outputPath);
+                return 1;
+            }
+
+            if (auto ec = listfile.open(listfilePath_, splitOptions))
             {
-                spdlog::error("readout: Error opening listfile '{}': {}", listfilePath_, e.what());
+                spdlog::error("readout: Error opening listfile '{}': {}", listfilePath_, ec.message());
                 return 1;
             }
+
+            if (writeRunInfo)
+            {
+                if (auto ec = listfile.writeRunInfo(runInfo))
+                {
+                    spdlog::error("readout: Error writing run info: {}", ec.message());
+                    return 1;
+                }
+            }
+
+            spdlog::info("readout: writing {} listfile '{}', compression: {}",
+                         to_string(listfileOptions.encoding), listfile.path(),
+                         to_string(listfileOptions.compression));
         }
 
 #ifdef MESYTEC_MCPD_ENABLE_ROOT
@@ -1617,7 +2414,12 @@ struct ReadoutCommand: public BaseCommand
             {
                 rootHistoContext_ = create_histo_context(rootHistoPath_);
                 rootHistoContext_.enableMdllGraphs = rootEnableMdllGraphs_;
+                rootHistoContext_.mdllGraphBuckets = rootMdllGraphPoints_;
+                root_histos_set_timestamp_mode(
+                    rootHistoContext_, parse_timestamp_histo_mode(rootTimestampMode_),
+                    rootTimestampBins_, rootTimestampShift_);
                 spdlog::info("Writing ROOT histograms to {}", rootHistoPath_);
+                root_histos_report_memory(rootHistoContext_, "readout");
             }
             catch (const std::runtime_error &e)
             {
@@ -1649,14 +2451,31 @@ struct ReadoutCommand: public BaseCommand
         }
 #endif
 
+        auto tof = make_tof_histogrammer(tofTrigger_, tofOptions_, "readout");
+
+        if (!tofTrigger_.empty() && !tof)
+            return 1;
+
+        auto shmHistos = make_shm_live_histos(shmHistoName_, "readout");
+
+        if (!shmHistoName_.empty() && !shmHistos)
+            return 1;
+
         ReadoutCounters counters = {};
         ReadoutCounters prevCounters = {};
+        DeviceStatsTable deviceStats;
+        std::vector<DeviceCounters> prevDeviceCounters;
+        // Indexed by the device index returned from deviceStats.
+        std::vector<std::unique_ptr<SplitListfileWriter>> deviceListfiles;
         DataPacket dataPacket = {};
 
         spdlog::info("readout: entering readout loop, press ctrl-c to quit");
 
         auto tStart = std::chrono::steady_clock::now();
         auto tReport = tStart;
+        auto tShmPublish = tStart;
+        auto tListfileFlush = tStart;
+        auto tFlightRecorderCheck = tStart;
 #ifdef MESYTEC_MCPD_ENABLE_ROOT
         auto tRootFlush = tStart;
 #endif
@@ -1664,6 +2483,71 @@ struct ReadoutCommand: public BaseCommand
         CountersReportInfo reportInfo;
         reportInfo.flags = CountersReportInfo::All;
 
+        unsigned flightRecorderDumpNumber = 0u;
+        u64 flightRecorderEvents = 0u;
+        u64 flightRecorderDropped = 0u;
+        bool flightRecorderRateArmed = true;
+
+        // Writes the packets held by the flight recorder to a new listfile in
+        // the background.
+        auto dump_flight_recorder = [&](const std::string &reason)
+        {
+            if (flightRecorder.isDumping())
+            {
+                spdlog::warn("readout: flight recorder: ignoring trigger ({}), still writing the "
+                             "previous dump", reason);
+                return;
+            }
+
+            if (!flightRecorder.packetCount())
+            {
+                spdlog::info("readout: flight recorder: {}, no packets to write", reason);
+                return;
+            }
+
+            auto path = next_flight_recorder_path(flightRecorderPrefix_, flightRecorderDumpNumber);
+            const double span = (flightRecorder.newestArrival() - flightRecorder.oldestArrival()) * 1e-9;
+
+            spdlog::info("readout: flight recorder: {}, writing {} packets ({:.3f} s) to '{}'",
+                         reason, flightRecorder.packetCount(), span, path);
+
+            flightRecorderDropped = flightRecorder.counters().dropped;
+
+            if (auto ec = flightRecorder.startDump(path, listfileOptions, &runInfo))
+                spdlog::error("readout: flight recorder: error starting dump: {}", ec.message());
+        };
+
+        auto report_flight_recorder_dump = [&](const FlightRecorder::DumpResult &result)
+        {
+            if (!result.ec)
+                spdlog::info("readout: flight recorder: wrote {} packets ({:.2f} MiB) to '{}', "
+                             "packets dropped while writing: {}",
+                             result.packets, result.bytes / double(1u << 20), result.path,
+                             flightRecorder.counters().dropped - flightRecorderDropped);
+        };
+
+        // Makes the data written so far visible to processes following the
+        // listfiles.
+        auto flush_listfiles = [&]() -> std::error_code
+        {
+            if (listfile.isOpen())
+            {
+                if (auto ec = listfile.flush())
+                    return ec;
+            }
+
+            for (auto &deviceListfile: deviceListfiles)
+            {
+                if (deviceListfile)
+                {
+                    if (auto ec = deviceListfile->flush())
+                        return ec;
+                }
+            }
+
+            return {};
+        };
+
         if (sendStartDaqCommand_)
         {
             spdlog::debug("readout: sending DAQ start command to {}", ctx.mcpdAddress);
@@ -1681,10 +2565,33 @@ struct ReadoutCommand: public BaseCommand
         {
             size_t bytesTransferred = 0u;
             sockaddr_in srcAddr = {};
+            std::error_code ec;
+
+            if (ringInput)
+            {
+                ShmPacketRingReader::PacketInfo info;
 
-            auto ec = receive_one_packet(dataSock, reinterpret_cast<u8 *>(&dataPacket),
-                                         sizeof(dataPacket), bytesTransferred,
-                                         DefaultReadTimeout_ms, &srcAddr);
+                if (ringInput->read(&dataPacket, sizeof(dataPacket), DefaultReadTimeout_ms, &info))
+                {
+                    bytesTransferred = std::min(info.size, sizeof(dataPacket));
+                    srcAddr.sin_addr.s_addr = htonl(info.srcAddr);
+                    srcAddr.sin_port = htons(info.srcPort);
+                }
+                else if (ringInput->isFinished())
+                {
+                    spdlog::info("readout: shared memory ring closed by the writer, leaving "
+                                 "readout loop");
+                    break;
+                }
+                else
+                    ++counters.timeouts;
+            }
+            else
+            {
+                ec = receive_one_packet(dataSock, reinterpret_cast<u8 *>(&dataPacket),
+                                        sizeof(dataPacket), bytesTransferred,
+                                        DefaultReadTimeout_ms, &srcAddr);
+            }
 
             if (ec)
             {
@@ -1707,17 +2614,87 @@ struct ReadoutCommand: public BaseCommand
 
             if (bytesTransferred)
             {
-                if (!noListfile_)
+                // Raw packets, before the filter modifies them.
+                if (flightRecorder.isInitialized())
+                {
+                    const u64 arrivalTime = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                                                std::chrono::system_clock::now().time_since_epoch())
+                                                .count();
+                    flightRecorder.push(&dataPacket, bytesTransferred, ntohl(srcAddr.sin_addr.s_addr),
+                                        ntohs(srcAddr.sin_port), arrivalTime);
+                }
+
+                if (filter)
+                    apply_event_filter(*filter, dataPacket);
+
+                // Filtered packets are shorter than the received datagram.
+                const size_t packetSize =
+                    filter ? std::min(bytesTransferred, get_packet_size(dataPacket)) : bytesTransferred;
+
+                if (ringOutput)
+                    ringOutput->write(&dataPacket, packetSize,
+                                      ntohl(srcAddr.sin_addr.s_addr), ntohs(srcAddr.sin_port));
+
+                if (forwarder)
+                    forwarder->forward(&dataPacket, packetSize);
+
+                const auto deviceIndex = deviceStats.handlePacket(
+                    ntohl(srcAddr.sin_addr.s_addr), dataPacket, bytesTransferred);
+
+                if (perDeviceListfiles_)
                 {
-                    try
+                    if (deviceIndex >= deviceListfiles.size())
+                        deviceListfiles.resize(deviceIndex + 1);
+
+                    auto &deviceListfile = deviceListfiles[deviceIndex];
+
+                    if (!deviceListfile)
+                    {
+                        auto path = make_device_listfile_path(
+                            listfilePath_, deviceStats.device(deviceIndex));
+
+                        const auto outputPath = listfile_output_path(path, splitOptions);
+
+                        if (!overwriteListfile_ && file_exists(outputPath.c_str()))
+                        {
+                            spdlog::error("readout: Output listfile '{}' already exists", outputPath);
+                            return 1;
+                        }
+
+                        deviceListfile = std::make_unique<SplitListfileWriter>();
+
+                        if (auto ec = deviceListfile->open(path, splitOptions))
+                        {
+                            spdlog::error("readout: Error opening listfile '{}': {}", path, ec.message());
+                            return 1;
+                        }
+
+                        if (writeRunInfo)
+                        {
+                            if (auto ec = deviceListfile->writeRunInfo(runInfo))
+                            {
+                                spdlog::error("readout: Error writing run info: {}", ec.message());
+                                return 1;
+                            }
+                        }
+
+                        spdlog::info("readout: writing data of device {} id={} to '{}'",
+                                     format_ipv4(deviceStats.device(deviceIndex).srcAddr),
+                                     dataPacket.deviceId, deviceListfile->path());
+                    }
+
+                    if (auto ec = deviceListfile->writePacket(dataPacket))
                     {
-                        listfile.write(reinterpret_cast<const char *>(&dataPacket),
-                                       sizeof(dataPacket));
+                        spdlog::error("readout: Error writing per device listfile: {}", ec.message());
+                        return 1;
                     }
-                    catch (const std::exception &e)
+                }
+                else if (!noListfile_)
+                {
+                    if (auto ec = listfile.writePacket(dataPacket))
                     {
                         spdlog::error("readout: Error writing to listfile '{}': {}", listfilePath_,
-                                      e.what());
+                                      ec.message());
                         return 1;
                     }
                 }
@@ -1767,6 +2744,12 @@ struct ReadoutCommand: public BaseCommand
                                            dataPacket.data + dataPacket.bufferLength, ", "));
                 }
 
+                if (tof)
+                    tof->processPacket(dataPacket);
+
+                if (shmHistos)
+                    shmHistos->processPacket(dataPacket);
+
 #ifdef MESYTEC_MCPD_ENABLE_ROOT
                 if (rootHistoContext_.histoOutFile)
                     root_histos_process_packet(rootHistoContext_, dataPacket);
@@ -1791,34 +2774,99 @@ struct ReadoutCommand: public BaseCommand
 
                 if (elapsed >= std::chrono::milliseconds(rootFlushInterval_ms_))
                 {
-                    rootHistoContext_.histoOutFile->Write("", TObject::kOverwrite);
-                    spdlog::debug("readout: flushed ROOT histograms to file");
+                    if (!root_histos_flush(rootHistoContext_))
+                        spdlog::debug("readout: ROOT writer busy, deferring histogram flush");
                     tRootFlush = now;
                 }
             }
 #endif
 
-            if (duration_s_ > 0)
+            if (shmHistos && now - tShmPublish >= std::chrono::milliseconds(shmPublishInterval_ms_))
             {
-                auto elapsed = now - tStart;
-
-                if (elapsed >= std::chrono::seconds(duration_s_))
-                {
-                    spdlog::info("readout: runDuration reached, leaving readout loop");
-                    break;
-                }
+                publish_shm_live_histos(*shmHistos, "readout");
+                tShmPublish = now;
             }
 
-            if (reportInterval_ms_ > 0)
+            if (flightRecorder.isInitialized())
             {
-                auto elapsed = now - tReport;
+                if (g_flightRecorderTrigger.exchange(false))
+                    dump_flight_recorder("SIGUSR1 received");
 
-                if (elapsed >= std::chrono::milliseconds(reportInterval_ms_))
+                const auto elapsed = now - tFlightRecorderCheck;
+
+                if (elapsed >= std::chrono::milliseconds(100))
+                {
+                    if (!flightRecorderTriggerFile_.empty()
+                        && file_exists(flightRecorderTriggerFile_.c_str()))
+                    {
+                        std::error_code ec;
+                        std::filesystem::remove(flightRecorderTriggerFile_, ec);
+                        dump_flight_recorder(
+                            fmt::format("trigger file '{}' found", flightRecorderTriggerFile_));
+                    }
+
+                    if (flightRecorderRate_ > 0.0)
+                    {
+                        const double rate = (counters.events - flightRecorderEvents)
+                            / std::chrono::duration<double>(elapsed).count();
+
+                        if (rate >= flightRecorderRate_ && flightRecorderRateArmed)
+                            dump_flight_recorder(fmt::format("event rate {:.0f}/s", rate));
+
+                        flightRecorderRateArmed = rate < flightRecorderRate_;
+                        flightRecorderEvents = counters.events;
+                    }
+
+                    tFlightRecorderCheck = now;
+                }
+
+                if (FlightRecorder::DumpResult result; flightRecorder.pollDump(result))
+                    report_flight_recorder_dump(result);
+            }
+
+            if (listfileFlushInterval_ms_
+                && now - tListfileFlush >= std::chrono::milliseconds(listfileFlushInterval_ms_))
+            {
+                if (auto ec = flush_listfiles(); ec)
+                {
+                    spdlog::error("readout: Error flushing listfile: {}", ec.message());
+                    return 1;
+                }
+
+                tListfileFlush = now;
+            }
+
+            if (duration_s_ > 0)
+            {
+                auto elapsed = now - tStart;
+
+                if (elapsed >= std::chrono::seconds(duration_s_))
+                {
+                    spdlog::info("readout: runDuration reached, leaving readout loop");
+                    break;
+                }
+            }
+
+            if (reportInterval_ms_ > 0)
+            {
+                auto elapsed = now - tReport;
+
+                if (elapsed >= std::chrono::milliseconds(reportInterval_ms_))
                 {
                     reportInfo.counters = counters;
                     reportInfo.prevCounters = prevCounters;
                     reportInfo.dt = std::chrono::duration_cast<std::chrono::microseconds>(elapsed);
                     report_counters(reportInfo, "readout");
+                    if (perDeviceStats_)
+                    {
+                        report_device_counters(deviceStats, prevDeviceCounters, reportInfo.dt,
+                                               "readout");
+                        prevDeviceCounters = deviceStats.devices();
+                    }
+                    if (forwarder)
+                        report_forwarder_counters(*forwarder, "readout");
+                    if (filter)
+                        report_filter_counters(*filter, "readout");
                     fmt::print("\n");
                     tReport = now;
                     prevCounters = counters;
@@ -1826,10 +2874,68 @@ struct ReadoutCommand: public BaseCommand
             }
         }
 
+        if (shmHistos)
+            publish_shm_live_histos(*shmHistos, "readout");
+
+        if (flightRecorder.isInitialized())
+        {
+            FlightRecorder::DumpResult result;
+
+            if (flightRecorder.isDumping())
+            {
+                spdlog::info("readout: waiting for the flight recorder dump to finish");
+                report_flight_recorder_dump(flightRecorder.waitForDump());
+            }
+            else if (flightRecorder.pollDump(result))
+                report_flight_recorder_dump(result);
+        }
+
+        if (ringOutput)
+        {
+            spdlog::info("readout: wrote {} packets to shared memory ring '{}'",
+                         ringOutput->packetsWritten(), shmRingName_);
+            ringOutput->close();
+        }
+
+        if (forwarder)
+        {
+            forwarder->stop();
+            report_forwarder_counters(*forwarder, "readout (full run)", true);
+        }
+
+        if (filter)
+            report_filter_counters(*filter, "readout (full run)");
+
+        // Compressed listfiles write their last block on close.
+        if (auto ec = listfile.close())
+            spdlog::error("readout: Error closing listfile '{}': {}", listfilePath_, ec.message());
+
+        for (auto &deviceListfile: deviceListfiles)
+        {
+            if (deviceListfile)
+            {
+                if (auto ec = deviceListfile->close())
+                    spdlog::error("readout: Error closing listfile '{}': {}",
+                                  deviceListfile->path(), ec.message());
+            }
+        }
+
+        if (ringInput && ringInput->overruns())
+        {
+            spdlog::warn("readout: lost {} packets from shared memory ring '{}' (reader too slow)",
+                         ringInput->overruns(), shmRingInput_);
+        }
+
+        if (tof)
+            report_tof_counters(*tof, "readout");
+
 #ifdef MESYTEC_MCPD_ENABLE_ROOT
         if (rootHistoContext_.histoOutFile)
         {
+            if (tof)
+                root_histos_write_tof(rootHistoContext_, *tof);
             root_histos_finalize(rootHistoContext_);
+            root_histos_report_memory(rootHistoContext_, "readout");
             spdlog::debug("readout: flushed ROOT histograms to file");
         }
 #endif
@@ -1851,6 +2957,8 @@ struct ReadoutCommand: public BaseCommand
             reportInfo.dt = std::chrono::duration_cast<std::chrono::microseconds>(elapsed);
             reportInfo.flags &= ~CountersReportInfo::ReportDeltas;
             report_counters(reportInfo, "readout (full run)");
+            if (perDeviceStats_ || deviceStats.size() > 1)
+                report_device_counters(deviceStats, {}, reportInfo.dt, "readout (full run)");
             fmt::print("\n");
         }
 
@@ -1865,12 +2973,42 @@ struct ReplayCommand: public BaseCommand
     bool printPacketSummary_ = false;
     bool printEventData_ = false;
     bool printRawPacketData_ = false;
+    bool perDeviceStats_ = false;
+    bool timeOrdered_ = false;
+    u64 maxSourceLag_ = EventMerger::Options{}.maxSourceLag;
+    u64 coincidenceWindow_ = 0u;
+    int coincidenceMaxChannelDistance_ = -1;
+    unsigned coincidenceMinMultiplicity_ = CoincidenceFinder::Options{}.minMultiplicity;
+
+    std::string tofTrigger_;
+    TofHistogrammer::Options tofOptions_;
+
+    std::string shmHistoName_;
+    size_t shmPublishInterval_ms_ = 40u;
+
+    std::string sendTo_;
+    double speed_ = 0.0;
+    double packetRate_ = 0.0;
+    bool follow_ = false;
+    unsigned followIdleTimeout_s_ = 0u;
+    std::string pcapPorts_;
+
+    std::string filterExpression_;
+    std::string outputListfilePath_;
+    bool overwriteListfile_ = false;
+    std::string listfileEncoding_ = "legacy";
+    std::string listfileCompression_ = "none";
+    unsigned compressionThreads_ = 0u;
 
 #ifdef MESYTEC_MCPD_ENABLE_ROOT
     RootHistoContext rootHistoContext_ = {};
     std::string rootHistoPath_;
     size_t rootFlushInterval_ms_ = 500u;
     bool rootEnableMdllGraphs_ = false;
+    size_t rootMdllGraphPoints_ = 4096u;
+    std::string rootTimestampMode_ = "full";
+    u32 rootTimestampBins_ = 1024u;
+    u32 rootTimestampShift_ = 9u;
 #endif
 
 #ifdef MESYTEC_MCPD_ENABLE_PYTHON
@@ -1887,7 +3025,7 @@ struct ReplayCommand: public BaseCommand
 
                 .add_argument(
                     lyra::opt(listfilePath_, "listfilePath")["--listfile"].required().help(
-                        "Path to the input listfile"))
+                        "Path to the input listfile or to the manifest of a split listfile"))
 
                 .add_argument(lyra::opt(reportInterval_ms_, "interval [ms]")["--report-interval"]
                                   .optional()
@@ -1908,6 +3046,132 @@ struct ReplayCommand: public BaseCommand
                                   .optional()
                                   .help("Print raw packet event data as 16 bit hex values"))
 
+                .add_argument(lyra::opt([this](const bool &b)
+                                        { perDeviceStats_ = b; })["--per-device-stats"]
+                                  .optional()
+                                  .help("Report counters and rates per deviceId"))
+
+                .add_argument(
+                    lyra::opt([this](const bool &b) { timeOrdered_ = b; })["--time-ordered"]
+                        .optional()
+                        .help("Merge the events of all devices into a single time ordered "
+                              "stream before printing them or passing them to Python."))
+
+                .add_argument(lyra::opt(maxSourceLag_, "ticks")["--max-source-lag"]
+                                  .optional()
+                                  .help("--time-ordered: maximum lag in timestamp units (100ns) "
+                                        "a device may have before it is ignored for ordering"))
+
+                .add_argument(lyra::opt(coincidenceWindow_, "ticks")["--coincidence-window"]
+                                  .optional()
+                                  .help("Search for coincident neutron hits within the given "
+                                        "window (100ns units). Implies --time-ordered."))
+
+                .add_argument(lyra::opt(coincidenceMaxChannelDistance_, "channels")
+                                  ["--coincidence-max-channel-distance"]
+                                  .optional()
+                                  .help("Only group hits on neighbouring channels (default: no "
+                                        "adjacency rule)"))
+
+                .add_argument(lyra::opt(coincidenceMinMultiplicity_, "hits")
+                                  ["--coincidence-min-multiplicity"]
+                                  .optional()
+                                  .help("Minimum number of hits for a coincidence record"))
+
+                .add_argument(
+                    lyra::opt(tofTrigger_, "triggerId[:dataId]")["--tof-trigger"]
+                        .optional()
+                        .help("Histogram the time-of-flight of neutrons relative to the last "
+                              "trigger event with the given trigger and data ids."))
+
+                .add_argument(lyra::opt(tofOptions_.bins, "bins")["--tof-bins"]
+                                  .optional()
+                                  .help("Number of TOF histogram bins"))
+
+                .add_argument(lyra::opt(tofOptions_.binWidth, "ticks")["--tof-bin-width"]
+                                  .optional()
+                                  .help("TOF bin width in timestamp units (100ns)"))
+
+                .add_argument(lyra::opt(tofOptions_.offset, "ticks")["--tof-offset"]
+                                  .optional()
+                                  .help("TOF value of the lower edge of the first bin"))
+
+                .add_argument(lyra::opt(tofOptions_.positionBins, "bins")["--tof-position-bins"]
+                                  .optional()
+                                  .help("Split each channel into this many position pixels, "
+                                        "each with its own TOF histogram"))
+
+                .add_argument(lyra::opt(shmHistoName_, "name")["--shm-histos"]
+                                  .optional()
+                                  .help("Publish live histograms to the named POSIX shared "
+                                        "memory segment, e.g. /mcpd-histos"))
+
+                .add_argument(lyra::opt(shmPublishInterval_ms_, "ms")["--shm-publish-interval"]
+                                  .optional()
+                                  .help("Shared memory histogram update interval in ms"))
+
+                .add_argument(
+                    lyra::opt(sendTo_, "host[:port][/dev=id,...][/type=bufferType,...]")["--send-to"]
+                        .optional()
+                        .help("Send the replayed packets as UDP datagrams to the given "
+                              "destination. Paced at the recorded speed unless --speed or --rate "
+                              "is given."))
+
+                .add_argument(lyra::opt(speed_, "factor")["--speed"].optional().help(
+                    "Replay in real time at this multiple of the recorded speed, derived from "
+                    "the packet header timestamps or the capture times of network captures"))
+
+                .add_argument(lyra::opt(packetRate_, "packets/s")["--rate"].optional().help(
+                    "Replay at a fixed packet rate"))
+
+                .add_argument(lyra::opt([this](const bool &b) { follow_ = b; })["--follow"]
+                                  .optional()
+                                  .help("Follow a listfile which is still being written instead "
+                                        "of stopping at its end"))
+
+                .add_argument(
+                    lyra::opt(followIdleTimeout_s_, "seconds")["--follow-idle-timeout"]
+                        .optional()
+                        .help("--follow: stop once no new data arrived for this long"))
+
+                .add_argument(lyra::opt(pcapPorts_, "port[,port...]")["--pcap-ports"].optional().help(
+                    "pcap/pcapng captures: only use UDP datagrams from or to these ports "
+                    "(default: any port). Not supported with --follow."))
+
+                .add_argument(lyra::opt(filterExpression_, "expression")["--filter"].optional().help(
+                    "Only keep events matching the filter expression, e.g. "
+                    "'mpsd in 0..3 and amplitude > 100 or type == trigger'"))
+
+                .add_argument(
+                    lyra::opt(outputListfilePath_, "listfilePath")["--write-listfile"].optional().help(
+                        "Write the replayed packets to a new listfile. Combined with --filter this "
+                        "produces a reduced listfile containing only the matching events."))
+
+                .add_argument(lyra::opt([this](const bool &b)
+                                        { overwriteListfile_ = b; })["--overwrite-listfile"]
+                                  .optional()
+                                  .help("Overwrite the --write-listfile output if it already exists"))
+
+                .add_argument(
+                    lyra::opt(listfileEncoding_, "encoding")["--listfile-encoding"]
+                        .optional()
+                        .choices("legacy", "packet", "coded")
+                        .help("Format of the --write-listfile output: 'legacy' (default), 'packet' "
+                              "or 'coded'. The input format is detected automatically."))
+
+                .add_argument(
+                    lyra::opt(listfileCompression_, "compression")["--listfile-compression"]
+                        .optional()
+                        .choices("none", "lz4")
+                        .help("Block compression of the --write-listfile output. Requires "
+                              "--listfile-encoding packet or coded."))
+
+                .add_argument(
+                    lyra::opt(compressionThreads_, "threads")["--compression-threads"]
+                        .optional()
+                        .help("Number of listfile compression threads (default: number of cores, "
+                              "at most 4)"))
+
 #ifdef MESYTEC_MCPD_ENABLE_ROOT
                 .add_argument(
                     lyra::opt(rootHistoPath_, "rootfile")["--root-histo-file"].optional().help(
@@ -1922,7 +3186,28 @@ struct ReplayCommand: public BaseCommand
                                         { rootEnableMdllGraphs_ = b; })["--root-enable-mdll-graphs"]
                                   .optional()
                                   .help("Create TGraphs of MDLL amplitude and position values vs "
-                                        "time in the ROOT ouptut file. Eats lots of memory!"))
+                                        "time in the ROOT ouptut file."))
+
+                .add_argument(lyra::opt(rootMdllGraphPoints_, "points")["--root-mdll-graph-points"]
+                                  .optional()
+                                  .help("Maximum number of points per MDLL graph. Values are "
+                                        "downsampled into time buckets (mean, min, max)."))
+
+                .add_argument(
+                    lyra::opt(rootTimestampMode_, "full|coarse|none")["--root-timestamp-histos"]
+                        .optional()
+                        .choices("full", "coarse", "none")
+                        .help("Per channel timestamp histograms: full (2^19 bins), coarse "
+                              "(rebinned) or none"))
+
+                .add_argument(lyra::opt(rootTimestampBins_, "bins")["--root-timestamp-bins"]
+                                  .optional()
+                                  .help("Number of coarse timestamp histogram bins"))
+
+                .add_argument(lyra::opt(rootTimestampShift_, "shift")["--root-timestamp-shift"]
+                                  .optional()
+                                  .help("Coarse timestamp histograms: timestamps are divided by "
+                                        "2^shift before binning"))
 #endif
 
 #ifdef MESYTEC_MCPD_ENABLE_PYTHON
@@ -1943,29 +3228,80 @@ struct ReplayCommand: public BaseCommand
 
         spdlog::debug("{} {}", PRETTY_FUNCTION, listfilePath_);
 
-        std::ifstream listfile;
-        listfile.exceptions(std::ios::badbit | std::ios::failbit);
+        if (!pcapPorts_.empty() && follow_)
+        {
+            spdlog::error("replay: --pcap-ports cannot be combined with --follow");
+            return 1;
+        }
 
-        try
+        if (!pcapPorts_.empty() && file_exists(listfilePath_.c_str())
+            && !is_pcap_file(listfilePath_))
         {
-            listfile.open(listfilePath_, std::ios::in | std::ios::binary);
+            spdlog::error("replay: --pcap-ports requires a pcap/pcapng input, '{}' is not a capture",
+                          listfilePath_);
+            return 1;
         }
-        catch (const std::exception &e)
+
+        std::unique_ptr<PacketSource> listfile;
+        std::error_code openError;
+
+        if (follow_)
         {
-            if (!std::filesystem::exists(listfilePath_))
-            {
-                spdlog::error("replay: Error opening listfile '{}': file does not exist",
-                              listfilePath_);
-            }
-            else
+            ListfileFollower::Options followOptions;
+            followOptions.idleTimeout = std::chrono::seconds(followIdleTimeout_s_);
+            auto follower = std::make_unique<ListfileFollower>();
+            openError = follower->open(listfilePath_, followOptions);
+            listfile = std::move(follower);
+        }
+        else if (!pcapPorts_.empty() && is_pcap_file(listfilePath_))
+        {
+            PcapReader::Options pcapOptions;
+            std::istringstream ports(pcapPorts_);
+
+            for (std::string port; std::getline(ports, port, ',');)
             {
-                spdlog::error("replay: Error opening listfile '{}': {}", listfilePath_, e.what());
+                try
+                {
+                    const auto value = std::stoul(port);
+
+                    if (value > 0xffffu)
+                        throw std::out_of_range(port);
+
+                    pcapOptions.ports.push_back(value);
+                }
+                catch (const std::exception &)
+                {
+                    spdlog::error("replay: invalid --pcap-ports '{}'", pcapPorts_);
+                    return 1;
+                }
             }
+
+            auto reader = std::make_unique<PcapReader>();
+            openError = reader->open(listfilePath_, pcapOptions);
+            listfile = std::move(reader);
+        }
+        else
+            openError = open_packet_source(listfilePath_, listfile);
+
+        if (auto ec = openError)
+        {
+            spdlog::error("replay: Error opening listfile '{}': {}", listfilePath_, ec.message());
             return 1;
         }
 
-        // no more failbit. don't want reads to throw.
-        listfile.exceptions(std::ios::badbit);
+        // Network captures provide the capture time and source address of
+        // each packet.
+        auto pcap = dynamic_cast<const PcapReader *>(listfile.get());
+
+        if (auto runInfo = listfile->runInfo())
+        {
+            spdlog::info("replay: listfile run info:");
+
+            std::istringstream lines(to_string(*runInfo));
+
+            for (std::string line; std::getline(lines, line);)
+                spdlog::info("  {}", line);
+        }
 
 #ifdef MESYTEC_MCPD_ENABLE_ROOT
         if (!rootHistoPath_.empty())
@@ -1974,7 +3310,12 @@ struct ReplayCommand: public BaseCommand
             {
                 rootHistoContext_ = create_histo_context(rootHistoPath_);
                 rootHistoContext_.enableMdllGraphs = rootEnableMdllGraphs_;
+                rootHistoContext_.mdllGraphBuckets = rootMdllGraphPoints_;
+                root_histos_set_timestamp_mode(
+                    rootHistoContext_, parse_timestamp_histo_mode(rootTimestampMode_),
+                    rootTimestampBins_, rootTimestampShift_);
                 spdlog::info("Writing ROOT histograms to {}", rootHistoPath_);
+                root_histos_report_memory(rootHistoContext_, "replay");
             }
             catch (const std::runtime_error &e)
             {
@@ -2006,15 +3347,160 @@ struct ReplayCommand: public BaseCommand
         }
 #endif
 
+        auto tof = make_tof_histogrammer(tofTrigger_, tofOptions_, "replay");
+
+        if (!tofTrigger_.empty() && !tof)
+            return 1;
+
+        auto shmHistos = make_shm_live_histos(shmHistoName_, "replay");
+
+        if (!shmHistoName_.empty() && !shmHistos)
+            return 1;
+
+        auto filter = make_event_filter(filterExpression_, "replay");
+
+        if (!filterExpression_.empty() && !filter)
+            return 1;
+
+        ListfileWriter outputListfile;
+        ListfileWriter::Options outputListfileOptions;
+
+        if (!parse_listfile_encoding(listfileEncoding_, outputListfileOptions.encoding))
+        {
+            spdlog::error("replay: invalid listfile encoding '{}'", listfileEncoding_);
+            return 1;
+        }
+
+        if (!parse_listfile_compression(listfileCompression_, outputListfileOptions.compression))
+        {
+            spdlog::error("replay: invalid listfile compression '{}'", listfileCompression_);
+            return 1;
+        }
+
+        if (outputListfileOptions.compression != ListfileCompression::None
+            && outputListfileOptions.encoding == ListfileEncoding::Legacy)
+        {
+            spdlog::error("replay: --listfile-compression requires --listfile-encoding packet or coded");
+            return 1;
+        }
+
+        outputListfileOptions.compressionThreads = compressionThreads_;
+
+        if (!outputListfilePath_.empty())
+        {
+            if (!overwriteListfile_ && file_exists(outputListfilePath_.c_str()))
+            {
+                spdlog::error("replay: Output listfile '{}' already exists", outputListfilePath_);
+                return 1;
+            }
+
+            if (auto ec = outputListfile.open(outputListfilePath_, outputListfileOptions))
+            {
+                spdlog::error("replay: Error opening output listfile '{}': {}",
+                              outputListfilePath_, ec.message());
+                return 1;
+            }
+
+            // Carry the run metadata over to the filtered/converted listfile.
+            if (listfile->runInfo() && outputListfileOptions.encoding != ListfileEncoding::Legacy)
+            {
+                if (auto ec = outputListfile.writeRunInfo(*listfile->runInfo()))
+                {
+                    spdlog::error("replay: Error writing run info: {}", ec.message());
+                    return 1;
+                }
+            }
+
+            spdlog::info("replay: writing packets to {} listfile '{}', compression: {}",
+                         to_string(outputListfileOptions.encoding), outputListfilePath_,
+                         to_string(outputListfileOptions.compression));
+        }
+
+        std::unique_ptr<PacketForwarder> sender;
+
+        if (!sendTo_.empty())
+        {
+            sender = make_packet_forwarder({ sendTo_ }, PacketForwarder::Options{}.queueSize,
+                                           "replay");
+
+            if (!sender)
+                return 1;
+
+            if (speed_ <= 0.0 && packetRate_ <= 0.0)
+                speed_ = 1.0;
+        }
+
+        ReplayPacer::Options pacerOptions;
+        pacerOptions.speed = speed_;
+        pacerOptions.packetRate = packetRate_;
+        ReplayPacer pacer(pacerOptions);
+
+        if (packetRate_ > 0.0)
+            spdlog::info("replay: pacing replay at {} packets/s", packetRate_);
+        else if (speed_ > 0.0)
+            spdlog::info("replay: pacing replay at {}x the recorded speed", speed_);
+
         ReadoutCounters counters = {};
         ReadoutCounters prevCounters = {};
         counters.reset();
+        DeviceStatsTable deviceStats;
+        std::vector<DeviceCounters> prevDeviceCounters;
         DataPacket dataPacket = {};
 
+        if (coincidenceWindow_)
+            timeOrdered_ = true;
+
+        CoincidenceFinder::Options coincidenceOptions;
+        coincidenceOptions.window = coincidenceWindow_;
+        coincidenceOptions.maxChannelDistance = coincidenceMaxChannelDistance_;
+        coincidenceOptions.minMultiplicity = coincidenceMinMultiplicity_;
+        CoincidenceFinder coincidenceFinder(coincidenceOptions);
+        CoincidenceOutput coincidences;
+
+        auto handle_coincidences = [&]
+        {
+            if (printEventData_)
+            {
+                for (const auto &record: coincidences.records)
+                {
+                    spdlog::info("coincidence: timestamp={}, duration={}, multiplicity={}",
+                                 record.timestamp, record.duration, record.multiplicity);
+                }
+            }
+
+            coincidences.clear();
+        };
+
+        EventMerger::Options mergerOptions;
+        mergerOptions.maxSourceLag = maxSourceLag_;
+        EventMerger merger(mergerOptions);
+        std::vector<DecodedEvent> mergedEvents;
+
+        auto handle_merged_events = [&]
+        {
+            for (const auto &event: mergedEvents)
+            {
+                if (printEventData_)
+                    spdlog::info("{}", to_string(event));
+#ifdef MESYTEC_MCPD_ENABLE_PYTHON
+                python_context_handle_event(ctx.pyContext, event);
+#endif
+            }
+
+            if (coincidenceWindow_)
+            {
+                coincidenceFinder.process(mergedEvents, coincidences);
+                handle_coincidences();
+            }
+
+            mergedEvents.clear();
+        };
+
         spdlog::info("Replaying from {}", listfilePath_);
 
         auto tStart = std::chrono::steady_clock::now();
         auto tReport = tStart;
+        auto tShmPublish = tStart;
 #ifdef MESYTEC_MCPD_ENABLE_ROOT
         auto tRootFlush = tStart;
 #endif
@@ -2022,23 +3508,55 @@ struct ReplayCommand: public BaseCommand
         CountersReportInfo reportInfo;
         reportInfo.flags = CountersReportInfo::All;
 
-        while (!listfile.eof() && !g_interrupted)
+        while (!g_interrupted)
         {
-            try
+            if (auto ec = listfile->readPacket(dataPacket))
             {
-                if (listfile.eof())
+                // Following: no new data yet.
+                if (ec == std::errc::timed_out)
+                    continue;
+
+                // End of file or a truncated last packet.
+                if (ec == ListfileError::EndOfFile)
                     break;
 
-                listfile.read(reinterpret_cast<char *>(&dataPacket), sizeof(dataPacket));
-            }
-            catch (const std::exception &e)
-            {
                 spdlog::error("replay: Error reading from listfile '{}': {}", listfilePath_,
-                              e.what());
+                              ec.message());
                 return 1;
             }
 
-            const auto eventCount = get_event_count(dataPacket);
+            if (pacer.isEnabled())
+            {
+                const bool due = pcap ? pacer.wait(pcap->lastCapture().timestamp / 100u, g_interrupted)
+                                      : pacer.wait(dataPacket, g_interrupted);
+
+                if (!due)
+                    break;
+            }
+
+            if (filter)
+                apply_event_filter(*filter, dataPacket);
+
+            if (outputListfile.isOpen())
+            {
+                if (auto ec = outputListfile.writePacket(dataPacket))
+                {
+                    spdlog::error("replay: Error writing to listfile '{}': {}",
+                                  outputListfilePath_, ec.message());
+                    return 1;
+                }
+            }
+
+            if (sender)
+            {
+                // Unlike in readout, wait for the forwarder instead of dropping packets.
+                while (!sender->forward(&dataPacket, get_packet_size(dataPacket)) && !g_interrupted)
+                    std::this_thread::sleep_for(std::chrono::microseconds(100));
+            }
+
+            // Corrupt length fields must not make decode_event() throw.
+            const size_t eventCount = std::clamp(get_data_length(dataPacket), 0,
+                                                 static_cast<int>(DataPacketMaxDataWords)) / 3;
 
             if (printPacketSummary_)
             {
@@ -2068,7 +3586,7 @@ struct ReplayCommand: public BaseCommand
                     spdlog::error("replay: unknown event type {} in packet#{}",
                                   static_cast<unsigned>(event.type), counters.packets);
 
-                if (printEventData_)
+                if (printEventData_ && !timeOrdered_)
                     spdlog::info("{}", to_string(event));
 
                 if (printRawPacketData_)
@@ -2079,15 +3597,33 @@ struct ReplayCommand: public BaseCommand
                 }
             }
 
+            if (tof)
+                tof->processPacket(dataPacket);
+
+            if (shmHistos)
+                shmHistos->processPacket(dataPacket);
+
 #ifdef MESYTEC_MCPD_ENABLE_ROOT
             if (rootHistoContext_.histoOutFile)
                 root_histos_process_packet(rootHistoContext_, dataPacket);
 #endif
 
+            if (timeOrdered_)
+            {
+                merger.pushPacket(dataPacket.deviceId, dataPacket);
+                merger.pop(mergedEvents);
+            }
+
 #ifdef MESYTEC_MCPD_ENABLE_PYTHON
-            python_context_handle_packet(ctx.pyContext, dataPacket);
+            python_context_handle_packet(ctx.pyContext, dataPacket, !timeOrdered_);
 #endif
 
+            handle_merged_events();
+
+            // The source address is not stored in listfiles.
+            deviceStats.handlePacket(pcap ? pcap->lastCapture().srcAddr : 0u, dataPacket,
+                                     sizeof(dataPacket));
+
             ++counters.packets;
             counters.bytes += sizeof(dataPacket);
             counters.events += eventCount;
@@ -2102,13 +3638,19 @@ struct ReplayCommand: public BaseCommand
 
                 if (elapsed >= std::chrono::milliseconds(rootFlushInterval_ms_))
                 {
-                    rootHistoContext_.histoOutFile->Write("", TObject::kOverwrite);
-                    spdlog::debug("readout: flushed ROOT histograms to file");
+                    if (!root_histos_flush(rootHistoContext_))
+                        spdlog::debug("replay: ROOT writer busy, deferring histogram flush");
                     tRootFlush = now;
                 }
             }
 #endif
 
+            if (shmHistos && now - tShmPublish >= std::chrono::milliseconds(shmPublishInterval_ms_))
+            {
+                publish_shm_live_histos(*shmHistos, "replay");
+                tShmPublish = now;
+            }
+
             if (reportInterval_ms_ > 0)
             {
                 auto elapsed = now - tReport;
@@ -2119,6 +3661,16 @@ struct ReplayCommand: public BaseCommand
                     reportInfo.prevCounters = prevCounters;
                     reportInfo.dt = std::chrono::duration_cast<std::chrono::microseconds>(elapsed);
                     report_counters(reportInfo, "replay");
+                    if (perDeviceStats_)
+                    {
+                        report_device_counters(deviceStats, prevDeviceCounters, reportInfo.dt,
+                                               "replay");
+                        prevDeviceCounters = deviceStats.devices();
+                    }
+                    if (sender)
+                        report_forwarder_counters(*sender, "replay");
+                    if (filter)
+                        report_filter_counters(*filter, "replay");
                     fmt::print("\n");
                     tReport = now;
                     prevCounters = counters;
@@ -2126,10 +3678,71 @@ struct ReplayCommand: public BaseCommand
             }
         }
 
+        if (pcap)
+        {
+            const auto &pc = pcap->counters();
+            spdlog::info("replay: capture: frames={}, packets={}, otherProtocol={}, otherPort={}, "
+                         "truncated={}, fragments={}, commandPackets={}, invalid={}",
+                         pc.frames, pc.packets, pc.otherProtocol, pc.otherPort, pc.truncated,
+                         pc.fragments, pc.commandPackets, pc.invalid);
+        }
+
+        if (timeOrdered_)
+        {
+            merger.finish(mergedEvents);
+            handle_merged_events();
+
+            const auto &mc = merger.counters();
+            spdlog::info("replay: time ordering: eventsIn={}, eventsOut={}, late={}, forced={}",
+                         mc.eventsIn, mc.eventsOut, mc.lateEvents, mc.forcedEvents);
+        }
+
+        if (coincidenceWindow_)
+        {
+            coincidenceFinder.finish(coincidences);
+            handle_coincidences();
+
+            const auto &cc = coincidenceFinder.counters();
+            spdlog::info("replay: coincidences: hits={}, groups={}, records={}, unordered={}, "
+                         "oversized={}",
+                         cc.hits, cc.groups, cc.records, cc.unorderedEvents, cc.oversizedGroups);
+
+            const auto &histo = coincidenceFinder.multiplicityHistogram();
+
+            for (size_t m = 1; m < histo.size(); ++m)
+            {
+                if (histo[m])
+                    spdlog::info("  multiplicity {}{}: {}", m,
+                                 m == histo.size() - 1 ? "+" : "", histo[m]);
+            }
+        }
+
+        if (shmHistos)
+            publish_shm_live_histos(*shmHistos, "replay");
+
+        if (sender)
+        {
+            sender->stop();
+            report_forwarder_counters(*sender, "replay (full run)", true);
+        }
+
+        if (filter)
+            report_filter_counters(*filter, "replay (full run)");
+
+        if (auto ec = outputListfile.close())
+            spdlog::error("replay: Error closing listfile '{}': {}", outputListfilePath_,
+                          ec.message());
+
+        if (tof)
+            report_tof_counters(*tof, "replay");
+
 #ifdef MESYTEC_MCPD_ENABLE_ROOT
         if (rootHistoContext_.histoOutFile)
         {
+            if (tof)
+                root_histos_write_tof(rootHistoContext_, *tof);
             root_histos_finalize(rootHistoContext_);
+            root_histos_report_memory(rootHistoContext_, "replay");
             spdlog::debug("readout: flushed ROOT histograms to file");
         }
 #endif
@@ -2143,6 +3756,8 @@ struct ReplayCommand: public BaseCommand
             reportInfo.dt = std::chrono::duration_cast<std::chrono::microseconds>(elapsed);
             reportInfo.flags &= ~CountersReportInfo::ReportDeltas;
             report_counters(reportInfo, "replay (full run)");
+            if (perDeviceStats_ || deviceStats.size() > 1)
+                report_device_counters(deviceStats, {}, reportInfo.dt, "replay (full run)");
             fmt::print("\n");
         }
 
@@ -2150,6 +3765,217 @@ struct ReplayCommand: public BaseCommand
     }
 };
 
+struct SortEventsCommand: public BaseCommand
+{
+    std::string listfilePath_;
+    std::string outputPath_;
+    std::string memoryLimit_ = "1G";
+    unsigned threads_ = 0u;
+    std::string tempDirectory_;
+    bool overwrite_ = false;
+
+    SortEventsCommand(lyra::cli &cli)
+    {
+        offline_ = true;
+
+        cli.add_argument(
+            lyra::command("sort_events", [this](const lyra::group &) { this->run_ = true; })
+                .help("Sort the events of a listfile by timestamp into a sorted event file")
+
+                .add_argument(
+                    lyra::opt(listfilePath_, "listfilePath")["--listfile"].required().help(
+                        "Path to the input listfile or to the manifest of a split listfile"))
+
+                .add_argument(lyra::opt(outputPath_, "outputPath")["--output"].required().help(
+                    "Path of the sorted event output file"))
+
+                .add_argument(lyra::opt([this](const bool &b) { overwrite_ = b; })["--overwrite"]
+                                  .optional()
+                                  .help("Overwrite an existing output file"))
+
+                .add_argument(lyra::opt(memoryLimit_, "size")["--memory"].optional().help(
+                    "Memory used for sorting, e.g. 512M or 4G (default: 1G). Larger inputs are "
+                    "sorted via temporary files."))
+
+                .add_argument(lyra::opt(threads_, "threads")["--threads"].optional().help(
+                    "Number of sorting threads (default: number of cores)"))
+
+                .add_argument(lyra::opt(tempDirectory_, "directory")["--temp-dir"].optional().help(
+                    "Directory for temporary files (default: directory of the output file)"))
+
+        );
+    }
+
+    int runCommand(CliContext &) override
+    {
+        EventSortOptions options;
+        options.threads = threads_;
+        options.tempDirectory = tempDirectory_;
+
+        if (u64 memoryLimit = 0; parse_byte_size(memoryLimit_, memoryLimit) && memoryLimit)
+            options.memoryLimit = memoryLimit;
+        else
+        {
+            spdlog::error("sort_events: Invalid memory limit '{}'", memoryLimit_);
+            return 1;
+        }
+
+        if (!overwrite_ && file_exists(outputPath_.c_str()))
+        {
+            spdlog::error("sort_events: Output file '{}' already exists", outputPath_);
+            return 1;
+        }
+
+        std::unique_ptr<PacketSource> listfile;
+
+        if (auto ec = open_packet_source(listfilePath_, listfile))
+        {
+            spdlog::error("sort_events: Error opening listfile '{}': {}", listfilePath_,
+                          ec.message());
+            return 1;
+        }
+
+        const auto tStart = std::chrono::steady_clock::now();
+        EventSortResult result;
+
+        if (auto ec = sort_events(*listfile, outputPath_, options, &result))
+        {
+            spdlog::error("sort_events: Error sorting '{}' into '{}': {}", listfilePath_,
+                          outputPath_, ec.message());
+            return 1;
+        }
+
+        const auto elapsed = std::chrono::duration_cast<std::chrono::duration<double>>(
+            std::chrono::steady_clock::now() - tStart);
+
+        spdlog::info("sort_events: sorted {} events from {} packets into '{}' in {:.3f} s "
+                     "({} runs, {} merge passes)",
+                     result.events, result.packets, outputPath_, elapsed.count(), result.runs,
+                     result.mergePasses);
+
+        return 0;
+    }
+};
+
+struct ExportEventsCommand: public BaseCommand
+{
+    std::string listfilePath_;
+    std::string sortedEventsPath_;
+    std::string outputPath_;
+    u32 chunkSize_ = EventArchiveWriter::Options{}.chunkSize;
+    bool overwrite_ = false;
+
+    ExportEventsCommand(lyra::cli &cli)
+    {
+        offline_ = true;
+
+        cli.add_argument(
+            lyra::command("export_events", [this](const lyra::group &) { this->run_ = true; })
+                .help("Export decoded events to a columnar event archive for analysis")
+
+                .add_argument(
+                    lyra::opt(listfilePath_, "listfilePath")["--listfile"].optional().help(
+                        "Path to the input listfile or to the manifest of a split listfile"))
+
+                .add_argument(
+                    lyra::opt(sortedEventsPath_, "sortedEventsPath")["--sorted-events"]
+                        .optional()
+                        .help("Read the events from a file created by 'sort_events' instead. "
+                              "The chunks of the archive then cover disjoint time ranges."))
+
+                .add_argument(lyra::opt(outputPath_, "outputPath")["--output"].required().help(
+                    "Path of the event archive"))
+
+                .add_argument(lyra::opt([this](const bool &b) { overwrite_ = b; })["--overwrite"]
+                                  .optional()
+                                  .help("Overwrite an existing output file"))
+
+                .add_argument(lyra::opt(chunkSize_, "events")["--chunk-size"].optional().help(
+                    "Number of events per chunk (default: 65536)"))
+
+        );
+    }
+
+    int runCommand(CliContext &) override
+    {
+        if (listfilePath_.empty() == sortedEventsPath_.empty())
+        {
+            spdlog::error("export_events: specify exactly one of --listfile and --sorted-events");
+            return 1;
+        }
+
+        if (!overwrite_ && file_exists(outputPath_.c_str()))
+        {
+            spdlog::error("export_events: Output file '{}' already exists", outputPath_);
+            return 1;
+        }
+
+        EventArchiveWriter::Options options;
+        options.chunkSize = chunkSize_;
+
+        const auto tStart = std::chrono::steady_clock::now();
+        u64 eventCount = 0u;
+
+        if (!listfilePath_.empty())
+        {
+            std::unique_ptr<PacketSource> listfile;
+
+            if (auto ec = open_packet_source(listfilePath_, listfile))
+            {
+                spdlog::error("export_events: Error opening listfile '{}': {}", listfilePath_,
+                              ec.message());
+                return 1;
+            }
+
+            if (auto ec = write_event_archive(*listfile, outputPath_, options, &eventCount))
+            {
+                spdlog::error("export_events: Error writing '{}': {}", outputPath_, ec.message());
+                return 1;
+            }
+        }
+        else
+        {
+            SortedEventReader input;
+            EventArchiveWriter writer;
+            EventBatch batch;
+
+            if (auto ec = input.open(sortedEventsPath_))
+            {
+                spdlog::error("export_events: Error opening sorted event file '{}': {}",
+                              sortedEventsPath_, ec.message());
+                return 1;
+            }
+
+            std::error_code ec = writer.open(outputPath_, options);
+
+            while (!ec && input.read(batch, options.chunkSize))
+            {
+                ec = writer.write(batch);
+                batch.clear();
+            }
+
+            eventCount = writer.eventCount();
+
+            if (auto ec2 = writer.close(); !ec)
+                ec = ec2;
+
+            if (ec)
+            {
+                spdlog::error("export_events: Error writing '{}': {}", outputPath_, ec.message());
+                return 1;
+            }
+        }
+
+        const auto elapsed = std::chrono::duration_cast<std::chrono::duration<double>>(
+            std::chrono::steady_clock::now() - tStart);
+
+        spdlog::info("export_events: wrote {} events to '{}' in {:.3f} s", eventCount, outputPath_,
+                     elapsed.count());
+
+        return 0;
+    }
+};
+
 struct CustomCommand: public BaseCommand
 {
     u16 commandId_;
@@ -2535,8 +4361,11 @@ int main(int argc, char *argv[])
     // Non-device specific commands (DAQ control, readout, replay, ...)
     commands.emplace_back(std::make_unique<CustomCommand>(cli));
     commands.emplace_back(std::make_unique<DaqCommand>(cli));
+    commands.emplace_back(std::make_unique<MultiDaqCommand>(cli));
     commands.emplace_back(std::make_unique<ReadoutCommand>(cli));
     commands.emplace_back(std::make_unique<ReplayCommand>(cli));
+    commands.emplace_back(std::make_unique<SortEventsCommand>(cli));
+    commands.emplace_back(std::make_unique<ExportEventsCommand>(cli));
 
     auto parsed = cli.parse({argc, argv});
 
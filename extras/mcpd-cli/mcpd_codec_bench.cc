@@ -0,0 +1,203 @@
+#include <chrono>
+#include <cstring>
+#include <iostream>
+#include <mesytec-mcpd/mesytec-mcpd.h>
+#include <mesytec-mcpd/util/lz4_block.h>
+#include <random>
+#include <spdlog/spdlog.h>
+
+using namespace mesytec::mcpd;
+
+// Measures encode_packet()/decode_packet() and LZ4 block compression
+// throughput and the compression ratios on the packets of a listfile or on
+// synthetic neutron data.
+
+namespace ec = event_constants;
+
+std::vector<DataPacket> make_synthetic_packets(size_t count)
+{
+    std::mt19937 rng(1);
+    std::vector<DataPacket> result(count);
+    u32 timestamp = 0u;
+    const size_t EventCount = DataPacketMaxDataWords / 3;
+
+    for (size_t pi = 0; pi < count; ++pi)
+    {
+        auto &packet = result[pi];
+        packet = {};
+        packet.bufferType = McpdDataBufferType;
+        packet.headerLength = 21;
+        packet.bufferLength = packet.headerLength + EventCount * 3;
+        packet.bufferNumber = pi;
+
+        for (size_t ei = 0; ei < EventCount; ++ei)
+        {
+            timestamp += rng() % 64;
+            const u64 event = (u64(rng() % 4) << ec::neutron::MpsdIdShift)
+                | (u64(rng() % 8) << ec::neutron::ChannelShift)
+                | (u64(rng() % 1024) << ec::neutron::AmplitudeShift)
+                | (u64(rng() % 1024) << ec::neutron::PositionShift)
+                | (timestamp & ec::TimestampMask);
+
+            packet.data[ei * 3 + 0] = event & 0xffffu;
+            packet.data[ei * 3 + 1] = (event >> 16) & 0xffffu;
+            packet.data[ei * 3 + 2] = (event >> 32) & 0xffffu;
+        }
+    }
+
+    return result;
+}
+
+int main(int argc, char *argv[])
+{
+    std::vector<DataPacket> packets;
+
+    if (argc > 1)
+    {
+        ListfileReader reader;
+
+        if (auto ec = reader.open(argv[1]))
+        {
+            spdlog::error("Error opening '{}': {}", argv[1], ec.message());
+            return 1;
+        }
+
+        DataPacket packet = {};
+
+        while (!reader.readPacket(packet))
+            packets.push_back(packet);
+
+        spdlog::info("Read {} packets from '{}'", packets.size(), argv[1]);
+    }
+    else
+    {
+        packets = make_synthetic_packets(10000);
+        spdlog::info("Using {} synthetic packets (pass a listfile to use recorded data)",
+                     packets.size());
+    }
+
+    if (packets.empty())
+    {
+        spdlog::error("No packets to encode");
+        return 1;
+    }
+
+    size_t rawBytes = 0u;
+
+    for (const auto &packet: packets)
+        rawBytes += get_packet_size(packet);
+
+    using Clock = std::chrono::steady_clock;
+    const auto MinDuration = std::chrono::seconds(1);
+
+    std::vector<u8> encoded;
+    std::vector<size_t> offsets;
+    size_t encodeRounds = 0u;
+    auto tStart = Clock::now();
+
+    do
+    {
+        encoded.clear();
+        offsets.clear();
+
+        for (const auto &packet: packets)
+        {
+            offsets.push_back(encoded.size());
+            encode_packet(packet, encoded);
+        }
+
+        ++encodeRounds;
+    } while (Clock::now() - tStart < MinDuration);
+
+    const std::chrono::duration<double> encodeTime = Clock::now() - tStart;
+    offsets.push_back(encoded.size());
+
+    DataPacket decoded = {};
+    size_t decodeRounds = 0u;
+    tStart = Clock::now();
+
+    do
+    {
+        for (size_t i = 0; i < packets.size(); ++i)
+        {
+            if (!decode_packet(encoded.data() + offsets[i], offsets[i + 1] - offsets[i], decoded))
+            {
+                spdlog::error("Failed to decode packet {}", i);
+                return 1;
+            }
+        }
+
+        ++decodeRounds;
+    } while (Clock::now() - tStart < MinDuration);
+
+    const std::chrono::duration<double> decodeTime = Clock::now() - tStart;
+
+    for (size_t i = 0; i < packets.size(); ++i)
+    {
+        decode_packet(encoded.data() + offsets[i], offsets[i + 1] - offsets[i], decoded);
+
+        if (std::memcmp(&packets[i], &decoded, get_packet_size(packets[i])) != 0)
+        {
+            spdlog::error("Roundtrip mismatch in packet {}", i);
+            return 1;
+        }
+    }
+
+    const double MB = 1024.0 * 1024.0;
+
+    std::cout << fmt::format("raw size:     {} bytes\n", rawBytes);
+    std::cout << fmt::format("encoded size: {} bytes, ratio {:.3f}\n", encoded.size(),
+                             static_cast<double>(encoded.size()) / rawBytes);
+    std::cout << fmt::format("encode:       {:.1f} MB/s (raw)\n",
+                             rawBytes * encodeRounds / MB / encodeTime.count());
+    std::cout << fmt::format("decode:       {:.1f} MB/s (raw)\n",
+                             rawBytes * decodeRounds / MB / decodeTime.count());
+    std::cout << "roundtrip:    ok\n";
+
+    // Single threaded LZ4 compression of the raw packets in listfile sized
+    // blocks. The listfile writer runs this on multiple threads.
+    const size_t BlockSize = 1u << 20;
+    std::vector<u8> raw;
+
+    for (const auto &packet: packets)
+    {
+        auto bytes = reinterpret_cast<const u8 *>(&packet);
+        raw.insert(raw.end(), bytes, bytes + get_packet_size(packet));
+    }
+
+    std::vector<u8> compressed(util::lz4_compress_bound(BlockSize));
+    std::vector<u8> decompressed(BlockSize);
+    size_t compressedBytes = 0u;
+    std::chrono::duration<double> lz4CompressTime{};
+    std::chrono::duration<double> lz4DecompressTime{};
+
+    for (size_t offset = 0; offset < raw.size(); offset += BlockSize)
+    {
+        const size_t size = std::min(BlockSize, raw.size() - offset);
+        auto t0 = Clock::now();
+        const size_t csize = util::lz4_compress(raw.data() + offset, size, compressed.data(),
+                                                compressed.size());
+        auto t1 = Clock::now();
+        const bool ok = util::lz4_decompress(compressed.data(), csize, decompressed.data(), size);
+        auto t2 = Clock::now();
+
+        if (!ok || std::memcmp(decompressed.data(), raw.data() + offset, size) != 0)
+        {
+            spdlog::error("LZ4 roundtrip mismatch in block at offset {}", offset);
+            return 1;
+        }
+
+        compressedBytes += csize;
+        lz4CompressTime += t1 - t0;
+        lz4DecompressTime += t2 - t1;
+    }
+
+    std::cout << fmt::format("lz4 size:     {} bytes, ratio {:.3f}\n", compressedBytes,
+                             static_cast<double>(compressedBytes) / rawBytes);
+    std::cout << fmt::format("lz4 compress: {:.1f} MB/s (raw, one thread)\n",
+                             rawBytes / MB / lz4CompressTime.count());
+    std::cout << fmt::format("lz4 decomp.:  {:.1f} MB/s (raw, one thread)\n",
+                             rawBytes / MB / lz4DecompressTime.count());
+
+    return 0;
+}
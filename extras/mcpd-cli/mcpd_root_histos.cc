@@ -1,21 +1,57 @@
 #include "mcpd_root_histos.h"
 #include <spdlog/spdlog.h>
-#include <TGraph.h>
+#include <TGraphAsymmErrors.h>
+#include <TROOT.h>
+#include <condition_variable>
+#include <mutex>
+#include <numeric>
+#include <thread>
 
 namespace mesytec::mcpd
 {
 
+struct RootHistoContext::Writer
+{
+    std::thread thread;
+    std::mutex mutex;
+    std::condition_variable cv;
+    std::unique_ptr<HistoDelta> pending; // handed over by root_histos_flush()
+    std::unique_ptr<HistoDelta> spare;   // merged, ready to be filled again
+    bool quit = false;
+
+    ~Writer()
+    {
+        {
+            std::lock_guard<std::mutex> guard(mutex);
+            quit = true;
+        }
+
+        cv.notify_one();
+
+        if (thread.joinable())
+            thread.join();
+    }
+};
+
+RootHistoContext::RootHistoContext() = default;
+RootHistoContext::RootHistoContext(RootHistoContext &&) = default;
+RootHistoContext &RootHistoContext::operator=(RootHistoContext &&) = default;
+
 RootHistoContext::~RootHistoContext()
 {
     if (histoOutFile && histoOutFile->IsOpen())
     {
         spdlog::debug("Closing histo file {}", histoOutFile->GetName());
+        root_histos_sync(*this);
         histoOutFile->Write("", TObject::kOverwrite);
     }
 }
 
 RootHistoContext create_histo_context(const std::string &outputFilename)
 {
+    // The ROOT objects are created and written by the writer thread.
+    ROOT::EnableThreadSafety();
+
     RootHistoContext result = {};
 
     result.histoOutFile = std::make_unique<TFile>(outputFilename.c_str(), "recreate");
@@ -28,20 +64,21 @@ RootHistoContext create_histo_context(const std::string &outputFilename)
                 strerror(result.histoOutFile->GetErrno())));
     }
 
+    result.accumulators = std::make_unique<RootHistoContext::Accumulators>();
+    result.accumulators->channelTable.resize(1u << 16);
+    result.rootObjects = std::make_unique<RootHistoContext::RootObjects>();
+    result.rootObjects->channelTable.resize(1u << 16);
+
     return result;
 }
 
-TH1D *get_maybe_create(
+template<typename TH>
+TH *create_channel_histo(
     TFile *outfile,
-    std::vector<TH1D *> &histos,
     unsigned mcpdId, unsigned mpsdId, unsigned channel,
-    unsigned bins, const char *name)
+    unsigned bins, double xMax, const char *name)
 {
-    auto idx = linear_address(mcpdId, mpsdId, channel);
-
-    if (idx < histos.size())
-        return histos[idx];
-
+    TH *result = nullptr;
 
     if (auto dir = outfile->mkdir(fmt::format("mcpd{}", mcpdId).c_str(), "", true))
     {
@@ -53,164 +90,529 @@ TH1D *get_maybe_create(
                 "mcpd{}_mpsd{}_channel{}_{}",
                 mcpdId, mpsdId, channel, name);
 
-            auto histo = std::make_unique<TH1D>(
+            result = new TH(
                 histoname.c_str(),
                 histoname.c_str(),
                 bins,
                 0.0,
-                bins + 1.0);
-
-            histos.resize(idx+1);
-            histos[idx] = histo.get();
-            outfile->cd();
-            return histo.release();
+                xMax);
         }
     }
 
     outfile->cd();
-    return nullptr;
+    return result;
 }
 
-TH1D *get_maybe_create(
-    TFile *outfile,
-    std::vector<TH1D *> &histos,
-    const DataPacket &packet,
-    const DecodedEvent &event,
-    unsigned bins, const char *name)
+void root_histos_set_timestamp_mode(RootHistoContext &ctx, TimestampHistoMode mode,
+                                    u32 bins, u32 shift)
 {
-    if (event.type == EventType::Neutron)
-        return get_maybe_create(
-            outfile, histos,
-            packet.deviceId,
-            event.neutron.mpsdId, event.neutron.channel,
-            bins, name);
-    return nullptr;
+    ctx.timestampMode = mode;
+
+    switch (mode)
+    {
+        case TimestampHistoMode::Full:
+            ctx.timestampAxis = { 1u << event_constants::TimestampBits, 0 };
+            break;
+        case TimestampHistoMode::Coarse:
+            ctx.timestampAxis = { std::max(bins, 1u), shift };
+            break;
+        case TimestampHistoMode::None:
+            ctx.timestampAxis = { 0, 0 };
+            break;
+    }
 }
 
-RootHistoContext::MdllHistos* get_or_create_mdll_histos(
-    TFile *outfile,
-    std::vector<std::unique_ptr<RootHistoContext::MdllHistos>> &mdllHistos,
-    unsigned mdllId)
+size_t root_histos_channel_memory(const RootHistoContext &ctx)
+{
+    namespace ec = event_constants;
+
+    const size_t ampBins = 1u << ec::neutron::AmplitudeBits;
+    const size_t posBins = 1u << ec::neutron::PositionBits;
+    const size_t tsBins = ctx.timestampAxis.bins;
+
+    // Accumulation arrays plus the TH1 bin arrays including under- and overflow bins.
+    size_t result = (ampBins + posBins + tsBins) * sizeof(u32);
+    result += (ampBins + 2 + posBins + 2) * sizeof(double);
+
+    if (tsBins)
+        result += (tsBins + 2) * sizeof(Int_t);
+
+    return result;
+}
+
+void root_histos_report_memory(const RootHistoContext &ctx, const char *title)
+{
+    const double channelMiB = root_histos_channel_memory(ctx) / double(1u << 20);
+    const size_t channelCount = ctx.rootObjects ? ctx.rootObjects->channelCount : 0u;
+    const char *modeName = ctx.timestampMode == TimestampHistoMode::Full ? "full"
+        : ctx.timestampMode == TimestampHistoMode::Coarse ? "coarse" : "none";
+
+    // MPSD-8 buses with 8 channels each.
+    spdlog::info("{}: ROOT channel histograms: timestamp mode={} (bins={}, shift={}), "
+                 "{:.3f} MiB per channel, {:.1f} MiB per fully populated MCPD (64 channels), "
+                 "{} channels allocated ({:.1f} MiB)",
+                 title, modeName, ctx.timestampAxis.bins, ctx.timestampAxis.shift, channelMiB,
+                 channelMiB * 64, channelCount, channelMiB * channelCount);
+}
+
+RootHistoContext::ChannelHistos *get_or_create_channel_histos(
+    RootHistoContext &ctx, unsigned mcpdId, unsigned mpsdId, unsigned channel)
+{
+    auto &acc = *ctx.accumulators;
+    auto &entry = acc.channelTable[linear_address(mcpdId, mpsdId, channel)];
+
+    if (!entry)
+    {
+        namespace ec = event_constants;
+
+        entry = std::make_unique<RootHistoContext::ChannelHistos>();
+        entry->mcpdId = mcpdId;
+        entry->mpsdId = mpsdId;
+        entry->channel = channel;
+        entry->amplitude = TrackedCounts(1u << ec::neutron::AmplitudeBits);
+        entry->position = TrackedCounts(1u << ec::neutron::PositionBits);
+        if (ctx.timestampMode != TimestampHistoMode::None)
+            entry->timestamp = TrackedCounts(ctx.timestampAxis.bins);
+        acc.channels.push_back(entry.get());
+    }
+
+    return entry.get();
+}
+
+RootHistoContext::MdllHistos *get_or_create_mdll_histos(
+    RootHistoContext::Accumulators &acc, unsigned mdllId)
 {
     namespace mn = event_constants::mdll_neutron;
 
-    if (mdllId < mdllHistos.size() && mdllHistos[mdllId])
+    if (mdllId >= acc.mdllHistos.size())
+        acc.mdllHistos.resize(mdllId + 1);
+
+    auto &entry = acc.mdllHistos[mdllId];
+
+    if (!entry)
     {
-        spdlog::trace("Returning existing histograms for MDLL {}", mdllId);
-        return mdllHistos[mdllId].get();
+        entry = std::make_unique<RootHistoContext::MdllHistos>();
+        entry->amplitudes = TrackedCounts(1u << mn::AmplitudeBits);
+        entry->xPositions = TrackedCounts(1u << mn::xPosBits);
+        entry->yPositions = TrackedCounts(1u << mn::yPosBits);
+        entry->xyPositions = TrackedCounts((1u << mn::xPosBits) * (1u << mn::yPosBits));
     }
 
-    spdlog::debug("No mdll histos yet, creating for MDLL {}", mdllId);
+    return entry.get();
+}
+
+RootHistoContext::MdllGraphStorage *get_or_create_mdll_graphs(RootHistoContext &ctx, unsigned mdllId)
+{
+    if (mdllId >= ctx.mdllGraphs.size())
+        ctx.mdllGraphs.resize(mdllId + 1);
+
+    auto &entry = ctx.mdllGraphs[mdllId];
 
-    mdllHistos.resize(mdllId + 1);
+    if (!entry)
+        entry = std::make_unique<RootHistoContext::MdllGraphStorage>(ctx.mdllGraphBuckets);
+
+    return entry.get();
+}
+
+void root_histos_process_packet(RootHistoContext &ctx, const DataPacket &packet)
+{
+    namespace mn = event_constants::mdll_neutron;
 
-    if (!mdllHistos[mdllId])
+    auto &batch = ctx.batch;
+    batch.clear();
+    decode_events(packet, batch);
+
+    RootHistoContext::ChannelHistos *histos = nullptr;
+    u32 lastAddress = ~0u;
+    const u64 headerTimestamp = get_header_timestamp(packet);
+
+    for (size_t ei = 0; ei < batch.size(); ++ei)
     {
-        mdllHistos[mdllId] = std::make_unique<RootHistoContext::MdllHistos>();
-        auto histos = mdllHistos[mdllId].get();
+        if (batch.type[ei] == EventType::Neutron)
+        {
+            const u32 address = linear_address(packet.deviceId, batch.address[ei], batch.channel[ei]);
 
-        if (auto dir = outfile->mkdir(fmt::format("mdll{}", mdllId).c_str(), "", true))
+            // Consecutive events often come from the same channel.
+            if (address != lastAddress)
+            {
+                histos = get_or_create_channel_histos(
+                    ctx, packet.deviceId, batch.address[ei], batch.channel[ei]);
+                lastAddress = address;
+            }
+
+            histos->amplitude.fill(batch.amplitude[ei]);
+            histos->position.fill(batch.position[ei]);
+            // The axis covers the 19 bit event timestamp, i.e. the time
+            // relative to the packet header timestamp.
+            if (ctx.timestampMode != TimestampHistoMode::None)
+                histos->timestamp.fill((batch.timestamp[ei] - headerTimestamp) >> ctx.timestampAxis.shift);
+        }
+        else if (batch.type[ei] == EventType::MdllNeutron)
         {
-            dir->cd();
+            // See EventBatch for the MDLL column mapping.
+            const u16 amplitude = batch.amplitude[ei];
+            const u16 xPos = batch.position[ei];
+            const u16 yPos = batch.yPosition[ei];
+            const u32 xBins = 1u << mn::xPosBits;
+
+            auto mdllHistos = get_or_create_mdll_histos(*ctx.accumulators, packet.deviceId);
+            mdllHistos->amplitudes.fill(amplitude);
+            mdllHistos->xPositions.fill(xPos);
+            mdllHistos->yPositions.fill(yPos);
+            mdllHistos->xyPositions.fill(xPos < xBins ? u64(yPos) * xBins + xPos
+                                                      : mdllHistos->xyPositions.size());
+
+            if (ctx.enableMdllGraphs)
+            {
+                auto gs = get_or_create_mdll_graphs(ctx, packet.deviceId);
+                gs->amplitudes.add(batch.timestamp[ei], amplitude);
+                gs->xPositions.add(batch.timestamp[ei], xPos);
+                gs->yPositions.add(batch.timestamp[ei], yPos);
+            }
         }
-        else
+    }
+}
+
+// Moves the counts of the filled bins into dest and zeroes them. The bin list
+// of dest is reused as the next list of filled bins.
+void take_counts(TrackedCounts &src, CountsDelta &dest)
+{
+    dest.bins.clear();
+    std::swap(src.filled, dest.bins);
+    dest.counts.resize(dest.bins.size());
+
+    for (size_t i = 0; i < dest.bins.size(); ++i)
+    {
+        dest.counts[i] = src.counts[dest.bins[i]];
+        src.counts[dest.bins[i]] = 0u;
+    }
+
+    dest.overflow = src.overflow;
+    src.overflow = 0u;
+}
+
+void take_counts(RootHistoContext::Accumulators &acc, RootHistoContext::HistoDelta &dest)
+{
+    if (dest.channels.size() < acc.channels.size())
+        dest.channels.resize(acc.channels.size());
+
+    for (size_t i = 0; i < acc.channels.size(); ++i)
+    {
+        auto &src = *acc.channels[i];
+        auto &channel = dest.channels[i];
+        channel.mcpdId = src.mcpdId;
+        channel.mpsdId = src.mpsdId;
+        channel.channel = src.channel;
+        take_counts(src.amplitude, channel.amplitude);
+        take_counts(src.position, channel.position);
+        take_counts(src.timestamp, channel.timestamp);
+    }
+
+    if (dest.mdlls.size() < acc.mdllHistos.size())
+        dest.mdlls.resize(acc.mdllHistos.size());
+
+    for (size_t mdllId = 0; mdllId < acc.mdllHistos.size(); ++mdllId)
+    {
+        if (auto src = acc.mdllHistos[mdllId].get())
         {
-            spdlog::error("Failed to create MDLL directory for id {}", mdllId);
-            return {};
+            auto &mdll = dest.mdlls[mdllId];
+            take_counts(src->amplitudes, mdll.amplitudes);
+            take_counts(src->xPositions, mdll.xPositions);
+            take_counts(src->yPositions, mdll.yPositions);
+            take_counts(src->xyPositions, mdll.xyPositions);
         }
+    }
+}
 
-        histos->amplitudes = new TH1D("mdll_amplitudes", fmt::format("MDLL{} Amplitudes", mdllId).c_str(),
-            1u << mn::AmplitudeBits, 0, (1u << mn::AmplitudeBits) + 1.0);
+// Adds the counts to the TH1. The overflow counter goes into the ROOT
+// overflow bin.
+void add_to_th1(const CountsDelta &delta, TH1 *th1)
+{
+    double entries = delta.overflow;
 
-        histos->xPositions = new TH1D("mdll_xPositions", fmt::format("MDLL{} X Positions", mdllId).c_str(),
-            1u << mn::xPosBits, 0, (1u << mn::xPosBits) + 1.0);
+    for (size_t i = 0; i < delta.bins.size(); ++i)
+    {
+        th1->AddBinContent(delta.bins[i] + 1, delta.counts[i]);
+        entries += delta.counts[i];
+    }
+
+    if (delta.overflow)
+        th1->AddBinContent(th1->GetNbinsX() + 1, delta.overflow);
 
-        histos->yPositions = new TH1D("mdll_yPositions", fmt::format("MDLL{} Y Positions", mdllId).c_str(),
-            1u << mn::yPosBits, 0, (1u << mn::yPosBits) + 1.0);
+    th1->SetEntries(th1->GetEntries() + entries);
+}
 
-        histos->xyPositions = new TH2D("mdll_xyPositions", fmt::format("MDLL{} XY Positions", mdllId).c_str(),
-            1u << mn::xPosBits, 0, (1u << mn::xPosBits) + 1.0,
-            1u << mn::yPosBits, 0, (1u << mn::yPosBits) + 1.0);
+// Adds the counts of a row major 2D array with xBins columns to the TH2.
+void add_to_th2(const CountsDelta &delta, u32 xBins, TH2 *th2)
+{
+    double entries = 0.0;
 
-        spdlog::info("Created histograms for MDLL {}: amplitude, xPosition, yPosition, xyPosition", mdllId);
+    for (size_t i = 0; i < delta.bins.size(); ++i)
+    {
+        const u32 x = delta.bins[i] % xBins;
+        const u32 y = delta.bins[i] / xBins;
+        th2->AddBinContent(th2->GetBin(x + 1, y + 1), delta.counts[i]);
+        entries += delta.counts[i];
     }
 
-    outfile->cd();
-    return mdllHistos[mdllId].get();
+    th2->SetEntries(th2->GetEntries() + entries);
 }
 
-void root_histos_process_packet(RootHistoContext &ctx, const DataPacket &packet)
+RootHistoContext::RootObjects::ChannelTH1s *get_or_create_channel_th1s(
+    TFile *outfile, RootHistoContext::RootObjects &ro,
+    const RootHistoContext::HistoDelta::Channel &histos,
+    TimestampHistoMode timestampMode, const HistoAxis &timestampAxis)
 {
-    const auto eventCount = get_event_count(packet);
+    namespace ec = event_constants;
+
+    auto &entry = ro.channelTable[linear_address(histos.mcpdId, histos.mpsdId, histos.channel)];
 
-    for(size_t ei=0; ei<eventCount; ++ei)
+    if (!entry)
     {
-        auto event = decode_event(packet, ei);
+        const unsigned ampBins = 1u << ec::neutron::AmplitudeBits;
+        const unsigned posBins = 1u << ec::neutron::PositionBits;
+
+        entry = std::make_unique<RootHistoContext::RootObjects::ChannelTH1s>();
+
+        entry->amplitude = create_channel_histo<TH1D>(
+            outfile, histos.mcpdId, histos.mpsdId, histos.channel,
+            ampBins, ampBins + 1.0, "amplitude");
+
+        entry->position = create_channel_histo<TH1D>(
+            outfile, histos.mcpdId, histos.mpsdId, histos.channel,
+            posBins, posBins + 1.0, "position");
 
-        if (event.type == EventType::Neutron)
+        if (timestampMode != TimestampHistoMode::None)
         {
-            auto histoAmp = get_maybe_create(
-                ctx.histoOutFile.get(), ctx.amplitudes,
-                packet, event, 1u << 10, "amplitude");
+            const double xMax = timestampMode == TimestampHistoMode::Full
+                ? timestampAxis.bins + 1.0 : timestampAxis.range();
 
-            auto histoPos = get_maybe_create(
-                ctx.histoOutFile.get(), ctx.positions,
-                packet, event, 1u << 10, "position");
+            entry->timestamp = create_channel_histo<TH1I>(
+                outfile, histos.mcpdId, histos.mpsdId, histos.channel,
+                timestampAxis.bins, xMax, "timestamp");
+        }
+
+        ++ro.channelCount;
+    }
 
-            auto histoTimestamp = get_maybe_create(
-                ctx.histoOutFile.get(), ctx.timestamps,
-                packet, event, 1u << 19, "timestamp");
+    return entry.get();
+}
 
-            if (histoAmp)
-                histoAmp->Fill(event.neutron.amplitude);
+RootHistoContext::RootObjects::MdllTHs *get_or_create_mdll_ths(
+    TFile *outfile, RootHistoContext::RootObjects &ro, unsigned mdllId)
+{
+    namespace mn = event_constants::mdll_neutron;
 
-            if (histoPos)
-                histoPos->Fill(event.neutron.position);
+    if (mdllId >= ro.mdllHistos.size())
+        ro.mdllHistos.resize(mdllId + 1);
 
-            if (histoTimestamp)
-                histoTimestamp->Fill(event.timestamp);
+    auto &entry = ro.mdllHistos[mdllId];
+
+    if (entry)
+        return entry.get();
+
+    spdlog::debug("No mdll histos yet, creating for MDLL {}", mdllId);
+
+    auto dir = outfile->mkdir(fmt::format("mdll{}", mdllId).c_str(), "", true);
+
+    if (!dir)
+    {
+        spdlog::error("Failed to create MDLL directory for id {}", mdllId);
+        return nullptr;
+    }
+
+    dir->cd();
+
+    entry = std::make_unique<RootHistoContext::RootObjects::MdllTHs>();
+
+    entry->amplitudes = new TH1D("mdll_amplitudes", fmt::format("MDLL{} Amplitudes", mdllId).c_str(),
+        1u << mn::AmplitudeBits, 0, (1u << mn::AmplitudeBits) + 1.0);
+
+    entry->xPositions = new TH1D("mdll_xPositions", fmt::format("MDLL{} X Positions", mdllId).c_str(),
+        1u << mn::xPosBits, 0, (1u << mn::xPosBits) + 1.0);
+
+    entry->yPositions = new TH1D("mdll_yPositions", fmt::format("MDLL{} Y Positions", mdllId).c_str(),
+        1u << mn::yPosBits, 0, (1u << mn::yPosBits) + 1.0);
+
+    entry->xyPositions = new TH2D("mdll_xyPositions", fmt::format("MDLL{} XY Positions", mdllId).c_str(),
+        1u << mn::xPosBits, 0, (1u << mn::xPosBits) + 1.0,
+        1u << mn::yPosBits, 0, (1u << mn::yPosBits) + 1.0);
+
+    spdlog::info("Created histograms for MDLL {}: amplitude, xPosition, yPosition, xyPosition", mdllId);
+
+    outfile->cd();
+    return entry.get();
+}
+
+// Adds the delta to the ROOT histograms, creating missing ones.
+void merge_into_root(TFile *outfile, RootHistoContext::RootObjects &ro,
+                     const RootHistoContext::HistoDelta &delta,
+                     TimestampHistoMode timestampMode, const HistoAxis &timestampAxis)
+{
+    namespace mn = event_constants::mdll_neutron;
+
+    for (const auto &histos: delta.channels)
+    {
+        if (histos.amplitude.empty() && histos.position.empty() && histos.timestamp.empty())
+            continue;
+
+        auto th1s = get_or_create_channel_th1s(outfile, ro, histos, timestampMode, timestampAxis);
+
+        if (th1s->amplitude)
+            add_to_th1(histos.amplitude, th1s->amplitude);
+
+        if (th1s->position)
+            add_to_th1(histos.position, th1s->position);
+
+        if (th1s->timestamp)
+            add_to_th1(histos.timestamp, th1s->timestamp);
+    }
+
+    for (size_t mdllId = 0; mdllId < delta.mdlls.size(); ++mdllId)
+    {
+        const auto &histos = delta.mdlls[mdllId];
+
+        if (histos.amplitudes.empty() && histos.xPositions.empty() && histos.yPositions.empty()
+            && histos.xyPositions.empty())
+        {
+            continue;
         }
-        else if (event.type == EventType::MdllNeutron)
+
+        if (auto ths = get_or_create_mdll_ths(outfile, ro, mdllId))
         {
-            auto mdllHistos = get_or_create_mdll_histos(
-                ctx.histoOutFile.get(), ctx.mdllHistos, packet.deviceId);
-
-            if (mdllHistos->amplitudes)
-                mdllHistos->amplitudes->Fill(event.mdllNeutron.amplitude);
-            if (mdllHistos->xPositions)
-                mdllHistos->xPositions->Fill(event.mdllNeutron.xPos);
-            if (mdllHistos->yPositions)
-                mdllHistos->yPositions->Fill(event.mdllNeutron.yPos);
-            if (mdllHistos->xyPositions)
-                mdllHistos->xyPositions->Fill(event.mdllNeutron.xPos, event.mdllNeutron.yPos);
+            add_to_th1(histos.amplitudes, ths->amplitudes);
+            add_to_th1(histos.xPositions, ths->xPositions);
+            add_to_th1(histos.yPositions, ths->yPositions);
+            add_to_th2(histos.xyPositions, 1u << mn::xPosBits, ths->xyPositions);
+        }
+    }
+}
 
-            if (ctx.enableMdllGraphs)
-            {
-                mdllHistos->graphStorage.timestamps.push_back(event.timestamp);
-                mdllHistos->graphStorage.amplitudes.push_back(event.mdllNeutron.amplitude);
-                mdllHistos->graphStorage.xPositions.push_back(event.mdllNeutron.xPos);
-                mdllHistos->graphStorage.yPositions.push_back(event.mdllNeutron.yPos);
-            }
+void writer_loop(RootHistoContext::Writer &w, TFile *outfile, RootHistoContext::RootObjects &ro,
+                 TimestampHistoMode timestampMode, HistoAxis timestampAxis)
+{
+    std::unique_lock<std::mutex> lock(w.mutex);
+
+    while (true)
+    {
+        w.cv.wait(lock, [&w] { return w.quit || w.pending; });
+
+        // A pending delta is written out before quitting.
+        if (w.pending)
+        {
+            auto delta = std::move(w.pending);
+            lock.unlock();
+
+            merge_into_root(outfile, ro, *delta, timestampMode, timestampAxis);
+            outfile->Write("", TObject::kOverwrite);
+            spdlog::debug("root writer: flushed ROOT histograms to file");
+
+            lock.lock();
+            w.spare = std::move(delta);
         }
+        else if (w.quit)
+            break;
+    }
+}
+
+bool root_histos_flush(RootHistoContext &ctx)
+{
+    if (!ctx.writer)
+    {
+        ctx.writer = std::make_unique<RootHistoContext::Writer>();
+        ctx.writer->spare = std::make_unique<RootHistoContext::HistoDelta>();
+        ctx.writer->thread = std::thread(writer_loop, std::ref(*ctx.writer),
+                                         ctx.histoOutFile.get(), std::ref(*ctx.rootObjects),
+                                         ctx.timestampMode, ctx.timestampAxis);
+    }
+
+    auto &w = *ctx.writer;
+    std::unique_ptr<RootHistoContext::HistoDelta> delta;
+
+    {
+        std::lock_guard<std::mutex> guard(w.mutex);
+
+        if (!w.spare)
+            return false; // writer busy with the previous delta
+
+        delta = std::move(w.spare);
+    }
+
+    // The spare is owned by this thread until it is handed back.
+    take_counts(*ctx.accumulators, *delta);
+
+    {
+        std::lock_guard<std::mutex> guard(w.mutex);
+        w.pending = std::move(delta);
+    }
+
+    w.cv.notify_one();
+    return true;
+}
+
+void root_histos_sync(RootHistoContext &ctx)
+{
+    // Finishes the pending delta and joins the thread.
+    ctx.writer.reset();
+
+    if (ctx.accumulators && ctx.rootObjects)
+    {
+        RootHistoContext::HistoDelta delta;
+        take_counts(*ctx.accumulators, delta);
+        merge_into_root(ctx.histoOutFile.get(), *ctx.rootObjects, delta, ctx.timestampMode,
+                        ctx.timestampAxis);
+    }
+}
+
+// Writes the mean value of each non-empty time bucket as a graph point. The
+// asymmetric y errors span the min and max values of the bucket, the x errors
+// the bucket width.
+void write_downsampled_graph(const util::TimeBucketDownsampler &ds,
+                             const std::string &name, const std::string &title)
+{
+    std::vector<double> x, y, exl, exh, eyl, eyh;
+    const double halfWidth = ds.bucketWidth() * 0.5;
+
+    for (size_t i = 0; i < ds.usedBuckets(); ++i)
+    {
+        const auto &bucket = ds.buckets()[i];
+
+        if (!bucket.count)
+            continue;
+
+        x.push_back(ds.bucketCenter(i));
+        y.push_back(bucket.mean());
+        exl.push_back(halfWidth);
+        exh.push_back(halfWidth);
+        eyl.push_back(bucket.mean() - bucket.min);
+        eyh.push_back(bucket.max - bucket.mean());
     }
+
+    auto graph = new TGraphAsymmErrors(x.size(), x.data(), y.data(), exl.data(), exh.data(),
+                                       eyl.data(), eyh.data());
+    graph->SetName(name.c_str());
+    graph->SetTitle(title.c_str());
+    graph->Write("", TObject::kOverwrite);
 }
 
 void root_histos_finalize(RootHistoContext &ctx)
 {
-    for (size_t mdllId = 0; mdllId < ctx.mdllHistos.size(); ++mdllId)
+    root_histos_sync(ctx);
+
+    for (size_t mdllId = 0; mdllId < ctx.mdllGraphs.size(); ++mdllId)
     {
-        auto histos = ctx.mdllHistos[mdllId].get();
+        auto graphs = ctx.mdllGraphs[mdllId].get();
 
-        if (!histos)
+        if (!graphs)
         {
             // can happen if we have a hole in the id ranges, e.g. mdll0, then
-            // mdll2, so mdll1 will not have any histos created
+            // mdll2, so mdll1 will not have any graphs created
             continue;
         }
 
-        assert(histos);
+        const auto &gs = *graphs;
 
-        if (histos->graphStorage.timestamps.empty())
+        if (!gs.amplitudes.sampleCount())
         {
             continue;
         }
@@ -220,25 +622,75 @@ void root_histos_finalize(RootHistoContext &ctx)
             dir->cd();
         }
 
-        auto graphAmplitude = new TGraph(histos->graphStorage.timestamps.size(), histos->graphStorage.timestamps.data(), histos->graphStorage.amplitudes.data());
-        graphAmplitude->SetName(fmt::format("mdll{}_amplitude_over_time", mdllId).c_str());
-        graphAmplitude->SetTitle(fmt::format("MDLL{} Amplitude over Time;Timestamp;Amplitude", mdllId).c_str());
-        graphAmplitude->Write("", TObject::kOverwrite);
+        write_downsampled_graph(gs.amplitudes,
+            fmt::format("mdll{}_amplitude_over_time", mdllId),
+            fmt::format("MDLL{} Amplitude over Time;Timestamp;Amplitude", mdllId));
+
+        write_downsampled_graph(gs.xPositions,
+            fmt::format("mdll{}_xpos_over_time", mdllId),
+            fmt::format("MDLL{} X Position over Time;Timestamp;X Position", mdllId));
 
-        auto graphXPos = new TGraph(histos->graphStorage.timestamps.size(), histos->graphStorage.timestamps.data(), histos->graphStorage.xPositions.data());
-        graphXPos->SetName(fmt::format("mdll{}_xpos_over_time", mdllId).c_str());
-        graphXPos->SetTitle(fmt::format("MDLL{} X Position over Time;Timestamp;X Position", mdllId).c_str());
-        graphXPos->Write("", TObject::kOverwrite);
+        write_downsampled_graph(gs.yPositions,
+            fmt::format("mdll{}_ypos_over_time", mdllId),
+            fmt::format("MDLL{} Y Position over Time;Timestamp;Y Position", mdllId));
 
-        auto graphYPos = new TGraph(histos->graphStorage.timestamps.size(), histos->graphStorage.timestamps.data(), histos->graphStorage.yPositions.data());
-        graphYPos->SetName(fmt::format("mdll{}_ypos_over_time", mdllId).c_str());
-        graphYPos->SetTitle(fmt::format("MDLL{} Y Position over Time;Timestamp;Y Position", mdllId).c_str());
-        graphYPos->Write("", TObject::kOverwrite);
+        spdlog::info("Wrote graphs for MDLL {} with {} points ({} events, bucket width {})",
+                     mdllId, gs.amplitudes.usedBuckets(), gs.amplitudes.sampleCount(),
+                     gs.amplitudes.bucketWidth());
 
-        spdlog::info("Wrote graphs for MDLL {} with {} points", mdllId, histos->graphStorage.timestamps.size());
+        ctx.histoOutFile->cd();
     }
 
     ctx.histoOutFile->Write("", TObject::kOverwrite);
 }
 
+void root_histos_write_tof(RootHistoContext &ctx, const TofHistogrammer &tof)
+{
+    const auto &options = tof.options();
+
+    if (!tof.rowCount())
+        return;
+
+    // The output file must not be touched while the writer is running.
+    root_histos_sync(ctx);
+
+    auto dir = ctx.histoOutFile->mkdir("tof", "", true);
+
+    if (!dir)
+    {
+        spdlog::error("Failed to create TOF directory in ROOT file");
+        return;
+    }
+
+    dir->cd();
+
+    for (size_t rowIndex = 0; rowIndex < tof.rowCount(); ++rowIndex)
+    {
+        const u32 channel = tof.rowChannel(rowIndex);
+        const unsigned mcpdId = (channel >> 8) & 0xffu;
+        const unsigned mpsdId = (channel >> 5) & 0b111u;
+        const unsigned chan = channel & 0b11111u;
+
+        auto histoname = options.positionBins > 1
+            ? fmt::format("mcpd{}_mpsd{}_channel{}_pixel{}_tof", mcpdId, mpsdId, chan, tof.rowPixel(rowIndex))
+            : fmt::format("mcpd{}_mpsd{}_channel{}_tof", mcpdId, mpsdId, chan);
+
+        // Owned by the directory.
+        auto histo = new TH1I(histoname.c_str(), histoname.c_str(), options.bins,
+                              tof.binLowEdge(0), tof.binLowEdge(options.bins));
+
+        const u32 *row = tof.row(rowIndex);
+
+        // ROOT bin 0 is the underflow bin.
+        for (u32 bin = 0; bin < options.bins; ++bin)
+            histo->SetBinContent(bin + 1, row[bin]);
+
+        histo->SetEntries(std::accumulate(row, row + options.bins, 0.0));
+        histo->Write("", TObject::kOverwrite);
+    }
+
+    ctx.histoOutFile->cd();
+    spdlog::info("Wrote {} TOF histograms", tof.rowCount());
+}
+
 }
@@ -3,14 +3,87 @@
 
 #include <TFile.h>
 #include <TH1D.h>
+#include <TH1I.h>
 #include <TH2D.h>
 #include <mesytec-mcpd/mesytec-mcpd.h>
+#include <mesytec-mcpd/util/time_bucket_downsampler.h>
 
 namespace mesytec::mcpd
 {
 
+// Timestamp histograms contain the 19 bit event timestamp, i.e. the time of
+// the event relative to its packet header timestamp.
+enum class TimestampHistoMode
+{
+    Full,   // 2^19 bins, one per timestamp unit
+    Coarse, // rebinned using timestampAxis
+    None,   // no timestamp histograms
+};
+
+// Parses "full", "coarse" or "none". Defaults to Full.
+inline TimestampHistoMode parse_timestamp_histo_mode(const std::string &str)
+{
+    if (str == "coarse")
+        return TimestampHistoMode::Coarse;
+    if (str == "none")
+        return TimestampHistoMode::None;
+    return TimestampHistoMode::Full;
+}
+
+// Accumulation array which remembers the bins filled since its counts were
+// last handed to the writer, so that handing them over costs time
+// proportional to the number of filled bins instead of the array size.
+struct TrackedCounts
+{
+    std::vector<u32> counts;
+    std::vector<u32> filled;    // bins which went from zero to non-zero
+    u64 overflow = 0u;
+
+    TrackedCounts() = default;
+    explicit TrackedCounts(size_t bins): counts(bins) {}
+
+    size_t size() const { return counts.size(); }
+
+    void fill(u64 bin)
+    {
+        if (bin >= counts.size())
+            ++overflow;
+        else if (!counts[bin]++)
+            filled.push_back(bin);
+    }
+};
+
+// The counts of the bins filled since the previous hand over.
+struct CountsDelta
+{
+    std::vector<u32> bins;
+    std::vector<u32> counts;
+    u64 overflow = 0u;
+
+    bool empty() const { return bins.empty() && !overflow; }
+};
+
+// Histograms are accumulated in plain arrays by the thread calling
+// root_histos_process_packet(). The ROOT objects and the output file are
+// owned by a background writer thread while one is running:
+// root_histos_flush() moves the counts of the bins filled since the previous
+// flush into a HistoDelta, zeroing them in the accumulation arrays, and
+// hands the delta to the writer. The writer adds the delta to the ROOT
+// histograms, writes the file and returns the delta as the next spare.
+//
+// Only one set of full size arrays is kept. The hand over lists grow with the
+// number of distinct bins filled between two flushes and keep their capacity:
+// up to 20 bytes per filled bin for the filled bin list and the two deltas
+// alternating between the receive and the writer thread.
 struct RootHistoContext
 {
+    struct Writer;
+
+    // Started by the first root_histos_flush(), stopped by root_histos_sync().
+    // Declared first so that move assignment stops a running writer before
+    // the output file and ROOT objects it uses are replaced.
+    std::unique_ptr<Writer> writer;
+
     std::unique_ptr<TFile> histoOutFile;
 
     // neutron events [mcpdId][mpsdId][channel]["amplitude"]
@@ -23,46 +96,177 @@ struct RootHistoContext
     // any event:     [mcpdId][mpsdId][channel]["timestamp"]
     // bits             8       3       5        19
 
-    // These use a linear index consisting of mcpd, mpsd and channel ids. See
-    // get_histo(), etc below.
-    std::vector<TH1D *> amplitudes;
-    std::vector<TH1D *> positions;
-    std::vector<TH1D *> timestamps;
+    // Per channel accumulation arrays.
+    struct ChannelHistos
+    {
+        unsigned mcpdId = 0;
+        unsigned mpsdId = 0;
+        unsigned channel = 0;
 
+        TrackedCounts amplitude;
+        TrackedCounts position;
+        TrackedCounts timestamp; // empty if TimestampHistoMode::None
+    };
+
+    // Per MDLL accumulation arrays. xyPositions is row major: y * xBins + x.
     struct MdllHistos
     {
-        TH1D *amplitudes = nullptr;
-        TH1D *xPositions = nullptr;
-        TH1D *yPositions = nullptr;
-        TH2D *xyPositions = nullptr;
-
-        // Used to create value-over-time graphs at the end of a run.
-        // This can grow indefinitely. Makes the OOM-killer happy.
-        struct GraphStorage
+        TrackedCounts amplitudes;
+        TrackedCounts xPositions;
+        TrackedCounts yPositions;
+        TrackedCounts xyPositions;
+    };
+
+    // The accumulation arrays. Only accessed by the receive thread.
+    struct Accumulators
+    {
+        // Flat lookup table indexed by linear_address(). Entries are allocated
+        // the first time a channel is hit.
+        std::vector<std::unique_ptr<ChannelHistos>> channelTable;
+
+        // Allocated channels in order of creation.
+        std::vector<ChannelHistos *> channels;
+
+        // Indexed by MDLL device id.
+        std::vector<std::unique_ptr<MdllHistos>> mdllHistos;
+    };
+
+    // Counts handed from the receive thread to the writer.
+    struct HistoDelta
+    {
+        struct Channel
+        {
+            unsigned mcpdId = 0;
+            unsigned mpsdId = 0;
+            unsigned channel = 0;
+
+            CountsDelta amplitude;
+            CountsDelta position;
+            CountsDelta timestamp;
+        };
+
+        struct Mdll
+        {
+            CountsDelta amplitudes;
+            CountsDelta xPositions;
+            CountsDelta yPositions;
+            CountsDelta xyPositions;
+        };
+
+        // Same order as Accumulators::channels.
+        std::vector<Channel> channels;
+
+        // Indexed by MDLL device id.
+        std::vector<Mdll> mdlls;
+    };
+
+    // The ROOT side of the histograms, owned by the output file. Only
+    // accessed by the writer thread while it is running.
+    struct RootObjects
+    {
+        struct ChannelTH1s
         {
-            std::vector<float> timestamps;
-            std::vector<float> amplitudes;
-            std::vector<float> xPositions;
-            std::vector<float> yPositions;
+            TH1D *amplitude = nullptr;
+            TH1D *position = nullptr;
+            TH1I *timestamp = nullptr;
         };
 
-        GraphStorage graphStorage;
+        struct MdllTHs
+        {
+            TH1D *amplitudes = nullptr;
+            TH1D *xPositions = nullptr;
+            TH1D *yPositions = nullptr;
+            TH2D *xyPositions = nullptr;
+        };
+
+        // Indexed by linear_address().
+        std::vector<std::unique_ptr<ChannelTH1s>> channelTable;
+        size_t channelCount = 0u;
+
+        // Indexed by MDLL device id.
+        std::vector<std::unique_ptr<MdllTHs>> mdllHistos;
+    };
+
+    // Timestamp histograms dominate the memory usage of the channel
+    // histograms. Set these before processing the first packet.
+    TimestampHistoMode timestampMode = TimestampHistoMode::Full;
+    HistoAxis timestampAxis = { 1u << event_constants::TimestampBits, 0 };
+
+    std::unique_ptr<Accumulators> accumulators;
+
+    std::unique_ptr<RootObjects> rootObjects;
+
+    // Decode buffer reused for each packet.
+    EventBatch batch;
+
+    // Used to create value-over-time graphs at the end of a run. The values
+    // are downsampled into a fixed number of time buckets so memory usage
+    // stays constant for long runs. Only touched by the receive thread.
+    struct MdllGraphStorage
+    {
+        explicit MdllGraphStorage(size_t maxBuckets)
+            : amplitudes(maxBuckets)
+            , xPositions(maxBuckets)
+            , yPositions(maxBuckets)
+        {}
+
+        util::TimeBucketDownsampler amplitudes;
+        util::TimeBucketDownsampler xPositions;
+        util::TimeBucketDownsampler yPositions;
     };
 
     // For MDLL data. Indexed by MDLL device id.
-    std::vector<std::unique_ptr<MdllHistos>> mdllHistos;
+    std::vector<std::unique_ptr<MdllGraphStorage>> mdllGraphs;
 
     bool enableMdllGraphs = false;
 
-    RootHistoContext(RootHistoContext &&) = default;
-    RootHistoContext &operator=(RootHistoContext &&) = default;
+    // Maximum number of points of each MDLL value-over-time graph.
+    size_t mdllGraphBuckets = 4096u;
+
+    RootHistoContext();
+    RootHistoContext(RootHistoContext &&);
+    RootHistoContext &operator=(RootHistoContext &&);
     ~RootHistoContext();
 };
 
 RootHistoContext create_histo_context(const std::string &outputFilename);
 void root_histos_process_packet(RootHistoContext &rootContext, const DataPacket &packet);
+// Stops the writer, writes the MDLL graphs and the final histogram contents.
 void root_histos_finalize(RootHistoContext &rootContext);
 
+// Sets the timestamp histogram mode. For TimestampHistoMode::Coarse the
+// timestamp is right shifted by 'shift' and histogrammed into 'bins' bins.
+void root_histos_set_timestamp_mode(RootHistoContext &rootContext, TimestampHistoMode mode,
+                                    u32 bins = 1024u, u32 shift = 9u);
+
+// Memory used by the histograms of a single channel (accumulation arrays
+// and the ROOT objects) with the current settings. Does not include the hand
+// over lists, see RootHistoContext.
+size_t root_histos_channel_memory(const RootHistoContext &rootContext);
+
+// Logs the per channel memory usage and the number of channels written to
+// the output file. Call without a running writer, e.g. before the first
+// flush or after root_histos_finalize().
+void root_histos_report_memory(const RootHistoContext &rootContext, const char *title);
+
+// Hands the counts accumulated since the previous flush to the background
+// writer thread which adds them to the ROOT histograms and writes the output
+// file. Starts the writer on first use. Does not block: if the writer is
+// still busy with the previous delta nothing is handed over and false is
+// returned. The counts stay in the accumulation arrays and go out with the
+// next flush.
+bool root_histos_flush(RootHistoContext &rootContext);
+
+// Stops the writer thread after it finished its current delta, then adds the
+// remaining accumulated counts to the ROOT histograms on the calling thread.
+// Afterwards the ROOT objects may be accessed directly.
+void root_histos_sync(RootHistoContext &rootContext);
+
+// Writes the TOF histograms to the "tof" directory of the output file. One
+// TH1I per channel or pixel, x axis in timestamp units (100 ns). Syncs first
+// if the writer thread is running.
+void root_histos_write_tof(RootHistoContext &rootContext, const TofHistogrammer &tof);
+
 inline size_t linear_address(unsigned mcpdId, unsigned mpsdId, unsigned channel)
 {
     return (  (channel & 0b11111u)
@@ -71,27 +275,6 @@ inline size_t linear_address(unsigned mcpdId, unsigned mpsdId, unsigned channel)
            );
 }
 
-inline TH1D *get_histo(const std::vector<TH1D *> histos, unsigned mcpdId, unsigned mpsdId, unsigned channel)
-{
-    auto idx = linear_address(mcpdId, mpsdId, channel);
-    return (idx < histos.size()) ? histos[idx] : nullptr;
-}
-
-inline TH1D *get_amplitude_histo(RootHistoContext &ctx, unsigned mcpdId, unsigned mpsdId, unsigned channel)
-{
-    return get_histo(ctx.amplitudes, mcpdId, mpsdId, channel);
-}
-
-inline TH1D *get_position_histo(RootHistoContext &ctx, unsigned mcpdId, unsigned mpsdId, unsigned channel)
-{
-    return get_histo(ctx.positions, mcpdId, mpsdId, channel);
-}
-
-inline TH1D *get_timestamp_histo(RootHistoContext &ctx, unsigned mcpdId, unsigned mpsdId, unsigned channel)
-{
-    return get_histo(ctx.timestamps, mcpdId, mpsdId, channel);
-}
-
 }
 
 #endif /* __MCPD_ROOT_HISTOS_H__ */
@@ -0,0 +1,142 @@
+#include <gtest/gtest.h>
+
+#include <algorithm>
+#include <filesystem>
+#include <unistd.h>
+
+#include "mcpd_root_histos.h"
+
+using namespace mesytec::mcpd;
+
+namespace
+{
+
+void append_neutron(DataPacket &packet, u64 mpsdId, u64 channel, u64 amplitude, u64 position,
+                    u64 timestamp)
+{
+    namespace ec = event_constants;
+
+    const u64 event = (mpsdId << ec::neutron::MpsdIdShift) | (channel << ec::neutron::ChannelShift)
+        | (amplitude << ec::neutron::AmplitudeShift) | (position << ec::neutron::PositionShift)
+        | timestamp;
+
+    const auto offset = get_data_length(packet);
+    packet.data[offset + 0] = event & 0xffffu;
+    packet.data[offset + 1] = (event >> 16) & 0xffffu;
+    packet.data[offset + 2] = (event >> 32) & 0xffffu;
+    packet.bufferLength += 3;
+}
+
+DataPacket make_packet(u64 headerTimestamp)
+{
+    DataPacket packet = {};
+    packet.bufferType = McpdDataBufferType;
+    packet.headerLength = 21;
+    packet.bufferLength = packet.headerLength;
+    packet.deviceId = 1;
+    packet.time[0] = headerTimestamp & 0xffffu;
+    packet.time[1] = (headerTimestamp >> 16) & 0xffffu;
+    packet.time[2] = (headerTimestamp >> 32) & 0xffffu;
+    return packet;
+}
+
+std::string temp_path()
+{
+    return (std::filesystem::temp_directory_path()
+            / ("mcpd-root-histos-test-" + std::to_string(getpid()) + ".root")).string();
+}
+
+} // namespace
+
+TEST(RootHistos, TimestampHistoUsesEventTimestamp)
+{
+    const u64 maxEventTimestamp = (1u << event_constants::TimestampBits) - 1u;
+
+    for (auto mode: { TimestampHistoMode::Full, TimestampHistoMode::Coarse })
+    {
+        const auto path = temp_path();
+
+        {
+            auto ctx = create_histo_context(path);
+            root_histos_set_timestamp_mode(ctx, mode);
+
+            // Header timestamps well past the 2^19 range of the event timestamp.
+            for (u64 headerTimestamp: { u64(0), u64(1) << 20, u64(0x123456789ab) })
+            {
+                auto packet = make_packet(headerTimestamp);
+                append_neutron(packet, 2, 3, 100, 200, 42);
+                append_neutron(packet, 2, 3, 100, 200, maxEventTimestamp);
+                root_histos_process_packet(ctx, packet);
+            }
+
+            root_histos_sync(ctx);
+
+            auto th1s = ctx.rootObjects->channelTable[linear_address(1, 2, 3)].get();
+            ASSERT_NE(th1s, nullptr);
+            ASSERT_NE(th1s->timestamp, nullptr);
+
+            const auto &axis = ctx.timestampAxis;
+            auto th1 = th1s->timestamp;
+
+            // ROOT bin 0 is the underflow bin.
+            ASSERT_EQ(th1->GetBinContent((42u >> axis.shift) + 1), 3.0);
+            ASSERT_EQ(th1->GetBinContent((maxEventTimestamp >> axis.shift) + 1), 3.0);
+            ASSERT_EQ(th1->GetBinContent(axis.bins + 1), 0.0);
+            ASSERT_EQ(th1->GetEntries(), 6.0);
+        }
+
+        std::filesystem::remove(path);
+    }
+}
+
+TEST(RootHistos, FlushHandsOverFilledBins)
+{
+    const auto path = temp_path();
+
+    {
+        auto ctx = create_histo_context(path);
+
+        for (u64 n = 0; n < 100; ++n)
+        {
+            auto packet = make_packet(n << 19);
+            append_neutron(packet, 0, n % 2, n % 10, 500, n);
+            root_histos_process_packet(ctx, packet);
+
+            // The writer may still be busy with the previous delta: the
+            // counts then go out with a later flush.
+            if (n % 10 == 9)
+                root_histos_flush(ctx);
+        }
+
+        root_histos_sync(ctx);
+
+        // The accumulation arrays are empty after handing over the counts.
+        for (auto histos: ctx.accumulators->channels)
+        {
+            for (auto counts: { &histos->amplitude, &histos->position, &histos->timestamp })
+            {
+                ASSERT_TRUE(counts->filled.empty());
+                ASSERT_EQ(std::count(counts->counts.begin(), counts->counts.end(), 0u),
+                          static_cast<ptrdiff_t>(counts->size()));
+            }
+        }
+
+        for (unsigned channel = 0; channel < 2; ++channel)
+        {
+            auto th1s = ctx.rootObjects->channelTable[linear_address(1, 0, channel)].get();
+            ASSERT_NE(th1s, nullptr);
+            ASSERT_EQ(th1s->position->GetBinContent(501), 50.0);
+            ASSERT_EQ(th1s->position->GetEntries(), 50.0);
+
+            for (unsigned amplitude = channel; amplitude < 10; amplitude += 2)
+                ASSERT_EQ(th1s->amplitude->GetBinContent(amplitude + 1), 10.0);
+
+            for (u64 n = channel; n < 100; n += 2)
+                ASSERT_EQ(th1s->timestamp->GetBinContent(n + 1), 1.0);
+        }
+
+        ASSERT_EQ(ctx.rootObjects->channelCount, 2u);
+    }
+
+    std::filesystem::remove(path);
+}
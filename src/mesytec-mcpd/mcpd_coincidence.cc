@@ -0,0 +1,168 @@
+#include "mcpd_coincidence.h"
+
+#include <algorithm>
+#include <stdexcept>
+
+namespace mesytec::mcpd
+{
+
+CoincidenceFinder::CoincidenceFinder()
+    : CoincidenceFinder(Options{})
+{
+}
+
+CoincidenceFinder::CoincidenceFinder(const Options &options)
+    : options_(options)
+{
+    if (!options_.channelMap.empty() && options_.channelMap.size() != LinearChannelCount)
+        throw std::invalid_argument("CoincidenceFinder: channelMap must be empty or have 65536 entries");
+
+    options_.maxGroupSize = std::max(options_.maxGroupSize, size_t(1));
+    multiplicityHisto_.resize(options_.maxMultiplicity + 1);
+    group_.reserve(std::min(options_.maxGroupSize, size_t(256)));
+}
+
+void CoincidenceFinder::process(const DecodedEvent *events, size_t count, CoincidenceOutput &out)
+{
+    for (size_t i = 0; i < count; ++i)
+    {
+        const auto &event = events[i];
+        ++counters_.eventsIn;
+
+        if (event.type != EventType::Neutron)
+        {
+            ++counters_.ignoredEvents;
+            continue;
+        }
+
+        const u32 linear = linear_channel_index(event.deviceId, event.neutron.mpsdId, event.neutron.channel);
+        u32 channel = linear;
+
+        if (!options_.channelMap.empty())
+        {
+            const s32 mapped = options_.channelMap[linear];
+
+            if (mapped < 0)
+            {
+                ++counters_.ignoredEvents;
+                continue;
+            }
+
+            channel = static_cast<u32>(mapped);
+        }
+
+        if (event.timestamp < lastTimestamp_)
+        {
+            ++counters_.unorderedEvents;
+            continue;
+        }
+
+        lastTimestamp_ = event.timestamp;
+        ++counters_.hits;
+
+        if (!group_.empty() && (event.timestamp - groupStart_ > options_.window
+                                || group_.size() >= options_.maxGroupSize))
+        {
+            if (group_.size() >= options_.maxGroupSize)
+                ++counters_.oversizedGroups;
+            closeGroup(out);
+        }
+
+        if (group_.empty())
+            groupStart_ = event.timestamp;
+
+        CoincidenceHit hit = {};
+        hit.channel = channel;
+        hit.dt = static_cast<u32>(event.timestamp - groupStart_);
+        hit.amplitude = event.neutron.amplitude;
+        hit.position = event.neutron.position;
+        hit.deviceId = event.deviceId;
+        hit.mpsdId = event.neutron.mpsdId;
+        hit.mpsdChannel = event.neutron.channel;
+        group_.push_back(hit);
+    }
+}
+
+void CoincidenceFinder::finish(CoincidenceOutput &out)
+{
+    if (!group_.empty())
+        closeGroup(out);
+}
+
+void CoincidenceFinder::reset()
+{
+    counters_ = {};
+    std::fill(multiplicityHisto_.begin(), multiplicityHisto_.end(), 0u);
+    group_.clear();
+    groupStart_ = 0u;
+    lastTimestamp_ = 0u;
+}
+
+void CoincidenceFinder::closeGroup(CoincidenceOutput &out)
+{
+    if (options_.maxChannelDistance < 0 || group_.size() == 1)
+    {
+        emitCluster(0, group_.size(), out);
+    }
+    else
+    {
+        // Split into clusters of neighbouring channels. Stable so that hits
+        // on the same channel stay in time order.
+        std::stable_sort(group_.begin(), group_.end(), [](const auto &a, const auto &b)
+                         { return a.channel < b.channel; });
+
+        const u32 maxDistance = static_cast<u32>(options_.maxChannelDistance);
+        size_t begin = 0u;
+
+        for (size_t i = 1; i < group_.size(); ++i)
+        {
+            if (group_[i].channel - group_[i - 1].channel > maxDistance)
+            {
+                emitCluster(begin, i, out);
+                begin = i;
+            }
+        }
+
+        emitCluster(begin, group_.size(), out);
+    }
+
+    group_.clear();
+}
+
+void CoincidenceFinder::emitCluster(size_t begin, size_t end, CoincidenceOutput &out)
+{
+    const size_t multiplicity = end - begin;
+
+    ++counters_.groups;
+    ++multiplicityHisto_[std::min(multiplicity, multiplicityHisto_.size() - 1)];
+
+    if (multiplicity < options_.minMultiplicity)
+        return;
+
+    u32 minDt = group_[begin].dt;
+    u32 maxDt = group_[begin].dt;
+
+    for (size_t i = begin + 1; i < end; ++i)
+    {
+        minDt = std::min(minDt, group_[i].dt);
+        maxDt = std::max(maxDt, group_[i].dt);
+    }
+
+    CoincidenceRecord record = {};
+    record.timestamp = groupStart_ + minDt;
+    record.duration = maxDt - minDt;
+    record.firstHit = static_cast<u32>(out.hits.size());
+    record.multiplicity = static_cast<u16>(std::min(multiplicity, size_t(0xffffu)));
+    out.records.push_back(record);
+
+    for (size_t i = begin; i < end; ++i)
+    {
+        auto hit = group_[i];
+        hit.dt -= minDt;
+        out.hits.push_back(hit);
+    }
+
+    ++counters_.records;
+}
+
+}
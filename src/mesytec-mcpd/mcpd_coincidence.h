@@ -0,0 +1,132 @@
+#ifndef __MESYTEC_MCPD_COINCIDENCE_H__
+#define __MESYTEC_MCPD_COINCIDENCE_H__
+
+#include <vector>
+
+#include "mcpd_core.h"
+
+namespace mesytec::mcpd
+{
+
+// Linear channel index over all devices: deviceId (8 bit), mpsdId (3 bit),
+// channel (5 bit).
+inline u32 linear_channel_index(u8 deviceId, u8 mpsdId, u8 channel)
+{
+    return (static_cast<u32>(deviceId) << 8) | ((mpsdId & 0x7u) << 5) | (channel & 0x1fu);
+}
+
+constexpr u32 LinearChannelCount = 1u << 16;
+
+struct MESYTEC_MCPD_EXPORT CoincidenceHit
+{
+    u32 channel;        // Mapped channel number used for the adjacency check.
+    u32 dt;             // Offset to the timestamp of the first hit in the group.
+    u16 amplitude;
+    u16 position;
+    u8 deviceId;
+    u8 mpsdId;
+    u8 mpsdChannel;
+};
+
+// A group of hits within the coincidence window. The hits are stored in
+// CoincidenceOutput::hits starting at firstHit.
+struct MESYTEC_MCPD_EXPORT CoincidenceRecord
+{
+    u64 timestamp;      // Timestamp of the first hit.
+    u32 duration;       // Timestamp difference between the last and first hit.
+    u32 firstHit;
+    u16 multiplicity;
+};
+
+struct MESYTEC_MCPD_EXPORT CoincidenceOutput
+{
+    std::vector<CoincidenceRecord> records;
+    std::vector<CoincidenceHit> hits;
+
+    void clear()
+    {
+        records.clear();
+        hits.clear();
+    }
+};
+
+// Forms groups of time-coincident neutron hits from a time-ordered event
+// stream, e.g. the output of EventMerger. Non-neutron events are ignored.
+//
+// A group is opened by a hit and contains all following hits whose timestamp
+// is within 'window' of the first hit. If maxChannelDistance is >= 0 the hits
+// of a closed group are additionally split into clusters of neighbouring
+// channels: two hits belong to the same cluster if their (mapped) channel
+// numbers differ by at most maxChannelDistance.
+//
+// Groups with a multiplicity of at least minMultiplicity are written to the
+// output as compact records. All groups are counted in the multiplicity
+// histogram. Memory is bounded by maxGroupSize: larger groups are closed
+// early.
+class MESYTEC_MCPD_EXPORT CoincidenceFinder
+{
+  public:
+    struct Options
+    {
+        u64 window = 10u; // In timestamp units (100 ns).
+        int maxChannelDistance = -1; // < 0 disables the adjacency rule.
+        unsigned minMultiplicity = 2u;
+        unsigned maxMultiplicity = 64u; // Last bin of the multiplicity histogram (overflow).
+        size_t maxGroupSize = 4096u;
+
+        // Optional mapping from linear_channel_index() to the channel number
+        // used for the adjacency check, e.g. to take the physical tube
+        // layout into account. Entries < 0 exclude the channel. Must be
+        // empty or have LinearChannelCount entries.
+        std::vector<s32> channelMap;
+    };
+
+    struct Counters
+    {
+        u64 eventsIn = 0u;
+        u64 hits = 0u;              // neutron events considered
+        u64 ignoredEvents = 0u;     // non-neutron or unmapped events
+        u64 unorderedEvents = 0u;   // dropped because the input was not time-ordered
+        u64 groups = 0u;
+        u64 records = 0u;
+        u64 oversizedGroups = 0u;   // groups closed early because of maxGroupSize
+    };
+
+    CoincidenceFinder();
+    explicit CoincidenceFinder(const Options &options);
+
+    // Processes the given time-ordered events. Completed coincidence records
+    // are appended to out.
+    void process(const DecodedEvent *events, size_t count, CoincidenceOutput &out);
+
+    void process(const std::vector<DecodedEvent> &events, CoincidenceOutput &out)
+    {
+        process(events.data(), events.size(), out);
+    }
+
+    // Closes the currently open group.
+    void finish(CoincidenceOutput &out);
+
+    // Index is the multiplicity, the last bin counts all groups with a
+    // multiplicity >= maxMultiplicity.
+    const std::vector<u64> &multiplicityHistogram() const { return multiplicityHisto_; }
+    const Counters &counters() const { return counters_; }
+    const Options &options() const { return options_; }
+
+    void reset();
+
+  private:
+    void closeGroup(CoincidenceOutput &out);
+    void emitCluster(size_t begin, size_t end, CoincidenceOutput &out);
+
+    Options options_;
+    Counters counters_;
+    std::vector<u64> multiplicityHisto_;
+    std::vector<CoincidenceHit> group_;
+    u64 groupStart_ = 0u;
+    u64 lastTimestamp_ = 0u;
+};
+
+}
+
+#endif /* __MESYTEC_MCPD_COINCIDENCE_H__ */
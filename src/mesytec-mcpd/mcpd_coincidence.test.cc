@@ -0,0 +1,126 @@
+#include <gtest/gtest.h>
+
+#include "mcpd_coincidence.h"
+
+using namespace mesytec::mcpd;
+
+namespace
+{
+
+DecodedEvent make_hit(u64 ts, u8 deviceId, u8 mpsdId, u8 channel)
+{
+    DecodedEvent event = {};
+    event.type = EventType::Neutron;
+    event.deviceId = deviceId;
+    event.neutron.mpsdId = mpsdId;
+    event.neutron.channel = channel;
+    event.timestamp = ts;
+    return event;
+}
+
+} // namespace
+
+TEST(CoincidenceFinder, WindowGrouping)
+{
+    CoincidenceFinder::Options options;
+    options.window = 5;
+    CoincidenceFinder finder(options);
+    CoincidenceOutput out;
+
+    DecodedEvent trigger = {};
+    trigger.type = EventType::Trigger;
+    trigger.timestamp = 101;
+
+    std::vector<DecodedEvent> events =
+    {
+        make_hit(100, 0, 0, 1),
+        trigger,
+        make_hit(103, 1, 2, 7),
+        make_hit(105, 0, 0, 2),
+        make_hit(106, 0, 0, 3), // outside the window of the first group
+        make_hit(200, 0, 0, 4),
+        make_hit(150, 0, 0, 4), // not time-ordered
+    };
+
+    finder.process(events, out);
+    finder.finish(out);
+
+    ASSERT_EQ(out.records.size(), 1u);
+    ASSERT_EQ(out.records[0].timestamp, 100u);
+    ASSERT_EQ(out.records[0].duration, 5u);
+    ASSERT_EQ(out.records[0].multiplicity, 3u);
+    ASSERT_EQ(out.hits.size(), 3u);
+    ASSERT_EQ(out.hits[1].deviceId, 1u);
+    ASSERT_EQ(out.hits[1].dt, 3u);
+
+    const auto &counters = finder.counters();
+    ASSERT_EQ(counters.eventsIn, 7u);
+    ASSERT_EQ(counters.hits, 5u);
+    ASSERT_EQ(counters.ignoredEvents, 1u);
+    ASSERT_EQ(counters.unorderedEvents, 1u);
+    ASSERT_EQ(counters.groups, 3u);
+
+    const auto &histo = finder.multiplicityHistogram();
+    ASSERT_EQ(histo[1], 2u);
+    ASSERT_EQ(histo[3], 1u);
+}
+
+TEST(CoincidenceFinder, ChannelAdjacency)
+{
+    CoincidenceFinder::Options options;
+    options.window = 10;
+    options.maxChannelDistance = 1;
+    CoincidenceFinder finder(options);
+    CoincidenceOutput out;
+
+    finder.process({
+        make_hit(10, 0, 0, 5),
+        make_hit(11, 0, 0, 20),
+        make_hit(12, 0, 0, 6),
+        make_hit(13, 0, 0, 21),
+        make_hit(14, 0, 0, 10),
+        }, out);
+    finder.finish(out);
+
+    // Two clusters (5, 6) and (20, 21), channel 10 is on its own.
+    ASSERT_EQ(out.records.size(), 2u);
+    ASSERT_EQ(out.records[0].timestamp, 10u);
+    ASSERT_EQ(out.records[0].duration, 2u);
+    ASSERT_EQ(out.records[1].timestamp, 11u);
+    ASSERT_EQ(out.hits[out.records[1].firstHit].mpsdChannel, 20u);
+    ASSERT_EQ(finder.multiplicityHistogram()[1], 1u);
+    ASSERT_EQ(finder.multiplicityHistogram()[2], 2u);
+}
+
+TEST(CoincidenceFinder, ChannelMapAndGroupLimit)
+{
+    CoincidenceFinder::Options options;
+    options.window = 1000;
+    options.maxChannelDistance = 1;
+    options.maxGroupSize = 3;
+    options.maxMultiplicity = 2;
+    options.channelMap.resize(LinearChannelCount, -1);
+    // Channel 0 of device 0 and device 1 are physical neighbours.
+    options.channelMap[linear_channel_index(0, 0, 0)] = 100;
+    options.channelMap[linear_channel_index(1, 0, 0)] = 101;
+    CoincidenceFinder finder(options);
+    CoincidenceOutput out;
+
+    finder.process({
+        make_hit(1, 0, 0, 0),
+        make_hit(2, 1, 0, 0),
+        make_hit(3, 0, 0, 1), // unmapped
+        make_hit(4, 0, 0, 0),
+        make_hit(5, 1, 0, 0), // exceeds maxGroupSize
+        }, out);
+    finder.finish(out);
+
+    ASSERT_EQ(finder.counters().ignoredEvents, 1u);
+    ASSERT_EQ(finder.counters().oversizedGroups, 1u);
+    ASSERT_EQ(out.records.size(), 1u);
+    ASSERT_EQ(out.records[0].multiplicity, 3u);
+    // Multiplicity 3 lands in the overflow bin.
+    ASSERT_EQ(finder.multiplicityHistogram().size(), 3u);
+    ASSERT_EQ(finder.multiplicityHistogram()[2], 1u);
+    ASSERT_EQ(finder.multiplicityHistogram()[1], 1u);
+}
@@ -1,6 +1,7 @@
 #ifndef __MESYTEC_MCPD_CORE_H__
 #define __MESYTEC_MCPD_CORE_H__
 
+#include <algorithm>
 #include <array>
 #include <cassert>
 #include <tuple>
@@ -405,6 +406,14 @@ inline int get_data_length(const PacketType &packet)
     return dataLen;
 }
 
+// Size in bytes of the packet as sent by the MCPD. Listfiles store packets
+// padded to sizeof(DataPacket).
+template<typename PacketType>
+inline size_t get_packet_size(const PacketType &packet)
+{
+    return std::min(packet.bufferLength * sizeof(u16), sizeof(PacketType));
+}
+
 inline u8 get_error_value(const u16 cmd)
 {
     return (cmd & CommandErrorMask) >> CommandErrorShift;
@@ -0,0 +1,59 @@
+#include "mcpd_device_stats.h"
+
+#include <algorithm>
+
+namespace mesytec::mcpd
+{
+
+size_t DeviceStatsTable::handlePacket(u32 srcAddr, const DataPacket &packet, size_t bytes)
+{
+    const size_t index = lookup(srcAddr, packet.deviceId);
+    auto &dc = devices_[index];
+
+    if (dc.packets > 0)
+    {
+        const u16 expected = dc.lastBufferNumber + 1;
+        const u16 delta = packet.bufferNumber - expected;
+
+        // Small forward jumps are lost packets, everything in the upper half
+        // of the 16 bit range is treated as a reordered or repeated packet.
+        if (delta != 0 && delta < 0x8000u)
+            dc.packetsLost += delta;
+        else if (delta != 0)
+            ++dc.outOfOrder;
+    }
+
+    const size_t eventCount = std::min(get_event_count(packet), DataPacketMaxDataWords / 3);
+    size_t triggerCount = 0u;
+
+    // Only the event type bit is needed here, so skip a full decode_event()
+    // and look at the top bit of the last word of each event.
+    for (size_t ei = 0; ei < eventCount; ++ei)
+        triggerCount += packet.data[ei * 3 + 2] >> 15;
+
+    const auto neutronType = packet.bufferType == MdllDataBufferType
+        ? EventType::MdllNeutron : EventType::Neutron;
+
+    dc.eventsByType[static_cast<unsigned>(neutronType)] += eventCount - triggerCount;
+    dc.eventsByType[static_cast<unsigned>(EventType::Trigger)] += triggerCount;
+
+    ++dc.packets;
+    dc.bytes += bytes;
+    dc.events += eventCount;
+    dc.lastBufferNumber = packet.bufferNumber;
+    dc.lastHeaderTimestamp = get_header_timestamp(packet);
+
+    return index;
+}
+
+u64 DeviceStatsTable::totalPacketsLost() const
+{
+    u64 result = 0u;
+
+    for (const auto &dc: devices_)
+        result += dc.packetsLost;
+
+    return result;
+}
+
+}
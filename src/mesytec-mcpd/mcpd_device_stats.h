@@ -0,0 +1,121 @@
+#ifndef __MESYTEC_MCPD_DEVICE_STATS_H__
+#define __MESYTEC_MCPD_DEVICE_STATS_H__
+
+#include <chrono>
+#include <unordered_map>
+#include <vector>
+
+#include "mcpd_core.h"
+
+namespace mesytec::mcpd
+{
+
+// Counters for a single data source identified by the packets source ip
+// address and the deviceId transmitted in the packet header.
+struct MESYTEC_MCPD_EXPORT DeviceCounters
+{
+    u32 srcAddr = 0u;       // IPv4 source address in host byte order. 0 if unknown, e.g. during replays.
+    u8 deviceId = 0u;
+    u64 packets = 0u;
+    u64 bytes = 0u;
+    u64 events = 0u;
+    std::array<u64, EventTypeCount> eventsByType = {}; // Neutron, Trigger, MdllNeutron
+    u64 packetsLost = 0u;   // Calculated from gaps in the 16 bit bufferNumber sequence.
+    u64 outOfOrder = 0u;    // Packets with a bufferNumber lower than expected (reordered or duplicated).
+    u16 lastBufferNumber = 0u;
+    u64 lastHeaderTimestamp = 0u;
+};
+
+struct MESYTEC_MCPD_EXPORT DeviceRates
+{
+    double packetsPerSecond = 0.0;
+    double eventsPerSecond = 0.0;
+    double bytesPerSecond = 0.0;
+    double packetsLostPerSecond = 0.0;
+};
+
+inline DeviceRates calculate_rates(const DeviceCounters &counters, const DeviceCounters &prev,
+                                   std::chrono::microseconds dt)
+{
+    DeviceRates result;
+    const double dt_s = std::chrono::duration<double>(dt).count();
+
+    if (dt_s > 0.0)
+    {
+        result.packetsPerSecond = (counters.packets - prev.packets) / dt_s;
+        result.eventsPerSecond = (counters.events - prev.events) / dt_s;
+        result.bytesPerSecond = (counters.bytes - prev.bytes) / dt_s;
+        result.packetsLostPerSecond = (counters.packetsLost - prev.packetsLost) / dt_s;
+    }
+
+    return result;
+}
+
+// Demultiplexes incoming packets by (srcAddr, deviceId) and keeps per device
+// counters. Devices are assigned a stable index on first sight which can be
+// used by callers to index their own per device data, e.g. output files.
+//
+// Lookups are O(1): the previously seen device is cached, everything else goes
+// through a hash table.
+class MESYTEC_MCPD_EXPORT DeviceStatsTable
+{
+  public:
+    // Returns the index of the device, creating a new entry if it was not seen before.
+    size_t lookup(u32 srcAddr, u8 deviceId)
+    {
+        const u64 key = make_key(srcAddr, deviceId);
+
+        if (key == lastKey_)
+            return lastIndex_;
+
+        auto it = index_.find(key);
+
+        if (it == index_.end())
+        {
+            DeviceCounters dc;
+            dc.srcAddr = srcAddr;
+            dc.deviceId = deviceId;
+            devices_.emplace_back(dc);
+            it = index_.emplace(key, devices_.size() - 1).first;
+        }
+
+        lastKey_ = key;
+        lastIndex_ = it->second;
+        return lastIndex_;
+    }
+
+    // Updates the counters of the packets source device. Returns the device index.
+    size_t handlePacket(u32 srcAddr, const DataPacket &packet, size_t bytes);
+
+    const std::vector<DeviceCounters> &devices() const { return devices_; }
+    const DeviceCounters &device(size_t index) const { return devices_.at(index); }
+    size_t size() const { return devices_.size(); }
+
+    // Sum of the packetsLost counters of all devices.
+    u64 totalPacketsLost() const;
+
+    void clear()
+    {
+        index_.clear();
+        devices_.clear();
+        lastKey_ = InvalidKey;
+        lastIndex_ = 0u;
+    }
+
+  private:
+    static constexpr u64 InvalidKey = ~static_cast<u64>(0);
+
+    static u64 make_key(u32 srcAddr, u8 deviceId)
+    {
+        return (static_cast<u64>(srcAddr) << 8) | deviceId;
+    }
+
+    std::unordered_map<u64, size_t> index_;
+    std::vector<DeviceCounters> devices_;
+    u64 lastKey_ = InvalidKey;
+    size_t lastIndex_ = 0u;
+};
+
+}
+
+#endif /* __MESYTEC_MCPD_DEVICE_STATS_H__ */
@@ -0,0 +1,69 @@
+#include <gtest/gtest.h>
+
+#include "mcpd_device_stats.h"
+
+using namespace mesytec::mcpd;
+
+namespace
+{
+
+DataPacket make_packet(u8 deviceId, u16 bufferNumber, size_t neutrons, size_t triggers)
+{
+    DataPacket packet = {};
+    packet.bufferType = McpdDataBufferType;
+    packet.headerLength = 21;
+    packet.bufferNumber = bufferNumber;
+    packet.deviceId = deviceId;
+
+    size_t wi = 0;
+
+    for (size_t i = 0; i < neutrons + triggers; ++i)
+    {
+        packet.data[wi++] = 0;
+        packet.data[wi++] = 0;
+        packet.data[wi++] = i < triggers ? 0x8000u : 0u;
+    }
+
+    packet.bufferLength = packet.headerLength + wi;
+    return packet;
+}
+
+} // namespace
+
+TEST(DeviceStatsTable, Demultiplex)
+{
+    DeviceStatsTable table;
+
+    auto i0 = table.handlePacket(0x0a000001, make_packet(0, 0, 10, 0), 100);
+    auto i1 = table.handlePacket(0x0a000002, make_packet(0, 0, 5, 1), 100);
+    auto i2 = table.handlePacket(0x0a000001, make_packet(1, 0, 1, 0), 100);
+
+    ASSERT_EQ(table.size(), 3u);
+    ASSERT_NE(i0, i1);
+    ASSERT_NE(i0, i2);
+    ASSERT_EQ(table.lookup(0x0a000001, 0), i0);
+    ASSERT_EQ(table.lookup(0x0a000002, 0), i1);
+
+    const auto &dc = table.device(i1);
+    ASSERT_EQ(dc.packets, 1u);
+    ASSERT_EQ(dc.events, 6u);
+    ASSERT_EQ(dc.eventsByType[static_cast<unsigned>(EventType::Neutron)], 5u);
+    ASSERT_EQ(dc.eventsByType[static_cast<unsigned>(EventType::Trigger)], 1u);
+}
+
+TEST(DeviceStatsTable, SequenceTracking)
+{
+    DeviceStatsTable table;
+
+    table.handlePacket(0, make_packet(3, 0xfffe, 1, 0), 100);
+    table.handlePacket(0, make_packet(3, 0xffff, 1, 0), 100);
+    table.handlePacket(0, make_packet(3, 0x0000, 1, 0), 100); // wrap, no loss
+    table.handlePacket(0, make_packet(3, 0x0003, 1, 0), 100); // 2 lost
+    table.handlePacket(0, make_packet(3, 0x0002, 1, 0), 100); // reordered
+
+    ASSERT_EQ(table.size(), 1u);
+    ASSERT_EQ(table.device(0).packets, 5u);
+    ASSERT_EQ(table.device(0).packetsLost, 2u);
+    ASSERT_EQ(table.device(0).outOfOrder, 1u);
+    ASSERT_EQ(table.totalPacketsLost(), 2u);
+}
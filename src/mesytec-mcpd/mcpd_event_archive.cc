@@ -0,0 +1,473 @@
+#include "mcpd_event_archive.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+
+#include "mcpd_listfile.h"
+#include "util/shared_memory.h"
+
+namespace mesytec::mcpd
+{
+
+namespace event_archive
+{
+
+size_t column_size(Column column)
+{
+    switch (column)
+    {
+        case Timestamp: return sizeof(u64);
+        case DeviceId:
+        case Type:
+        case Address:
+        case Channel: return sizeof(u8);
+        case Amplitude:
+        case Position:
+        case YPosition: return sizeof(u16);
+        case Value: return sizeof(u32);
+        case ColumnCount: break;
+    }
+
+    return 0u;
+}
+
+const char *column_name(Column column)
+{
+    switch (column)
+    {
+        case Timestamp: return "timestamp";
+        case DeviceId: return "device_id";
+        case Type: return "type";
+        case Address: return "address";
+        case Channel: return "channel";
+        case Amplitude: return "amplitude";
+        case Position: return "position";
+        case YPosition: return "y_position";
+        case Value: return "value";
+        case ColumnCount: break;
+    }
+
+    return "";
+}
+
+Column find_column(const std::string &name)
+{
+    for (u8 c = 0; c < ColumnCount; ++c)
+    {
+        if (name == column_name(static_cast<Column>(c)))
+            return static_cast<Column>(c);
+    }
+
+    return ColumnCount;
+}
+
+bool chunk_may_match(const ChunkInfo &chunk, const std::vector<RangePredicate> &predicates)
+{
+    return std::all_of(predicates.begin(), predicates.end(),
+                       [&chunk](const RangePredicate &p)
+                       {
+                           if (p.column >= ColumnCount)
+                               return true;
+                           const auto &c = chunk.columns[p.column];
+                           return c.min <= p.max && p.min <= c.max;
+                       });
+}
+
+} // namespace event_archive
+
+using namespace event_archive;
+
+namespace
+{
+
+const u8 ZeroPadding[ColumnAlignment] = {};
+
+std::error_code errno_error_code(int fallback = EIO)
+{
+    return std::error_code(errno ? errno : fallback, std::generic_category());
+}
+
+int file_seek(std::FILE *f, u64 offset)
+{
+#ifdef _WIN32
+    return _fseeki64(f, offset, SEEK_SET);
+#else
+    return fseeko(f, offset, SEEK_SET);
+#endif
+}
+
+// Calls f(column, values) for each column of the batch. The type column is
+// passed as u8 values.
+template<typename F>
+void for_each_column(const EventBatch &batch, F &&f)
+{
+    std::vector<u8> types(batch.type.size());
+    std::transform(batch.type.begin(), batch.type.end(), types.begin(),
+                   [](EventType t) { return static_cast<u8>(t); });
+
+    f(Timestamp, batch.timestamp);
+    f(DeviceId, batch.deviceId);
+    f(Type, types);
+    f(Address, batch.address);
+    f(Channel, batch.channel);
+    f(Amplitude, batch.amplitude);
+    f(Position, batch.position);
+    f(YPosition, batch.yPosition);
+    f(Value, batch.value);
+}
+
+template<typename T>
+void append(std::vector<T> &dest, const std::vector<T> &src, size_t offset, size_t count)
+{
+    dest.insert(dest.end(), src.begin() + offset, src.begin() + offset + count);
+}
+
+} // namespace
+
+//
+// EventArchiveWriter
+//
+
+EventArchiveWriter::EventArchiveWriter() = default;
+
+EventArchiveWriter::~EventArchiveWriter()
+{
+    if (file_)
+        close();
+}
+
+std::error_code EventArchiveWriter::open(const std::string &path)
+{
+    return open(path, Options{});
+}
+
+std::error_code EventArchiveWriter::open(const std::string &path, const Options &options)
+{
+    if (file_)
+        close();
+
+    errno = 0;
+
+    if (!(file_ = std::fopen(path.c_str(), "wb")))
+        return errno_error_code(ENOENT);
+
+    header_ = {};
+    std::memcpy(header_.magic, Magic, sizeof(header_.magic));
+    header_.version = Version;
+    header_.columnCount = ColumnCount;
+    header_.chunkSize = std::max(options.chunkSize, 1u);
+    chunks_.clear();
+    pending_.clear();
+    pending_.reserve(header_.chunkSize);
+
+    // Placeholder, rewritten by close().
+    if (std::fwrite(&header_, sizeof(header_), 1, file_) != 1)
+        return errno_error_code();
+
+    fileOffset_ = sizeof(header_);
+
+    return {};
+}
+
+std::error_code EventArchiveWriter::write(const EventBatch &batch)
+{
+    if (!file_)
+        return ListfileError::NotOpen;
+
+    for (size_t offset = 0; offset < batch.size();)
+    {
+        const size_t count = std::min(header_.chunkSize - pending_.size(), batch.size() - offset);
+
+        append(pending_.timestamp, batch.timestamp, offset, count);
+        append(pending_.deviceId, batch.deviceId, offset, count);
+        append(pending_.type, batch.type, offset, count);
+        append(pending_.address, batch.address, offset, count);
+        append(pending_.channel, batch.channel, offset, count);
+        append(pending_.amplitude, batch.amplitude, offset, count);
+        append(pending_.position, batch.position, offset, count);
+        append(pending_.yPosition, batch.yPosition, offset, count);
+        append(pending_.value, batch.value, offset, count);
+        offset += count;
+
+        if (pending_.size() >= header_.chunkSize)
+        {
+            if (auto ec = writeChunk())
+                return ec;
+        }
+    }
+
+    return {};
+}
+
+std::error_code EventArchiveWriter::writeChunk()
+{
+    ChunkInfo chunk = {};
+    chunk.eventCount = pending_.size();
+    std::error_code ret;
+
+    for_each_column(pending_, [&](Column column, const auto &values)
+    {
+        if (ret)
+            return;
+
+        const size_t padding = (ColumnAlignment - fileOffset_ % ColumnAlignment) % ColumnAlignment;
+        const size_t bytes = values.size() * sizeof(values[0]);
+        auto minmax = std::minmax_element(values.begin(), values.end());
+
+        auto &info = chunk.columns[column];
+        info.offset = fileOffset_ + padding;
+        info.min = *minmax.first;
+        info.max = *minmax.second;
+
+        if (std::fwrite(ZeroPadding, 1, padding, file_) != padding
+            || std::fwrite(values.data(), 1, bytes, file_) != bytes)
+        {
+            ret = errno_error_code();
+            return;
+        }
+
+        fileOffset_ += padding + bytes;
+    });
+
+    if (ret)
+        return ret;
+
+    header_.eventCount += chunk.eventCount;
+    chunks_.push_back(chunk);
+    pending_.clear();
+
+    return {};
+}
+
+std::error_code EventArchiveWriter::close()
+{
+    if (!file_)
+        return ListfileError::NotOpen;
+
+    std::error_code ret;
+
+    if (!pending_.empty())
+        ret = writeChunk();
+
+    if (!ret)
+    {
+        const size_t padding = (sizeof(u64) - fileOffset_ % sizeof(u64)) % sizeof(u64);
+
+        header_.chunkCount = chunks_.size();
+        header_.chunkTableOffset = fileOffset_ + padding;
+
+        errno = 0;
+
+        if (std::fwrite(ZeroPadding, 1, padding, file_) != padding
+            || std::fwrite(chunks_.data(), sizeof(ChunkInfo), chunks_.size(), file_) != chunks_.size()
+            || file_seek(file_, 0) != 0
+            || std::fwrite(&header_, sizeof(header_), 1, file_) != 1)
+        {
+            ret = errno_error_code();
+        }
+    }
+
+    errno = 0;
+
+    if (std::fclose(file_) != 0 && !ret)
+        ret = errno_error_code();
+
+    file_ = nullptr;
+    chunks_.clear();
+    pending_.clear();
+
+    return ret;
+}
+
+std::error_code write_event_archive(PacketSource &input, const std::string &outputPath,
+                                    const EventArchiveWriter::Options &options, u64 *eventCount)
+{
+    EventArchiveWriter writer;
+
+    if (auto ec = writer.open(outputPath, options))
+        return ec;
+
+    DataPacket packet = {};
+    EventBatch batch;
+    batch.reserve(options.chunkSize);
+
+    while (true)
+    {
+        auto ec = input.readPacket(packet);
+
+        if (ec == ListfileError::EndOfFile)
+            break;
+
+        if (ec)
+            return ec;
+
+        decode_events(packet, batch);
+
+        if (batch.size() >= options.chunkSize)
+        {
+            if ((ec = writer.write(batch)))
+                return ec;
+
+            batch.clear();
+        }
+    }
+
+    if (auto ec = writer.write(batch))
+        return ec;
+
+    if (eventCount)
+        *eventCount = writer.eventCount();
+
+    return writer.close();
+}
+
+//
+// EventArchiveReader
+//
+
+EventArchiveReader::EventArchiveReader() = default;
+
+EventArchiveReader::~EventArchiveReader()
+{
+    close();
+}
+
+std::error_code EventArchiveReader::open(const std::string &path)
+{
+    close();
+
+    const void *mem = nullptr;
+    size_t size = 0u;
+
+    if (auto ec = util::map_file(path, &mem, &size))
+    {
+        if (ec != std::errc::function_not_supported)
+            return ec;
+
+        std::ifstream in(path, std::ios::binary);
+
+        if (!in)
+            return std::make_error_code(std::errc::no_such_file_or_directory);
+
+        buffer_.assign(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+        mem = buffer_.data();
+        size = buffer_.size();
+    }
+    else
+        mapped_ = true;
+
+    data_ = reinterpret_cast<const u8 *>(mem);
+    size_ = size;
+
+    auto fail = [this](ListfileError error)
+    {
+        close();
+        return make_error_code(error);
+    };
+
+    if (size_ < sizeof(header_))
+        return fail(ListfileError::InvalidHeader);
+
+    std::memcpy(&header_, data_, sizeof(header_));
+
+    if (std::memcmp(header_.magic, Magic, sizeof(header_.magic)) != 0)
+        return fail(ListfileError::InvalidHeader);
+
+    if (header_.version > Version || header_.columnCount != ColumnCount)
+        return fail(ListfileError::UnsupportedVersion);
+
+    if (header_.chunkTableOffset > size_
+        || (size_ - header_.chunkTableOffset) / sizeof(ChunkInfo) < header_.chunkCount)
+        return fail(ListfileError::CorruptRecord);
+
+    chunks_.resize(header_.chunkCount);
+    std::memcpy(chunks_.data(), data_ + header_.chunkTableOffset, chunks_.size() * sizeof(ChunkInfo));
+
+    u64 eventCount = 0u;
+
+    for (const auto &chunk: chunks_)
+    {
+        for (u8 c = 0; c < ColumnCount; ++c)
+        {
+            const auto &info = chunk.columns[c];
+            const u64 bytes = chunk.eventCount * column_size(static_cast<Column>(c));
+
+            if (info.offset > size_ || size_ - info.offset < bytes)
+                return fail(ListfileError::CorruptRecord);
+        }
+
+        eventCount += chunk.eventCount;
+    }
+
+    if (eventCount != header_.eventCount)
+        return fail(ListfileError::CorruptRecord);
+
+    return {};
+}
+
+void EventArchiveReader::close()
+{
+    if (mapped_)
+        util::unmap_shared_memory(data_, size_);
+
+    data_ = nullptr;
+    size_ = 0u;
+    mapped_ = false;
+    buffer_ = {};
+    header_ = {};
+    chunks_.clear();
+}
+
+std::vector<size_t> EventArchiveReader::selectChunks(const std::vector<RangePredicate> &predicates) const
+{
+    std::vector<size_t> result;
+
+    for (size_t i = 0; i < chunks_.size(); ++i)
+    {
+        if (chunk_may_match(chunks_[i], predicates))
+            result.push_back(i);
+    }
+
+    return result;
+}
+
+const void *EventArchiveReader::columnData(size_t index, Column column) const
+{
+    if (index >= chunks_.size() || column >= ColumnCount)
+        return nullptr;
+
+    return data_ + chunks_[index].columns[column].offset;
+}
+
+void EventArchiveReader::readChunk(size_t index, EventBatch &dest) const
+{
+    if (index >= chunks_.size())
+        return;
+
+    const size_t count = chunks_[index].eventCount;
+    const size_t offset = dest.size();
+    dest.resize(offset + count);
+
+    auto copy = [&](Column column, auto &values)
+    {
+        std::memcpy(values.data() + offset, columnData(index, column), count * sizeof(values[0]));
+    };
+
+    copy(Timestamp, dest.timestamp);
+    copy(DeviceId, dest.deviceId);
+    copy(Address, dest.address);
+    copy(Channel, dest.channel);
+    copy(Amplitude, dest.amplitude);
+    copy(Position, dest.position);
+    copy(YPosition, dest.yPosition);
+    copy(Value, dest.value);
+
+    auto types = column<u8>(index, Type);
+    std::transform(types, types + count, dest.type.begin() + offset,
+                   [](u8 t) { return static_cast<EventType>(t); });
+}
+
+}
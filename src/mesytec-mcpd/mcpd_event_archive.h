@@ -0,0 +1,187 @@
+#ifndef __MESYTEC_MCPD_EVENT_ARCHIVE_H__
+#define __MESYTEC_MCPD_EVENT_ARCHIVE_H__
+
+#include <cstdio>
+#include <string>
+#include <system_error>
+#include <vector>
+
+#include "mcpd_event_batch.h"
+#include "mcpd_packet_source.h"
+
+namespace mesytec::mcpd
+{
+
+// Columnar event archives
+//
+// Decoded events stored for analysis. The events are split into chunks of up
+// to chunkSize events. Each chunk stores the EventBatch columns one after the
+// other, every column is a contiguous, 64 byte aligned array of little endian
+// values. A chunk table at the end of the file holds the event count, the
+// column offsets and the minimum and maximum value of every column of each
+// chunk. Readers map the file and only touch the columns they need, chunks
+// whose value ranges cannot match a query are skipped without reading them.
+//
+// Layout: FileHeader, chunk data, ChunkInfo[chunkCount].
+namespace event_archive
+{
+    static const char Magic[8] = { 'M', 'C', 'P', 'D', 'E', 'V', 'A', 'R' };
+    static const u32 Version = 1u;
+    static const size_t ColumnAlignment = 64u;
+
+    // The EventBatch columns in file order.
+    enum Column: u8
+    {
+        Timestamp,      // u64
+        DeviceId,       // u8
+        Type,           // u8, EventType
+        Address,        // u8, mpsdId or triggerId
+        Channel,        // u8, channel or dataId
+        Amplitude,      // u16
+        Position,       // u16, position or MDLL xPos
+        YPosition,      // u16, MDLL yPos
+        Value,          // u32, trigger value
+        ColumnCount
+    };
+
+    struct FileHeader
+    {
+        char magic[8];
+        u32 version;
+        u32 columnCount;    // ColumnCount
+        u64 eventCount;
+        u64 chunkCount;
+        u64 chunkTableOffset;
+        u32 chunkSize;      // maximum number of events per chunk
+        u32 reserved;
+    };
+
+    struct ColumnInfo
+    {
+        u64 offset;         // file offset of the column data
+        u64 min;
+        u64 max;
+    };
+
+    struct ChunkInfo
+    {
+        u64 eventCount;
+        ColumnInfo columns[ColumnCount];
+    };
+
+    static_assert(sizeof(FileHeader) == 48);
+    static_assert(sizeof(ChunkInfo) == 8 + ColumnCount * 24);
+
+    // Size in bytes of a single value of the column.
+    MESYTEC_MCPD_EXPORT size_t column_size(Column column);
+    // Python style names as used by the EventBatch bindings, e.g. "device_id".
+    MESYTEC_MCPD_EXPORT const char *column_name(Column column);
+    // Returns ColumnCount for unknown names.
+    MESYTEC_MCPD_EXPORT Column find_column(const std::string &name);
+
+    // Inclusive value range of a column. Used to select chunks.
+    struct RangePredicate
+    {
+        Column column;
+        u64 min;
+        u64 max;
+    };
+
+    // True if the column ranges of the chunk intersect all predicates.
+    MESYTEC_MCPD_EXPORT bool chunk_may_match(const ChunkInfo &chunk,
+                                             const std::vector<RangePredicate> &predicates);
+}
+
+class MESYTEC_MCPD_EXPORT EventArchiveWriter
+{
+  public:
+    struct Options
+    {
+        u32 chunkSize = 1u << 16;
+    };
+
+    EventArchiveWriter();
+    ~EventArchiveWriter();
+
+    EventArchiveWriter(const EventArchiveWriter &) = delete;
+    EventArchiveWriter &operator=(const EventArchiveWriter &) = delete;
+
+    std::error_code open(const std::string &path);
+    std::error_code open(const std::string &path, const Options &options);
+
+    // Appends the events of the batch. Full chunks are written immediately.
+    std::error_code write(const EventBatch &batch);
+
+    // Writes the last partial chunk, the chunk table and the final header.
+    // The archive is invalid until this has been called.
+    std::error_code close();
+
+    bool isOpen() const { return file_ != nullptr; }
+    u64 eventCount() const { return header_.eventCount + pending_.size(); }
+
+  private:
+    std::error_code writeChunk();
+
+    std::FILE *file_ = nullptr;
+    u64 fileOffset_ = 0u;
+    event_archive::FileHeader header_ = {};
+    std::vector<event_archive::ChunkInfo> chunks_;
+    EventBatch pending_;
+};
+
+// Decodes all packets of the input into the archive at outputPath.
+MESYTEC_MCPD_EXPORT std::error_code write_event_archive(PacketSource &input, const std::string &outputPath,
+                                                        const EventArchiveWriter::Options &options,
+                                                        u64 *eventCount = nullptr);
+
+// Read-only access to a memory mapped event archive. Column pointers stay
+// valid until the reader is closed.
+class MESYTEC_MCPD_EXPORT EventArchiveReader
+{
+  public:
+    EventArchiveReader();
+    ~EventArchiveReader();
+
+    EventArchiveReader(const EventArchiveReader &) = delete;
+    EventArchiveReader &operator=(const EventArchiveReader &) = delete;
+
+    std::error_code open(const std::string &path);
+    void close();
+
+    bool isOpen() const { return data_ != nullptr; }
+    const event_archive::FileHeader &header() const { return header_; }
+    u64 eventCount() const { return header_.eventCount; }
+    size_t chunkCount() const { return chunks_.size(); }
+    const event_archive::ChunkInfo &chunk(size_t index) const { return chunks_[index]; }
+
+    // Indexes of the chunks which may contain events matching all predicates.
+    std::vector<size_t> selectChunks(const std::vector<event_archive::RangePredicate> &predicates) const;
+
+    // Raw column data of a chunk: chunk(index).eventCount values of
+    // column_size(column) bytes each.
+    const void *columnData(size_t index, event_archive::Column column) const;
+
+    template<typename T>
+    const T *column(size_t index, event_archive::Column column) const
+    {
+        if (sizeof(T) != event_archive::column_size(column))
+            return nullptr;
+        return reinterpret_cast<const T *>(columnData(index, column));
+    }
+
+    // Appends all events of the chunk to the batch.
+    void readChunk(size_t index, EventBatch &dest) const;
+
+  private:
+    const u8 *data_ = nullptr;
+    size_t size_ = 0u;
+    bool mapped_ = false;
+    // Used if the file cannot be mapped.
+    std::vector<u8> buffer_;
+    event_archive::FileHeader header_ = {};
+    std::vector<event_archive::ChunkInfo> chunks_;
+};
+
+}
+
+#endif /* __MESYTEC_MCPD_EVENT_ARCHIVE_H__ */
@@ -0,0 +1,107 @@
+#include <gtest/gtest.h>
+
+#include <filesystem>
+#include <unistd.h>
+
+#include "mcpd_event_archive.h"
+
+using namespace mesytec::mcpd;
+using namespace mesytec::mcpd::event_archive;
+
+namespace
+{
+
+EventBatch make_batch(size_t count)
+{
+    EventBatch batch;
+    batch.resize(count);
+
+    for (size_t i = 0; i < count; ++i)
+    {
+        batch.timestamp[i] = 1000 + i * 10;
+        batch.deviceId[i] = i % 3;
+        batch.type[i] = (i % 5 == 0) ? EventType::Trigger : EventType::Neutron;
+        batch.address[i] = i % 8;
+        batch.channel[i] = i % 16;
+
+        if (batch.type[i] == EventType::Trigger)
+            batch.value[i] = i;
+        else
+        {
+            batch.amplitude[i] = i % 1024;
+            batch.position[i] = (i * 7) % 1024;
+        }
+    }
+
+    return batch;
+}
+
+} // namespace
+
+TEST(EventArchive, WriteRead)
+{
+    const auto path = (std::filesystem::temp_directory_path()
+                       / ("mcpd-event-archive-test-" + std::to_string(getpid()))).string();
+    const auto input = make_batch(10000);
+
+    EventArchiveWriter::Options options;
+    options.chunkSize = 1024;
+
+    EventArchiveWriter writer;
+    ASSERT_FALSE(writer.open(path, options));
+
+    // Batches not aligned to the chunk size.
+    for (size_t offset = 0; offset < input.size(); offset += 777)
+    {
+        EventBatch part;
+        for (size_t i = offset; i < std::min(offset + 777, input.size()); ++i)
+            part.push_back(input.event(i));
+        ASSERT_FALSE(writer.write(part));
+    }
+
+    ASSERT_EQ(writer.eventCount(), input.size());
+    ASSERT_FALSE(writer.close());
+
+    EventArchiveReader reader;
+    ASSERT_FALSE(reader.open(path));
+    ASSERT_EQ(reader.eventCount(), input.size());
+    ASSERT_EQ(reader.chunkCount(), 10u);
+    ASSERT_EQ(reader.chunk(9).eventCount, 10000u - 9 * 1024);
+
+    EventBatch output;
+    for (size_t ci = 0; ci < reader.chunkCount(); ++ci)
+        reader.readChunk(ci, output);
+
+    ASSERT_EQ(output.timestamp, input.timestamp);
+    ASSERT_EQ(output.deviceId, input.deviceId);
+    ASSERT_EQ(output.type, input.type);
+    ASSERT_EQ(output.address, input.address);
+    ASSERT_EQ(output.channel, input.channel);
+    ASSERT_EQ(output.amplitude, input.amplitude);
+    ASSERT_EQ(output.position, input.position);
+    ASSERT_EQ(output.yPosition, input.yPosition);
+    ASSERT_EQ(output.value, input.value);
+
+    // Column access and statistics
+    auto timestamps = reader.column<u64>(2, Timestamp);
+    ASSERT_NE(timestamps, nullptr);
+    ASSERT_EQ(reinterpret_cast<uintptr_t>(timestamps) % ColumnAlignment, 0u);
+    ASSERT_EQ(timestamps[0], input.timestamp[2048]);
+    ASSERT_EQ(reader.column<u32>(2, Timestamp), nullptr);
+    ASSERT_EQ(reader.chunk(2).columns[Timestamp].min, input.timestamp[2048]);
+    ASSERT_EQ(reader.chunk(2).columns[Timestamp].max, input.timestamp[3071]);
+    ASSERT_EQ(reader.chunk(2).columns[Type].max, static_cast<u64>(EventType::Trigger));
+
+    // Chunk selection
+    ASSERT_EQ(reader.selectChunks({}).size(), 10u);
+    ASSERT_EQ(reader.selectChunks({ { Timestamp, input.timestamp[3071], input.timestamp[3072] } }),
+              (std::vector<size_t>{ 2, 3 }));
+    ASSERT_TRUE(reader.selectChunks({ { Timestamp, 0, 999 } }).empty());
+    ASSERT_TRUE(reader.selectChunks({ { Timestamp, 0, 1u << 30 }, { DeviceId, 3, 255 } }).empty());
+
+    ASSERT_EQ(find_column("y_position"), YPosition);
+    ASSERT_EQ(find_column("foo"), ColumnCount);
+
+    reader.close();
+    std::filesystem::remove(path);
+}
@@ -0,0 +1,160 @@
+#include "mcpd_event_batch.h"
+
+#include <algorithm>
+
+namespace mesytec::mcpd
+{
+
+void EventBatch::clear()
+{
+    resize(0);
+}
+
+void EventBatch::reserve(size_t count)
+{
+    timestamp.reserve(count);
+    deviceId.reserve(count);
+    type.reserve(count);
+    address.reserve(count);
+    channel.reserve(count);
+    amplitude.reserve(count);
+    position.reserve(count);
+    yPosition.reserve(count);
+    value.reserve(count);
+}
+
+void EventBatch::resize(size_t count)
+{
+    timestamp.resize(count);
+    deviceId.resize(count);
+    type.resize(count);
+    address.resize(count);
+    channel.resize(count);
+    amplitude.resize(count);
+    position.resize(count);
+    yPosition.resize(count);
+    value.resize(count);
+}
+
+void EventBatch::push_back(const DecodedEvent &event)
+{
+    const size_t i = size();
+    resize(i + 1);
+
+    timestamp[i] = event.timestamp;
+    deviceId[i] = event.deviceId;
+    type[i] = event.type;
+
+    switch (event.type)
+    {
+        case EventType::Neutron:
+            address[i] = event.neutron.mpsdId;
+            channel[i] = event.neutron.channel;
+            amplitude[i] = event.neutron.amplitude;
+            position[i] = event.neutron.position;
+            break;
+
+        case EventType::Trigger:
+            address[i] = event.trigger.triggerId;
+            channel[i] = event.trigger.dataId;
+            value[i] = event.trigger.value;
+            break;
+
+        case EventType::MdllNeutron:
+            amplitude[i] = event.mdllNeutron.amplitude;
+            position[i] = event.mdllNeutron.xPos;
+            yPosition[i] = event.mdllNeutron.yPos;
+            break;
+    }
+}
+
+DecodedEvent EventBatch::event(size_t i) const
+{
+    DecodedEvent result = {};
+
+    result.timestamp = timestamp[i];
+    result.deviceId = deviceId[i];
+    result.type = type[i];
+
+    switch (result.type)
+    {
+        case EventType::Neutron:
+            result.neutron.mpsdId = address[i];
+            result.neutron.channel = channel[i];
+            result.neutron.amplitude = amplitude[i];
+            result.neutron.position = position[i];
+            break;
+
+        case EventType::Trigger:
+            result.trigger.triggerId = address[i];
+            result.trigger.dataId = channel[i];
+            result.trigger.value = value[i];
+            break;
+
+        case EventType::MdllNeutron:
+            result.mdllNeutron.amplitude = amplitude[i];
+            result.mdllNeutron.xPos = position[i];
+            result.mdllNeutron.yPos = yPosition[i];
+            break;
+    }
+
+    return result;
+}
+
+size_t decode_events(const DataPacket &packet, EventBatch &batch)
+{
+    namespace ec = event_constants;
+
+    const int dataLength = std::clamp(get_data_length(packet), 0, static_cast<int>(DataPacketMaxDataWords));
+    const size_t eventCount = dataLength / 3;
+    const size_t offset = batch.size();
+    const u64 headerTimestamp = get_header_timestamp(packet);
+    const bool isMdll = packet.bufferType == MdllDataBufferType;
+
+    batch.resize(offset + eventCount);
+
+    for (size_t ei = 0; ei < eventCount; ++ei)
+    {
+        const size_t i = offset + ei;
+        const u16 *words = packet.data + ei * 3;
+        const u64 event = to_48bit_value(words[0], words[1], words[2]);
+
+        batch.timestamp[i] = headerTimestamp + ((event >> ec::TimestampShift) & ec::TimestampMask);
+        batch.deviceId[i] = packet.deviceId;
+
+        if ((event >> ec::IdShift) & ec::IdMask)
+        {
+            batch.type[i] = EventType::Trigger;
+            batch.address[i] = (event >> ec::trigger::TriggerIdShift) & ec::trigger::TriggerIdMask;
+            batch.channel[i] = (event >> ec::trigger::DataIdShift) & ec::trigger::DataIdMask;
+            batch.amplitude[i] = 0u;
+            batch.position[i] = 0u;
+            batch.yPosition[i] = 0u;
+            batch.value[i] = (event >> ec::trigger::DataShift) & ec::trigger::DataMask;
+        }
+        else if (isMdll)
+        {
+            batch.type[i] = EventType::MdllNeutron;
+            batch.address[i] = 0u;
+            batch.channel[i] = 0u;
+            batch.amplitude[i] = (event >> ec::mdll_neutron::AmplitudeShift) & ec::mdll_neutron::AmplitudeMask;
+            batch.position[i] = (event >> ec::mdll_neutron::xPosShift) & ec::mdll_neutron::xPosMask;
+            batch.yPosition[i] = (event >> ec::mdll_neutron::yPosShift) & ec::mdll_neutron::yPosMask;
+            batch.value[i] = 0u;
+        }
+        else
+        {
+            batch.type[i] = EventType::Neutron;
+            batch.address[i] = (event >> ec::neutron::MpsdIdShift) & ec::neutron::MpsdIdMask;
+            batch.channel[i] = (event >> ec::neutron::ChannelShift) & ec::neutron::ChannelMask;
+            batch.amplitude[i] = (event >> ec::neutron::AmplitudeShift) & ec::neutron::AmplitudeMask;
+            batch.position[i] = (event >> ec::neutron::PositionShift) & ec::neutron::PositionMask;
+            batch.yPosition[i] = 0u;
+            batch.value[i] = 0u;
+        }
+    }
+
+    return eventCount;
+}
+
+}
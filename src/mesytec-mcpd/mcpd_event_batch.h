@@ -0,0 +1,57 @@
+#ifndef __MESYTEC_MCPD_EVENT_BATCH_H__
+#define __MESYTEC_MCPD_EVENT_BATCH_H__
+
+#include <vector>
+
+#include "mcpd_core.h"
+
+namespace mesytec::mcpd
+{
+
+// Columnar (structure of arrays) storage for decoded events. Processing code
+// that only needs a few fields of each event, e.g. histogramming, can walk
+// the relevant columns without touching the rest of the event data.
+//
+// The meaning of the generic columns depends on the event type:
+//
+//   column     Neutron    Trigger     MdllNeutron
+//   address    mpsdId     triggerId   0
+//   channel    channel    dataId      0
+//   amplitude  amplitude  0           amplitude
+//   position   position   0           xPos
+//   yPosition  0          0           yPos
+//   value      0          value       0
+struct MESYTEC_MCPD_EXPORT EventBatch
+{
+    std::vector<u64> timestamp;     // Full event timestamp (header + event timestamp).
+    std::vector<u8> deviceId;
+    std::vector<EventType> type;
+    std::vector<u8> address;
+    std::vector<u8> channel;
+    std::vector<u16> amplitude;
+    std::vector<u16> position;
+    std::vector<u16> yPosition;
+    std::vector<u32> value;
+
+    size_t size() const { return timestamp.size(); }
+    bool empty() const { return timestamp.empty(); }
+
+    void clear();
+    void reserve(size_t count);
+    void resize(size_t count);
+
+    // Appends a single event.
+    void push_back(const DecodedEvent &event);
+
+    // Recreates the DecodedEvent at the given index. The raw packet and event
+    // timestamps are not stored and are left at zero.
+    DecodedEvent event(size_t index) const;
+};
+
+// Decodes all events of the packet and appends them to the batch. Returns the
+// number of events appended.
+MESYTEC_MCPD_EXPORT size_t decode_events(const DataPacket &packet, EventBatch &batch);
+
+}
+
+#endif /* __MESYTEC_MCPD_EVENT_BATCH_H__ */
@@ -0,0 +1,86 @@
+#include <gtest/gtest.h>
+
+#include "mcpd_event_batch.h"
+
+using namespace mesytec::mcpd;
+
+namespace
+{
+
+void append_event(DataPacket &packet, u64 event)
+{
+    const auto offset = get_data_length(packet);
+    packet.data[offset + 0] = event & 0xffffu;
+    packet.data[offset + 1] = (event >> 16) & 0xffffu;
+    packet.data[offset + 2] = (event >> 32) & 0xffffu;
+    packet.bufferLength += 3;
+}
+
+} // namespace
+
+TEST(EventBatch, DecodeEventsMatchesDecodeEvent)
+{
+    namespace ec = event_constants;
+
+    for (u16 bufferType: { McpdDataBufferType, MdllDataBufferType })
+    {
+        DataPacket packet = {};
+        packet.bufferType = bufferType;
+        packet.headerLength = 21;
+        packet.bufferLength = packet.headerLength;
+        packet.deviceId = 3;
+        packet.time[0] = 0x1234;
+        packet.time[1] = 0x0001;
+
+        append_event(packet, (u64(5) << ec::neutron::MpsdIdShift) | (u64(17) << ec::neutron::ChannelShift)
+                     | (u64(1000) << ec::neutron::AmplitudeShift) | (u64(513) << ec::neutron::PositionShift) | 42u);
+        append_event(packet, (u64(1) << ec::IdShift) | (u64(3) << ec::trigger::TriggerIdShift)
+                     | (u64(9) << ec::trigger::DataIdShift) | (u64(0x1abcde) << ec::trigger::DataShift) | 7u);
+
+        EventBatch batch;
+        ASSERT_EQ(decode_events(packet, batch), 2u);
+        ASSERT_EQ(decode_events(packet, batch), 2u);
+        ASSERT_EQ(batch.size(), 4u);
+
+        for (size_t i = 0; i < batch.size(); ++i)
+        {
+            auto expected = decode_event(packet, i % 2);
+            auto event = batch.event(i);
+
+            ASSERT_EQ(event.type, expected.type);
+            ASSERT_EQ(event.deviceId, expected.deviceId);
+            ASSERT_EQ(event.timestamp, expected.timestamp);
+
+            switch (event.type)
+            {
+                case EventType::Neutron:
+                    ASSERT_EQ(event.neutron.mpsdId, expected.neutron.mpsdId);
+                    ASSERT_EQ(event.neutron.channel, expected.neutron.channel);
+                    ASSERT_EQ(event.neutron.amplitude, expected.neutron.amplitude);
+                    ASSERT_EQ(event.neutron.position, expected.neutron.position);
+                    break;
+                case EventType::Trigger:
+                    ASSERT_EQ(event.trigger.triggerId, expected.trigger.triggerId);
+                    ASSERT_EQ(event.trigger.dataId, expected.trigger.dataId);
+                    ASSERT_EQ(event.trigger.value, expected.trigger.value);
+                    break;
+                case EventType::MdllNeutron:
+                    ASSERT_EQ(event.mdllNeutron.amplitude, expected.mdllNeutron.amplitude);
+                    ASSERT_EQ(event.mdllNeutron.xPos, expected.mdllNeutron.xPos);
+                    ASSERT_EQ(event.mdllNeutron.yPos, expected.mdllNeutron.yPos);
+                    break;
+            }
+        }
+    }
+}
+
+TEST(EventBatch, InvalidDataLength)
+{
+    DataPacket packet = {};
+    packet.headerLength = 21;
+    packet.bufferLength = 10; // shorter than the header
+
+    EventBatch batch;
+    ASSERT_EQ(decode_events(packet, batch), 0u);
+    ASSERT_TRUE(batch.empty());
+}
@@ -0,0 +1,427 @@
+#include "mcpd_event_codec.h"
+
+#include <algorithm>
+#include <cstring>
+
+namespace mesytec::mcpd
+{
+
+namespace
+{
+    namespace ec = event_constants;
+    using event_codec::DataPacketHeaderSize;
+
+    enum Format: u8
+    {
+        Verbatim = 0,
+        Packed = 1,
+    };
+
+    static const size_t MaxEvents = DataPacketMaxDataWords / 3;
+    static const unsigned WidthBits = 5u; // bits used to store a field width (0..31)
+
+    struct FieldDef
+    {
+        unsigned shift;
+        unsigned bits;
+    };
+
+    struct GroupDef
+    {
+        size_t fieldCount;
+        FieldDef fields[4];
+    };
+
+    // The bits of the event words below the type bit and above the timestamp.
+    const GroupDef NeutronGroup =
+    {
+        4,
+        {
+            { ec::neutron::MpsdIdShift, ec::neutron::MpsdIdBits },
+            { ec::neutron::ChannelShift, ec::neutron::ChannelBits },
+            { ec::neutron::AmplitudeShift, ec::neutron::AmplitudeBits },
+            { ec::neutron::PositionShift, ec::neutron::PositionBits },
+        }
+    };
+
+    const GroupDef MdllNeutronGroup =
+    {
+        3,
+        {
+            { ec::mdll_neutron::AmplitudeShift, ec::mdll_neutron::AmplitudeBits },
+            { ec::mdll_neutron::xPosShift, ec::mdll_neutron::xPosBits },
+            { ec::mdll_neutron::yPosShift, ec::mdll_neutron::yPosBits },
+        }
+    };
+
+    const GroupDef TriggerGroup =
+    {
+        3,
+        {
+            { ec::trigger::TriggerIdShift, ec::trigger::TriggerIdBits },
+            { ec::trigger::DataIdShift, ec::trigger::DataIdBits },
+            { ec::trigger::DataShift, ec::trigger::DataBits },
+        }
+    };
+
+    inline unsigned bit_width(u32 v)
+    {
+        unsigned result = 0u;
+
+        while (v)
+        {
+            ++result;
+            v >>= 1;
+        }
+
+        return result;
+    }
+
+    inline u32 event_timestamp(const DataPacket &packet, size_t eventIndex)
+    {
+        return (packet.data[eventIndex * 3] | (packet.data[eventIndex * 3 + 1] << 16)) & ec::TimestampMask;
+    }
+
+    // Little endian bit stream writer. Values are at most 32 bits wide.
+    class BitWriter
+    {
+      public:
+        explicit BitWriter(u8 *out): out_(out), begin_(out) {}
+
+        void put(u32 value, unsigned width)
+        {
+            acc_ |= static_cast<u64>(value) << bits_;
+            bits_ += width;
+
+            while (bits_ >= 8)
+            {
+                *out_++ = acc_ & 0xffu;
+                acc_ >>= 8;
+                bits_ -= 8;
+            }
+        }
+
+        // Pads to a full byte. Returns the total number of bytes written.
+        size_t finish()
+        {
+            if (bits_)
+                *out_++ = acc_ & 0xffu;
+
+            acc_ = 0u;
+            bits_ = 0u;
+
+            return out_ - begin_;
+        }
+
+      private:
+        u8 *out_;
+        u8 *begin_;
+        u64 acc_ = 0u;
+        unsigned bits_ = 0u;
+    };
+
+    class BitReader
+    {
+      public:
+        BitReader(const u8 *data, size_t size): in_(data), end_(data + size) {}
+
+        bool get(unsigned width, u32 &value)
+        {
+            while (bits_ < width)
+            {
+                if (in_ == end_)
+                    return false;
+
+                acc_ |= static_cast<u64>(*in_++) << bits_;
+                bits_ += 8;
+            }
+
+            value = acc_ & ((u64(1) << width) - 1);
+            acc_ >>= width;
+            bits_ -= width;
+
+            return true;
+        }
+
+      private:
+        const u8 *in_;
+        const u8 *end_;
+        u64 acc_ = 0u;
+        unsigned bits_ = 0u;
+    };
+
+    bool is_packable(const DataPacket &packet)
+    {
+        return packet.headerLength * sizeof(u16) == DataPacketHeaderSize
+            && packet.bufferLength >= packet.headerLength
+            && get_data_length(packet) <= static_cast<int>(DataPacketMaxDataWords);
+    }
+
+    const GroupDef &neutron_group(const DataPacket &packet)
+    {
+        return packet.bufferType == MdllDataBufferType ? MdllNeutronGroup : NeutronGroup;
+    }
+
+    // Writes the fields of the events of one group using frame of reference
+    // packing.
+    void encode_group(BitWriter &writer, const GroupDef &group, const u64 *events, size_t count)
+    {
+        if (!count)
+            return;
+
+        for (size_t fi = 0; fi < group.fieldCount; ++fi)
+        {
+            const auto &field = group.fields[fi];
+            const u32 mask = (u32(1) << field.bits) - 1;
+            u32 min = mask;
+            u32 max = 0u;
+
+            for (size_t i = 0; i < count; ++i)
+            {
+                const u32 v = (events[i] >> field.shift) & mask;
+                min = std::min(min, v);
+                max = std::max(max, v);
+            }
+
+            const unsigned width = bit_width(max - min);
+            writer.put(min, field.bits);
+            writer.put(width, WidthBits);
+
+            if (width)
+            {
+                for (size_t i = 0; i < count; ++i)
+                    writer.put(((events[i] >> field.shift) & mask) - min, width);
+            }
+        }
+    }
+
+    bool decode_group(BitReader &reader, const GroupDef &group, u64 *events, size_t count)
+    {
+        if (!count)
+            return true;
+
+        for (size_t fi = 0; fi < group.fieldCount; ++fi)
+        {
+            const auto &field = group.fields[fi];
+            u32 min = 0u;
+            u32 width = 0u;
+
+            if (!reader.get(field.bits, min) || !reader.get(WidthBits, width) || width > field.bits)
+                return false;
+
+            for (size_t i = 0; i < count; ++i)
+            {
+                u32 v = 0u;
+
+                if (width && !reader.get(width, v))
+                    return false;
+
+                events[i] |= static_cast<u64>((min + v) & ((u32(1) << field.bits) - 1)) << field.shift;
+            }
+        }
+
+        return true;
+    }
+}
+
+size_t encode_packet(const DataPacket &packet, std::vector<u8> &dest)
+{
+    const size_t offset = dest.size();
+    dest.resize(offset + event_codec::MaxEncodedSize);
+    u8 *out = dest.data() + offset;
+
+    auto encode_verbatim = [&]
+    {
+        const u16 size = get_packet_size(packet);
+        out[0] = Verbatim;
+        out[1] = size & 0xffu;
+        out[2] = size >> 8;
+        std::memcpy(out + 3, &packet, size);
+        dest.resize(offset + 3 + size);
+        return 3u + size;
+    };
+
+    if (!is_packable(packet))
+        return encode_verbatim();
+
+    out[0] = Packed;
+    std::memcpy(out + 1, &packet, DataPacketHeaderSize);
+
+    const size_t dataLength = get_data_length(packet);
+    const size_t eventCount = dataLength / 3;
+
+    // Split the events by type keeping their order within each group.
+    u64 neutrons[MaxEvents];
+    u64 triggers[MaxEvents];
+    size_t neutronCount = 0u;
+    size_t triggerCount = 0u;
+
+    BitWriter writer(out + 1 + DataPacketHeaderSize);
+
+    for (size_t i = 0; i < eventCount; ++i)
+    {
+        const u64 event = to_48bit_value(packet.data[i * 3], packet.data[i * 3 + 1], packet.data[i * 3 + 2]);
+        const u32 type = (event >> ec::IdShift) & ec::IdMask;
+
+        writer.put(type, 1);
+
+        if (type)
+            triggers[triggerCount++] = event;
+        else
+            neutrons[neutronCount++] = event;
+    }
+
+    // Timestamps in event order: the first one verbatim followed by the
+    // differences modulo 2^TimestampBits. These are small for the time ordered
+    // events of a single packet.
+    u32 deltas[MaxEvents];
+    u32 maxDelta = 0u;
+
+    for (size_t i = 0; i < eventCount; ++i)
+    {
+        const u32 ts = event_timestamp(packet, i);
+        const u32 prev = i ? event_timestamp(packet, i - 1) : 0u;
+        deltas[i] = (ts - prev) & ec::TimestampMask;
+
+        if (i)
+            maxDelta |= deltas[i];
+    }
+
+    if (eventCount)
+        writer.put(deltas[0], ec::TimestampBits);
+
+    const unsigned tsWidth = bit_width(maxDelta);
+    writer.put(tsWidth, WidthBits);
+
+    if (tsWidth)
+    {
+        for (size_t i = 1; i < eventCount; ++i)
+            writer.put(deltas[i], tsWidth);
+    }
+
+    encode_group(writer, neutron_group(packet), neutrons, neutronCount);
+    encode_group(writer, TriggerGroup, triggers, triggerCount);
+
+    // Trailing data words not forming a complete event.
+    for (size_t i = eventCount * 3; i < dataLength; ++i)
+        writer.put(packet.data[i], 16);
+
+    const size_t size = 1 + DataPacketHeaderSize + writer.finish();
+
+    // Random event data does not pack.
+    if (size > 3 + get_packet_size(packet))
+        return encode_verbatim();
+
+    dest.resize(offset + size);
+    return size;
+}
+
+bool decode_packet(const u8 *data, size_t size, DataPacket &dest)
+{
+    if (size < 1)
+        return false;
+
+    if (data[0] == Verbatim)
+    {
+        if (size < 3)
+            return false;
+
+        const size_t packetSize = data[1] | (data[2] << 8);
+
+        if (packetSize < sizeof(PacketBase) || packetSize > sizeof(DataPacket)
+            || size != 3 + packetSize)
+            return false;
+
+        auto bytes = reinterpret_cast<u8 *>(&dest);
+        std::memcpy(bytes, data + 3, packetSize);
+        std::memset(bytes + packetSize, 0, sizeof(DataPacket) - packetSize);
+
+        return get_packet_size(dest) <= packetSize;
+    }
+
+    if (data[0] != Packed || size < 1 + DataPacketHeaderSize)
+        return false;
+
+    std::memcpy(&dest, data + 1, DataPacketHeaderSize);
+
+    if (!is_packable(dest))
+        return false;
+
+    const size_t dataLength = get_data_length(dest);
+    const size_t eventCount = dataLength / 3;
+
+    BitReader reader(data + 1 + DataPacketHeaderSize, size - 1 - DataPacketHeaderSize);
+
+    u64 events[MaxEvents];
+    bool isTrigger[MaxEvents];
+    size_t triggerCount = 0u;
+
+    for (size_t i = 0; i < eventCount; ++i)
+    {
+        u32 type = 0u;
+
+        if (!reader.get(1, type))
+            return false;
+
+        isTrigger[i] = type;
+        triggerCount += type;
+        events[i] = static_cast<u64>(type) << ec::IdShift;
+    }
+
+    u32 timestamp = 0u;
+
+    if (eventCount && !reader.get(ec::TimestampBits, timestamp))
+        return false;
+
+    u32 tsWidth = 0u;
+
+    if (!reader.get(WidthBits, tsWidth) || tsWidth > ec::TimestampBits)
+        return false;
+
+    for (size_t i = 0; i < eventCount; ++i)
+    {
+        u32 delta = 0u;
+
+        if (i && tsWidth && !reader.get(tsWidth, delta))
+            return false;
+
+        timestamp = (timestamp + delta) & ec::TimestampMask;
+        events[i] |= timestamp;
+    }
+
+    // Decode the groups into separate arrays, then merge them back in event order.
+    const size_t neutronCount = eventCount - triggerCount;
+    u64 neutrons[MaxEvents] = {};
+    u64 triggers[MaxEvents] = {};
+
+    if (!decode_group(reader, neutron_group(dest), neutrons, neutronCount)
+        || !decode_group(reader, TriggerGroup, triggers, triggerCount))
+        return false;
+
+    size_t ni = 0u;
+    size_t ti = 0u;
+
+    for (size_t i = 0; i < eventCount; ++i)
+    {
+        const u64 event = events[i] | (isTrigger[i] ? triggers[ti++] : neutrons[ni++]);
+        dest.data[i * 3 + 0] = event & 0xffffu;
+        dest.data[i * 3 + 1] = (event >> 16) & 0xffffu;
+        dest.data[i * 3 + 2] = (event >> 32) & 0xffffu;
+    }
+
+    for (size_t i = eventCount * 3; i < dataLength; ++i)
+    {
+        u32 word = 0u;
+
+        if (!reader.get(16, word))
+            return false;
+
+        dest.data[i] = word;
+    }
+
+    std::fill(dest.data + dataLength, dest.data + DataPacketMaxDataWords, 0u);
+
+    return true;
+}
+
+}
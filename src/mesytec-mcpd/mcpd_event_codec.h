@@ -0,0 +1,45 @@
+#ifndef __MESYTEC_MCPD_EVENT_CODEC_H__
+#define __MESYTEC_MCPD_EVENT_CODEC_H__
+
+#include <vector>
+
+#include "mcpd_core.h"
+
+namespace mesytec::mcpd
+{
+
+// Lossless compact encoding of MCPD/MDLL data packets.
+//
+// The packet header is stored verbatim. The events are transposed into one
+// bit stream per field: the event type bits, the timestamps as differences to
+// the previous event (modulo 2^19) and the remaining fields of each event type
+// (see event_constants) using frame of reference packing: the minimum value of
+// the field within the packet followed by (value - min) using just enough bits
+// to hold the largest difference. Fields which are constant within a packet,
+// e.g. the mpsdId with a single MPSD, take no space at all.
+//
+// Packets which do not look like data packets (unexpected headerLength or
+// bufferLength) are stored verbatim so that encoding never fails.
+//
+// Decoding restores the first get_packet_size(packet) bytes of the packet bit
+// for bit.
+namespace event_codec
+{
+    // Size of the DataPacket header in bytes, i.e. the offset of the data words.
+    static const size_t DataPacketHeaderSize = sizeof(DataPacket) - sizeof(DataPacket::data);
+
+    // Space needed by encode_packet() for a single packet. The encoded size
+    // itself never exceeds get_packet_size(packet) + 3.
+    static const size_t MaxEncodedSize = sizeof(DataPacket) + 64u;
+}
+
+// Appends the encoded packet to dest. Returns the number of bytes appended.
+MESYTEC_MCPD_EXPORT size_t encode_packet(const DataPacket &packet, std::vector<u8> &dest);
+
+// Decodes a packet produced by encode_packet(). Returns false if the input is
+// truncated or malformed.
+MESYTEC_MCPD_EXPORT bool decode_packet(const u8 *data, size_t size, DataPacket &dest);
+
+}
+
+#endif /* __MESYTEC_MCPD_EVENT_CODEC_H__ */
@@ -0,0 +1,163 @@
+#include <gtest/gtest.h>
+
+#include <cstring>
+#include <random>
+
+#include "mcpd_event_codec.h"
+
+using namespace mesytec::mcpd;
+
+namespace
+{
+
+namespace ec = event_constants;
+
+DataPacket make_packet(u16 bufferType, size_t dataWords)
+{
+    DataPacket packet = {};
+    packet.bufferType = bufferType;
+    packet.headerLength = 21;
+    packet.bufferLength = packet.headerLength + dataWords;
+    packet.bufferNumber = 1234;
+    packet.runId = 42;
+    packet.deviceId = 3;
+    packet.time[0] = 0x1111;
+    packet.time[1] = 0x2222;
+    packet.time[2] = 0x0003;
+    packet.param[1][0] = 0xbeef;
+    return packet;
+}
+
+void set_event(DataPacket &packet, size_t index, u64 event)
+{
+    packet.data[index * 3 + 0] = event & 0xffffu;
+    packet.data[index * 3 + 1] = (event >> 16) & 0xffffu;
+    packet.data[index * 3 + 2] = (event >> 32) & 0xffffu;
+}
+
+void expect_roundtrip(const DataPacket &packet)
+{
+    std::vector<u8> encoded;
+    const size_t size = encode_packet(packet, encoded);
+    ASSERT_EQ(size, encoded.size());
+    ASSERT_LE(size, get_packet_size(packet) + 3);
+
+    DataPacket decoded;
+    std::memset(&decoded, 0xff, sizeof(decoded));
+    ASSERT_TRUE(decode_packet(encoded.data(), encoded.size(), decoded));
+    ASSERT_EQ(std::memcmp(&packet, &decoded, get_packet_size(packet)), 0);
+
+    // Nothing from a previous packet is left past the end of the decoded one.
+    auto bytes = reinterpret_cast<const u8 *>(&decoded);
+    for (size_t i = get_packet_size(packet); i < sizeof(decoded); ++i)
+        ASSERT_EQ(bytes[i], 0u) << i;
+}
+
+} // namespace
+
+TEST(EventCodec, RoundtripRandomEvents)
+{
+    std::mt19937_64 rng(1);
+
+    for (u16 bufferType: { McpdDataBufferType, MdllDataBufferType })
+    {
+        for (size_t dataWords: { 0, 1, 2, 3, 4, 30, 31, 32, 714, 715 })
+        {
+            auto packet = make_packet(bufferType, dataWords);
+
+            for (size_t i = 0; i < dataWords; ++i)
+                packet.data[i] = rng();
+
+            expect_roundtrip(packet);
+        }
+    }
+}
+
+TEST(EventCodec, RoundtripTypicalPacket)
+{
+    std::mt19937 rng(2);
+    const size_t EventCount = DataPacketMaxDataWords / 3;
+    auto packet = make_packet(McpdDataBufferType, EventCount * 3);
+    u64 timestamp = 1000;
+
+    for (size_t i = 0; i < EventCount; ++i)
+    {
+        u64 event = 0;
+
+        if (i % 50 == 49)
+        {
+            event = (u64(1) << ec::IdShift) | (u64(1) << ec::trigger::TriggerIdShift)
+                | (u64(rng() & 0xffff) << ec::trigger::DataShift);
+        }
+        else
+        {
+            event = (u64(rng() % 2) << ec::neutron::MpsdIdShift) | (u64(rng() % 8) << ec::neutron::ChannelShift)
+                | (u64(rng() % 1024) << ec::neutron::AmplitudeShift) | (u64(rng() % 1024) << ec::neutron::PositionShift);
+        }
+
+        timestamp += rng() % 64;
+        set_event(packet, i, event | (timestamp & ec::TimestampMask));
+    }
+
+    expect_roundtrip(packet);
+
+    std::vector<u8> encoded;
+    encode_packet(packet, encoded);
+
+    // 1+6+1+3+10+10 bits vs 48 bits per event.
+    EXPECT_LT(encoded.size(), get_packet_size(packet) * 3 / 4);
+}
+
+TEST(EventCodec, VerbatimFallback)
+{
+    auto packet = make_packet(McpdDataBufferType, 6);
+    packet.headerLength = 10; // unusual header
+    packet.data[0] = 0xabcd;
+    expect_roundtrip(packet);
+
+    packet = make_packet(McpdDataBufferType, 6);
+    packet.bufferLength = 5; // shorter than the header
+    expect_roundtrip(packet);
+}
+
+TEST(EventCodec, MalformedInput)
+{
+    auto packet = make_packet(MdllDataBufferType, 300);
+    set_event(packet, 7, 0x123456789abc);
+
+    std::vector<u8> encoded;
+    encode_packet(packet, encoded);
+
+    DataPacket decoded;
+
+    for (size_t size = 0; size < encoded.size(); ++size)
+        ASSERT_FALSE(decode_packet(encoded.data(), size, decoded)) << size;
+
+    encoded[0] = 0x7f; // unknown format
+    ASSERT_FALSE(decode_packet(encoded.data(), encoded.size(), decoded));
+}
+
+TEST(EventCodec, TruncatedVerbatimPacket)
+{
+    auto packet = make_packet(McpdDataBufferType, 30);
+    packet.headerLength = 10; // forces the verbatim encoding
+
+    std::vector<u8> encoded;
+    encode_packet(packet, encoded);
+    DataPacket decoded;
+    ASSERT_TRUE(decode_packet(encoded.data(), encoded.size(), decoded));
+
+    // Shorter than announced by its bufferLength.
+    const u16 truncatedSize = 40;
+    encoded.resize(3 + truncatedSize);
+    encoded[1] = truncatedSize & 0xffu;
+    encoded[2] = truncatedSize >> 8;
+    ASSERT_FALSE(decode_packet(encoded.data(), encoded.size(), decoded));
+
+    // Shorter than the packet header.
+    const u16 tinySize = sizeof(PacketBase) - 1;
+    encoded.resize(3 + tinySize);
+    encoded[1] = tinySize;
+    encoded[2] = 0;
+    ASSERT_FALSE(decode_packet(encoded.data(), encoded.size(), decoded));
+}
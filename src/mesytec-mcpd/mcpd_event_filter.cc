@@ -0,0 +1,678 @@
+#include "mcpd_event_filter.h"
+
+#include <algorithm>
+#include <cassert>
+#include <cctype>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <limits>
+#include <stdexcept>
+#include <spdlog/spdlog.h>
+
+namespace mesytec::mcpd
+{
+
+namespace
+{
+    using Field = EventFilter::Field;
+
+    constexpr u8 type_bit(EventType t) { return 1u << static_cast<unsigned>(t); }
+
+    constexpr u8 AllTypes = type_bit(EventType::Neutron) | type_bit(EventType::Trigger)
+        | type_bit(EventType::MdllNeutron);
+
+    constexpr u64 U64Max = std::numeric_limits<u64>::max();
+
+    struct FieldInfo
+    {
+        const char *name;
+        Field field;
+        u8 typeMask;    // event types the field applies to
+    };
+
+    // Indexed by Field.
+    const FieldInfo FieldInfos[] =
+    {
+        { "type",       Field::Type,        AllTypes },
+        { "device",     Field::DeviceId,    AllTypes },
+        { "timestamp",  Field::Timestamp,   AllTypes },
+        { "mpsd",       Field::MpsdId,      type_bit(EventType::Neutron) },
+        { "channel",    Field::Channel,     type_bit(EventType::Neutron) },
+        { "position",   Field::Position,    type_bit(EventType::Neutron) },
+        { "amplitude",  Field::Amplitude,   type_bit(EventType::Neutron) | type_bit(EventType::MdllNeutron) },
+        { "x",          Field::XPosition,   type_bit(EventType::MdllNeutron) },
+        { "y",          Field::YPosition,   type_bit(EventType::MdllNeutron) },
+        { "trigger",    Field::TriggerId,   type_bit(EventType::Trigger) },
+        { "data",       Field::DataId,      type_bit(EventType::Trigger) },
+        { "value",      Field::Value,       type_bit(EventType::Trigger) },
+    };
+
+    const FieldInfo &field_info(Field field)
+    {
+        return FieldInfos[static_cast<size_t>(field)];
+    }
+
+    const std::pair<const char *, EventType> EventTypeNames[] =
+    {
+        { "neutron", EventType::Neutron },
+        { "trigger", EventType::Trigger },
+        { "mdll", EventType::MdllNeutron },
+    };
+
+    // out[i] = typeApplies(type[i]) & (inRange(column[i]) ^ invert)
+    //
+    // No branches in the loops so that gcc and clang vectorize them.
+    template<typename T>
+    void eval_range(const T *column, const EventType *types, size_t size, u8 typeMask,
+                    u64 min, u64 max, bool invert, u8 *out)
+    {
+        constexpr u64 TMax = std::numeric_limits<T>::max();
+        T lo = static_cast<T>(min);
+        T hi = static_cast<T>(std::min(max, TMax));
+
+        if (min > max || min > TMax)
+        {
+            // Empty range.
+            lo = std::numeric_limits<T>::max();
+            hi = 0;
+        }
+
+        const u8 inv = invert;
+
+        if (typeMask == AllTypes)
+        {
+            for (size_t i = 0; i < size; ++i)
+                out[i] = ((column[i] >= lo) & (column[i] <= hi)) ^ inv;
+        }
+        else
+        {
+            for (size_t i = 0; i < size; ++i)
+            {
+                out[i] = (((column[i] >= lo) & (column[i] <= hi)) ^ inv)
+                    & ((typeMask >> static_cast<unsigned>(types[i])) & 1u);
+            }
+        }
+    }
+
+    void eval_type_range(const EventType *types, size_t size, u64 min, u64 max, bool invert, u8 *out)
+    {
+        const u8 inv = invert;
+
+        for (size_t i = 0; i < size; ++i)
+        {
+            const auto t = static_cast<u64>(types[i]);
+            out[i] = ((t >= min) & (t <= max)) ^ inv;
+        }
+    }
+
+    template<typename T>
+    void append_selected(const std::vector<T> &src, const std::vector<u8> &mask, std::vector<T> &dest)
+    {
+        for (size_t i = 0; i < src.size(); ++i)
+        {
+            if (mask[i])
+                dest.push_back(src[i]);
+        }
+    }
+
+    //
+    // Expression parser. Emits the postfix program via recursive descent.
+    //
+
+    struct Token
+    {
+        enum Kind { End, Identifier, Number, Operator };
+
+        Kind kind = End;
+        std::string text;
+        u64 value = 0u;
+        size_t pos = 0u;
+    };
+
+    template<typename Instruction>
+    class Parser
+    {
+      public:
+        Parser(const std::string &input, std::vector<Instruction> &program)
+            : input_(input)
+            , program_(program)
+        {
+        }
+
+        void parse()
+        {
+            next();
+            parseExpr();
+
+            if (token_.kind != Token::End)
+                error("unexpected '" + token_.text + "'");
+        }
+
+      private:
+        [[noreturn]] void error(const std::string &msg) const
+        {
+            throw std::invalid_argument(
+                fmt::format("event filter: {} at position {} in '{}'", msg, token_.pos, input_));
+        }
+
+        bool accept(const char *text)
+        {
+            if ((token_.kind == Token::Operator || token_.kind == Token::Identifier)
+                && token_.text == text)
+            {
+                next();
+                return true;
+            }
+
+            return false;
+        }
+
+        void expect(const char *text)
+        {
+            if (!accept(text))
+                error(fmt::format("expected '{}'", text));
+        }
+
+        void emit(typename Instruction::Op op, Field field = {}, u64 min = 0, u64 max = 0)
+        {
+            program_.push_back({ op, field, min, max });
+        }
+
+        void next()
+        {
+            while (pos_ < input_.size() && std::isspace(static_cast<unsigned char>(input_[pos_])))
+                ++pos_;
+
+            token_ = {};
+            token_.pos = pos_;
+
+            if (pos_ >= input_.size())
+                return;
+
+            const char c = input_[pos_];
+
+            if (std::isalpha(static_cast<unsigned char>(c)) || c == '_')
+            {
+                size_t end = pos_;
+
+                while (end < input_.size()
+                       && (std::isalnum(static_cast<unsigned char>(input_[end])) || input_[end] == '_'))
+                    ++end;
+
+                token_.kind = Token::Identifier;
+                token_.text = input_.substr(pos_, end - pos_);
+                pos_ = end;
+                return;
+            }
+
+            if (std::isdigit(static_cast<unsigned char>(c)))
+            {
+                const char *begin = input_.c_str() + pos_;
+                char *end = nullptr;
+                const bool hex = input_.compare(pos_, 2, "0x") == 0 || input_.compare(pos_, 2, "0X") == 0;
+                errno = 0;
+                token_.value = std::strtoull(begin, &end, hex ? 16 : 10);
+                token_.kind = Token::Number;
+                token_.text = std::string(begin, const_cast<const char *>(end));
+                pos_ += end - begin;
+
+                if (errno)
+                    error("number out of range");
+
+                return;
+            }
+
+            static const char *Operators[] = { "==", "!=", "<=", ">=", "&&", "||", "..",
+                                               "<", ">", "=", "!", "(", ")", "," };
+
+            for (const char *op: Operators)
+            {
+                if (input_.compare(pos_, std::strlen(op), op) == 0)
+                {
+                    token_.kind = Token::Operator;
+                    token_.text = op;
+                    pos_ += token_.text.size();
+                    return;
+                }
+            }
+
+            token_.text = std::string(1, c);
+            error("unexpected character '" + token_.text + "'");
+        }
+
+        void parseExpr()
+        {
+            parseTerm();
+
+            while (accept("or") || accept("||"))
+            {
+                parseTerm();
+                emit(Instruction::Or);
+            }
+        }
+
+        void parseTerm()
+        {
+            parseFactor();
+
+            while (accept("and") || accept("&&"))
+            {
+                parseFactor();
+                emit(Instruction::And);
+            }
+        }
+
+        void parseFactor()
+        {
+            if (accept("not") || accept("!"))
+            {
+                parseFactor();
+                emit(Instruction::Not);
+            }
+            else if (accept("("))
+            {
+                parseExpr();
+                expect(")");
+            }
+            else
+                parseComparison();
+        }
+
+        u64 parseValue(Field field)
+        {
+            if (field == Field::Type && token_.kind == Token::Identifier)
+            {
+                for (const auto &[name, type]: EventTypeNames)
+                {
+                    if (accept(name))
+                        return static_cast<u64>(type);
+                }
+
+                error("unknown event type '" + token_.text + "'");
+            }
+
+            if (token_.kind != Token::Number)
+                error("expected a number");
+
+            const u64 value = token_.value;
+            next();
+            return value;
+        }
+
+        void parseComparison()
+        {
+            if (token_.kind != Token::Identifier)
+                error("expected a field name");
+
+            auto it = std::find_if(std::begin(FieldInfos), std::end(FieldInfos),
+                                   [this] (const FieldInfo &fi) { return token_.text == fi.name; });
+
+            if (it == std::end(FieldInfos))
+                error("unknown field '" + token_.text + "'");
+
+            const Field field = it->field;
+            next();
+
+            if (accept("in"))
+            {
+                size_t items = 0;
+
+                do
+                {
+                    const u64 min = parseValue(field);
+                    const u64 max = accept("..") ? parseValue(field) : min;
+                    emit(Instruction::Range, field, min, max);
+
+                    if (items++)
+                        emit(Instruction::Or);
+                } while (accept(","));
+            }
+            else if (accept("==") || accept("="))
+            {
+                const u64 v = parseValue(field);
+                emit(Instruction::Range, field, v, v);
+            }
+            else if (accept("!="))
+            {
+                const u64 v = parseValue(field);
+                emit(Instruction::Outside, field, v, v);
+            }
+            else if (accept("<="))
+                emit(Instruction::Range, field, 0, parseValue(field));
+            else if (accept(">="))
+                emit(Instruction::Range, field, parseValue(field), U64Max);
+            else if (accept("<"))
+            {
+                // "< 0" results in an empty range.
+                const u64 v = parseValue(field);
+                emit(Instruction::Range, field, v ? 0 : 1, v ? v - 1 : 0);
+            }
+            else if (accept(">"))
+            {
+                const u64 v = parseValue(field);
+                emit(Instruction::Range, field, v == U64Max ? 1 : v + 1, v == U64Max ? 0 : U64Max);
+            }
+            else
+                error("expected a comparison operator");
+        }
+
+        const std::string &input_;
+        std::vector<Instruction> &program_;
+        size_t pos_ = 0u;
+        Token token_;
+    };
+
+    std::string value_to_string(Field field, u64 value)
+    {
+        if (field == Field::Type)
+        {
+            for (const auto &[name, type]: EventTypeNames)
+            {
+                if (value == static_cast<u64>(type))
+                    return name;
+            }
+        }
+
+        return std::to_string(value);
+    }
+}
+
+const char *to_string(EventFilter::Field field)
+{
+    return field_info(field).name;
+}
+
+EventFilter::EventFilter() = default;
+
+EventFilter::EventFilter(const std::string &expression)
+{
+    Parser<Instruction>(expression, program_).parse();
+}
+
+EventFilter EventFilter::range(Field field, u64 min, u64 max)
+{
+    EventFilter result;
+    result.program_.push_back({ Instruction::Range, field, min, max });
+    return result;
+}
+
+EventFilter EventFilter::type(EventType type)
+{
+    return equals(Field::Type, static_cast<u64>(type));
+}
+
+EventFilter EventFilter::operator&&(const EventFilter &other) const
+{
+    if (matchesAll())
+        return other;
+
+    if (other.matchesAll())
+        return *this;
+
+    EventFilter result(*this);
+    result.program_.insert(result.program_.end(), other.program_.begin(), other.program_.end());
+    result.program_.push_back({ Instruction::And, {}, 0, 0 });
+    result.counters_ = {};
+    return result;
+}
+
+EventFilter EventFilter::operator||(const EventFilter &other) const
+{
+    if (matchesAll() || other.matchesAll())
+        return {};
+
+    EventFilter result(*this);
+    result.program_.insert(result.program_.end(), other.program_.begin(), other.program_.end());
+    result.program_.push_back({ Instruction::Or, {}, 0, 0 });
+    result.counters_ = {};
+    return result;
+}
+
+EventFilter EventFilter::operator!() const
+{
+    // Matches nothing: an empty range on a field that applies to all events.
+    if (matchesAll())
+        return range(Field::Type, 1, 0);
+
+    EventFilter result(*this);
+    result.program_.push_back({ Instruction::Not, {}, 0, 0 });
+    result.counters_ = {};
+    return result;
+}
+
+std::string EventFilter::toString() const
+{
+    if (matchesAll())
+        return "true";
+
+    // Operator precedence of each partial expression: 0 or, 1 and, 2 atom.
+    std::vector<std::pair<std::string, int>> stack;
+
+    auto paren = [] (const std::pair<std::string, int> &e, int prec)
+    {
+        return e.second < prec ? "(" + e.first + ")" : e.first;
+    };
+
+    for (const auto &instr: program_)
+    {
+        switch (instr.op)
+        {
+            case Instruction::Range:
+            case Instruction::Outside:
+                {
+                    const char *name = to_string(instr.field);
+                    const auto min = value_to_string(instr.field, instr.min);
+                    const auto max = value_to_string(instr.field, instr.max);
+                    std::string str;
+
+                    if (instr.op == Instruction::Outside)
+                    {
+                        if (instr.min == instr.max)
+                            str = fmt::format("{} != {}", name, min);
+                        else
+                        {
+                            stack.emplace_back(
+                                fmt::format("{} < {} or {} > {}", name, min, name, max), 0);
+                            break;
+                        }
+                    }
+                    else if (instr.min == instr.max)
+                        str = fmt::format("{} == {}", name, min);
+                    else if (instr.min > instr.max)
+                        str = fmt::format("{} < 0", name);
+                    else if (instr.min == 0)
+                        str = fmt::format("{} <= {}", name, max);
+                    else if (instr.max == U64Max)
+                        str = fmt::format("{} >= {}", name, min);
+                    else
+                        str = fmt::format("{} in {}..{}", name, min, max);
+
+                    stack.emplace_back(str, 2);
+                } break;
+
+            case Instruction::And:
+            case Instruction::Or:
+                {
+                    assert(stack.size() >= 2);
+                    auto rhs = stack.back(); stack.pop_back();
+                    auto lhs = stack.back(); stack.pop_back();
+
+                    if (instr.op == Instruction::And)
+                        stack.emplace_back(paren(lhs, 1) + " and " + paren(rhs, 1), 1);
+                    else
+                        stack.emplace_back(lhs.first + " or " + rhs.first, 0);
+                } break;
+
+            case Instruction::Not:
+                assert(!stack.empty());
+                stack.back() = { "not " + paren(stack.back(), 2), 2 };
+                break;
+        }
+    }
+
+    assert(stack.size() == 1);
+    return stack.back().first;
+}
+
+void EventFilter::evaluate(const EventBatch &batch, std::vector<u8> &mask)
+{
+    const size_t size = batch.size();
+
+    if (matchesAll())
+    {
+        mask.assign(size, 1u);
+        return;
+    }
+
+    size_t sp = 0u;
+
+    for (const auto &instr: program_)
+    {
+        switch (instr.op)
+        {
+            case Instruction::Range:
+            case Instruction::Outside:
+                {
+                    if (stack_.size() <= sp)
+                        stack_.emplace_back();
+
+                    auto &out = stack_[sp++];
+                    out.resize(size);
+
+                    const bool invert = instr.op == Instruction::Outside;
+                    const u8 typeMask = field_info(instr.field).typeMask;
+                    const EventType *types = batch.type.data();
+
+                    auto eval = [&] (const auto &column)
+                    {
+                        eval_range(column.data(), types, size, typeMask, instr.min, instr.max,
+                                   invert, out.data());
+                    };
+
+                    switch (instr.field)
+                    {
+                        case Field::Type:
+                            eval_type_range(types, size, instr.min, instr.max, invert, out.data());
+                            break;
+
+                        case Field::DeviceId:   eval(batch.deviceId); break;
+                        case Field::Timestamp:  eval(batch.timestamp); break;
+                        case Field::MpsdId:     eval(batch.address); break;
+                        case Field::Channel:    eval(batch.channel); break;
+                        case Field::Position:   eval(batch.position); break;
+                        case Field::Amplitude:  eval(batch.amplitude); break;
+                        case Field::XPosition:  eval(batch.position); break;
+                        case Field::YPosition:  eval(batch.yPosition); break;
+                        case Field::TriggerId:  eval(batch.address); break;
+                        case Field::DataId:     eval(batch.channel); break;
+                        case Field::Value:      eval(batch.value); break;
+                    }
+                } break;
+
+            case Instruction::And:
+                {
+                    assert(sp >= 2);
+                    u8 *a = stack_[sp - 2].data();
+                    const u8 *b = stack_[sp - 1].data();
+                    for (size_t i = 0; i < size; ++i)
+                        a[i] &= b[i];
+                    --sp;
+                } break;
+
+            case Instruction::Or:
+                {
+                    assert(sp >= 2);
+                    u8 *a = stack_[sp - 2].data();
+                    const u8 *b = stack_[sp - 1].data();
+                    for (size_t i = 0; i < size; ++i)
+                        a[i] |= b[i];
+                    --sp;
+                } break;
+
+            case Instruction::Not:
+                {
+                    assert(sp >= 1);
+                    u8 *a = stack_[sp - 1].data();
+                    for (size_t i = 0; i < size; ++i)
+                        a[i] ^= 1u;
+                } break;
+        }
+    }
+
+    assert(sp == 1);
+    // Swapping keeps both buffers allocated for the next call.
+    mask.swap(stack_[0]);
+}
+
+size_t EventFilter::filter(const EventBatch &batch, EventBatch &dest)
+{
+    evaluate(batch, mask_);
+
+    const size_t count = std::count(mask_.begin(), mask_.end(), 1u);
+
+    dest.reserve(dest.size() + count);
+    append_selected(batch.timestamp, mask_, dest.timestamp);
+    append_selected(batch.deviceId, mask_, dest.deviceId);
+    append_selected(batch.type, mask_, dest.type);
+    append_selected(batch.address, mask_, dest.address);
+    append_selected(batch.channel, mask_, dest.channel);
+    append_selected(batch.amplitude, mask_, dest.amplitude);
+    append_selected(batch.position, mask_, dest.position);
+    append_selected(batch.yPosition, mask_, dest.yPosition);
+    append_selected(batch.value, mask_, dest.value);
+
+    counters_.eventsIn += batch.size();
+    counters_.eventsOut += count;
+
+    return count;
+}
+
+size_t EventFilter::filterPacket(const DataPacket &packet, DataPacket &dest)
+{
+    const size_t eventCount = std::clamp(
+        get_data_length(packet), 0, static_cast<int>(DataPacketMaxDataWords)) / 3;
+    size_t kept = eventCount;
+
+    if (&dest != &packet)
+    {
+        const auto headerBytes = reinterpret_cast<const u8 *>(packet.data) - reinterpret_cast<const u8 *>(&packet);
+        std::memcpy(reinterpret_cast<u8 *>(&dest), &packet, headerBytes);
+    }
+
+    if (matchesAll())
+    {
+        if (&dest != &packet)
+            std::copy_n(packet.data, eventCount * 3, dest.data);
+    }
+    else
+    {
+        batch_.clear();
+        decode_events(packet, batch_);
+        evaluate(batch_, mask_);
+
+        kept = 0u;
+
+        // Moves events towards the front, works in place as kept <= ei.
+        for (size_t ei = 0; ei < eventCount; ++ei)
+        {
+            if (mask_[ei])
+            {
+                if (&dest != &packet || kept != ei)
+                    std::copy_n(packet.data + ei * 3, 3, dest.data + kept * 3);
+                ++kept;
+            }
+        }
+    }
+
+    dest.bufferLength = dest.headerLength + kept * 3;
+
+    ++counters_.packetsIn;
+    counters_.packetsOut += kept > 0;
+    counters_.eventsIn += eventCount;
+    counters_.eventsOut += kept;
+
+    return kept;
+}
+
+}
@@ -0,0 +1,131 @@
+#ifndef __MESYTEC_MCPD_EVENT_FILTER_H__
+#define __MESYTEC_MCPD_EVENT_FILTER_H__
+
+#include <string>
+#include <vector>
+
+#include "mcpd_event_batch.h"
+
+namespace mesytec::mcpd
+{
+
+// Event selection on decoded event fields.
+//
+// A filter is compiled into a short postfix program of range checks on the
+// columns of an EventBatch combined with and/or/not. Evaluation runs one
+// instruction at a time over the whole batch producing a byte mask per event,
+// so the inner loops are simple, branch free and vectorized by the compiler.
+//
+// Expression syntax:
+//
+//   expr       := term ('or' term)*
+//   term       := factor ('and' factor)*
+//   factor     := 'not' factor | '(' expr ')' | comparison
+//   comparison := field ('=='|'!='|'<'|'<='|'>'|'>=') value
+//               | field 'in' item (',' item)*
+//   item       := value | value '..' value       (inclusive range)
+//
+// '&&', '||', '!' and '=' are accepted as well. Values are decimal or 0x
+// prefixed hex numbers. The type field takes 'neutron', 'trigger' or 'mdll'.
+//
+// Fields and the event types they apply to. A comparison on a type specific
+// field does not match events of other types:
+//
+//   type, device, timestamp    all events
+//   mpsd, channel, position    neutron
+//   amplitude                  neutron, mdll
+//   x, y                       mdll
+//   trigger, data, value       trigger
+//
+// Example: "type == trigger or (mpsd in 0..3 and channel != 7 and amplitude > 100)"
+class MESYTEC_MCPD_EXPORT EventFilter
+{
+  public:
+    enum class Field: u8
+    {
+        Type,
+        DeviceId,
+        Timestamp,
+        MpsdId,
+        Channel,
+        Position,
+        Amplitude,
+        XPosition,
+        YPosition,
+        TriggerId,
+        DataId,
+        Value,
+    };
+
+    struct Counters
+    {
+        u64 packetsIn = 0u;
+        u64 packetsOut = 0u;    // packets with at least one matching event
+        u64 eventsIn = 0u;
+        u64 eventsOut = 0u;
+    };
+
+    // Matches all events.
+    EventFilter();
+
+    // Compiles the expression. Throws std::invalid_argument on syntax errors.
+    explicit EventFilter(const std::string &expression);
+
+    // Builder API: min <= field <= max.
+    static EventFilter range(Field field, u64 min, u64 max);
+    static EventFilter equals(Field field, u64 value) { return range(field, value, value); }
+    static EventFilter type(EventType type);
+
+    EventFilter operator&&(const EventFilter &other) const;
+    EventFilter operator||(const EventFilter &other) const;
+    EventFilter operator!() const;
+
+    bool matchesAll() const { return program_.empty(); }
+
+    // The filter as an expression, e.g. for logging.
+    std::string toString() const;
+
+    // Evaluates the filter for all events of the batch. On return mask has
+    // batch.size() entries, 1 for matching events, 0 otherwise.
+    void evaluate(const EventBatch &batch, std::vector<u8> &mask);
+
+    // Appends the matching events of the batch to dest. Returns the number
+    // of events appended.
+    size_t filter(const EventBatch &batch, EventBatch &dest);
+
+    // Copies the header and the raw words of the matching events of packet
+    // to dest and adjusts bufferLength. dest may refer to packet. Returns the
+    // number of events in dest.
+    size_t filterPacket(const DataPacket &packet, DataPacket &dest);
+
+    const Counters &counters() const { return counters_; }
+    void resetCounters() { counters_ = {}; }
+
+  private:
+    struct Instruction
+    {
+        // Range: the field applies to the event and min <= value <= max.
+        // Outside: the field applies to the event and the value is not in range.
+        enum Op: u8 { Range, Outside, And, Or, Not };
+
+        Op op;
+        Field field;
+        u64 min;
+        u64 max;
+    };
+
+    std::vector<Instruction> program_;  // postfix
+
+    // Scratch space reused between calls.
+    std::vector<std::vector<u8>> stack_;
+    std::vector<u8> mask_;
+    EventBatch batch_;
+
+    Counters counters_;
+};
+
+MESYTEC_MCPD_EXPORT const char *to_string(EventFilter::Field field);
+
+}
+
+#endif /* __MESYTEC_MCPD_EVENT_FILTER_H__ */
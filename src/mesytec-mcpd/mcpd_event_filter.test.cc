@@ -0,0 +1,169 @@
+#include <gtest/gtest.h>
+
+#include <cstring>
+
+#include "mcpd_event_filter.h"
+
+using namespace mesytec::mcpd;
+
+namespace
+{
+
+namespace ec = event_constants;
+
+u64 neutron(u64 mpsd, u64 channel, u64 amplitude, u64 position, u64 ts = 0)
+{
+    return (mpsd << ec::neutron::MpsdIdShift) | (channel << ec::neutron::ChannelShift)
+        | (amplitude << ec::neutron::AmplitudeShift) | (position << ec::neutron::PositionShift) | ts;
+}
+
+u64 trigger(u64 triggerId, u64 dataId, u64 value, u64 ts = 0)
+{
+    return (u64(1) << ec::IdShift) | (triggerId << ec::trigger::TriggerIdShift)
+        | (dataId << ec::trigger::DataIdShift) | (value << ec::trigger::DataShift) | ts;
+}
+
+DataPacket make_packet(const std::vector<u64> &events, u8 deviceId = 0)
+{
+    DataPacket packet = {};
+    packet.bufferType = McpdDataBufferType;
+    packet.headerLength = 21;
+    packet.bufferLength = packet.headerLength + events.size() * 3;
+    packet.deviceId = deviceId;
+
+    for (size_t i = 0; i < events.size(); ++i)
+    {
+        packet.data[i * 3 + 0] = events[i] & 0xffffu;
+        packet.data[i * 3 + 1] = (events[i] >> 16) & 0xffffu;
+        packet.data[i * 3 + 2] = (events[i] >> 32) & 0xffffu;
+    }
+
+    return packet;
+}
+
+std::vector<u8> evaluate(EventFilter &filter, const DataPacket &packet)
+{
+    EventBatch batch;
+    decode_events(packet, batch);
+    std::vector<u8> mask;
+    filter.evaluate(batch, mask);
+    return mask;
+}
+
+const DataPacket TestPacket = make_packet(
+    {
+        neutron(0, 1, 100, 10),
+        neutron(3, 7, 200, 20),
+        neutron(4, 2, 300, 30),
+        trigger(1, 2, 1000),
+        trigger(5, 0, 2000),
+    });
+
+} // namespace
+
+TEST(EventFilter, Evaluate)
+{
+    const std::vector<std::pair<const char *, std::vector<u8>>> tests =
+    {
+        { "mpsd == 3",                          { 0, 1, 0, 0, 0 } },
+        { "mpsd = 3",                           { 0, 1, 0, 0, 0 } },
+        { "mpsd != 3",                          { 1, 0, 1, 0, 0 } },
+        { "mpsd in 0..3",                       { 1, 1, 0, 0, 0 } },
+        { "mpsd in 0, 4",                       { 1, 0, 1, 0, 0 } },
+        { "amplitude > 100",                    { 0, 1, 1, 0, 0 } },
+        { "amplitude >= 0x64",                  { 1, 1, 1, 0, 0 } },
+        { "position < 20 || value <= 1000",     { 1, 0, 0, 1, 0 } },
+        { "amplitude < 0",                      { 0, 0, 0, 0, 0 } },
+        { "type == trigger",                    { 0, 0, 0, 1, 1 } },
+        { "not type == trigger",                { 1, 1, 1, 0, 0 } },
+        { "trigger == 5 or channel == 2",       { 0, 0, 1, 0, 1 } },
+        { "device == 0 and !(mpsd in 3..4)",    { 1, 0, 0, 1, 1 } },
+        { "type == trigger or (mpsd in 0..3 and channel != 7 and amplitude > 50)",
+                                                { 1, 0, 0, 1, 1 } },
+        { "x >= 0",                             { 0, 0, 0, 0, 0 } },
+    };
+
+    for (const auto &[expr, expected]: tests)
+    {
+        EventFilter filter(expr);
+        ASSERT_EQ(evaluate(filter, TestPacket), expected) << expr;
+
+        // The string representation compiles to an equivalent filter.
+        EventFilter reparsed(filter.toString());
+        ASSERT_EQ(evaluate(reparsed, TestPacket), expected) << expr << " -> " << filter.toString();
+    }
+}
+
+TEST(EventFilter, SyntaxErrors)
+{
+    for (const char *expr: { "", "mpsd", "mpsd ==", "foo == 1", "mpsd == 1 and", "(mpsd == 1",
+                             "mpsd == 1)", "type == foo", "mpsd in 1..", "mpsd == 1 # 2",
+                             "mpsd == 99999999999999999999999" })
+    {
+        ASSERT_THROW(EventFilter filter(expr), std::invalid_argument) << expr;
+    }
+}
+
+TEST(EventFilter, Builder)
+{
+    using Field = EventFilter::Field;
+
+    auto filter = EventFilter::type(EventType::Neutron) && EventFilter::range(Field::Amplitude, 150, 250);
+    ASSERT_EQ(evaluate(filter, TestPacket), std::vector<u8>({ 0, 1, 0, 0, 0 }));
+
+    filter = filter || EventFilter::equals(Field::Value, 2000);
+    ASSERT_EQ(evaluate(filter, TestPacket), std::vector<u8>({ 0, 1, 0, 0, 1 }));
+
+    filter = !filter;
+    ASSERT_EQ(evaluate(filter, TestPacket), std::vector<u8>({ 1, 0, 1, 1, 0 }));
+
+    EventFilter all;
+    ASSERT_TRUE(all.matchesAll());
+    ASSERT_EQ(evaluate(all, TestPacket), std::vector<u8>(5, 1));
+
+    all = !all;
+    ASSERT_EQ(evaluate(all, TestPacket), std::vector<u8>(5, 0));
+}
+
+TEST(EventFilter, FilterPacket)
+{
+    EventFilter filter("mpsd >= 3 or type == trigger");
+    DataPacket dest = {};
+
+    ASSERT_EQ(filter.filterPacket(TestPacket, dest), 4u);
+    ASSERT_EQ(dest.bufferLength, dest.headerLength + 4 * 3);
+    ASSERT_EQ(get_event(dest, 0), get_event(TestPacket, 1));
+    ASSERT_EQ(get_event(dest, 3), get_event(TestPacket, 4));
+
+    // In place.
+    DataPacket packet = TestPacket;
+    ASSERT_EQ(filter.filterPacket(packet, packet), 4u);
+    ASSERT_EQ(packet.bufferLength, dest.bufferLength);
+    ASSERT_EQ(std::memcmp(packet.data, dest.data, get_data_length(dest) * sizeof(u16)), 0);
+
+    EventFilter none("mpsd > 10");
+    ASSERT_EQ(none.filterPacket(packet, packet), 0u);
+    ASSERT_EQ(get_event_count(packet), 0u);
+
+    const auto &counters = filter.counters();
+    ASSERT_EQ(counters.packetsIn, 2u);
+    ASSERT_EQ(counters.packetsOut, 2u);
+    ASSERT_EQ(counters.eventsIn, 10u);
+    ASSERT_EQ(counters.eventsOut, 8u);
+    ASSERT_EQ(none.counters().packetsOut, 0u);
+}
+
+TEST(EventFilter, FilterBatch)
+{
+    EventBatch batch;
+    decode_events(TestPacket, batch);
+
+    EventFilter filter("amplitude in 150..300 or trigger == 1");
+    EventBatch dest;
+
+    ASSERT_EQ(filter.filter(batch, dest), 3u);
+    ASSERT_EQ(dest.size(), 3u);
+    ASSERT_EQ(dest.event(0).neutron.amplitude, 200u);
+    ASSERT_EQ(dest.event(1).neutron.amplitude, 300u);
+    ASSERT_EQ(dest.event(2).trigger.value, 1000u);
+}
@@ -0,0 +1,195 @@
+#include "mcpd_event_merger.h"
+
+#include <algorithm>
+#include <functional>
+#include <limits>
+
+namespace mesytec::mcpd
+{
+
+namespace
+{
+    inline bool timestamp_less(const DecodedEvent &a, const DecodedEvent &b)
+    {
+        return a.timestamp < b.timestamp;
+    }
+}
+
+EventMerger::EventMerger()
+    : EventMerger(Options{})
+{
+}
+
+EventMerger::EventMerger(const Options &options)
+    : options_(options)
+{
+}
+
+void EventMerger::push(size_t source, const DecodedEvent *events, size_t count)
+{
+    if (source >= sources_.size())
+        sources_.resize(source + 1);
+
+    auto &src = sources_[source];
+    src.active = true;
+
+    const size_t oldSize = src.queue.size();
+    bool sorted = true;
+
+    for (size_t i = 0; i < count; ++i)
+    {
+        const auto &event = events[i];
+        ++counters_.eventsIn;
+
+        if (anyEmitted_ && event.timestamp < lastEmitted_)
+        {
+            ++counters_.lateEvents;
+            continue;
+        }
+
+        if (!src.queue.empty() && event.timestamp < src.queue.back().timestamp)
+            sorted = false;
+
+        src.queue.push_back(event);
+        src.maxTimestamp = std::max(src.maxTimestamp, event.timestamp);
+    }
+
+    if (!sorted)
+    {
+        // Sort the newly added part, then merge it with the already ordered
+        // part of the queue.
+        auto mid = src.queue.begin() + oldSize;
+        std::stable_sort(mid, src.queue.end(), timestamp_less);
+        std::inplace_merge(src.queue.begin(), mid, src.queue.end(), timestamp_less);
+    }
+
+    buffered_ += src.queue.size() - oldSize;
+}
+
+void EventMerger::pushPacket(size_t source, const DataPacket &packet)
+{
+    // Corrupt length fields must not make decode_event() throw.
+    const size_t eventCount = std::clamp(get_data_length(packet), 0,
+                                         static_cast<int>(DataPacketMaxDataWords)) / 3;
+
+    decodeBuffer_.clear();
+    decodeBuffer_.reserve(eventCount);
+
+    for (size_t ei = 0; ei < eventCount; ++ei)
+        decodeBuffer_.push_back(decode_event(packet, ei));
+
+    push(source, decodeBuffer_);
+}
+
+u64 EventMerger::watermark() const
+{
+    u64 newest = 0u;
+    bool anyActive = false;
+
+    for (const auto &src: sources_)
+    {
+        if (src.active)
+        {
+            newest = std::max(newest, src.maxTimestamp);
+            anyActive = true;
+        }
+    }
+
+    if (!anyActive)
+        return 0u;
+
+    u64 result = std::numeric_limits<u64>::max();
+
+    for (const auto &src: sources_)
+    {
+        if (src.active && newest - src.maxTimestamp <= options_.maxSourceLag)
+            result = std::min(result, src.maxTimestamp);
+    }
+
+    return result;
+}
+
+size_t EventMerger::pop(std::vector<DecodedEvent> &dest)
+{
+    if (!buffered_)
+        return 0u;
+
+    const u64 wm = watermark();
+
+    for (const auto &src: sources_)
+    {
+        if (src.active && src.maxTimestamp < wm)
+        {
+            ++counters_.stalledSourceSkips;
+            break;
+        }
+    }
+
+    size_t result = emitUpTo(wm, dest, std::numeric_limits<size_t>::max());
+
+    if (buffered_ > options_.maxBufferedEvents)
+    {
+        const size_t forced = emitUpTo(std::numeric_limits<u64>::max(), dest,
+                                       buffered_ - options_.maxBufferedEvents);
+        counters_.forcedEvents += forced;
+        result += forced;
+    }
+
+    return result;
+}
+
+size_t EventMerger::finish(std::vector<DecodedEvent> &dest)
+{
+    return emitUpTo(std::numeric_limits<u64>::max(), dest, std::numeric_limits<size_t>::max());
+}
+
+size_t EventMerger::emitUpTo(u64 limit, std::vector<DecodedEvent> &dest, size_t maxCount)
+{
+    // Min-heap of (timestamp, source index) over the queue heads.
+    using HeapEntry = std::pair<u64, size_t>;
+    std::vector<HeapEntry> heap;
+    heap.reserve(sources_.size());
+    const auto cmp = std::greater<HeapEntry>();
+
+    for (size_t si = 0; si < sources_.size(); ++si)
+    {
+        const auto &queue = sources_[si].queue;
+
+        if (!queue.empty() && queue.front().timestamp <= limit)
+            heap.emplace_back(queue.front().timestamp, si);
+    }
+
+    std::make_heap(heap.begin(), heap.end(), cmp);
+
+    size_t emitted = 0u;
+
+    while (!heap.empty() && emitted < maxCount)
+    {
+        std::pop_heap(heap.begin(), heap.end(), cmp);
+        const size_t si = heap.back().second;
+        heap.pop_back();
+
+        auto &queue = sources_[si].queue;
+        dest.push_back(queue.front());
+        queue.pop_front();
+        ++emitted;
+
+        if (!queue.empty() && queue.front().timestamp <= limit)
+        {
+            heap.emplace_back(queue.front().timestamp, si);
+            std::push_heap(heap.begin(), heap.end(), cmp);
+        }
+    }
+
+    if (emitted)
+    {
+        lastEmitted_ = dest.back().timestamp;
+        anyEmitted_ = true;
+        buffered_ -= emitted;
+        counters_.eventsOut += emitted;
+    }
+
+    return emitted;
+}
+
+}
@@ -0,0 +1,98 @@
+#ifndef __MESYTEC_MCPD_EVENT_MERGER_H__
+#define __MESYTEC_MCPD_EVENT_MERGER_H__
+
+#include <deque>
+#include <vector>
+
+#include "mcpd_core.h"
+
+namespace mesytec::mcpd
+{
+
+// Merges the decoded event streams of multiple devices into a single globally
+// time-ordered stream. Ordering is done on DecodedEvent::timestamp (48 bit
+// packet header timestamp + 19 bit event timestamp).
+//
+// Each source (usually one per device) must deliver its events roughly in
+// time order, e.g. packet by packet. Events are held back until every active
+// source has advanced past them (the watermark), then emitted in order via a
+// k-way heap merge over the per-source queues.
+//
+// Latency and memory are bounded:
+// - Sources lagging more than maxSourceLag timestamp units behind the newest
+//   source are considered stalled and do not hold back the watermark.
+// - If more than maxBufferedEvents are buffered, the oldest events are emitted
+//   regardless of the watermark.
+// Events arriving after newer events have already been emitted are counted as
+// late and dropped so that the output stays strictly ordered.
+class MESYTEC_MCPD_EXPORT EventMerger
+{
+  public:
+    struct Options
+    {
+        // In timestamp units (100 ns). Default is one second.
+        u64 maxSourceLag = 10'000'000u;
+        size_t maxBufferedEvents = 1u << 20;
+    };
+
+    struct Counters
+    {
+        u64 eventsIn = 0u;
+        u64 eventsOut = 0u;
+        u64 lateEvents = 0u;        // dropped because newer events were already emitted
+        u64 forcedEvents = 0u;      // emitted early because of the maxBufferedEvents limit
+        u64 stalledSourceSkips = 0u; // number of pops where at least one source was considered stalled
+    };
+
+    EventMerger();
+    explicit EventMerger(const Options &options);
+
+    // Adds events of the given source. Sources are created on first use.
+    void push(size_t source, const DecodedEvent *events, size_t count);
+
+    void push(size_t source, const std::vector<DecodedEvent> &events)
+    {
+        push(source, events.data(), events.size());
+    }
+
+    // Decodes all events of the packet and pushes them.
+    void pushPacket(size_t source, const DataPacket &packet);
+
+    // Appends all events up to the current watermark to dest in time order.
+    // Returns the number of events appended.
+    size_t pop(std::vector<DecodedEvent> &dest);
+
+    // Appends all buffered events to dest regardless of the watermark, e.g.
+    // at the end of a run.
+    size_t finish(std::vector<DecodedEvent> &dest);
+
+    // Current watermark: events with a timestamp <= this value can be emitted.
+    u64 watermark() const;
+
+    size_t bufferedEvents() const { return buffered_; }
+    size_t sourceCount() const { return sources_.size(); }
+    const Counters &counters() const { return counters_; }
+    const Options &options() const { return options_; }
+
+  private:
+    struct Source
+    {
+        std::deque<DecodedEvent> queue;
+        u64 maxTimestamp = 0u;
+        bool active = false;
+    };
+
+    size_t emitUpTo(u64 limit, std::vector<DecodedEvent> &dest, size_t maxCount);
+
+    Options options_;
+    std::vector<Source> sources_;
+    std::vector<DecodedEvent> decodeBuffer_;
+    size_t buffered_ = 0u;
+    u64 lastEmitted_ = 0u;
+    bool anyEmitted_ = false;
+    Counters counters_;
+};
+
+}
+
+#endif /* __MESYTEC_MCPD_EVENT_MERGER_H__ */
@@ -0,0 +1,138 @@
+#include <gtest/gtest.h>
+
+#include "mcpd_event_merger.h"
+
+using namespace mesytec::mcpd;
+
+namespace
+{
+
+std::vector<DecodedEvent> make_events(u8 deviceId, std::initializer_list<u64> timestamps)
+{
+    std::vector<DecodedEvent> result;
+
+    for (auto ts: timestamps)
+    {
+        DecodedEvent event = {};
+        event.deviceId = deviceId;
+        event.timestamp = ts;
+        result.push_back(event);
+    }
+
+    return result;
+}
+
+bool is_time_ordered(const std::vector<DecodedEvent> &events)
+{
+    return std::is_sorted(events.begin(), events.end(), [](const auto &a, const auto &b)
+                          { return a.timestamp < b.timestamp; });
+}
+
+} // namespace
+
+TEST(EventMerger, WatermarkAndOrdering)
+{
+    EventMerger merger;
+    std::vector<DecodedEvent> out;
+
+    merger.push(0, make_events(0, {10, 20, 30}));
+    // Only one source known so far: everything up to its newest event is ready.
+    ASSERT_EQ(merger.pop(out), 3u);
+
+    merger.push(0, make_events(0, {40, 50, 60}));
+    merger.push(1, make_events(1, {35, 45}));
+    // The watermark is the newest timestamp of the slowest source (45).
+    ASSERT_EQ(merger.watermark(), 45u);
+    ASSERT_EQ(merger.pop(out), 3u); // 35, 40, 45
+    ASSERT_EQ(out.back().timestamp, 45u);
+    ASSERT_EQ(merger.bufferedEvents(), 2u);
+
+    merger.push(1, make_events(1, {55, 70}));
+    merger.pop(out);
+    ASSERT_EQ(out.back().timestamp, 60u);
+
+    merger.finish(out);
+    ASSERT_EQ(out.size(), 10u);
+    ASSERT_TRUE(is_time_ordered(out));
+    ASSERT_EQ(merger.counters().eventsIn, 10u);
+    ASSERT_EQ(merger.counters().eventsOut, 10u);
+    ASSERT_EQ(merger.counters().lateEvents, 0u);
+}
+
+TEST(EventMerger, UnorderedInputWithinSource)
+{
+    EventMerger merger;
+    std::vector<DecodedEvent> out;
+
+    merger.push(0, make_events(0, {10, 30, 20}));
+    merger.push(0, make_events(0, {25, 40}));
+    merger.finish(out);
+
+    ASSERT_EQ(out.size(), 5u);
+    ASSERT_TRUE(is_time_ordered(out));
+}
+
+TEST(EventMerger, LateEventsAndStalledSources)
+{
+    EventMerger::Options options;
+    options.maxSourceLag = 100;
+    EventMerger merger(options);
+    std::vector<DecodedEvent> out;
+
+    merger.push(0, make_events(0, {10}));
+    merger.push(1, make_events(1, {20, 500}));
+
+    // Source 0 lags by more than maxSourceLag and is ignored for the watermark.
+    ASSERT_EQ(merger.watermark(), 500u);
+    ASSERT_EQ(merger.pop(out), 3u);
+
+    // Source 0 catches up with an event older than what was already emitted.
+    merger.push(0, make_events(0, {300, 600}));
+    ASSERT_EQ(merger.counters().lateEvents, 1u);
+
+    merger.finish(out);
+    ASSERT_TRUE(is_time_ordered(out));
+    ASSERT_EQ(out.size(), 4u);
+}
+
+TEST(EventMerger, BoundedMemory)
+{
+    EventMerger::Options options;
+    options.maxBufferedEvents = 4;
+    EventMerger merger(options);
+    std::vector<DecodedEvent> out;
+
+    merger.push(0, make_events(0, {1}));
+    merger.push(1, make_events(1, {2, 3, 4, 5, 6, 7, 8}));
+
+    // The watermark is held back by source 0 but the buffer limit forces
+    // the oldest events out.
+    merger.pop(out);
+    ASSERT_LE(merger.bufferedEvents(), 4u);
+    ASSERT_GT(merger.counters().forcedEvents, 0u);
+    ASSERT_TRUE(is_time_ordered(out));
+}
+
+TEST(EventMerger, CorruptPacketLength)
+{
+    EventMerger merger;
+    std::vector<DecodedEvent> out;
+
+    // Header longer than the buffer: negative data length.
+    DataPacket packet = {};
+    packet.bufferType = McpdDataBufferType;
+    packet.bufferLength = 10;
+    packet.headerLength = 21;
+
+    merger.pushPacket(0, packet);
+    merger.finish(out);
+    ASSERT_TRUE(out.empty());
+
+    // Data length beyond the packet: only the events fitting into it are used.
+    packet.headerLength = 0;
+    packet.bufferLength = 0xffffu;
+
+    merger.pushPacket(0, packet);
+    merger.finish(out);
+    ASSERT_EQ(out.size(), DataPacketMaxDataWords / 3);
+}
@@ -0,0 +1,711 @@
+#include "mcpd_event_sort.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <deque>
+#include <filesystem>
+#include <limits>
+#include <queue>
+#include <spdlog/spdlog.h>
+
+#include "mcpd_listfile.h"
+#include "util/thread_pool.h"
+
+namespace fs = std::filesystem;
+
+namespace mesytec::mcpd
+{
+
+namespace
+{
+
+using sorted_events::Record;
+
+// Buffer size used for stdio file streams.
+const size_t FileBufferSize = 1u << 20;
+
+std::error_code errno_error_code(int fallback = EIO)
+{
+    return std::error_code(errno ? errno : fallback, std::generic_category());
+}
+
+int file_seek(std::FILE *f, u64 offset)
+{
+#ifdef _WIN32
+    return _fseeki64(f, offset, SEEK_SET);
+#else
+    return fseeko(f, offset, SEEK_SET);
+#endif
+}
+
+std::FILE *open_file(const std::string &path, const char *mode, std::error_code &ec)
+{
+    errno = 0;
+    auto f = std::fopen(path.c_str(), mode);
+
+    if (!f)
+        ec = errno_error_code(ENOENT);
+    else
+        std::setvbuf(f, nullptr, _IOFBF, FileBufferSize);
+
+    return f;
+}
+
+struct RunFile
+{
+    std::string path;
+    u64 count = 0u;
+};
+
+// Removes the temporary files it created on destruction.
+class TempFiles
+{
+  public:
+    TempFiles(const fs::path &dir, const std::string &prefix)
+        : dir_(dir)
+        , prefix_(prefix)
+    {
+    }
+
+    ~TempFiles()
+    {
+        for (const auto &path: paths_)
+        {
+            std::error_code ec;
+            fs::remove(path, ec);
+        }
+    }
+
+    std::string create()
+    {
+        auto path = (dir_ / (prefix_ + std::to_string(paths_.size()) + ".tmp")).string();
+        paths_.push_back(path);
+        return path;
+    }
+
+  private:
+    fs::path dir_;
+    std::string prefix_;
+    std::vector<std::string> paths_;
+};
+
+// Buffered sequential writer of raw records.
+class RunWriter
+{
+  public:
+    std::error_code open(const std::string &path)
+    {
+        std::error_code ec;
+        file_ = open_file(path, "wb", ec);
+        return ec;
+    }
+
+    ~RunWriter()
+    {
+        if (file_)
+            std::fclose(file_);
+    }
+
+    std::error_code push(const Record &record)
+    {
+        if (std::fwrite(&record, sizeof(record), 1, file_) != 1)
+            return errno_error_code();
+        return {};
+    }
+
+    std::error_code write(const Record *records, size_t count)
+    {
+        if (std::fwrite(records, sizeof(Record), count, file_) != count)
+            return errno_error_code();
+        return {};
+    }
+
+    std::error_code close()
+    {
+        errno = 0;
+        int res = std::fclose(file_);
+        file_ = nullptr;
+        return res == 0 ? std::error_code{} : errno_error_code();
+    }
+
+  private:
+    std::FILE *file_ = nullptr;
+};
+
+// Writes the sorted event file: records, index and finally the header.
+class OutputWriter
+{
+  public:
+    ~OutputWriter()
+    {
+        if (file_)
+            std::fclose(file_);
+    }
+
+    std::error_code open(const std::string &path, u32 indexStride)
+    {
+        std::error_code ec;
+
+        if (!(file_ = open_file(path, "wb", ec)))
+            return ec;
+
+        header_ = {};
+        std::memcpy(header_.magic, sorted_events::Magic, sizeof(header_.magic));
+        header_.version = sorted_events::Version;
+        header_.recordSize = sizeof(Record);
+        header_.indexStride = std::max(indexStride, 1u);
+
+        // Placeholder, rewritten by finish().
+        if (std::fwrite(&header_, sizeof(header_), 1, file_) != 1)
+            return errno_error_code();
+
+        return {};
+    }
+
+    std::error_code push(const Record &record)
+    {
+        if (header_.eventCount % header_.indexStride == 0)
+            index_.push_back({ record.timestamp, header_.eventCount });
+
+        if (header_.eventCount == 0)
+            header_.firstTimestamp = record.timestamp;
+
+        header_.lastTimestamp = record.timestamp;
+        ++header_.eventCount;
+
+        if (std::fwrite(&record, sizeof(record), 1, file_) != 1)
+            return errno_error_code();
+
+        return {};
+    }
+
+    std::error_code write(const Record *records, size_t count)
+    {
+        for (size_t i = 0; i < count; ++i)
+        {
+            if (auto ec = push(records[i]))
+                return ec;
+        }
+
+        return {};
+    }
+
+    std::error_code finish()
+    {
+        header_.indexOffset = sizeof(header_) + header_.eventCount * sizeof(Record);
+
+        if (std::fwrite(index_.data(), sizeof(index_[0]), index_.size(), file_) != index_.size()
+            || file_seek(file_, 0) != 0
+            || std::fwrite(&header_, sizeof(header_), 1, file_) != 1)
+        {
+            return errno_error_code();
+        }
+
+        errno = 0;
+        int res = std::fclose(file_);
+        file_ = nullptr;
+        return res == 0 ? std::error_code{} : errno_error_code();
+    }
+
+    const sorted_events::FileHeader &header() const { return header_; }
+
+  private:
+    std::FILE *file_ = nullptr;
+    sorted_events::FileHeader header_ = {};
+    std::vector<sorted_events::IndexEntry> index_;
+};
+
+// Buffered sequential reader of a run file.
+class RunReader
+{
+  public:
+    ~RunReader()
+    {
+        if (file_)
+            std::fclose(file_);
+    }
+
+    std::error_code open(const RunFile &run, size_t bufferRecords)
+    {
+        std::error_code ec;
+
+        if (!(file_ = open_file(run.path, "rb", ec)))
+            return ec;
+
+        // The records are buffered here, avoid double buffering in stdio.
+        std::setvbuf(file_, nullptr, _IONBF, 0);
+        remaining_ = run.count;
+        buffer_.resize(std::max(bufferRecords, size_t(1)));
+        return refill();
+    }
+
+    const Record *current() const { return pos_ < end_ ? &buffer_[pos_] : nullptr; }
+
+    std::error_code next()
+    {
+        if (++pos_ < end_)
+            return {};
+
+        return refill();
+    }
+
+  private:
+    std::error_code refill()
+    {
+        const size_t count = std::min(static_cast<u64>(buffer_.size()), remaining_);
+        pos_ = end_ = 0u;
+
+        if (!count)
+            return {};
+
+        if (std::fread(buffer_.data(), sizeof(Record), count, file_) != count)
+            return std::ferror(file_) ? errno_error_code() : make_error_code(ListfileError::CorruptRecord);
+
+        remaining_ -= count;
+        end_ = count;
+        return {};
+    }
+
+    std::FILE *file_ = nullptr;
+    std::vector<Record> buffer_;
+    size_t pos_ = 0u;
+    size_t end_ = 0u;
+    u64 remaining_ = 0u;
+};
+
+// Merges the sorted runs into sink. Records with equal timestamps are taken
+// from the run with the lower index first which keeps the merge stable as the
+// runs are in input order.
+template<typename Sink>
+std::error_code merge_runs(const std::vector<RunFile> &runs, size_t bufferRecords, Sink &sink)
+{
+    std::vector<RunReader> readers(runs.size());
+
+    struct Head
+    {
+        u64 timestamp;
+        size_t run;
+
+        bool operator>(const Head &o) const
+        {
+            return timestamp > o.timestamp || (timestamp == o.timestamp && run > o.run);
+        }
+    };
+
+    std::priority_queue<Head, std::vector<Head>, std::greater<Head>> heap;
+
+    for (size_t i = 0; i < runs.size(); ++i)
+    {
+        if (auto ec = readers[i].open(runs[i], bufferRecords))
+            return ec;
+
+        if (auto record = readers[i].current())
+            heap.push({ record->timestamp, i });
+    }
+
+    while (!heap.empty())
+    {
+        const auto run = heap.top().run;
+        heap.pop();
+        auto &reader = readers[run];
+
+        // Emit records of this run as long as it stays the minimum.
+        const u64 limit = heap.empty() ? std::numeric_limits<u64>::max() : heap.top().timestamp;
+        const size_t limitRun = heap.empty() ? 0u : heap.top().run;
+
+        while (auto record = reader.current())
+        {
+            if (record->timestamp > limit || (record->timestamp == limit && run > limitRun))
+            {
+                heap.push({ record->timestamp, run });
+                break;
+            }
+
+            if (auto ec = sink.push(*record))
+                return ec;
+
+            if (auto ec = reader.next())
+                return ec;
+        }
+    }
+
+    return {};
+}
+
+void sort_chunk(std::vector<Record> &chunk)
+{
+    std::stable_sort(chunk.begin(), chunk.end(),
+                     [](const Record &a, const Record &b) { return a.timestamp < b.timestamp; });
+}
+
+} // namespace
+
+namespace sorted_events
+{
+
+Record make_record(const DataPacket &packet, size_t eventNum)
+{
+    namespace ec = event_constants;
+
+    const u64 event = get_event(packet, eventNum);
+
+    Record result = {};
+    result.timestamp = get_header_timestamp(packet) + ((event >> ec::TimestampShift) & ec::TimestampMask);
+    result.payload = static_cast<u32>(event >> ec::TimestampBits);
+    result.deviceId = packet.deviceId;
+    result.flags = packet.bufferType == MdllDataBufferType ? MdllEvent : 0u;
+    return result;
+}
+
+DecodedEvent decode_record(const Record &record)
+{
+    const u64 event = static_cast<u64>(record.payload) << event_constants::TimestampBits;
+    const u16 bufferType = (record.flags & MdllEvent) ? MdllDataBufferType : McpdDataBufferType;
+
+    auto result = decode_event(event, record.deviceId, bufferType, record.timestamp);
+    result.packet_timestamp = 0u;
+    return result;
+}
+
+} // namespace sorted_events
+
+std::error_code sort_events(PacketSource &input, const std::string &outputPath,
+                            const EventSortOptions &options, EventSortResult *resultp)
+{
+    EventSortResult result;
+    const size_t threads = options.threads
+        ? options.threads
+        : util::ThreadPool::defaultThreadCount(std::thread::hardware_concurrency());
+
+    // threads chunks are being sorted while the next one is filled. The factor
+    // of two accounts for the temporary buffer of std::stable_sort.
+    const size_t chunkRecords =
+        std::max(options.memoryLimit / ((threads + 1) * 2 * sizeof(Record)), size_t(1024));
+
+    const auto outputDir = fs::path(outputPath).parent_path();
+    const auto tempDir = !options.tempDirectory.empty() ? fs::path(options.tempDirectory)
+        : !outputDir.empty() ? outputDir : fs::path(".");
+    TempFiles tempFiles(tempDir, fs::path(outputPath).filename().string() + ".sort-run");
+
+    util::ThreadPool pool(threads);
+    std::deque<std::future<std::error_code>> pending;
+    std::vector<RunFile> runs;
+
+    auto wait_pending = [&pending](size_t maxPending) -> std::error_code
+    {
+        std::error_code ret;
+
+        while (pending.size() > maxPending)
+        {
+            if (auto ec = pending.front().get(); !ret)
+                ret = ec;
+            pending.pop_front();
+        }
+
+        return ret;
+    };
+
+    std::vector<Record> chunk;
+    chunk.reserve(chunkRecords);
+    DataPacket packet = {};
+    std::error_code ec;
+
+    // Run generation: cut the input into chunks, sort each one on the thread
+    // pool and write it to a temporary file.
+    while (true)
+    {
+        ec = input.readPacket(packet);
+
+        if (!ec)
+        {
+            ++result.packets;
+            // Corrupt length fields must not make make_record() throw.
+            const size_t eventCount = std::clamp(get_data_length(packet), 0,
+                                                 static_cast<int>(DataPacketMaxDataWords)) / 3;
+
+            for (size_t ei = 0; ei < eventCount; ++ei)
+                chunk.emplace_back(sorted_events::make_record(packet, ei));
+
+            result.events += eventCount;
+        }
+
+        const bool atEnd = (ec == ListfileError::EndOfFile);
+
+        if (ec && !atEnd)
+            break;
+
+        if (atEnd)
+            ec = {};
+
+        // Small inputs are sorted in memory and written directly.
+        if (atEnd && runs.empty())
+            break;
+
+        if (chunk.size() >= chunkRecords || (atEnd && !chunk.empty()))
+        {
+            RunFile run{ tempFiles.create(), chunk.size() };
+            runs.push_back(run);
+
+            pending.emplace_back(pool.submit(
+                [chunk = std::move(chunk), path = run.path]() mutable -> std::error_code
+                {
+                    sort_chunk(chunk);
+                    RunWriter writer;
+
+                    if (auto ec = writer.open(path))
+                        return ec;
+
+                    if (auto ec = writer.write(chunk.data(), chunk.size()))
+                        return ec;
+
+                    return writer.close();
+                }));
+
+            chunk = {};
+
+            if (!atEnd)
+                chunk.reserve(chunkRecords);
+
+            if ((ec = wait_pending(threads)))
+                break;
+        }
+
+        if (atEnd)
+            break;
+    }
+
+    if (auto ec2 = wait_pending(0); !ec)
+        ec = ec2;
+
+    if (ec)
+        return ec;
+
+    result.runs = runs.size();
+
+    OutputWriter output;
+
+    if ((ec = output.open(outputPath, options.indexStride)))
+        return ec;
+
+    if (runs.empty())
+    {
+        sort_chunk(chunk);
+
+        if ((ec = output.write(chunk.data(), chunk.size())))
+            return ec;
+    }
+    else
+    {
+        const size_t fanIn = std::max(options.maxMergeFanIn, size_t(2));
+        // Read buffers of all runs merged concurrently share the memory limit.
+        const size_t bufferRecords = std::clamp(
+            options.memoryLimit / (threads * fanIn * sizeof(Record)), size_t(1024), size_t(1) << 16);
+
+        // Intermediate passes: merge groups of adjacent runs in parallel
+        // until a single merge suffices. Keeping the groups adjacent
+        // preserves the input order of events with equal timestamps.
+        while (runs.size() > fanIn)
+        {
+            std::vector<RunFile> merged;
+
+            for (size_t i = 0; i < runs.size(); i += fanIn)
+            {
+                std::vector<RunFile> group(runs.begin() + i,
+                                           runs.begin() + std::min(i + fanIn, runs.size()));
+
+                if (group.size() == 1)
+                {
+                    merged.push_back(group[0]);
+                    continue;
+                }
+
+                RunFile out{ tempFiles.create(), 0u };
+
+                for (const auto &run: group)
+                    out.count += run.count;
+
+                merged.push_back(out);
+
+                pending.emplace_back(pool.submit(
+                    [group, out, bufferRecords]() -> std::error_code
+                    {
+                        RunWriter writer;
+
+                        if (auto ec = writer.open(out.path))
+                            return ec;
+
+                        if (auto ec = merge_runs(group, bufferRecords, writer))
+                            return ec;
+
+                        auto ec = writer.close();
+
+                        for (const auto &run: group)
+                        {
+                            std::error_code ec2;
+                            fs::remove(run.path, ec2);
+                        }
+
+                        return ec;
+                    }));
+            }
+
+            ++result.mergePasses;
+
+            if ((ec = wait_pending(0)))
+                return ec;
+
+            runs = std::move(merged);
+        }
+
+        ++result.mergePasses;
+
+        if ((ec = merge_runs(runs, bufferRecords, output)))
+            return ec;
+    }
+
+    if ((ec = output.finish()))
+        return ec;
+
+    spdlog::debug("sort_events: {} events, {} runs, {} merge passes", result.events, result.runs,
+                  result.mergePasses);
+
+    if (resultp)
+        *resultp = result;
+
+    return {};
+}
+
+//
+// SortedEventReader
+//
+
+SortedEventReader::SortedEventReader() = default;
+
+SortedEventReader::~SortedEventReader()
+{
+    close();
+}
+
+std::error_code SortedEventReader::open(const std::string &path)
+{
+    close();
+
+    std::error_code ec;
+
+    if (!(file_ = open_file(path, "rb", ec)))
+        return ec;
+
+    auto fail = [this](ListfileError error)
+    {
+        close();
+        return make_error_code(error);
+    };
+
+    if (std::fread(&header_, sizeof(header_), 1, file_) != 1
+        || std::memcmp(header_.magic, sorted_events::Magic, sizeof(header_.magic)) != 0)
+        return fail(ListfileError::InvalidHeader);
+
+    if (header_.version > sorted_events::Version || header_.recordSize != sizeof(Record))
+        return fail(ListfileError::UnsupportedVersion);
+
+    if (!header_.indexStride)
+        return fail(ListfileError::InvalidHeader);
+
+    index_.resize((header_.eventCount + header_.indexStride - 1) / header_.indexStride);
+
+    if (file_seek(file_, header_.indexOffset) != 0
+        || std::fread(index_.data(), sizeof(index_[0]), index_.size(), file_) != index_.size())
+        return fail(ListfileError::CorruptRecord);
+
+    return seekToEvent(0);
+}
+
+void SortedEventReader::close()
+{
+    if (file_)
+    {
+        std::fclose(file_);
+        file_ = nullptr;
+    }
+
+    header_ = {};
+    index_.clear();
+    position_ = 0u;
+}
+
+std::error_code SortedEventReader::seekToEvent(u64 eventIndex)
+{
+    if (!file_)
+        return ListfileError::NotOpen;
+
+    eventIndex = std::min(eventIndex, header_.eventCount);
+    errno = 0;
+
+    if (file_seek(file_, sizeof(header_) + eventIndex * sizeof(Record)) != 0)
+        return errno_error_code();
+
+    position_ = eventIndex;
+    return {};
+}
+
+std::error_code SortedEventReader::seek(u64 timestamp)
+{
+    if (!file_)
+        return ListfileError::NotOpen;
+
+    // First index entry at or after the timestamp. Matching events may
+    // precede it, so scan from the entry before.
+    auto it = std::lower_bound(index_.begin(), index_.end(), timestamp,
+                               [](const sorted_events::IndexEntry &e, u64 ts) { return e.timestamp < ts; });
+
+    const u64 start = it == index_.begin() ? 0u : std::prev(it)->eventIndex;
+
+    if (auto ec = seekToEvent(start))
+        return ec;
+
+    std::vector<Record> records;
+
+    while (readRecords(records, header_.indexStride))
+    {
+        auto match = std::lower_bound(records.begin(), records.end(), timestamp,
+                                      [](const Record &r, u64 ts) { return r.timestamp < ts; });
+
+        if (match != records.end())
+            return seekToEvent(position_ - (records.end() - match));
+
+        records.clear();
+    }
+
+    return {};
+}
+
+size_t SortedEventReader::readRecords(std::vector<Record> &dest, size_t maxEvents)
+{
+    if (!file_)
+        return 0u;
+
+    const size_t count = std::min(static_cast<u64>(maxEvents), header_.eventCount - position_);
+    const size_t offset = dest.size();
+    dest.resize(offset + count);
+
+    const size_t read = std::fread(dest.data() + offset, sizeof(Record), count, file_);
+    dest.resize(offset + read);
+    position_ += read;
+    return read;
+}
+
+size_t SortedEventReader::read(EventBatch &dest, size_t maxEvents)
+{
+    buffer_.clear();
+    const size_t count = readRecords(buffer_, maxEvents);
+
+    dest.reserve(dest.size() + count);
+
+    for (const auto &record: buffer_)
+        dest.push_back(sorted_events::decode_record(record));
+
+    return count;
+}
+
+}
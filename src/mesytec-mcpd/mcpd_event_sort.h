@@ -0,0 +1,140 @@
+#ifndef __MESYTEC_MCPD_EVENT_SORT_H__
+#define __MESYTEC_MCPD_EVENT_SORT_H__
+
+#include <cstdio>
+#include <string>
+#include <system_error>
+#include <vector>
+
+#include "mcpd_event_batch.h"
+#include "mcpd_packet_source.h"
+
+namespace mesytec::mcpd
+{
+
+// Time sorted event files
+//
+// Events of a listfile sorted by their full timestamp, stored as fixed size
+// records. The file starts with a FileHeader followed by eventCount Records
+// and an index with one IndexEntry for every indexStride-th event which allows
+// seeking to a timestamp without scanning the file. Events with equal
+// timestamps keep their listfile order. All values are little endian.
+namespace sorted_events
+{
+    static const char Magic[8] = { 'M', 'C', 'P', 'D', 'S', 'E', 'V', 'T' };
+    static const u32 Version = 1u;
+
+    struct FileHeader
+    {
+        char magic[8];
+        u32 version;
+        u32 recordSize;     // sizeof(Record)
+        u64 eventCount;
+        u64 indexOffset;    // file offset of the index
+        u32 indexStride;    // events per index entry
+        u32 reserved;
+        u64 firstTimestamp;
+        u64 lastTimestamp;
+    };
+
+    // Record flags
+    static const u8 MdllEvent = 1u << 0; // from an MDLL data packet
+
+    struct Record
+    {
+        u64 timestamp;      // full event timestamp (header + event timestamp)
+        u32 payload;        // bits 19..47 of the raw event word
+        u8 deviceId;
+        u8 flags;
+        u16 reserved;
+    };
+
+    struct IndexEntry
+    {
+        u64 timestamp;      // timestamp of event eventIndex
+        u64 eventIndex;     // a multiple of indexStride
+    };
+
+    static_assert(sizeof(FileHeader) == 56);
+    static_assert(sizeof(Record) == 16);
+    static_assert(sizeof(IndexEntry) == 16);
+
+    // Converts the event at eventNum of the packet.
+    MESYTEC_MCPD_EXPORT Record make_record(const DataPacket &packet, size_t eventNum);
+
+    // The raw packet and event timestamps are not stored and are left at zero.
+    MESYTEC_MCPD_EXPORT DecodedEvent decode_record(const Record &record);
+}
+
+struct MESYTEC_MCPD_EXPORT EventSortOptions
+{
+    // Memory used for sorting. Determines the size of the sorted runs written
+    // to temporary files.
+    size_t memoryLimit = size_t(1) << 30;
+    // Number of sorting threads, 0 uses all cores.
+    unsigned threads = 0u;
+    // Directory for the temporary run files. Defaults to the directory of the
+    // output file.
+    std::string tempDirectory;
+    // Maximum number of runs merged at once. More runs are merged in
+    // multiple passes.
+    size_t maxMergeFanIn = 256u;
+    u32 indexStride = 1u << 16;
+};
+
+struct MESYTEC_MCPD_EXPORT EventSortResult
+{
+    u64 packets = 0u;
+    u64 events = 0u;
+    size_t runs = 0u;           // sorted runs written during run generation
+    size_t mergePasses = 0u;
+};
+
+// Sorts all events of the input by timestamp and writes them to a sorted
+// event file at outputPath. Memory use is bounded by options.memoryLimit
+// independent of the input size: the input is cut into chunks which are
+// sorted in parallel and written to temporary run files, these are then
+// combined using k-way merges.
+MESYTEC_MCPD_EXPORT std::error_code sort_events(PacketSource &input, const std::string &outputPath,
+                                                const EventSortOptions &options,
+                                                EventSortResult *result = nullptr);
+
+class MESYTEC_MCPD_EXPORT SortedEventReader
+{
+  public:
+    SortedEventReader();
+    ~SortedEventReader();
+
+    SortedEventReader(const SortedEventReader &) = delete;
+    SortedEventReader &operator=(const SortedEventReader &) = delete;
+
+    std::error_code open(const std::string &path);
+    void close();
+
+    // Positions the reader on the first event with a timestamp >= the given
+    // value. Uses the index and reads at most indexStride records.
+    std::error_code seek(u64 timestamp);
+    std::error_code seekToEvent(u64 eventIndex);
+
+    // Appends up to maxEvents events to the batch. Returns the number of
+    // events appended, 0 at the end of the file.
+    size_t read(EventBatch &dest, size_t maxEvents);
+    size_t readRecords(std::vector<sorted_events::Record> &dest, size_t maxEvents);
+
+    bool isOpen() const { return file_ != nullptr; }
+    const sorted_events::FileHeader &header() const { return header_; }
+    u64 eventCount() const { return header_.eventCount; }
+    // Index of the next event returned by read().
+    u64 position() const { return position_; }
+
+  private:
+    std::FILE *file_ = nullptr;
+    sorted_events::FileHeader header_ = {};
+    std::vector<sorted_events::IndexEntry> index_;
+    std::vector<sorted_events::Record> buffer_;
+    u64 position_ = 0u;
+};
+
+}
+
+#endif /* __MESYTEC_MCPD_EVENT_SORT_H__ */
@@ -0,0 +1,181 @@
+#include <gtest/gtest.h>
+
+#include <cstring>
+#include <filesystem>
+#include <random>
+#include <unistd.h>
+
+#include "mcpd_event_sort.h"
+#include "mcpd_listfile.h"
+
+using namespace mesytec::mcpd;
+
+namespace
+{
+
+// Packets of two devices with overlapping, locally unordered timestamps.
+std::vector<DataPacket> make_packets(size_t count)
+{
+    namespace ec = event_constants;
+    std::mt19937 rng(1);
+    std::vector<DataPacket> result(count);
+
+    for (size_t pi = 0; pi < count; ++pi)
+    {
+        auto &packet = result[pi];
+        const size_t eventCount = 1 + rng() % 100;
+        const u64 headerTimestamp = pi * 1000 + rng() % 5000;
+
+        packet.bufferType = (pi % 7 == 0) ? MdllDataBufferType : McpdDataBufferType;
+        packet.headerLength = 21;
+        packet.bufferLength = packet.headerLength + eventCount * 3;
+        packet.bufferNumber = pi;
+        packet.deviceId = pi % 2;
+        packet.time[0] = headerTimestamp & 0xffffu;
+        packet.time[1] = (headerTimestamp >> 16) & 0xffffu;
+        packet.time[2] = (headerTimestamp >> 32) & 0xffffu;
+
+        for (size_t ei = 0; ei < eventCount; ++ei)
+        {
+            // Few distinct timestamps to exercise the ordering of equal keys.
+            const u64 event = (u64(rng() % 2) << ec::IdShift)
+                | (u64(rng() % 1024) << ec::neutron::PositionShift)
+                | (u64(ei) << ec::neutron::AmplitudeShift)
+                | (rng() % 16);
+
+            packet.data[ei * 3 + 0] = event & 0xffffu;
+            packet.data[ei * 3 + 1] = (event >> 16) & 0xffffu;
+            packet.data[ei * 3 + 2] = (event >> 32) & 0xffffu;
+        }
+    }
+
+    return result;
+}
+
+class VectorSource: public PacketSource
+{
+  public:
+    explicit VectorSource(const std::vector<DataPacket> &packets): packets_(packets) {}
+
+    std::error_code readPacket(DataPacket &packet) override
+    {
+        if (pos_ >= packets_.size())
+            return ListfileError::EndOfFile;
+        packet = packets_[pos_++];
+        return {};
+    }
+
+    std::error_code rewind() override { pos_ = 0; return {}; }
+    u64 packetsRead() const override { return pos_; }
+
+  private:
+    const std::vector<DataPacket> &packets_;
+    size_t pos_ = 0u;
+};
+
+} // namespace
+
+TEST(EventSort, SortOutOfCore)
+{
+    const auto packets = make_packets(2000);
+
+    // Reference: stable sort of all events in memory.
+    std::vector<sorted_events::Record> expected;
+
+    for (const auto &packet: packets)
+        for (size_t ei = 0; ei < get_event_count(packet); ++ei)
+            expected.push_back(sorted_events::make_record(packet, ei));
+
+    std::stable_sort(expected.begin(), expected.end(),
+                     [](const auto &a, const auto &b) { return a.timestamp < b.timestamp; });
+
+    const auto path = (std::filesystem::temp_directory_path()
+                       / ("mcpd-event-sort-test-" + std::to_string(getpid()))).string();
+
+    // In memory and with tiny memory limits forcing many runs and multiple
+    // merge passes.
+    for (size_t memoryLimit: { size_t(1) << 30, size_t(64) << 10 })
+    {
+        EventSortOptions options;
+        options.memoryLimit = memoryLimit;
+        options.threads = 3;
+        options.maxMergeFanIn = 4;
+        options.indexStride = 1000;
+
+        VectorSource source(packets);
+        EventSortResult result;
+        auto ec = sort_events(source, path, options, &result);
+        ASSERT_FALSE(ec) << ec.message();
+        ASSERT_EQ(result.packets, packets.size());
+        ASSERT_EQ(result.events, expected.size());
+
+        if (memoryLimit < 1u << 20)
+        {
+            ASSERT_GT(result.runs, 16u);
+            ASSERT_GT(result.mergePasses, 1u);
+        }
+
+        SortedEventReader reader;
+        ASSERT_FALSE(reader.open(path));
+        ASSERT_EQ(reader.eventCount(), expected.size());
+        ASSERT_EQ(reader.header().firstTimestamp, expected.front().timestamp);
+        ASSERT_EQ(reader.header().lastTimestamp, expected.back().timestamp);
+
+        std::vector<sorted_events::Record> records;
+        while (reader.readRecords(records, 777)) {}
+
+        ASSERT_EQ(records.size(), expected.size());
+        ASSERT_EQ(std::memcmp(records.data(), expected.data(), records.size() * sizeof(records[0])), 0);
+
+        // Seeking
+        for (u64 ts: { u64(0), expected[12345].timestamp, expected.back().timestamp + 1 })
+        {
+            auto it = std::lower_bound(expected.begin(), expected.end(), ts,
+                                       [](const auto &r, u64 ts) { return r.timestamp < ts; });
+            ASSERT_FALSE(reader.seek(ts));
+            ASSERT_EQ(reader.position(), static_cast<u64>(it - expected.begin()));
+        }
+
+        // Decoding
+        ASSERT_FALSE(reader.seekToEvent(100));
+        EventBatch batch;
+        ASSERT_EQ(reader.read(batch, 10), 10u);
+        const auto event = sorted_events::decode_record(expected[100]);
+        ASSERT_EQ(batch.timestamp[0], event.timestamp);
+        ASSERT_EQ(batch.type[0], event.type);
+        ASSERT_EQ(batch.position[0], event.type == EventType::Neutron ? event.neutron.position
+                  : event.type == EventType::MdllNeutron ? event.mdllNeutron.xPos : 0u);
+    }
+
+    std::filesystem::remove(path);
+}
+
+TEST(EventSort, CorruptPacketLength)
+{
+    auto packets = make_packets(3);
+    const size_t expectedEvents = get_event_count(packets[0]) + get_event_count(packets[2]);
+
+    // Header longer than the buffer: negative data length.
+    packets[1].bufferLength = 10;
+    packets[1].headerLength = 21;
+
+    const auto path = (std::filesystem::temp_directory_path()
+                       / ("mcpd-event-sort-corrupt-test-" + std::to_string(getpid()))).string();
+
+    EventSortOptions options;
+    options.memoryLimit = size_t(1) << 20;
+    options.threads = 1;
+
+    VectorSource source(packets);
+    EventSortResult result;
+    auto ec = sort_events(source, path, options, &result);
+    ASSERT_FALSE(ec) << ec.message();
+    ASSERT_EQ(result.packets, packets.size());
+    ASSERT_EQ(result.events, expectedEvents);
+
+    SortedEventReader reader;
+    ASSERT_FALSE(reader.open(path));
+    ASSERT_EQ(reader.eventCount(), expectedEvents);
+
+    std::filesystem::remove(path);
+}
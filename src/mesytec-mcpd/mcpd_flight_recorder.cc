@@ -0,0 +1,270 @@
+#include "mcpd_flight_recorder.h"
+
+#include <algorithm>
+#include <cstring>
+#include <spdlog/spdlog.h>
+
+#include "util/shared_memory.h"
+
+namespace mesytec::mcpd
+{
+
+namespace
+{
+    // Record size marking the padding at the end of the buffer.
+    const u16 PaddingMarker = 0xffffu;
+    const size_t RecordAlignment = 8u;
+    const size_t RecordHeaderSize = 16u;
+
+    // Size of a RecordHeader followed by the packet, aligned.
+    size_t record_size(size_t packetSize)
+    {
+        return (RecordHeaderSize + packetSize + RecordAlignment - 1u) & ~(RecordAlignment - 1u);
+    }
+}
+
+FlightRecorder::FlightRecorder() = default;
+
+FlightRecorder::~FlightRecorder()
+{
+    release();
+}
+
+void FlightRecorder::release()
+{
+    if (dumpThread_.joinable())
+        dumpThread_.join();
+
+    dumping_ = false;
+    resultPending_ = false;
+
+    if (mem_ && !heapMem_)
+        util::unmap_shared_memory(mem_, capacity_);
+
+    heapMem_.reset();
+    mem_ = nullptr;
+    capacity_ = 0u;
+    hugePages_ = false;
+    head_ = tail_ = 0u;
+    packetCount_ = 0u;
+    newestArrival_ = 0u;
+    counters_ = {};
+}
+
+std::error_code FlightRecorder::init(const Options &options)
+{
+    release();
+
+    const size_t capacity = std::max(options.capacity + util::HugePageSize - 1u, util::HugePageSize)
+        / util::HugePageSize * util::HugePageSize;
+
+    void *mem = nullptr;
+
+    if (auto ec = util::allocate_pages(capacity, &mem, &hugePages_))
+    {
+        if (ec != std::errc::function_not_supported)
+            return ec;
+
+        heapMem_ = std::make_unique<u8[]>(capacity);
+        mem = heapMem_.get();
+    }
+
+    mem_ = static_cast<u8 *>(mem);
+    capacity_ = capacity;
+    options_ = options;
+
+    return {};
+}
+
+u64 FlightRecorder::skipPadding(u64 pos) const
+{
+    const size_t offset = pos % capacity_;
+    const size_t remaining = capacity_ - offset;
+
+    if (remaining < sizeof(RecordHeader)
+        || reinterpret_cast<const RecordHeader *>(mem_ + offset)->size == PaddingMarker)
+    {
+        return pos + remaining;
+    }
+
+    return pos;
+}
+
+const FlightRecorder::RecordHeader *FlightRecorder::recordAt(u64 pos) const
+{
+    return reinterpret_cast<const RecordHeader *>(mem_ + skipPadding(pos) % capacity_);
+}
+
+u64 FlightRecorder::recordEnd(u64 pos) const
+{
+    pos = skipPadding(pos);
+    return pos + record_size(reinterpret_cast<const RecordHeader *>(mem_ + pos % capacity_)->size);
+}
+
+u64 FlightRecorder::oldestArrival() const
+{
+    return packetCount_ ? recordAt(head_)->arrivalTime : 0u;
+}
+
+bool FlightRecorder::evictOldest()
+{
+    const u64 end = recordEnd(head_);
+
+    if (dumping_.load(std::memory_order_acquire) && end > dumpPos_.load(std::memory_order_acquire))
+        return false;
+
+    head_ = end;
+    --packetCount_;
+    ++counters_.evicted;
+    return true;
+}
+
+void FlightRecorder::push(const void *packet, size_t size, u32 srcAddr, u16 srcPort, u64 arrivalTime)
+{
+    if (!mem_)
+        return;
+
+    size = std::min(size, sizeof(DataPacket));
+
+    ++counters_.packets;
+    counters_.bytes += size;
+
+    if (options_.maxAge.count() > 0)
+    {
+        const u64 maxAge = options_.maxAge.count();
+
+        while (packetCount_ && recordAt(head_)->arrivalTime + maxAge < arrivalTime)
+        {
+            if (!evictOldest())
+                break;
+        }
+    }
+
+    const size_t recordSize = record_size(size);
+    const size_t offset = tail_ % capacity_;
+    // A record is never split: pad to the end of the buffer if it does not fit.
+    const size_t padding = capacity_ - offset < recordSize ? capacity_ - offset : 0u;
+    const size_t needed = padding + recordSize;
+
+    while (tail_ + needed - head_ > capacity_)
+    {
+        if (!evictOldest())
+        {
+            ++counters_.dropped;
+            return;
+        }
+    }
+
+    if (padding >= sizeof(RecordHeader))
+        reinterpret_cast<RecordHeader *>(mem_ + offset)->size = PaddingMarker;
+
+    auto dest = mem_ + (tail_ + padding) % capacity_;
+    auto header = reinterpret_cast<RecordHeader *>(dest);
+    header->arrivalTime = arrivalTime;
+    header->srcAddr = srcAddr;
+    header->srcPort = srcPort;
+    header->size = size;
+    std::memcpy(dest + sizeof(RecordHeader), packet, size);
+
+    tail_ += needed;
+    ++packetCount_;
+    newestArrival_ = arrivalTime;
+}
+
+std::error_code FlightRecorder::startDump(const std::string &path,
+                                          const ListfileWriter::Options &options,
+                                          const RunInfo *runInfo)
+{
+    if (!mem_)
+        return std::make_error_code(std::errc::invalid_argument);
+
+    if (isDumping())
+        return std::make_error_code(std::errc::device_or_resource_busy);
+
+    if (dumpThread_.joinable())
+        dumpThread_.join();
+
+    ++counters_.dumps;
+    dumpResult_ = {};
+    resultPending_ = true;
+    dumpPos_.store(head_, std::memory_order_release);
+    dumping_.store(true, std::memory_order_release);
+
+    dumpThread_ = std::thread(&FlightRecorder::dumpLoop, this, path, options,
+                              runInfo ? std::make_unique<RunInfo>(*runInfo) : nullptr, head_, tail_);
+
+    return {};
+}
+
+void FlightRecorder::dumpLoop(std::string path, ListfileWriter::Options options,
+                              std::unique_ptr<RunInfo> runInfo, u64 begin, u64 end)
+{
+    DumpResult result;
+    result.path = path;
+
+    ListfileWriter writer;
+    auto packet = std::make_unique<DataPacket>();
+
+    result.ec = writer.open(path, options);
+
+    if (!result.ec && runInfo && options.encoding != ListfileEncoding::Legacy)
+        result.ec = writer.writeRunInfo(*runInfo);
+
+    for (u64 pos = begin; pos < end && !result.ec;)
+    {
+        const auto header = *recordAt(pos);
+        auto dest = reinterpret_cast<u8 *>(packet.get());
+
+        std::memcpy(dest, recordAt(pos) + 1, header.size);
+        std::memset(dest + header.size, 0, sizeof(DataPacket) - header.size);
+
+        if (!result.packets)
+            result.firstArrival = header.arrivalTime;
+        result.lastArrival = header.arrivalTime;
+
+        pos = recordEnd(pos);
+
+        // The record has been copied: its space may be reused.
+        dumpPos_.store(pos, std::memory_order_release);
+
+        if ((result.ec = writer.writePacket(*packet)))
+            break;
+
+        ++result.packets;
+        result.bytes += header.size;
+    }
+
+    if (writer.isOpen())
+    {
+        auto ec = writer.close();
+
+        if (!result.ec)
+            result.ec = ec;
+    }
+
+    if (result.ec)
+        spdlog::error("FlightRecorder: error writing '{}': {}", path, result.ec.message());
+
+    dumpResult_ = std::move(result);
+    dumping_.store(false, std::memory_order_release);
+}
+
+bool FlightRecorder::pollDump(DumpResult &dest)
+{
+    if (!resultPending_ || isDumping())
+        return false;
+
+    dest = waitForDump();
+    return true;
+}
+
+FlightRecorder::DumpResult FlightRecorder::waitForDump()
+{
+    if (dumpThread_.joinable())
+        dumpThread_.join();
+
+    resultPending_ = false;
+    return dumpResult_;
+}
+
+}
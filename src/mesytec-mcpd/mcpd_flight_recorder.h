@@ -0,0 +1,153 @@
+#ifndef __MESYTEC_MCPD_FLIGHT_RECORDER_H__
+#define __MESYTEC_MCPD_FLIGHT_RECORDER_H__
+
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <string>
+#include <system_error>
+#include <thread>
+
+#include "mcpd_listfile.h"
+#include "mcpd_run_info.h"
+
+namespace mesytec::mcpd
+{
+
+// Pre-trigger packet buffer
+//
+// Keeps the most recently received raw packets in memory, limited by size and
+// optionally by age, so that the data leading up to an interesting condition
+// can be written to a listfile even if the readout is not writing one.
+//
+// Packets are stored back to back in a byte ring together with their arrival
+// time and source address. The ring is allocated once, backed by huge pages
+// where available (see util::allocate_pages()). The oldest packets are
+// dropped to make room for new ones.
+//
+// push() and startDump() must be called from the same thread, typically the
+// readout loop. A dump writes the packets held at the time of the call from a
+// background thread while push() continues: new packets only replace packets
+// which have already been written. If the dump falls so far behind that no
+// such space is left, new packets are not stored and counted as dropped.
+class MESYTEC_MCPD_EXPORT FlightRecorder
+{
+  public:
+    struct Options
+    {
+        // Memory used for the packets and their arrival info. Rounded up to
+        // a multiple of util::HugePageSize.
+        size_t capacity = 256u << 20;
+        // Packets older than this relative to the newest packet are dropped.
+        // 0 keeps packets until their space is needed.
+        std::chrono::nanoseconds maxAge{0};
+    };
+
+    struct Counters
+    {
+        u64 packets = 0u;           // packets pushed
+        u64 bytes = 0u;             // packet bytes pushed
+        u64 evicted = 0u;           // packets dropped from the ring to make room or by age
+        u64 dropped = 0u;           // packets not stored because of a slow dump
+        u64 dumps = 0u;             // dumps started
+    };
+
+    struct DumpResult
+    {
+        std::string path;
+        std::error_code ec;
+        u64 packets = 0u;
+        u64 bytes = 0u;
+        u64 firstArrival = 0u;      // arrival time of the first and last packet written
+        u64 lastArrival = 0u;
+    };
+
+    FlightRecorder();
+    ~FlightRecorder();
+
+    FlightRecorder(const FlightRecorder &) = delete;
+    FlightRecorder &operator=(const FlightRecorder &) = delete;
+
+    // Allocates the ring. Waits for a running dump and discards the current
+    // contents.
+    std::error_code init(const Options &options);
+
+    bool isInitialized() const { return mem_ != nullptr; }
+    bool usesHugePages() const { return hugePages_; }
+    size_t capacity() const { return capacity_; }
+
+    // Stores a copy of the packet, truncated to sizeof(DataPacket). arrivalTime
+    // is in ns, usually since the unix epoch, and must not decrease.
+    void push(const void *packet, size_t size, u32 srcAddr, u16 srcPort, u64 arrivalTime);
+
+    // Starts writing the packets currently held to a new listfile at path.
+    // Returns std::errc::device_or_resource_busy if the previous dump is still
+    // running. Errors of the dump itself are reported by pollDump().
+    std::error_code startDump(const std::string &path, const ListfileWriter::Options &options,
+                              const RunInfo *runInfo = nullptr);
+
+    bool isDumping() const { return dumping_.load(std::memory_order_acquire); }
+
+    // Returns true once for each finished dump, storing its result in dest.
+    bool pollDump(DumpResult &dest);
+
+    // Waits for the current dump to finish and returns its result. The result
+    // is not returned by pollDump() anymore.
+    DumpResult waitForDump();
+
+    // Number of packets held and the bytes used for them.
+    u64 packetCount() const { return packetCount_; }
+    u64 usedBytes() const { return tail_ - head_; }
+    // Arrival time of the oldest and the newest packet held. 0 if empty.
+    u64 oldestArrival() const;
+    u64 newestArrival() const { return packetCount_ ? newestArrival_ : 0u; }
+
+    const Counters &counters() const { return counters_; }
+
+  private:
+    struct RecordHeader
+    {
+        u64 arrivalTime;
+        u32 srcAddr;
+        u16 srcPort;
+        u16 size;
+    };
+
+    static_assert(sizeof(RecordHeader) == 16);
+
+    void release();
+    // Position of the record starting at or after pos, skipping padding at
+    // the end of the buffer.
+    u64 skipPadding(u64 pos) const;
+    const RecordHeader *recordAt(u64 pos) const;
+    // End position of the record at pos.
+    u64 recordEnd(u64 pos) const;
+    // Drops the oldest packet unless it has not been dumped yet.
+    bool evictOldest();
+    void dumpLoop(std::string path, ListfileWriter::Options options, std::unique_ptr<RunInfo> runInfo,
+                  u64 begin, u64 end);
+
+    Options options_;
+    u8 *mem_ = nullptr;
+    std::unique_ptr<u8[]> heapMem_; // used if allocate_pages() is not available
+    size_t capacity_ = 0u;
+    bool hugePages_ = false;
+
+    // Logical byte positions, the buffer offset is position % capacity_.
+    u64 head_ = 0u;
+    u64 tail_ = 0u;
+    u64 packetCount_ = 0u;
+    u64 newestArrival_ = 0u;
+    Counters counters_;
+
+    std::thread dumpThread_;
+    std::atomic<bool> dumping_{false};
+    // Position up to which the running dump has written the packets.
+    std::atomic<u64> dumpPos_{0u};
+    DumpResult dumpResult_;
+    bool resultPending_ = false;    // dump result not yet returned
+};
+
+}
+
+#endif /* __MESYTEC_MCPD_FLIGHT_RECORDER_H__ */
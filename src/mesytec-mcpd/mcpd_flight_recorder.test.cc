@@ -0,0 +1,188 @@
+#include <gtest/gtest.h>
+
+#include <cstring>
+#include <filesystem>
+#include <unistd.h>
+
+#include "mcpd_flight_recorder.h"
+#include "util/shared_memory.h"
+
+using namespace mesytec::mcpd;
+
+namespace
+{
+
+DataPacket make_packet(u32 number)
+{
+    DataPacket packet = {};
+    packet.bufferType = McpdDataBufferType;
+    packet.headerLength = 21;
+    packet.bufferLength = packet.headerLength + 3 * (number % 200);
+    packet.bufferNumber = number;
+    packet.param[0][0] = number & 0xffffu;
+    packet.param[0][1] = number >> 16;
+
+    for (int i = 0; i < get_data_length(packet); ++i)
+        packet.data[i] = number * 7 + i;
+
+    return packet;
+}
+
+void push_packets(FlightRecorder &recorder, u32 first, u32 count, u64 timeStep = 1000u)
+{
+    for (u32 n = first; n < first + count; ++n)
+    {
+        const auto packet = make_packet(n);
+        recorder.push(&packet, get_packet_size(packet), 0xc0a8a864u, 54321, n * timeStep);
+    }
+}
+
+std::string temp_path(const std::string &name)
+{
+    return (std::filesystem::temp_directory_path()
+            / (name + "-" + std::to_string(getpid()) + ".mcpdlst")).string();
+}
+
+// Reads the dumped listfile checking that it contains consecutive, intact
+// packets. Returns the number of packets read.
+u64 check_listfile(const std::string &path, u32 firstNumber)
+{
+    ListfileReader reader;
+    EXPECT_FALSE(reader.open(path));
+
+    DataPacket packet = {};
+    u32 expected = firstNumber;
+
+    while (!reader.readPacket(packet))
+    {
+        const auto reference = make_packet(expected++);
+        EXPECT_EQ(std::memcmp(&packet, &reference, sizeof(packet)), 0);
+
+        if (std::memcmp(&packet, &reference, sizeof(packet)) != 0)
+            break;
+
+        // Framed listfiles only fill the packet up to its length.
+        packet = {};
+    }
+
+    return reader.packetsRead();
+}
+
+} // namespace
+
+TEST(FlightRecorder, KeepsNewestPackets)
+{
+    FlightRecorder recorder;
+    FlightRecorder::Options options;
+    options.capacity = 1u; // rounded up
+    ASSERT_FALSE(recorder.init(options));
+    ASSERT_EQ(recorder.capacity(), util::HugePageSize);
+
+    // Wraps around the buffer several times.
+    const u32 count = 20000u;
+    push_packets(recorder, 0u, count);
+
+    const auto held = recorder.packetCount();
+    ASSERT_GT(held, 0u);
+    ASSERT_LT(held, count);
+    ASSERT_LE(recorder.usedBytes(), recorder.capacity());
+    ASSERT_EQ(recorder.counters().packets, count);
+    ASSERT_EQ(recorder.counters().evicted, count - held);
+    ASSERT_EQ(recorder.counters().dropped, 0u);
+    ASSERT_EQ(recorder.newestArrival(), (count - 1) * 1000u);
+    ASSERT_EQ(recorder.oldestArrival(), (count - held) * 1000u);
+
+    for (auto encoding: { ListfileEncoding::Legacy, ListfileEncoding::Packet })
+    {
+        const auto path = temp_path("mcpd-flight-recorder-test");
+        ListfileWriter::Options listfileOptions;
+        listfileOptions.encoding = encoding;
+        const auto runInfo = make_run_info();
+
+        ASSERT_FALSE(recorder.startDump(path, listfileOptions, &runInfo));
+        const auto result = recorder.waitForDump();
+        ASSERT_FALSE(result.ec);
+        ASSERT_EQ(result.path, path);
+        ASSERT_EQ(result.packets, held);
+        ASSERT_EQ(result.firstArrival, recorder.oldestArrival());
+        ASSERT_EQ(result.lastArrival, recorder.newestArrival());
+
+        ASSERT_EQ(check_listfile(path, count - held), held);
+
+        FlightRecorder::DumpResult polled;
+        ASSERT_FALSE(recorder.pollDump(polled));
+
+        std::filesystem::remove(path);
+    }
+
+    // Dumping does not remove the packets.
+    ASSERT_EQ(recorder.packetCount(), held);
+    ASSERT_EQ(recorder.counters().dumps, 2u);
+}
+
+TEST(FlightRecorder, MaxAge)
+{
+    FlightRecorder recorder;
+    FlightRecorder::Options options;
+    options.maxAge = std::chrono::microseconds(10);
+    ASSERT_FALSE(recorder.init(options));
+
+    push_packets(recorder, 0u, 100u);
+
+    // Packets at most 10 us older than the newest one are kept.
+    ASSERT_EQ(recorder.packetCount(), 11u);
+    ASSERT_EQ(recorder.oldestArrival(), 89000u);
+}
+
+TEST(FlightRecorder, PushWhileDumping)
+{
+    FlightRecorder recorder;
+    FlightRecorder::Options options;
+    options.capacity = 1u;
+    ASSERT_FALSE(recorder.init(options));
+
+    u32 next = 0u;
+    push_packets(recorder, next, 10000u);
+    next += 10000u;
+
+    const auto firstHeld = next - recorder.packetCount();
+    const auto path = temp_path("mcpd-flight-recorder-test");
+    ASSERT_FALSE(recorder.startDump(path, {}));
+
+    // Overwrite the ring while the dump is running. Packets are either
+    // stored in space already written by the dump or dropped.
+    while (recorder.isDumping())
+    {
+        push_packets(recorder, next, 100u);
+        next += 100u;
+
+        if (recorder.isDumping())
+        {
+            ASSERT_EQ(recorder.startDump(path + ".2", {}),
+                      std::errc::device_or_resource_busy);
+        }
+    }
+
+    FlightRecorder::DumpResult result;
+    ASSERT_TRUE(recorder.pollDump(result));
+    ASSERT_FALSE(result.ec);
+    ASSERT_FALSE(recorder.pollDump(result));
+
+    // The dump is intact.
+    ASSERT_EQ(check_listfile(path, firstHeld), result.packets);
+
+    // Now the ring holds the newest packets only, possibly with a gap from
+    // dropped packets: check that the packets after the last dropped one are
+    // intact.
+    const auto dropped = recorder.counters().dropped;
+    push_packets(recorder, next, 10000u);
+    next += 10000u;
+    ASSERT_EQ(recorder.counters().dropped, dropped);
+    ASSERT_FALSE(recorder.startDump(path, {}));
+    result = recorder.waitForDump();
+    ASSERT_FALSE(result.ec);
+    ASSERT_EQ(check_listfile(path, next - recorder.packetCount()), result.packets);
+
+    std::filesystem::remove(path);
+    std::filesystem::remove(path + ".2");
+}
@@ -0,0 +1,352 @@
+#include "mcpd_forwarder.h"
+
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <limits>
+#include <sstream>
+#include <spdlog/spdlog.h>
+
+namespace mesytec::mcpd
+{
+
+namespace
+{
+    std::vector<std::string> split(const std::string &str, char sep)
+    {
+        std::vector<std::string> result;
+        std::string part;
+        std::istringstream ss(str);
+
+        while (std::getline(ss, part, sep))
+            result.push_back(part);
+
+        return result;
+    }
+
+    // Accepts decimal and 0x prefixed hex values up to maxValue.
+    bool parse_unsigned(const std::string &str, unsigned long maxValue, unsigned long &dest)
+    {
+        if (str.empty())
+            return false;
+
+        char *end = nullptr;
+        errno = 0;
+        dest = std::strtoul(str.c_str(), &end, 0);
+
+        return errno == 0 && *end == '\0' && dest <= maxValue;
+    }
+
+    template<typename T>
+    bool parse_value_list(const std::string &str, std::vector<T> &dest)
+    {
+        for (const auto &part: split(str, ','))
+        {
+            unsigned long value = 0;
+
+            if (!parse_unsigned(part, std::numeric_limits<T>::max(), value))
+                return false;
+
+            dest.push_back(static_cast<T>(value));
+        }
+
+        return !dest.empty();
+    }
+
+    template<typename T>
+    bool matches(const std::vector<T> &filter, T value)
+    {
+        return filter.empty() || std::find(filter.begin(), filter.end(), value) != filter.end();
+    }
+
+    size_t round_up_pow2(size_t value)
+    {
+        size_t result = 1u;
+        while (result < value)
+            result <<= 1;
+        return result;
+    }
+}
+
+std::error_code parse_forward_destination(const std::string &spec, ForwardDestination &dest)
+{
+    const auto invalid = std::make_error_code(std::errc::invalid_argument);
+    auto parts = split(spec, '/');
+
+    if (parts.empty() || parts[0].empty())
+        return invalid;
+
+    ForwardDestination result;
+
+    if (auto colon = parts[0].rfind(':'); colon != std::string::npos)
+    {
+        unsigned long port = 0;
+
+        if (!parse_unsigned(parts[0].substr(colon + 1), 0xffffu, port) || port == 0)
+            return invalid;
+
+        result.host = parts[0].substr(0, colon);
+        result.port = port;
+    }
+    else
+        result.host = parts[0];
+
+    if (result.host.empty())
+        return invalid;
+
+    for (size_t i = 1; i < parts.size(); ++i)
+    {
+        const auto &part = parts[i];
+
+        if (part.compare(0, 4, "dev=") == 0)
+        {
+            if (!parse_value_list(part.substr(4), result.deviceIds))
+                return invalid;
+        }
+        else if (part.compare(0, 5, "type=") == 0)
+        {
+            if (!parse_value_list(part.substr(5), result.bufferTypes))
+                return invalid;
+        }
+        else
+            return invalid;
+    }
+
+    dest = result;
+    return {};
+}
+
+std::string to_string(const ForwardDestination &dest)
+{
+    auto result = fmt::format("{}:{}", dest.host, dest.port);
+
+    if (!dest.deviceIds.empty())
+        result += fmt::format("/dev={}", fmt::join(dest.deviceIds, ","));
+
+    if (!dest.bufferTypes.empty())
+        result += fmt::format("/type={:#x}", fmt::join(dest.bufferTypes, ","));
+
+    return result;
+}
+
+PacketForwarder::PacketForwarder() = default;
+
+PacketForwarder::~PacketForwarder()
+{
+    stop();
+}
+
+std::error_code PacketForwarder::start(const std::vector<ForwardDestination> &destinations)
+{
+    return start(destinations, Options{});
+}
+
+std::error_code PacketForwarder::start(const std::vector<ForwardDestination> &destinations,
+                                       const Options &options)
+{
+    stop();
+
+    std::vector<sockaddr_in> destAddrs;
+
+    for (const auto &dest: destinations)
+    {
+        sockaddr_in addr = {};
+
+        if (auto ec = lookup(dest.host, dest.port, addr))
+            return ec;
+
+        destAddrs.push_back(addr);
+    }
+
+    std::error_code ec;
+    int sock = create_bound_udp_socket(0, &ec);
+
+    if (ec)
+        return ec;
+
+    destinations_ = destinations;
+    destAddrs_ = destAddrs;
+    options_ = options;
+    options_.batchSize = std::max(options_.batchSize, size_t(1));
+    sock_ = sock;
+
+    const size_t slotCount = round_up_pow2(std::max(options_.queueSize, size_t(2)));
+    slots_ = std::make_unique<Slot[]>(slotCount);
+    slotMask_ = slotCount - 1;
+    head_ = 0u;
+    tail_ = 0u;
+    packetsDropped_ = 0u;
+
+    datagrams_.reserve(options_.batchSize * destinations_.size());
+    datagramDests_.reserve(datagrams_.capacity());
+
+    {
+        std::lock_guard<std::mutex> lock(countersMutex_);
+        counters_ = {};
+        counters_.destinations.resize(destinations_.size());
+    }
+
+    quit_ = false;
+    thread_ = std::thread(&PacketForwarder::loop, this);
+
+    return {};
+}
+
+void PacketForwarder::stop()
+{
+    if (thread_.joinable())
+    {
+        quit_ = true;
+        thread_.join();
+    }
+
+    if (sock_ >= 0)
+    {
+        close_socket(sock_);
+        sock_ = -1;
+    }
+}
+
+bool PacketForwarder::forward(const void *packet, size_t size)
+{
+    if (!slots_)
+        return false;
+
+    const u64 head = head_.load(std::memory_order_relaxed);
+
+    if (head - tail_.load(std::memory_order_acquire) > slotMask_)
+    {
+        packetsDropped_.fetch_add(1, std::memory_order_relaxed);
+        return false;
+    }
+
+    auto &slot = slots_[head & slotMask_];
+    slot.tQueued = std::chrono::steady_clock::now();
+    slot.size = std::min(size, sizeof(slot.data));
+    std::memcpy(slot.data, packet, slot.size);
+
+    head_.store(head + 1, std::memory_order_release);
+
+    return true;
+}
+
+PacketForwarder::Counters PacketForwarder::counters() const
+{
+    std::lock_guard<std::mutex> lock(countersMutex_);
+    auto result = counters_;
+    result.packetsQueued = head_.load(std::memory_order_relaxed);
+    result.packetsDropped = packetsDropped_.load(std::memory_order_relaxed);
+    return result;
+}
+
+void PacketForwarder::loop()
+{
+    spdlog::debug("PacketForwarder: forwarding to {} destinations", destinations_.size());
+
+    while (true)
+    {
+        const u64 tail = tail_.load(std::memory_order_relaxed);
+        const u64 head = head_.load(std::memory_order_acquire);
+
+        if (head == tail)
+        {
+            if (quit_)
+                break;
+
+            std::this_thread::sleep_for(std::chrono::microseconds(200));
+            continue;
+        }
+
+        const size_t count = std::min(head - tail, static_cast<u64>(options_.batchSize));
+        sendBatch(tail, count);
+        tail_.store(tail + count, std::memory_order_release);
+    }
+
+    spdlog::debug("PacketForwarder: leaving forwarder loop");
+}
+
+void PacketForwarder::sendBatch(size_t first, size_t count)
+{
+    datagrams_.clear();
+    datagramDests_.clear();
+
+    std::vector<DestinationCounters> destCounters(destinations_.size());
+
+    for (size_t i = 0; i < count; ++i)
+    {
+        const auto &slot = slots_[(first + i) & slotMask_];
+        const auto &packet = *reinterpret_cast<const DataPacket *>(slot.data);
+        const bool hasHeader = slot.size >= sizeof(PacketBase) + 4;
+
+        for (size_t di = 0; di < destinations_.size(); ++di)
+        {
+            const auto &dest = destinations_[di];
+
+            if (hasHeader && matches(dest.deviceIds, packet.deviceId)
+                && matches(dest.bufferTypes, packet.bufferType))
+            {
+                datagrams_.push_back({ slot.data, slot.size, destAddrs_[di] });
+                datagramDests_.push_back(di);
+            }
+            else
+                ++destCounters[di].filtered;
+        }
+    }
+
+    size_t sendCalls = 0u;
+    size_t offset = 0u;
+
+    while (offset < datagrams_.size())
+    {
+        size_t sent = 0u;
+        auto ec = send_datagrams(sock_, datagrams_.data() + offset, datagrams_.size() - offset, sent);
+        ++sendCalls;
+
+        for (size_t i = offset; i < offset + sent; ++i)
+        {
+            ++destCounters[datagramDests_[i]].packets;
+            destCounters[datagramDests_[i]].bytes += datagrams_[i].size;
+        }
+
+        offset += sent;
+
+        if (ec)
+        {
+            // Skip the failed datagram, e.g. ECONNREFUSED from a previous send.
+            spdlog::trace("PacketForwarder: error sending to {}: {}",
+                          to_string(destinations_[datagramDests_[offset]]), ec.message());
+            ++destCounters[datagramDests_[offset]].errors;
+            ++offset;
+        }
+    }
+
+    const auto now = std::chrono::steady_clock::now();
+    std::chrono::microseconds lagMax = {};
+    std::chrono::microseconds lagTotal = {};
+
+    for (size_t i = 0; i < count; ++i)
+    {
+        auto lag = std::chrono::duration_cast<std::chrono::microseconds>(
+            now - slots_[(first + i) & slotMask_].tQueued);
+        lagMax = std::max(lagMax, lag);
+        lagTotal += lag;
+    }
+
+    std::lock_guard<std::mutex> lock(countersMutex_);
+
+    counters_.packetsHandled += count;
+    counters_.sendCalls += sendCalls;
+    counters_.lagMax = std::max(counters_.lagMax, lagMax);
+    counters_.lagTotal += lagTotal;
+
+    for (size_t di = 0; di < destCounters.size(); ++di)
+    {
+        auto &dc = counters_.destinations[di];
+        dc.packets += destCounters[di].packets;
+        dc.bytes += destCounters[di].bytes;
+        dc.filtered += destCounters[di].filtered;
+        dc.errors += destCounters[di].errors;
+    }
+}
+
+}
@@ -0,0 +1,141 @@
+#ifndef __MESYTEC_MCPD_FORWARDER_H__
+#define __MESYTEC_MCPD_FORWARDER_H__
+
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <system_error>
+#include <thread>
+#include <vector>
+
+#include "mcpd_core.h"
+
+namespace mesytec::mcpd
+{
+
+// An additional receiver of the raw MCPD UDP data stream.
+struct MESYTEC_MCPD_EXPORT ForwardDestination
+{
+    std::string host;
+    u16 port = McpdDefaultPort;
+    // Only packets from these devices / with these buffer types are
+    // forwarded. Empty vectors match all packets.
+    std::vector<u8> deviceIds;
+    std::vector<u16> bufferTypes;
+};
+
+// Parses "host[:port][/dev=id,...][/type=bufferType,...]", e.g.
+// "monitor-box:54321/dev=0,1/type=0x2".
+MESYTEC_MCPD_EXPORT std::error_code parse_forward_destination(const std::string &spec,
+                                                              ForwardDestination &dest);
+
+MESYTEC_MCPD_EXPORT std::string to_string(const ForwardDestination &dest);
+
+// Re-sends received data packets to a list of extra destinations.
+//
+// forward() is called by the readout loop. It copies the packet into a
+// preallocated single producer/single consumer queue and returns without
+// doing any system calls. If the queue is full the packet is dropped for all
+// destinations, the readout never waits for the forwarder.
+//
+// A separate thread drains the queue in batches, applies the per destination
+// filters and sends all resulting datagrams of a batch using
+// send_datagrams() (sendmmsg() under linux).
+class MESYTEC_MCPD_EXPORT PacketForwarder
+{
+  public:
+    struct Options
+    {
+        size_t queueSize = 4096u;   // packets, rounded up to a power of two
+        size_t batchSize = 64u;     // packets taken from the queue per send call
+    };
+
+    struct DestinationCounters
+    {
+        u64 packets = 0u;           // datagrams sent
+        u64 bytes = 0u;
+        u64 filtered = 0u;          // packets not matching the destinations filter
+        u64 errors = 0u;            // failed sends
+    };
+
+    struct Counters
+    {
+        u64 packetsQueued = 0u;
+        u64 packetsDropped = 0u;    // queue full
+        u64 packetsHandled = 0u;    // taken from the queue by the forwarder thread
+        u64 sendCalls = 0u;
+        // Time from forward() until the packet was sent to all its destinations.
+        std::chrono::microseconds lagMax = {};
+        std::chrono::microseconds lagTotal = {};
+        std::vector<DestinationCounters> destinations;
+
+        std::chrono::microseconds lagMean() const
+        {
+            return std::chrono::microseconds(packetsHandled ? lagTotal.count() / packetsHandled : 0);
+        }
+    };
+
+    PacketForwarder();
+    ~PacketForwarder();
+
+    PacketForwarder(const PacketForwarder &) = delete;
+    PacketForwarder &operator=(const PacketForwarder &) = delete;
+
+    // Resolves the destination hosts, creates the sending socket and starts
+    // the forwarder thread.
+    std::error_code start(const std::vector<ForwardDestination> &destinations);
+    std::error_code start(const std::vector<ForwardDestination> &destinations,
+                          const Options &options);
+
+    // Sends the packets still in the queue and stops the forwarder thread.
+    void stop();
+
+    bool isRunning() const { return thread_.joinable(); }
+
+    // Queues the packet for forwarding. Returns false if the queue was full
+    // and the packet was dropped.
+    bool forward(const void *packet, size_t size);
+
+    const std::vector<ForwardDestination> &destinations() const { return destinations_; }
+
+    Counters counters() const;
+
+  private:
+    struct Slot
+    {
+        std::chrono::steady_clock::time_point tQueued;
+        u32 size;
+        u8 data[MaxPayloadSize];
+    };
+
+    void loop();
+    void sendBatch(size_t first, size_t count);
+
+    std::vector<ForwardDestination> destinations_;
+    std::vector<sockaddr_in> destAddrs_;
+    Options options_;
+    int sock_ = -1;
+
+    std::unique_ptr<Slot[]> slots_;
+    size_t slotMask_ = 0u;
+    // Written by forward() only.
+    alignas(64) std::atomic<u64> head_ = {};
+    std::atomic<u64> packetsDropped_ = {};
+    // Written by the forwarder thread only.
+    alignas(64) std::atomic<u64> tail_ = {};
+
+    std::thread thread_;
+    std::atomic<bool> quit_ = {};
+
+    std::vector<UdpDatagram> datagrams_;
+    std::vector<size_t> datagramDests_;
+
+    mutable std::mutex countersMutex_;
+    Counters counters_;
+};
+
+}
+
+#endif /* __MESYTEC_MCPD_FORWARDER_H__ */
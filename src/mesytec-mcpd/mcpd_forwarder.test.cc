@@ -0,0 +1,99 @@
+#include <gtest/gtest.h>
+
+#include <thread>
+
+#include "mcpd_forwarder.h"
+
+using namespace mesytec::mcpd;
+
+TEST(PacketForwarder, ParseDestination)
+{
+    ForwardDestination dest;
+
+    ASSERT_FALSE(parse_forward_destination("monitor-box", dest));
+    ASSERT_EQ(dest.host, "monitor-box");
+    ASSERT_EQ(dest.port, McpdDefaultPort);
+    ASSERT_TRUE(dest.deviceIds.empty());
+
+    ASSERT_FALSE(parse_forward_destination("10.0.0.5:5000/dev=0,3/type=0x2", dest));
+    ASSERT_EQ(dest.host, "10.0.0.5");
+    ASSERT_EQ(dest.port, 5000);
+    ASSERT_EQ(dest.deviceIds, (std::vector<u8>{ 0, 3 }));
+    ASSERT_EQ(dest.bufferTypes, (std::vector<u16>{ 2 }));
+    ASSERT_EQ(to_string(dest), "10.0.0.5:5000/dev=0,3/type=0x2");
+
+    ASSERT_TRUE(parse_forward_destination("", dest));
+    ASSERT_TRUE(parse_forward_destination(":5000", dest));
+    ASSERT_TRUE(parse_forward_destination("host:0", dest));
+    ASSERT_TRUE(parse_forward_destination("host:70000", dest));
+    ASSERT_TRUE(parse_forward_destination("host/dev=256", dest));
+    ASSERT_TRUE(parse_forward_destination("host/dev=", dest));
+    ASSERT_TRUE(parse_forward_destination("host/foo=1", dest));
+}
+
+TEST(PacketForwarder, ForwardWithFilter)
+{
+    std::error_code ec;
+    int sockAll = create_bound_udp_socket(0, &ec);
+    ASSERT_FALSE(ec);
+    int sockDev1 = create_bound_udp_socket(0, &ec);
+    ASSERT_FALSE(ec);
+    ASSERT_FALSE(set_socket_read_timeout(sockAll, 100));
+    ASSERT_FALSE(set_socket_read_timeout(sockDev1, 100));
+
+    std::vector<ForwardDestination> dests(2);
+    dests[0].host = "127.0.0.1";
+    dests[0].port = get_local_socket_port(sockAll);
+    dests[1].host = "127.0.0.1";
+    dests[1].port = get_local_socket_port(sockDev1);
+    dests[1].deviceIds = { 1 };
+
+    PacketForwarder fwd;
+    ASSERT_FALSE(fwd.start(dests, { 4, 2 }));
+
+    const size_t PacketCount = 10;
+
+    for (size_t i = 0; i < PacketCount; ++i)
+    {
+        DataPacket packet = {};
+        packet.bufferLength = 21;
+        packet.bufferType = McpdDataBufferType;
+        packet.bufferNumber = i;
+        packet.deviceId = i % 2;
+
+        // Give the forwarder a chance to keep up with the tiny queue.
+        while (!fwd.forward(&packet, 42))
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+
+    fwd.stop();
+
+    auto counters = fwd.counters();
+    ASSERT_EQ(counters.packetsHandled, PacketCount);
+    ASSERT_EQ(counters.packetsQueued, PacketCount);
+    ASSERT_EQ(counters.destinations[0].packets, PacketCount);
+    ASSERT_EQ(counters.destinations[1].packets, PacketCount / 2);
+    ASSERT_EQ(counters.destinations[1].filtered, PacketCount / 2);
+
+    auto receive_all = [](int sock)
+    {
+        std::vector<u16> bufferNumbers;
+        DataPacket packet = {};
+        size_t bytesTransferred = 0;
+
+        while (!receive_one_packet(sock, reinterpret_cast<u8 *>(&packet), sizeof(packet),
+                                   bytesTransferred, 100))
+        {
+            EXPECT_EQ(bytesTransferred, 42u);
+            bufferNumbers.push_back(packet.bufferNumber);
+        }
+
+        return bufferNumbers;
+    };
+
+    ASSERT_EQ(receive_all(sockAll), (std::vector<u16>{ 0, 1, 2, 3, 4, 5, 6, 7, 8, 9 }));
+    ASSERT_EQ(receive_all(sockDev1), (std::vector<u16>{ 1, 3, 5, 7, 9 }));
+
+    close_socket(sockAll);
+    close_socket(sockDev1);
+}
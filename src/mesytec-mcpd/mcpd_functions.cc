@@ -693,6 +693,133 @@ std::error_code write_peripheral_register(
     return {};
 }
 
+namespace
+{
+
+// Receives packets from the socket until a response matching the request
+// arrives. Unrelated packets are logged and skipped.
+std::error_code receive_matching_response(
+    int sock,
+    const CommandPacket &request,
+    CommandPacket &response)
+{
+    const unsigned MaxSkippedPackets = 5;
+
+    for (unsigned skipped=0; skipped<MaxSkippedPackets; ++skipped)
+    {
+        if (auto ec = receive_response(sock, response))
+            return ec;
+
+        if (response.bufferType != CommandPacketBufferType)
+        {
+            spdlog::warn("unexpected response buffer type 0x{:04X}",
+                         response.bufferType);
+            continue;
+        }
+
+        if ((response.cmd & CommandNumberMask) != request.cmd)
+        {
+            spdlog::warn("request/response cmd mismatch: req={}, resp={}",
+                         request.cmd, response.cmd & CommandNumberMask);
+            continue;
+        }
+
+        if (has_error(response))
+            return make_error_code(static_cast<CommandError>(get_error_value(response)));
+
+        return {};
+    }
+
+    return make_error_code(std::errc::timed_out);
+}
+
+} // end anon namespace
+
+McpdGroupCommandResult mcpd_group_command(
+    const std::vector<McpdGroupMember> &members,
+    const CommandType &cmd,
+    const std::vector<u16> &data)
+{
+    using Clock = std::chrono::steady_clock;
+
+    const size_t memberCount = members.size();
+
+    McpdGroupCommandResult result;
+    result.errors.resize(memberCount);
+    result.sendOffsets.resize(memberCount);
+
+    std::vector<CommandPacket> requests(memberCount);
+
+    for (size_t i=0; i<memberCount; ++i)
+        result.errors[i] = prepare_command_packet(requests[i], cmd, members[i].mcpdId, data);
+
+    // Timing critical part: nothing but send() calls in here. Logging is
+    // done afterwards.
+    const auto tStart = Clock::now();
+    auto tLastSend = tStart;
+
+    for (size_t i=0; i<memberCount; ++i)
+    {
+        if (result.errors[i])
+            continue;
+
+        result.sendOffsets[i] = Clock::now() - tStart;
+        result.errors[i] = send_command(members[i].sock, requests[i]);
+        tLastSend = Clock::now();
+    }
+
+    result.sendSkew = tLastSend - tStart;
+
+    spdlog::debug("group {}: sent {} requests, skew={} us",
+                  to_string(cmd), memberCount,
+                  std::chrono::duration_cast<std::chrono::microseconds>(result.sendSkew).count());
+
+    std::vector<size_t> needRetry;
+
+    for (size_t i=0; i<memberCount; ++i)
+    {
+        auto &ec = result.errors[i];
+
+        if (!ec)
+        {
+            CommandPacket response = {};
+            ec = receive_matching_response(members[i].sock, requests[i], response);
+        }
+
+        if (ec == SocketErrorType::Timeout || ec == std::errc::timed_out)
+            needRetry.push_back(i);
+    }
+
+    for (auto i: needRetry)
+    {
+        spdlog::warn("group {}: no response from mcpdId={}, retrying",
+                     to_string(cmd), members[i].mcpdId);
+
+        CommandPacket response = {};
+        result.errors[i] = command_transaction(members[i].sock, requests[i], response);
+        ++result.retriedCount;
+    }
+
+    result.totalTime = Clock::now() - tStart;
+
+    return result;
+}
+
+McpdGroupCommandResult mcpd_group_start_daq(const std::vector<McpdGroupMember> &members)
+{
+    return mcpd_group_command(members, CommandType::StartDAQ);
+}
+
+McpdGroupCommandResult mcpd_group_stop_daq(const std::vector<McpdGroupMember> &members)
+{
+    return mcpd_group_command(members, CommandType::StopDAQ);
+}
+
+McpdGroupCommandResult mcpd_group_continue_daq(const std::vector<McpdGroupMember> &members)
+{
+    return mcpd_group_command(members, CommandType::ContinueDAQ);
+}
+
 #if 0 // untested/not implemented according to Gregor
 std::error_code mcpd_send_serial_string(
     int sock, u8 mcpdId,
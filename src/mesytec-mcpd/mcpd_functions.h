@@ -1,6 +1,8 @@
 #ifndef __MESYTEC_MCPD_FUNCTIONS_H__
 #define __MESYTEC_MCPD_FUNCTIONS_H__
 
+#include <algorithm>
+#include <chrono>
 #include <vector>
 #include <cstring>
 
@@ -176,6 +178,61 @@ std::error_code MESYTEC_MCPD_EXPORT write_peripheral_register(
     int sock, u8 mcpdId, u8 mpsdId,
     u16 registerNumber, u16 registerValue);
 
+//
+// Multi-MCPD DAQ control
+//
+
+// One device taking part in a group command: the connected command socket
+// (see connect_udp_socket()) and the mcpd id to use.
+struct MESYTEC_MCPD_EXPORT McpdGroupMember
+{
+    int sock = -1;
+    u8 mcpdId = 0;
+};
+
+struct MESYTEC_MCPD_EXPORT McpdGroupCommandResult
+{
+    // One entry per group member in input order. Empty if the device confirmed
+    // the command.
+    std::vector<std::error_code> errors;
+
+    // Offset of each members send() call relative to the first one.
+    std::vector<std::chrono::nanoseconds> sendOffsets;
+
+    // Number of members which did not respond to the initial back-to-back
+    // send and had to be retried individually. Their start/stop time is not
+    // covered by sendSkew.
+    unsigned retriedCount = 0u;
+
+    // Time from the start of the first send() to the end of the last send().
+    std::chrono::nanoseconds sendSkew = {};
+
+    // Total time including waiting for all responses and retries.
+    std::chrono::nanoseconds totalTime = {};
+
+    size_t failedCount() const
+    {
+        return std::count_if(std::begin(errors), std::end(errors),
+                             [] (const std::error_code &ec) { return static_cast<bool>(ec); });
+    }
+
+    bool ok() const { return failedCount() == 0; }
+};
+
+// Sends the same command to all members with minimal skew: all command
+// packets are built upfront and sent back to back from the calling thread,
+// then the responses are collected. Members not confirming the command are
+// retried using command_transaction(). Per-member results are stored in the
+// returned structure.
+McpdGroupCommandResult MESYTEC_MCPD_EXPORT mcpd_group_command(
+    const std::vector<McpdGroupMember> &members,
+    const CommandType &cmd,
+    const std::vector<u16> &data = {});
+
+McpdGroupCommandResult MESYTEC_MCPD_EXPORT mcpd_group_start_daq(const std::vector<McpdGroupMember> &members);
+McpdGroupCommandResult MESYTEC_MCPD_EXPORT mcpd_group_stop_daq(const std::vector<McpdGroupMember> &members);
+McpdGroupCommandResult MESYTEC_MCPD_EXPORT mcpd_group_continue_daq(const std::vector<McpdGroupMember> &members);
+
 //
 // MPSD specific
 //
@@ -0,0 +1,128 @@
+#include <atomic>
+#include <gtest/gtest.h>
+#include <thread>
+
+#include "mcpd_functions.h"
+
+#ifdef SOCKET_PLATFORM_POSIX
+#include <sys/socket.h>
+#endif
+
+using namespace mesytec::mcpd;
+
+namespace
+{
+
+// Minimal MCPD stand-in listening on a local port. Answers each command
+// packet by mirroring it back unless 'silent' is set.
+class FakeMcpd
+{
+  public:
+    explicit FakeMcpd(bool silent = false)
+        : silent_(silent)
+    {
+        sock_ = create_bound_udp_socket(0);
+        set_socket_read_timeout(sock_, 50);
+        port_ = get_local_socket_port(sock_);
+        thread_ = std::thread(&FakeMcpd::loop, this);
+    }
+
+    ~FakeMcpd()
+    {
+        quit_ = true;
+        thread_.join();
+        close_socket(sock_);
+    }
+
+    u16 port() const { return port_; }
+    size_t commandsReceived() const { return commandsReceived_; }
+
+  private:
+    void loop()
+    {
+        while (!quit_)
+        {
+            CommandPacket packet = {};
+            size_t bytesTransferred = 0;
+            sockaddr_in srcAddr = {};
+
+            auto ec = receive_one_packet(sock_, reinterpret_cast<u8 *>(&packet), sizeof(packet),
+                                         bytesTransferred, 50, &srcAddr);
+
+            if (ec || !bytesTransferred)
+                continue;
+
+            ++commandsReceived_;
+
+            if (!silent_)
+            {
+                ::sendto(sock_, reinterpret_cast<const char *>(&packet),
+                         packet.bufferLength * sizeof(u16), 0,
+                         reinterpret_cast<const sockaddr *>(&srcAddr), sizeof(srcAddr));
+            }
+        }
+    }
+
+    bool silent_;
+    int sock_ = -1;
+    u16 port_ = 0;
+    std::atomic<bool> quit_ = false;
+    std::atomic<size_t> commandsReceived_ = 0;
+    std::thread thread_;
+};
+
+} // namespace
+
+TEST(McpdGroupCommand, AllConfirm)
+{
+    std::vector<std::unique_ptr<FakeMcpd>> fakes;
+    std::vector<McpdGroupMember> members;
+
+    for (u8 id = 0; id < 4; ++id)
+    {
+        fakes.emplace_back(std::make_unique<FakeMcpd>());
+        members.push_back({connect_udp_socket("127.0.0.1", fakes.back()->port()), id});
+        ASSERT_GE(members.back().sock, 0);
+    }
+
+    auto result = mcpd_group_start_daq(members);
+
+    ASSERT_TRUE(result.ok());
+    ASSERT_EQ(result.errors.size(), members.size());
+    ASSERT_EQ(result.sendOffsets.size(), members.size());
+    ASSERT_EQ(result.retriedCount, 0u);
+    ASSERT_LE(result.sendSkew, result.totalTime);
+
+    for (auto &fake: fakes)
+        ASSERT_EQ(fake->commandsReceived(), 1u);
+
+    for (auto &member: members)
+        close_socket(member.sock);
+}
+
+TEST(McpdGroupCommand, ReportsSilentDevice)
+{
+    FakeMcpd good;
+    FakeMcpd silent(true);
+
+    std::vector<McpdGroupMember> members = {
+        {connect_udp_socket("127.0.0.1", good.port()), 0},
+        {connect_udp_socket("127.0.0.1", silent.port()), 1},
+    };
+
+    // Keep the retry phase short.
+    for (auto &member: members)
+        set_socket_read_timeout(member.sock, 20);
+
+    auto result = mcpd_group_stop_daq(members);
+
+    ASSERT_FALSE(result.ok());
+    ASSERT_EQ(result.failedCount(), 1u);
+    ASSERT_FALSE(result.errors[0]);
+    ASSERT_TRUE(result.errors[1]);
+    ASSERT_EQ(result.retriedCount, 1u);
+    ASSERT_GT(silent.commandsReceived(), 1u);
+
+    for (auto &member: members)
+        close_socket(member.sock);
+}
@@ -0,0 +1,207 @@
+#ifndef __MESYTEC_MCPD_HISTO_H__
+#define __MESYTEC_MCPD_HISTO_H__
+
+#include <algorithm>
+#include <stdexcept>
+#include <vector>
+
+#include "mcpd_event_batch.h"
+
+namespace mesytec::mcpd
+{
+
+// Integer axis covering the value range [0, bins << shift). Values are right
+// shifted before binning which allows rebinning by powers of two, e.g. a 19
+// bit timestamp into 1024 bins using shift=9.
+struct MESYTEC_MCPD_EXPORT HistoAxis
+{
+    u32 bins = 1024u;
+    u32 shift = 0u;
+
+    u64 range() const { return static_cast<u64>(bins) << shift; }
+
+    bool operator==(const HistoAxis &o) const { return bins == o.bins && shift == o.shift; }
+    bool operator!=(const HistoAxis &o) const { return !(*this == o); }
+};
+
+inline HistoAxis make_axis_for_bits(unsigned valueBits, unsigned binBits)
+{
+    binBits = std::min(valueBits, binBits);
+    return { 1u << binBits, valueBits - binBits };
+}
+
+// Dense one dimensional histogram with flat storage. The storage is allocated
+// once on construction so pointers to the data stay valid for the lifetime
+// of the histogram.
+//
+// Histograms are not thread-safe. Use one instance per thread and merge()
+// them on demand.
+template<typename T>
+class Histo1D
+{
+  public:
+    using value_type = T;
+
+    Histo1D() = default;
+
+    explicit Histo1D(const HistoAxis &axis)
+        : axis_(axis)
+        , data_(axis.bins)
+    {}
+
+    void fill(u64 value)
+    {
+        const u64 bin = value >> axis_.shift;
+
+        if (bin < data_.size())
+            ++data_[bin];
+        else
+            ++overflow_;
+    }
+
+    template<typename V>
+    void fill(const V *values, size_t count)
+    {
+        for (size_t i = 0; i < count; ++i)
+            fill(values[i]);
+    }
+
+    // Fills only values whose corresponding type entry equals 'type'.
+    template<typename V>
+    void fill(const V *values, const EventType *types, EventType type, size_t count)
+    {
+        for (size_t i = 0; i < count; ++i)
+        {
+            if (types[i] == type)
+                fill(values[i]);
+        }
+    }
+
+    void merge(const Histo1D &other)
+    {
+        if (axis_ != other.axis_)
+            throw std::invalid_argument("Histo1D::merge: axis mismatch");
+
+        for (size_t i = 0; i < data_.size(); ++i)
+            data_[i] += other.data_[i];
+
+        overflow_ += other.overflow_;
+    }
+
+    void clear()
+    {
+        std::fill(data_.begin(), data_.end(), T{});
+        overflow_ = 0u;
+    }
+
+    const HistoAxis &axis() const { return axis_; }
+    const std::vector<T> &data() const { return data_; }
+    T *data() { return data_.data(); }
+    size_t size() const { return data_.size(); }
+    T operator[](size_t bin) const { return data_[bin]; }
+
+    // Number of values that were >= axis().range().
+    u64 overflow() const { return overflow_; }
+
+  private:
+    HistoAxis axis_ = {};
+    std::vector<T> data_;
+    u64 overflow_ = 0u;
+};
+
+// Dense two dimensional histogram, row major: index = y * xBins + x.
+template<typename T>
+class Histo2D
+{
+  public:
+    using value_type = T;
+
+    Histo2D() = default;
+
+    Histo2D(const HistoAxis &xAxis, const HistoAxis &yAxis)
+        : xAxis_(xAxis)
+        , yAxis_(yAxis)
+        , data_(static_cast<size_t>(xAxis.bins) * yAxis.bins)
+    {}
+
+    void fill(u64 x, u64 y)
+    {
+        const u64 xBin = x >> xAxis_.shift;
+        const u64 yBin = y >> yAxis_.shift;
+
+        if (xBin < xAxis_.bins && yBin < yAxis_.bins)
+            ++data_[yBin * xAxis_.bins + xBin];
+        else
+            ++overflow_;
+    }
+
+    template<typename X, typename Y>
+    void fill(const X *xs, const Y *ys, size_t count)
+    {
+        for (size_t i = 0; i < count; ++i)
+            fill(xs[i], ys[i]);
+    }
+
+    template<typename X, typename Y>
+    void fill(const X *xs, const Y *ys, const EventType *types, EventType type, size_t count)
+    {
+        for (size_t i = 0; i < count; ++i)
+        {
+            if (types[i] == type)
+                fill(xs[i], ys[i]);
+        }
+    }
+
+    void merge(const Histo2D &other)
+    {
+        if (xAxis_ != other.xAxis_ || yAxis_ != other.yAxis_)
+            throw std::invalid_argument("Histo2D::merge: axis mismatch");
+
+        for (size_t i = 0; i < data_.size(); ++i)
+            data_[i] += other.data_[i];
+
+        overflow_ += other.overflow_;
+    }
+
+    void clear()
+    {
+        std::fill(data_.begin(), data_.end(), T{});
+        overflow_ = 0u;
+    }
+
+    const HistoAxis &xAxis() const { return xAxis_; }
+    const HistoAxis &yAxis() const { return yAxis_; }
+    const std::vector<T> &data() const { return data_; }
+    T *data() { return data_.data(); }
+    size_t size() const { return data_.size(); }
+    T at(u32 xBin, u32 yBin) const { return data_[static_cast<size_t>(yBin) * xAxis_.bins + xBin]; }
+    u64 overflow() const { return overflow_; }
+
+  private:
+    HistoAxis xAxis_ = {};
+    HistoAxis yAxis_ = {};
+    std::vector<T> data_;
+    u64 overflow_ = 0u;
+};
+
+// Batch fill from EventBatch columns, e.g.
+//   fill_column(histo, batch, &EventBatch::amplitude, EventType::Neutron);
+template<typename T, typename V>
+void fill_column(Histo1D<T> &histo, const EventBatch &batch,
+                 std::vector<V> EventBatch::*column, EventType type)
+{
+    histo.fill((batch.*column).data(), batch.type.data(), type, batch.size());
+}
+
+template<typename T, typename X, typename Y>
+void fill_columns(Histo2D<T> &histo, const EventBatch &batch,
+                  std::vector<X> EventBatch::*xColumn, std::vector<Y> EventBatch::*yColumn,
+                  EventType type)
+{
+    histo.fill((batch.*xColumn).data(), (batch.*yColumn).data(), batch.type.data(), type,
+               batch.size());
+}
+
+}
+
+#endif /* __MESYTEC_MCPD_HISTO_H__ */
@@ -0,0 +1,84 @@
+#include <gtest/gtest.h>
+#include <thread>
+
+#include "mcpd_histo.h"
+
+using namespace mesytec::mcpd;
+
+TEST(Histo, Fill1D)
+{
+    Histo1D<u32> histo(make_axis_for_bits(19, 10));
+
+    ASSERT_EQ(histo.axis().bins, 1024u);
+    ASSERT_EQ(histo.axis().shift, 9u);
+    ASSERT_EQ(histo.axis().range(), 1u << 19);
+
+    histo.fill(0);
+    histo.fill(511);
+    histo.fill(512);
+    histo.fill(1u << 19);
+
+    ASSERT_EQ(histo[0], 2u);
+    ASSERT_EQ(histo[1], 1u);
+    ASSERT_EQ(histo.overflow(), 1u);
+
+    histo.clear();
+    ASSERT_EQ(histo[0], 0u);
+    ASSERT_EQ(histo.overflow(), 0u);
+}
+
+TEST(Histo, FillFromEventBatch)
+{
+    EventBatch batch;
+
+    for (u16 i = 0; i < 10; ++i)
+    {
+        DecodedEvent event = {};
+        event.type = (i % 2) ? EventType::Trigger : EventType::Neutron;
+        event.neutron.amplitude = i;
+        event.neutron.position = 1023 - i;
+        batch.push_back(event);
+    }
+
+    Histo1D<u64> amplitudes(HistoAxis{ 1024, 0 });
+    fill_column(amplitudes, batch, &EventBatch::amplitude, EventType::Neutron);
+
+    ASSERT_EQ(amplitudes[0], 1u);
+    ASSERT_EQ(amplitudes[1], 0u);
+    ASSERT_EQ(amplitudes[8], 1u);
+
+    Histo2D<u32> xy(HistoAxis{ 16, 6 }, HistoAxis{ 16, 6 });
+    fill_columns(xy, batch, &EventBatch::amplitude, &EventBatch::position, EventType::Neutron);
+
+    ASSERT_EQ(xy.at(0, 15), 5u);
+    ASSERT_EQ(xy.overflow(), 0u);
+}
+
+TEST(Histo, MergePerThread)
+{
+    const HistoAxis axis{ 64, 0 };
+    std::vector<Histo1D<u64>> perThread(4, Histo1D<u64>(axis));
+    std::vector<std::thread> threads;
+
+    for (size_t ti = 0; ti < perThread.size(); ++ti)
+    {
+        threads.emplace_back([&histo = perThread[ti]]
+                             {
+                                 for (u32 i = 0; i < 6400; ++i)
+                                     histo.fill(i % 64);
+                             });
+    }
+
+    for (auto &t: threads)
+        t.join();
+
+    Histo1D<u64> total(axis);
+
+    for (const auto &histo: perThread)
+        total.merge(histo);
+
+    for (size_t bin = 0; bin < total.size(); ++bin)
+        ASSERT_EQ(total[bin], 400u);
+
+    ASSERT_THROW(total.merge(Histo1D<u64>(HistoAxis{ 32, 0 })), std::invalid_argument);
+}
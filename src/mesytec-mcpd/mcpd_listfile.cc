@@ -0,0 +1,782 @@
+#include "mcpd_listfile.h"
+
+#include <cerrno>
+#include <cstring>
+
+#ifdef __linux__
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+#include "mcpd_event_codec.h"
+#include "util/lz4_block.h"
+#include "util/thread_pool.h"
+
+namespace
+{
+
+class ListfileErrorCategory: public std::error_category
+{
+    const char *name() const noexcept override
+    {
+        return "listfile_error";
+    }
+
+    std::string message(int ev) const override
+    {
+        using LE = mesytec::mcpd::ListfileError;
+
+        switch (static_cast<LE>(ev))
+        {
+            case LE::NoError:
+                return "NoError";
+            case LE::EndOfFile:
+                return "EndOfFile";
+            case LE::NotOpen:
+                return "NotOpen";
+            case LE::InvalidHeader:
+                return "InvalidHeader";
+            case LE::UnsupportedVersion:
+                return "UnsupportedVersion";
+            case LE::CorruptRecord:
+                return "CorruptRecord";
+            case LE::RecordsNotSupported:
+                return "RecordsNotSupported";
+        }
+
+        return "unknown listfile error";
+    }
+};
+
+const ListfileErrorCategory theListfileErrorCategory{};
+
+// Buffer size used for stdio file streams.
+const size_t FileBufferSize = 1u << 20;
+
+std::error_code errno_error_code(int fallback = EIO)
+{
+    return std::error_code(errno ? errno : fallback, std::generic_category());
+}
+
+int file_seek(std::FILE *f, mesytec::mcpd::u64 offset)
+{
+#ifdef _WIN32
+    return _fseeki64(f, offset, SEEK_SET);
+#else
+    return fseeko(f, offset, SEEK_SET);
+#endif
+}
+
+// Upper limit of compression/decompression threads used by default.
+const size_t DefaultMaxCompressionThreads = 4;
+
+}
+
+namespace mesytec::mcpd
+{
+
+std::error_code make_error_code(ListfileError error)
+{
+    return { static_cast<int>(error), theListfileErrorCategory };
+}
+
+const char *to_string(ListfileEncoding encoding)
+{
+    switch (encoding)
+    {
+        case ListfileEncoding::Legacy:
+            return "legacy";
+        case ListfileEncoding::Packet:
+            return "packet";
+        case ListfileEncoding::Coded:
+            return "coded";
+    }
+
+    return "unknown";
+}
+
+bool parse_listfile_encoding(const std::string &str, ListfileEncoding &dest)
+{
+    for (auto encoding: { ListfileEncoding::Legacy, ListfileEncoding::Packet, ListfileEncoding::Coded })
+    {
+        if (str == to_string(encoding))
+        {
+            dest = encoding;
+            return true;
+        }
+    }
+
+    return false;
+}
+
+const char *to_string(ListfileCompression compression)
+{
+    switch (compression)
+    {
+        case ListfileCompression::None:
+            return "none";
+        case ListfileCompression::Lz4:
+            return "lz4";
+    }
+
+    return "unknown";
+}
+
+bool parse_listfile_compression(const std::string &str, ListfileCompression &dest)
+{
+    for (auto compression: { ListfileCompression::None, ListfileCompression::Lz4 })
+    {
+        if (str == to_string(compression))
+        {
+            dest = compression;
+            return true;
+        }
+    }
+
+    return false;
+}
+
+namespace
+{
+
+// Returns the CompressedBlock record payload for the given records.
+std::vector<u8> compress_block(const std::vector<u8> &records)
+{
+    listfile::BlockHeader header = {};
+    header.codec = static_cast<u8>(listfile::BlockCodec::Lz4);
+    header.rawSize = records.size();
+
+    std::vector<u8> result(sizeof(header) + util::lz4_compress_bound(records.size()));
+    size_t size = util::lz4_compress(records.data(), records.size(), result.data() + sizeof(header),
+                                     result.size() - sizeof(header));
+
+    if (size == 0 || size >= records.size())
+    {
+        header.codec = static_cast<u8>(listfile::BlockCodec::Stored);
+        std::memcpy(result.data() + sizeof(header), records.data(), records.size());
+        size = records.size();
+    }
+
+    std::memcpy(result.data(), &header, sizeof(header));
+    result.resize(sizeof(header) + size);
+    return result;
+}
+
+bool decompress_block(const std::vector<u8> &payload, std::vector<u8> &dest)
+{
+    listfile::BlockHeader header = {};
+
+    if (payload.size() < sizeof(header))
+        return false;
+
+    std::memcpy(&header, payload.data(), sizeof(header));
+
+    if (header.rawSize > listfile::MaxRecordSize)
+        return false;
+
+    const u8 *data = payload.data() + sizeof(header);
+    const size_t size = payload.size() - sizeof(header);
+    dest.resize(header.rawSize);
+
+    switch (static_cast<listfile::BlockCodec>(header.codec))
+    {
+        case listfile::BlockCodec::Stored:
+            if (size != header.rawSize)
+                return false;
+            std::memcpy(dest.data(), data, size);
+            return true;
+
+        case listfile::BlockCodec::Lz4:
+            return util::lz4_decompress(data, size, dest.data(), dest.size());
+    }
+
+    return false;
+}
+
+}
+
+//
+// ListfileWriter
+//
+
+ListfileWriter::ListfileWriter() = default;
+
+ListfileWriter::~ListfileWriter()
+{
+    close();
+}
+
+std::error_code ListfileWriter::open(const std::string &path)
+{
+    return open(path, Options{});
+}
+
+std::error_code ListfileWriter::open(const std::string &path, const Options &options)
+{
+    close();
+
+    if (options.encoding == ListfileEncoding::Legacy
+        && options.compression != ListfileCompression::None)
+        return ListfileError::RecordsNotSupported;
+
+    errno = 0;
+    file_ = std::fopen(path.c_str(), "wb");
+
+    if (!file_)
+        return errno_error_code();
+
+    std::setvbuf(file_, nullptr, _IOFBF, FileBufferSize);
+
+    path_ = path;
+    options_ = options;
+    bytesWritten_ = 0u;
+    packetsWritten_ = 0u;
+    preallocated_ = false;
+    block_.clear();
+
+    if (options_.compression != ListfileCompression::None)
+    {
+        const size_t threads = options_.compressionThreads
+            ? options_.compressionThreads
+            : util::ThreadPool::defaultThreadCount(DefaultMaxCompressionThreads);
+
+        if (!pool_ || pool_->size() != threads)
+            pool_ = std::make_unique<util::ThreadPool>(threads);
+
+        block_.reserve(options_.blockSize + sizeof(DataPacket));
+    }
+
+    if (options_.encoding != ListfileEncoding::Legacy)
+    {
+        listfile::FileHeader header = {};
+        std::memcpy(header.magic, listfile::Magic, sizeof(header.magic));
+        header.version = listfile::Version;
+
+        if (auto ec = write(&header, sizeof(header)))
+            return ec;
+
+        // Make the format detectable by readers following the file.
+        if (auto ec = flush())
+            return ec;
+    }
+
+    return {};
+}
+
+std::error_code ListfileWriter::writePacket(const DataPacket &packet)
+{
+    std::error_code ec;
+
+    switch (options_.encoding)
+    {
+        case ListfileEncoding::Legacy:
+            ec = write(&packet, sizeof(packet));
+            break;
+
+        case ListfileEncoding::Packet:
+            ec = writeRecord(listfile::RecordType::Packet, &packet, get_packet_size(packet));
+            break;
+
+        case ListfileEncoding::Coded:
+            buffer_.clear();
+            encode_packet(packet, buffer_);
+            ec = writeRecord(listfile::RecordType::CodedPacket, buffer_.data(), buffer_.size());
+            break;
+    }
+
+    if (!ec)
+        ++packetsWritten_;
+
+    return ec;
+}
+
+std::error_code ListfileWriter::writeRecord(listfile::RecordType type, const void *data, size_t size)
+{
+    if (options_.encoding == ListfileEncoding::Legacy)
+        return ListfileError::RecordsNotSupported;
+
+    if (options_.compression == ListfileCompression::None)
+        return writeRecordToFile(type, data, size);
+
+    if (!file_)
+        return ListfileError::NotOpen;
+
+    listfile::RecordHeader header = {};
+    header.type = static_cast<u16>(type);
+    header.size = size;
+
+    auto bytes = reinterpret_cast<const u8 *>(&header);
+    block_.insert(block_.end(), bytes, bytes + sizeof(header));
+    bytes = reinterpret_cast<const u8 *>(data);
+    block_.insert(block_.end(), bytes, bytes + size);
+
+    if (block_.size() >= options_.blockSize)
+        return submitBlock();
+
+    return {};
+}
+
+std::error_code ListfileWriter::writeRunInfo(const RunInfo &info)
+{
+    if (options_.encoding == ListfileEncoding::Legacy)
+        return ListfileError::RecordsNotSupported;
+
+    const auto data = serialize_run_info(info);
+
+    // Keep the record uncompressed if nothing has been queued for compression
+    // yet so that ListfileReader::open() can pick it up.
+    if (block_.empty() && pendingBlocks_.empty())
+        return writeRecordToFile(listfile::RecordType::RunInfo, data.data(), data.size());
+
+    return writeRecord(listfile::RecordType::RunInfo, data.data(), data.size());
+}
+
+std::error_code ListfileWriter::writeRecordToFile(listfile::RecordType type, const void *data, size_t size)
+{
+    listfile::RecordHeader header = {};
+    header.type = static_cast<u16>(type);
+    header.size = size;
+
+    if (auto ec = write(&header, sizeof(header)))
+        return ec;
+
+    return write(data, size);
+}
+
+std::error_code ListfileWriter::submitBlock()
+{
+    if (!block_.empty())
+    {
+        pendingBlocks_.emplace_back(
+            pool_->submit([records = std::move(block_)] { return compress_block(records); }));
+
+        block_ = {};
+        block_.reserve(options_.blockSize + sizeof(DataPacket));
+    }
+
+    return writeCompressedBlocks(false);
+}
+
+std::error_code ListfileWriter::writeCompressedBlocks(bool wait)
+{
+    // Enough blocks in flight to keep all threads busy.
+    const size_t maxPending = 2 * pool_->size();
+
+    while (!pendingBlocks_.empty())
+    {
+        auto &front = pendingBlocks_.front();
+
+        if (!wait && pendingBlocks_.size() <= maxPending
+            && front.wait_for(std::chrono::seconds(0)) != std::future_status::ready)
+        {
+            break;
+        }
+
+        const auto payload = front.get();
+        pendingBlocks_.pop_front();
+
+        if (auto ec = writeRecordToFile(listfile::RecordType::CompressedBlock, payload.data(),
+                                        payload.size()))
+        {
+            return ec;
+        }
+    }
+
+    return {};
+}
+
+std::error_code ListfileWriter::flush()
+{
+    if (!file_)
+        return ListfileError::NotOpen;
+
+    if (pool_ && options_.compression != ListfileCompression::None)
+    {
+        if (auto ec = submitBlock())
+            return ec;
+
+        if (auto ec = writeCompressedBlocks(true))
+            return ec;
+    }
+
+    errno = 0;
+
+    if (std::fflush(file_) != 0)
+        return errno_error_code();
+
+    return {};
+}
+
+std::error_code ListfileWriter::close()
+{
+    if (!file_)
+        return {};
+
+    auto ec = flush();
+    pendingBlocks_.clear();
+
+#ifdef __linux__
+    // Release the preallocated space beyond the end of the data.
+    if (!ec && preallocated_ && ::ftruncate(fileno(file_), bytesWritten_) != 0)
+        ec = errno_error_code();
+#endif
+
+    errno = 0;
+    const int res = std::fclose(file_);
+    file_ = nullptr;
+
+    if (!ec && res != 0)
+        ec = errno_error_code();
+
+    return ec;
+}
+
+std::error_code ListfileWriter::preallocate([[maybe_unused]] u64 size)
+{
+    if (!file_)
+        return ListfileError::NotOpen;
+
+#ifdef __linux__
+    if (::fallocate(fileno(file_), FALLOC_FL_KEEP_SIZE, 0, size) != 0)
+        return errno_error_code();
+
+    preallocated_ = true;
+#endif
+
+    return {};
+}
+
+std::error_code ListfileWriter::write(const void *data, size_t size)
+{
+    if (!file_)
+        return ListfileError::NotOpen;
+
+    errno = 0;
+
+    if (std::fwrite(data, 1, size, file_) != size)
+        return errno_error_code();
+
+    bytesWritten_ += size;
+    return {};
+}
+
+//
+// ListfileReader
+//
+
+ListfileReader::ListfileReader() = default;
+
+ListfileReader::~ListfileReader()
+{
+    close();
+}
+
+std::error_code ListfileReader::open(const std::string &path)
+{
+    close();
+
+    errno = 0;
+    file_ = std::fopen(path.c_str(), "rb");
+
+    if (!file_)
+        return errno_error_code(ENOENT);
+
+    std::setvbuf(file_, nullptr, _IOFBF, FileBufferSize);
+
+    path_ = path;
+    packetsRead_ = 0u;
+    runInfo_.reset();
+
+    listfile::FileHeader header = {};
+
+    if (read(&header, sizeof(header))
+        && std::memcmp(header.magic, listfile::Magic, sizeof(header.magic)) == 0)
+    {
+        if (header.version > listfile::Version)
+        {
+            close();
+            return ListfileError::UnsupportedVersion;
+        }
+
+        legacy_ = false;
+        dataStart_ = sizeof(header);
+
+        // Pick up the run metadata record following the file header.
+        listfile::RecordHeader recordHeader = {};
+
+        if (read(&recordHeader, sizeof(recordHeader))
+            && static_cast<listfile::RecordType>(recordHeader.type) == listfile::RecordType::RunInfo
+            && recordHeader.size <= listfile::MaxRecordSize)
+        {
+            std::vector<u8> payload(recordHeader.size);
+            RunInfo info;
+
+            if (read(payload.data(), payload.size())
+                && deserialize_run_info(payload.data(), payload.size(), info))
+            {
+                runInfo_ = std::move(info);
+            }
+        }
+    }
+    else
+    {
+        legacy_ = true;
+        dataStart_ = 0u;
+    }
+
+    return rewindTo(dataStart_);
+}
+
+void ListfileReader::close()
+{
+    resetBlocks();
+    haveBlocks_ = false;
+
+    if (file_)
+    {
+        std::fclose(file_);
+        file_ = nullptr;
+    }
+}
+
+std::error_code ListfileReader::rewind()
+{
+    if (!file_)
+        return ListfileError::NotOpen;
+
+    resetBlocks();
+    packetsRead_ = 0u;
+    return rewindTo(dataStart_);
+}
+
+void ListfileReader::resetBlocks()
+{
+    // Outstanding decompression tasks own their data and finish on their own.
+    pendingBlocks_.clear();
+    block_ = {};
+    blockPos_ = 0u;
+}
+
+std::error_code ListfileReader::readPacket(DataPacket &packet)
+{
+    if (!file_)
+        return ListfileError::NotOpen;
+
+    while (true)
+    {
+        if (legacy_)
+        {
+            if (!read(&packet, sizeof(packet)))
+            {
+                if (auto ec = rewindTo(offset_))
+                    return ec;
+                return ListfileError::EndOfFile;
+            }
+
+            offset_ += sizeof(packet);
+            ++packetsRead_;
+            return {};
+        }
+
+        bool havePacket = false;
+
+        // Records of the current decompressed block.
+        if (blockPos_ < block_.data.size())
+        {
+            listfile::RecordHeader header = {};
+
+            if (block_.data.size() - blockPos_ < sizeof(header))
+                return ListfileError::CorruptRecord;
+
+            std::memcpy(&header, block_.data.data() + blockPos_, sizeof(header));
+            blockPos_ += sizeof(header);
+
+            if (header.size > block_.data.size() - blockPos_)
+                return ListfileError::CorruptRecord;
+
+            const u8 *data = block_.data.data() + blockPos_;
+            blockPos_ += header.size;
+
+            if (static_cast<listfile::RecordType>(header.type) == listfile::RecordType::CompressedBlock)
+                return ListfileError::CorruptRecord;
+
+            if (auto ec = handleRecord(static_cast<listfile::RecordType>(header.type), data,
+                                       header.size, packet, havePacket))
+                return ec;
+
+            if (havePacket)
+                return {};
+
+            continue;
+        }
+
+        if (haveBlocks_)
+        {
+            if (auto ec = readAheadBlocks())
+                return ec;
+
+            if (!pendingBlocks_.empty())
+            {
+                block_ = pendingBlocks_.front().get();
+                blockPos_ = 0u;
+                pendingBlocks_.pop_front();
+
+                if (!block_.valid)
+                    return ListfileError::CorruptRecord;
+
+                continue;
+            }
+        }
+
+        listfile::RecordHeader header = {};
+        bool complete = read(&header, sizeof(header));
+
+        if (complete && header.size > listfile::MaxRecordSize)
+            return ListfileError::CorruptRecord;
+
+        if (complete)
+        {
+            buffer_.resize(header.size);
+            complete = read(buffer_.data(), header.size);
+        }
+
+        if (!complete)
+        {
+            if (auto ec = rewindTo(offset_))
+                return ec;
+            return ListfileError::EndOfFile;
+        }
+
+        offset_ += sizeof(header) + header.size;
+
+        const auto type = static_cast<listfile::RecordType>(header.type);
+
+        if (type == listfile::RecordType::CompressedBlock)
+        {
+            haveBlocks_ = true;
+            submitBlock(std::move(buffer_));
+            buffer_ = {};
+            continue;
+        }
+
+        if (auto ec = handleRecord(type, buffer_.data(), buffer_.size(), packet, havePacket))
+            return ec;
+
+        if (havePacket)
+            return {};
+
+        // Skip records of unknown types.
+    }
+}
+
+std::error_code ListfileReader::handleRecord(listfile::RecordType type, const u8 *data, size_t size,
+                                             DataPacket &dest, bool &havePacket)
+{
+    switch (type)
+    {
+        case listfile::RecordType::Packet:
+            {
+                if (size < sizeof(PacketBase) || size > sizeof(dest))
+                    return ListfileError::CorruptRecord;
+
+                auto bytes = reinterpret_cast<u8 *>(&dest);
+                std::memcpy(bytes, data, size);
+                std::memset(bytes + size, 0, sizeof(dest) - size);
+
+                // The record must hold the full packet announced in its header.
+                if (get_packet_size(dest) > size)
+                    return ListfileError::CorruptRecord;
+            }
+            break;
+
+        case listfile::RecordType::CodedPacket:
+            if (!decode_packet(data, size, dest))
+                return ListfileError::CorruptRecord;
+            break;
+
+        case listfile::RecordType::RunInfo:
+            {
+                RunInfo info;
+
+                if (deserialize_run_info(data, size, info))
+                    runInfo_ = std::move(info);
+            }
+            return {};
+
+        default:
+            return {};
+    }
+
+    havePacket = true;
+    ++packetsRead_;
+    return {};
+}
+
+void ListfileReader::submitBlock(std::vector<u8> &&payload)
+{
+    if (!pool_)
+        pool_ = std::make_unique<util::ThreadPool>(
+            util::ThreadPool::defaultThreadCount(DefaultMaxCompressionThreads));
+
+    pendingBlocks_.emplace_back(pool_->submit(
+        [payload = std::move(payload)]
+        {
+            Block block;
+            block.valid = decompress_block(payload, block.data);
+            return block;
+        }));
+}
+
+std::error_code ListfileReader::readAheadBlocks()
+{
+    const size_t maxPending = 2 * pool_->size();
+
+    while (pendingBlocks_.size() < maxPending)
+    {
+        listfile::RecordHeader header = {};
+        bool complete = read(&header, sizeof(header));
+
+        if (complete
+            && (static_cast<listfile::RecordType>(header.type) != listfile::RecordType::CompressedBlock
+                || header.size > listfile::MaxRecordSize))
+        {
+            // Leave other records to readPacket().
+            complete = false;
+        }
+
+        std::vector<u8> payload;
+
+        if (complete)
+        {
+            payload.resize(header.size);
+            complete = read(payload.data(), payload.size());
+        }
+
+        if (!complete)
+            return rewindTo(offset_);
+
+        offset_ += sizeof(header) + header.size;
+        submitBlock(std::move(payload));
+    }
+
+    return {};
+}
+
+bool ListfileReader::read(void *dest, size_t size)
+{
+    return std::fread(dest, 1, size, file_) == size;
+}
+
+std::error_code ListfileReader::rewindTo(u64 offset)
+{
+    std::clearerr(file_);
+    errno = 0;
+
+    if (file_seek(file_, offset) != 0)
+        return errno_error_code();
+
+    offset_ = offset;
+    return {};
+}
+
+}
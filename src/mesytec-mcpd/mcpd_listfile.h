@@ -0,0 +1,269 @@
+#ifndef __MESYTEC_MCPD_LISTFILE_H__
+#define __MESYTEC_MCPD_LISTFILE_H__
+
+#include <cstdio>
+#include <deque>
+#include <future>
+#include <memory>
+#include <optional>
+#include <string>
+#include <system_error>
+#include <vector>
+
+#include "mcpd_core.h"
+#include "mcpd_packet_source.h"
+#include "mcpd_run_info.h"
+
+namespace util
+{
+    class ThreadPool;
+}
+
+namespace mesytec::mcpd
+{
+
+// Listfile formats
+//
+// Legacy listfiles are a plain sequence of sizeof(DataPacket) sized records,
+// one per received packet, regardless of the actual packet length.
+//
+// Framed listfiles start with a FileHeader followed by records, each
+// consisting of a RecordHeader and 'size' bytes of payload. Readers skip
+// records of unknown types. All values are little endian.
+//
+// With compression enabled the records are collected into blocks of about
+// Options::blockSize bytes. Each block is stored as a CompressedBlock record
+// whose payload is a BlockHeader followed by the compressed records.
+//
+// A RunInfo record written by the readout directly follows the FileHeader. It
+// is never compressed.
+namespace listfile
+{
+    static const char Magic[8] = { 'M', 'C', 'P', 'D', 'L', 'I', 'S', 'T' };
+    static const u32 Version = 1u;
+
+    struct FileHeader
+    {
+        char magic[8];
+        u32 version;
+        u32 flags;
+    };
+
+    enum class RecordType: u16
+    {
+        Packet = 1,             // The first get_packet_size() bytes of a DataPacket.
+        CodedPacket = 2,        // A packet encoded by encode_packet().
+        CompressedBlock = 3,    // A BlockHeader followed by a compressed sequence of records.
+        RunInfo = 4,            // Run metadata serialized by serialize_run_info().
+    };
+
+    struct RecordHeader
+    {
+        u16 type;
+        u16 flags;
+        u32 size;           // payload size in bytes
+    };
+
+    enum class BlockCodec: u8
+    {
+        Stored = 0,         // uncompressed, used if compression does not pay off
+        Lz4 = 1,            // LZ4 block format
+    };
+
+    struct BlockHeader
+    {
+        u8 codec;
+        u8 flags;
+        u16 reserved;
+        u32 rawSize;        // size of the decompressed records in bytes
+    };
+
+    static_assert(sizeof(FileHeader) == 16);
+    static_assert(sizeof(RecordHeader) == 8);
+    static_assert(sizeof(BlockHeader) == 8);
+
+    // Largest record payload accepted by the reader.
+    static const u32 MaxRecordSize = 64u * 1024u * 1024u;
+}
+
+enum class ListfileEncoding
+{
+    Legacy,     // fixed size raw packets, readable by all versions
+    Packet,     // framed, raw packets of their actual length
+    Coded,      // framed, packets compacted using encode_packet()
+};
+
+MESYTEC_MCPD_EXPORT const char *to_string(ListfileEncoding encoding);
+
+// Accepts the names returned by to_string(ListfileEncoding).
+MESYTEC_MCPD_EXPORT bool parse_listfile_encoding(const std::string &str, ListfileEncoding &dest);
+
+enum class ListfileCompression
+{
+    None,
+    Lz4,
+};
+
+MESYTEC_MCPD_EXPORT const char *to_string(ListfileCompression compression);
+MESYTEC_MCPD_EXPORT bool parse_listfile_compression(const std::string &str, ListfileCompression &dest);
+
+enum class ListfileError
+{
+    NoError,
+    EndOfFile,
+    NotOpen,
+    InvalidHeader,
+    UnsupportedVersion,
+    CorruptRecord,
+    RecordsNotSupported,    // writeRecord() or compression with a legacy listfile
+};
+
+MESYTEC_MCPD_EXPORT std::error_code make_error_code(ListfileError error);
+
+class MESYTEC_MCPD_EXPORT ListfileWriter
+{
+  public:
+    struct Options
+    {
+        ListfileEncoding encoding = ListfileEncoding::Legacy;
+        // Block compression. Requires a framed encoding.
+        ListfileCompression compression = ListfileCompression::None;
+        // Number of compression threads, 0 picks a default based on the
+        // number of cores.
+        unsigned compressionThreads = 0u;
+        // Uncompressed size at which a block is handed to the compression
+        // threads.
+        u32 blockSize = 1u << 20;
+    };
+
+    ListfileWriter();
+    ~ListfileWriter();
+
+    ListfileWriter(const ListfileWriter &) = delete;
+    ListfileWriter &operator=(const ListfileWriter &) = delete;
+
+    // Creates or truncates the file and writes the file header.
+    std::error_code open(const std::string &path);
+    std::error_code open(const std::string &path, const Options &options);
+
+    std::error_code writePacket(const DataPacket &packet);
+
+    // Writes a record of the given type. Requires a framed encoding.
+    std::error_code writeRecord(listfile::RecordType type, const void *data, size_t size);
+
+    // Writes the run metadata record. Should be called right after open() so
+    // that readers find it without scanning the file. Requires a framed
+    // encoding.
+    std::error_code writeRunInfo(const RunInfo &info);
+
+    // With compression enabled flush() also compresses and writes the current
+    // partial block and waits for all blocks to be written.
+    std::error_code flush();
+    std::error_code close();
+
+    // Reserves disk space for a file of the given size without changing the
+    // file size, so that writing does not have to allocate blocks. Unused
+    // space is released on close(). Only implemented under Linux, a no-op on
+    // other systems.
+    std::error_code preallocate(u64 size);
+
+    bool isOpen() const { return file_ != nullptr; }
+    const std::string &path() const { return path_; }
+    const Options &options() const { return options_; }
+    u64 bytesWritten() const { return bytesWritten_; }
+    u64 packetsWritten() const { return packetsWritten_; }
+
+  private:
+    std::error_code write(const void *data, size_t size);
+    std::error_code writeRecordToFile(listfile::RecordType type, const void *data, size_t size);
+    std::error_code submitBlock();
+    // Writes compressed blocks in order. Waits for all blocks if wait is set,
+    // otherwise only for as many as needed to limit the blocks in flight.
+    std::error_code writeCompressedBlocks(bool wait);
+
+    std::FILE *file_ = nullptr;
+    std::string path_;
+    Options options_;
+    u64 bytesWritten_ = 0u;
+    u64 packetsWritten_ = 0u;
+    bool preallocated_ = false;
+    std::vector<u8> buffer_;
+    std::vector<u8> block_;
+    std::deque<std::future<std::vector<u8>>> pendingBlocks_;
+    std::unique_ptr<util::ThreadPool> pool_;
+};
+
+// Reads legacy and framed listfiles. Compressed blocks are decompressed in
+// parallel by a small thread pool which reads ahead of the current position.
+class MESYTEC_MCPD_EXPORT ListfileReader: public PacketSource
+{
+  public:
+    ListfileReader();
+    ~ListfileReader();
+
+    ListfileReader(const ListfileReader &) = delete;
+    ListfileReader &operator=(const ListfileReader &) = delete;
+
+    // Opens the file and detects the format.
+    std::error_code open(const std::string &path);
+    void close();
+
+    // Reads the next data packet. Returns ListfileError::EndOfFile at the end
+    // of the file. A partially written last record also results in EndOfFile
+    // and is read again by the next call, so files which are still being
+    // written can be followed.
+    std::error_code readPacket(DataPacket &packet) override;
+
+    // Rewinds to the first record.
+    std::error_code rewind() override;
+
+    bool isOpen() const { return file_ != nullptr; }
+    bool isLegacy() const { return legacy_; }
+    const std::string &path() const { return path_; }
+    u64 bytesRead() const { return offset_; }
+    u64 packetsRead() const override { return packetsRead_; }
+    // The run metadata stored at the start of the file, updated if another
+    // RunInfo record is encountered while reading.
+    const RunInfo *runInfo() const override { return runInfo_ ? &*runInfo_ : nullptr; }
+
+  private:
+    struct Block
+    {
+        std::vector<u8> data;
+        bool valid = false;
+    };
+
+    // Reads exactly size bytes. Returns false on a short read.
+    bool read(void *dest, size_t size);
+    std::error_code rewindTo(u64 offset);
+    // Interprets a record. Sets havePacket if a packet was stored in dest.
+    std::error_code handleRecord(listfile::RecordType type, const u8 *data, size_t size,
+                                 DataPacket &dest, bool &havePacket);
+    void submitBlock(std::vector<u8> &&payload);
+    // Queues the directly following CompressedBlock records for decompression.
+    std::error_code readAheadBlocks();
+    void resetBlocks();
+
+    std::FILE *file_ = nullptr;
+    std::string path_;
+    bool legacy_ = false;
+    u64 dataStart_ = 0u;    // offset of the first record
+    u64 offset_ = 0u;       // file offset of the next record
+    u64 packetsRead_ = 0u;
+    std::vector<u8> buffer_;
+    bool haveBlocks_ = false; // set once the first compressed block was seen
+    Block block_;           // current decompressed block
+    size_t blockPos_ = 0u;  // offset of the next record in block_
+    std::deque<std::future<Block>> pendingBlocks_;
+    std::unique_ptr<util::ThreadPool> pool_;
+    std::optional<RunInfo> runInfo_;
+};
+
+}
+
+namespace std
+{
+    template<> struct is_error_code_enum<mesytec::mcpd::ListfileError>: true_type {};
+}
+
+#endif /* __MESYTEC_MCPD_LISTFILE_H__ */
@@ -0,0 +1,243 @@
+#include <gtest/gtest.h>
+
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <unistd.h>
+
+#include "mcpd_listfile.h"
+
+using namespace mesytec::mcpd;
+
+namespace
+{
+
+std::string test_file_path(const char *suffix)
+{
+    return (std::filesystem::temp_directory_path()
+            / ("mcpd-listfile-test-" + std::to_string(getpid()) + "-" + suffix)).string();
+}
+
+DataPacket make_packet(u16 bufferNumber, size_t events)
+{
+    DataPacket packet = {};
+    packet.bufferType = McpdDataBufferType;
+    packet.headerLength = 21;
+    packet.bufferLength = packet.headerLength + events * 3;
+    packet.bufferNumber = bufferNumber;
+
+    for (size_t i = 0; i < events * 3; ++i)
+        packet.data[i] = bufferNumber * 1000 + i;
+
+    return packet;
+}
+
+} // namespace
+
+TEST(Listfile, WriteReadAllEncodings)
+{
+    for (auto encoding: { ListfileEncoding::Legacy, ListfileEncoding::Packet, ListfileEncoding::Coded })
+    {
+        const auto path = test_file_path(to_string(encoding));
+
+        ListfileWriter writer;
+        ListfileWriter::Options options;
+        options.encoding = encoding;
+        ASSERT_FALSE(writer.open(path, options));
+
+        for (u16 i = 0; i < 10; ++i)
+            ASSERT_FALSE(writer.writePacket(make_packet(i, i * 20)));
+
+        if (encoding != ListfileEncoding::Legacy)
+        {
+            // Unknown record types are skipped by the reader.
+            const char unknown[] = "future record type";
+            ASSERT_FALSE(writer.writeRecord(static_cast<listfile::RecordType>(0x7fff), unknown, sizeof(unknown)));
+        }
+        else
+            ASSERT_EQ(writer.writeRecord(listfile::RecordType::Packet, "", 0), ListfileError::RecordsNotSupported);
+
+        ASSERT_FALSE(writer.writePacket(make_packet(10, 1)));
+        ASSERT_EQ(writer.packetsWritten(), 11u);
+        ASSERT_FALSE(writer.close());
+
+        ListfileReader reader;
+        ASSERT_FALSE(reader.open(path));
+        ASSERT_EQ(reader.isLegacy(), encoding == ListfileEncoding::Legacy);
+
+        for (int pass = 0; pass < 2; ++pass)
+        {
+            DataPacket packet = {};
+
+            for (u16 i = 0; i < 11; ++i)
+            {
+                ASSERT_FALSE(reader.readPacket(packet)) << to_string(encoding) << " " << i;
+                auto expected = make_packet(i, i < 10 ? i * 20 : 1);
+                ASSERT_EQ(std::memcmp(&packet, &expected, get_packet_size(expected)), 0);
+            }
+
+            ASSERT_EQ(reader.readPacket(packet), ListfileError::EndOfFile);
+            ASSERT_EQ(reader.packetsRead(), 11u);
+            ASSERT_FALSE(reader.rewind());
+        }
+
+        std::filesystem::remove(path);
+    }
+}
+
+TEST(Listfile, CompressedBlocks)
+{
+    for (auto encoding: { ListfileEncoding::Packet, ListfileEncoding::Coded })
+    {
+        const auto path = test_file_path("compressed");
+
+        ListfileWriter writer;
+        ListfileWriter::Options options;
+        options.encoding = encoding;
+        options.compression = ListfileCompression::Lz4;
+        options.compressionThreads = 3;
+        options.blockSize = 4096;
+        ASSERT_FALSE(writer.open(path, options));
+
+        const u16 PacketCount = 2000;
+
+        for (u16 i = 0; i < PacketCount; ++i)
+        {
+            ASSERT_FALSE(writer.writePacket(make_packet(i, i % 100)));
+
+            if (i == PacketCount / 2)
+                ASSERT_FALSE(writer.flush());
+        }
+
+        ASSERT_FALSE(writer.close());
+
+        ListfileReader reader;
+        ASSERT_FALSE(reader.open(path));
+        DataPacket packet = {};
+
+        for (u16 i = 0; i < PacketCount; ++i)
+        {
+            ASSERT_FALSE(reader.readPacket(packet)) << i;
+            auto expected = make_packet(i, i % 100);
+            ASSERT_EQ(std::memcmp(&packet, &expected, get_packet_size(expected)), 0);
+        }
+
+        ASSERT_EQ(reader.readPacket(packet), ListfileError::EndOfFile);
+
+        ASSERT_FALSE(reader.rewind());
+        ASSERT_FALSE(reader.readPacket(packet));
+        ASSERT_EQ(packet.bufferNumber, 0);
+
+        std::filesystem::remove(path);
+    }
+
+    ListfileWriter writer;
+    ListfileWriter::Options options;
+    options.compression = ListfileCompression::Lz4;
+    ASSERT_EQ(writer.open(test_file_path("legacy-lz4"), options), ListfileError::RecordsNotSupported);
+}
+
+TEST(Listfile, PartialRecordIsReadAgain)
+{
+    for (auto compression: { ListfileCompression::None, ListfileCompression::Lz4 })
+    for (auto encoding: { ListfileEncoding::Legacy, ListfileEncoding::Coded })
+    {
+        if (encoding == ListfileEncoding::Legacy && compression != ListfileCompression::None)
+            continue;
+
+        const auto path = test_file_path("partial");
+
+        ListfileWriter writer;
+        ListfileWriter::Options options;
+        options.encoding = encoding;
+        options.compression = compression;
+        ASSERT_FALSE(writer.open(path, options));
+        ASSERT_FALSE(writer.writePacket(make_packet(1, 10)));
+        ASSERT_FALSE(writer.flush());
+        ASSERT_FALSE(writer.writePacket(make_packet(2, 10)));
+        ASSERT_FALSE(writer.close());
+
+        // Cut the file in the middle of the second record.
+        const auto fullSize = std::filesystem::file_size(path);
+        std::vector<char> tail(20);
+        {
+            std::FILE *f = std::fopen(path.c_str(), "rb");
+            std::fseek(f, fullSize - tail.size(), SEEK_SET);
+            ASSERT_EQ(std::fread(tail.data(), 1, tail.size(), f), tail.size());
+            std::fclose(f);
+        }
+        std::filesystem::resize_file(path, fullSize - tail.size());
+
+        ListfileReader reader;
+        ASSERT_FALSE(reader.open(path));
+
+        DataPacket packet = {};
+        ASSERT_FALSE(reader.readPacket(packet));
+        ASSERT_EQ(packet.bufferNumber, 1);
+        ASSERT_EQ(reader.readPacket(packet), ListfileError::EndOfFile);
+        ASSERT_EQ(reader.readPacket(packet), ListfileError::EndOfFile);
+
+        // Complete the record, the reader picks it up.
+        {
+            std::FILE *f = std::fopen(path.c_str(), "ab");
+            std::fwrite(tail.data(), 1, tail.size(), f);
+            std::fclose(f);
+        }
+
+        ASSERT_FALSE(reader.readPacket(packet));
+        ASSERT_EQ(packet.bufferNumber, 2);
+        ASSERT_EQ(reader.readPacket(packet), ListfileError::EndOfFile);
+
+        std::filesystem::remove(path);
+    }
+}
+
+TEST(Listfile, TruncatedPacketRecords)
+{
+    const auto path = test_file_path("truncated");
+
+    ListfileWriter writer;
+    ListfileWriter::Options options;
+    options.encoding = ListfileEncoding::Packet;
+    ASSERT_FALSE(writer.open(path, options));
+
+    // A long packet followed by a short one: nothing of the first may be
+    // left in the second.
+    ASSERT_FALSE(writer.writePacket(make_packet(1, 100)));
+    ASSERT_FALSE(writer.writePacket(make_packet(2, 1)));
+    // Shorter than announced by its bufferLength.
+    const auto packet = make_packet(3, 10);
+    ASSERT_FALSE(writer.writeRecord(listfile::RecordType::Packet, &packet, get_packet_size(packet) - 2));
+    ASSERT_FALSE(writer.close());
+
+    ListfileReader reader;
+    ASSERT_FALSE(reader.open(path));
+
+    DataPacket dest = {};
+    ASSERT_FALSE(reader.readPacket(dest));
+    ASSERT_EQ(dest.bufferNumber, 1);
+    ASSERT_FALSE(reader.readPacket(dest));
+    auto expected = make_packet(2, 1);
+    ASSERT_EQ(std::memcmp(&dest, &expected, sizeof(dest)), 0);
+    ASSERT_EQ(reader.readPacket(dest), ListfileError::CorruptRecord);
+
+    std::filesystem::remove(path);
+
+    // Shorter than the packet header.
+    ASSERT_FALSE(writer.open(path, options));
+    ASSERT_FALSE(writer.writeRecord(listfile::RecordType::Packet, &packet, sizeof(PacketBase) - 2));
+    ASSERT_FALSE(writer.close());
+
+    ASSERT_FALSE(reader.open(path));
+    ASSERT_EQ(reader.readPacket(dest), ListfileError::CorruptRecord);
+
+    std::filesystem::remove(path);
+}
+
+TEST(Listfile, ParseEncoding)
+{
+    ListfileEncoding encoding = ListfileEncoding::Legacy;
+    ASSERT_TRUE(parse_listfile_encoding("coded", encoding));
+    ASSERT_EQ(encoding, ListfileEncoding::Coded);
+    ASSERT_FALSE(parse_listfile_encoding("zip", encoding));
+}
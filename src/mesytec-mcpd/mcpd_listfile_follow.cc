@@ -0,0 +1,248 @@
+#include "mcpd_listfile_follow.h"
+
+#include <algorithm>
+#include <filesystem>
+#include <spdlog/spdlog.h>
+#include <thread>
+
+#ifdef __linux__
+#include <poll.h>
+#include <sys/inotify.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#include "mcpd_listfile.h"
+
+namespace fs = std::filesystem;
+
+namespace mesytec::mcpd
+{
+
+namespace
+{
+    // Used if inotify is not available.
+    const std::chrono::milliseconds PollInterval(20);
+
+    struct FileState
+    {
+        bool exists = false;
+        u64 id = 0u;
+        u64 size = 0u;
+    };
+
+    FileState get_file_state(const std::string &path)
+    {
+        FileState result;
+#ifdef __linux__
+        struct stat st = {};
+
+        if (::stat(path.c_str(), &st) == 0)
+        {
+            result.exists = true;
+            result.id = (static_cast<u64>(st.st_dev) << 32) ^ static_cast<u64>(st.st_ino);
+            result.size = st.st_size;
+        }
+#else
+        std::error_code ec;
+        result.size = fs::file_size(path, ec);
+        result.exists = !ec;
+#endif
+        return result;
+    }
+}
+
+ListfileFollower::ListfileFollower() = default;
+
+ListfileFollower::~ListfileFollower()
+{
+    close();
+}
+
+std::error_code ListfileFollower::open(const std::string &path)
+{
+    return open(path, Options{});
+}
+
+std::error_code ListfileFollower::open(const std::string &path, const Options &options)
+{
+    close();
+
+    path_ = path;
+    options_ = options;
+    packetsRead_ = 0u;
+
+    if (auto ec = openSource())
+        return ec;
+
+#ifdef __linux__
+    // Watch the directory: this also catches new parts, the atomically
+    // replaced manifest and a listfile being recreated under the same name.
+    auto dir = fs::path(path_).parent_path();
+
+    if (dir.empty())
+        dir = ".";
+
+    inotifyFd_ = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+
+    if (inotifyFd_ >= 0
+        && inotify_add_watch(inotifyFd_, dir.c_str(),
+                             IN_MODIFY | IN_CLOSE_WRITE | IN_CREATE | IN_MOVED_TO) < 0)
+    {
+        ::close(inotifyFd_);
+        inotifyFd_ = -1;
+    }
+
+    if (inotifyFd_ < 0)
+        spdlog::debug("ListfileFollower: inotify not available for '{}', polling", dir.string());
+#endif
+
+    return {};
+}
+
+void ListfileFollower::close()
+{
+    source_.reset();
+    fileReader_ = nullptr;
+
+#ifdef __linux__
+    if (inotifyFd_ >= 0)
+    {
+        ::close(inotifyFd_);
+        inotifyFd_ = -1;
+    }
+#endif
+}
+
+std::error_code ListfileFollower::openSource()
+{
+    std::unique_ptr<PacketSource> source;
+
+    if (auto ec = open_packet_source(path_, source))
+        return ec;
+
+    const auto state = get_file_state(path_);
+
+    source_ = std::move(source);
+    fileReader_ = dynamic_cast<ListfileReader *>(source_.get());
+    fileId_ = state.id;
+    // An empty or partially written file header is detected as a legacy
+    // listfile.
+    reopenOnData_ = fileReader_ && state.size < sizeof(listfile::FileHeader);
+    lastData_ = Clock::now();
+
+    return {};
+}
+
+std::error_code ListfileFollower::rewind()
+{
+    if (!source_)
+        return ListfileError::NotOpen;
+
+    packetsRead_ = 0u;
+    lastData_ = Clock::now();
+
+    if (reopenOnData_)
+        return openSource();
+
+    return source_->rewind();
+}
+
+const RunInfo *ListfileFollower::runInfo() const
+{
+    return source_ ? source_->runInfo() : nullptr;
+}
+
+bool ListfileFollower::fileReplaced() const
+{
+    if (!fileReader_)
+        return false;
+
+    const auto state = get_file_state(path_);
+
+    // A removed file may be recreated, keep waiting.
+    if (!state.exists)
+        return false;
+
+    return state.id != fileId_ || state.size < fileReader_->bytesRead();
+}
+
+std::error_code ListfileFollower::readPacket(DataPacket &packet)
+{
+    if (!source_)
+        return ListfileError::NotOpen;
+
+    const auto deadline = Clock::now() + options_.waitTimeout;
+
+    while (true)
+    {
+        if (reopenOnData_ && get_file_state(path_).size >= sizeof(listfile::FileHeader))
+        {
+            if (auto ec = openSource())
+                return ec;
+        }
+
+        auto ec = source_->readPacket(packet);
+
+        if (!ec)
+        {
+            ++packetsRead_;
+            lastData_ = Clock::now();
+            return {};
+        }
+
+        if (ec != ListfileError::EndOfFile)
+            return ec;
+
+        if (fileReplaced())
+        {
+            spdlog::info("ListfileFollower: '{}' was replaced, continuing with the new file", path_);
+
+            if ((ec = openSource()))
+                return ec;
+
+            continue;
+        }
+
+        const auto now = Clock::now();
+        auto timeout = deadline - now;
+
+        if (options_.idleTimeout.count())
+        {
+            const auto idleLeft = lastData_ + options_.idleTimeout - now;
+
+            if (idleLeft <= Clock::duration::zero())
+                return ListfileError::EndOfFile;
+
+            timeout = std::min(timeout, idleLeft);
+        }
+
+        if (now >= deadline)
+            return std::make_error_code(std::errc::timed_out);
+
+        waitForChange(std::chrono::ceil<std::chrono::milliseconds>(timeout));
+    }
+}
+
+void ListfileFollower::waitForChange(std::chrono::milliseconds timeout)
+{
+#ifdef __linux__
+    if (inotifyFd_ >= 0)
+    {
+        pollfd pfd = { inotifyFd_, POLLIN, 0 };
+
+        if (::poll(&pfd, 1, static_cast<int>(timeout.count())) > 0)
+        {
+            // Only the wakeup is of interest, discard the events.
+            alignas(inotify_event) char buffer[4096];
+            while (::read(inotifyFd_, buffer, sizeof(buffer)) > 0) {}
+        }
+
+        return;
+    }
+#endif
+
+    std::this_thread::sleep_for(std::min(timeout, PollInterval));
+}
+
+}
@@ -0,0 +1,86 @@
+#ifndef __MESYTEC_MCPD_LISTFILE_FOLLOW_H__
+#define __MESYTEC_MCPD_LISTFILE_FOLLOW_H__
+
+#include <chrono>
+#include <memory>
+#include <string>
+#include <system_error>
+
+#include "mcpd_packet_source.h"
+
+namespace mesytec::mcpd
+{
+
+class ListfileReader;
+
+// Reads a listfile or a split listfile manifest while it is still being
+// written, like 'tail -f'.
+//
+// At the end of the available data readPacket() waits for the file to change
+// instead of reporting the end of the file. Under Linux the directory of the
+// file is watched using inotify so new data is picked up as soon as the writer
+// flushes it, other systems poll. Partially written records are left in place
+// until they are complete. New parts of split listfiles are followed via the
+// manifest. If the file is replaced or truncated, e.g. by a new readout
+// overwriting it, reading continues at the start of the new file.
+class MESYTEC_MCPD_EXPORT ListfileFollower: public PacketSource
+{
+  public:
+    struct Options
+    {
+        // Maximum time readPacket() blocks waiting for new data before it
+        // returns std::errc::timed_out. Allows callers to check for shutdown.
+        std::chrono::milliseconds waitTimeout{100};
+        // ListfileError::EndOfFile is returned once no data was appended for
+        // this long. 0 follows the file forever.
+        std::chrono::milliseconds idleTimeout{0};
+    };
+
+    ListfileFollower();
+    ~ListfileFollower();
+
+    ListfileFollower(const ListfileFollower &) = delete;
+    ListfileFollower &operator=(const ListfileFollower &) = delete;
+
+    std::error_code open(const std::string &path);
+    std::error_code open(const std::string &path, const Options &options);
+    void close();
+
+    // Returns the next packet, std::errc::timed_out if no packet became
+    // available within Options::waitTimeout or ListfileError::EndOfFile after
+    // Options::idleTimeout.
+    std::error_code readPacket(DataPacket &packet) override;
+    std::error_code rewind() override;
+    u64 packetsRead() const override { return packetsRead_; }
+    const RunInfo *runInfo() const override;
+
+    bool isOpen() const { return source_ != nullptr; }
+    const std::string &path() const { return path_; }
+    const Options &options() const { return options_; }
+
+  private:
+    using Clock = std::chrono::steady_clock;
+
+    std::error_code openSource();
+    // True if the path now refers to a different or truncated file.
+    bool fileReplaced() const;
+    void waitForChange(std::chrono::milliseconds timeout);
+
+    std::string path_;
+    Options options_;
+    std::unique_ptr<PacketSource> source_;
+    // Set if source_ reads a single listfile, null for manifests.
+    ListfileReader *fileReader_ = nullptr;
+    // Identity of the file opened by fileReader_.
+    u64 fileId_ = 0u;
+    // Opened before the file header was complete: the format detection has to
+    // be repeated once more data is available.
+    bool reopenOnData_ = false;
+    u64 packetsRead_ = 0u;
+    Clock::time_point lastData_;
+    int inotifyFd_ = -1;
+};
+
+}
+
+#endif /* __MESYTEC_MCPD_LISTFILE_FOLLOW_H__ */
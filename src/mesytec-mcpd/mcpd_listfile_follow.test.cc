@@ -0,0 +1,149 @@
+#include <gtest/gtest.h>
+
+#include <filesystem>
+#include <fstream>
+#include <thread>
+#include <unistd.h>
+
+#include "mcpd_listfile.h"
+#include "mcpd_listfile_follow.h"
+#include "mcpd_listfile_split.h"
+
+using namespace mesytec::mcpd;
+using namespace std::chrono_literals;
+
+namespace
+{
+
+DataPacket make_packet(u16 bufferNumber)
+{
+    DataPacket packet = {};
+    packet.bufferType = McpdDataBufferType;
+    packet.headerLength = 21;
+    packet.bufferLength = packet.headerLength + 30;
+    packet.bufferNumber = bufferNumber;
+    return packet;
+}
+
+struct TempDir
+{
+    std::filesystem::path path;
+
+    TempDir()
+        : path(std::filesystem::temp_directory_path()
+               / ("mcpd-follow-test-" + std::to_string(getpid())))
+    {
+        std::filesystem::create_directories(path);
+    }
+
+    ~TempDir() { std::filesystem::remove_all(path); }
+};
+
+// Reads until count packets have been received, checking the buffer numbers.
+void follow(ListfileFollower &follower, u16 firstBufferNumber, u16 count)
+{
+    DataPacket packet = {};
+
+    for (u16 i = 0; i < count;)
+    {
+        auto ec = follower.readPacket(packet);
+
+        if (ec == std::errc::timed_out)
+            continue;
+
+        ASSERT_FALSE(ec) << ec.message();
+        ASSERT_EQ(packet.bufferNumber, firstBufferNumber + i);
+        ++i;
+    }
+}
+
+} // namespace
+
+TEST(ListfileFollow, FollowGrowingAndReplacedFile)
+{
+    TempDir dir;
+    const auto path = (dir.path / "run.mcpdlst").string();
+    const u16 PacketCount = 200;
+
+    // Create the file without a header to exercise the repeated format detection.
+    { std::ofstream out(path); }
+
+    ListfileFollower follower;
+    ListfileFollower::Options options;
+    options.waitTimeout = 50ms;
+    options.idleTimeout = 500ms;
+    ASSERT_FALSE(follower.open(path, options));
+
+    auto write = [&] (u16 firstBufferNumber)
+    {
+        ListfileWriter writer;
+        ListfileWriter::Options writerOptions;
+        writerOptions.encoding = ListfileEncoding::Coded;
+        writer.open(path, writerOptions);
+        // Let the follower notice the truncation before the file grows again.
+        std::this_thread::sleep_for(50ms);
+
+        for (u16 i = 0; i < PacketCount; ++i)
+        {
+            writer.writePacket(make_packet(firstBufferNumber + i));
+
+            if (i % 10 == 0)
+            {
+                writer.flush();
+                std::this_thread::sleep_for(1ms);
+            }
+        }
+
+        writer.close();
+    };
+
+    std::thread writerThread(write, 0);
+    follow(follower, 0, PacketCount);
+    writerThread.join();
+
+    // A new readout overwriting the file.
+    writerThread = std::thread(write, 1000);
+    follow(follower, 1000, PacketCount);
+    writerThread.join();
+
+    DataPacket packet = {};
+    std::error_code ec;
+
+    while ((ec = follower.readPacket(packet)) == std::errc::timed_out) {}
+
+    ASSERT_EQ(ec, ListfileError::EndOfFile);
+    ASSERT_EQ(follower.packetsRead(), 2u * PacketCount);
+}
+
+TEST(ListfileFollow, FollowSplitListfile)
+{
+    TempDir dir;
+    const auto basePath = (dir.path / "run.mcpdlst").string();
+    const u16 PacketCount = 500;
+
+    SplitListfileWriter writer;
+    SplitListfileWriter::Options options;
+    options.listfile.encoding = ListfileEncoding::Packet;
+    options.splitSize = 10000;
+    ASSERT_FALSE(writer.open(basePath, options));
+
+    ListfileFollower follower;
+    ASSERT_FALSE(follower.open(writer.path()));
+
+    std::thread writerThread([&]
+    {
+        for (u16 i = 0; i < PacketCount; ++i)
+        {
+            writer.writePacket(make_packet(i));
+
+            if (i % 10 == 0)
+                writer.flush();
+        }
+
+        writer.close();
+    });
+
+    follow(follower, 0, PacketCount);
+    writerThread.join();
+    ASSERT_GT(writer.partCount(), 1u);
+}
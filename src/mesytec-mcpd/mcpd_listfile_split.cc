@@ -0,0 +1,399 @@
+#include "mcpd_listfile_split.h"
+
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <spdlog/spdlog.h>
+
+#include "util/thread_pool.h"
+
+namespace fs = std::filesystem;
+
+namespace mesytec::mcpd
+{
+
+std::string make_listfile_part_path(const std::string &basePath, unsigned partNumber)
+{
+    fs::path path(basePath);
+    char suffix[32];
+    std::snprintf(suffix, sizeof(suffix), "_part%03u", partNumber);
+    auto filename = path.stem().string() + suffix + path.extension().string();
+    return (path.parent_path() / filename).string();
+}
+
+std::string make_listfile_manifest_path(const std::string &basePath)
+{
+    return basePath + ".manifest";
+}
+
+bool is_listfile_manifest(const std::string &path)
+{
+    std::ifstream in(path, std::ios::binary);
+    char buffer[sizeof(ListfileManifestMagic) - 1] = {};
+
+    if (!in.read(buffer, sizeof(buffer)))
+        return false;
+
+    return std::memcmp(buffer, ListfileManifestMagic, sizeof(buffer)) == 0;
+}
+
+std::error_code read_listfile_manifest(const std::string &path, std::vector<std::string> &parts)
+{
+    std::ifstream in(path);
+
+    if (!in)
+        return std::make_error_code(std::errc::no_such_file_or_directory);
+
+    std::string line;
+
+    if (!std::getline(in, line) || line != ListfileManifestMagic)
+        return ListfileError::InvalidHeader;
+
+    const auto dir = fs::path(path).parent_path();
+    parts.clear();
+
+    while (std::getline(in, line))
+    {
+        if (!line.empty() && line.back() == '\r')
+            line.pop_back();
+
+        if (line.empty() || line[0] == '#')
+            continue;
+
+        parts.emplace_back((dir / line).string());
+    }
+
+    return {};
+}
+
+std::error_code write_listfile_manifest(const std::string &path, const std::vector<std::string> &parts)
+{
+    const auto tmpPath = path + ".tmp";
+
+    {
+        std::ofstream out(tmpPath, std::ios::trunc);
+        out << ListfileManifestMagic << "\n";
+
+        for (const auto &part: parts)
+            out << fs::path(part).filename().string() << "\n";
+
+        out.flush();
+
+        if (!out)
+            return std::make_error_code(std::errc::io_error);
+    }
+
+    std::error_code ec;
+    fs::rename(tmpPath, path, ec);
+    return ec;
+}
+
+//
+// ManifestReader
+//
+
+std::error_code ManifestReader::open(const std::string &manifestPath)
+{
+    close();
+
+    if (auto ec = read_listfile_manifest(manifestPath, parts_))
+        return ec;
+
+    manifestPath_ = manifestPath;
+    return rewind();
+}
+
+void ManifestReader::close()
+{
+    reader_.close();
+    parts_.clear();
+    partIndex_ = 0u;
+    packetsRead_ = 0u;
+}
+
+std::error_code ManifestReader::rewind()
+{
+    packetsRead_ = 0u;
+    reader_.close();
+
+    if (parts_.empty())
+        return {};
+
+    return openPart(0);
+}
+
+std::error_code ManifestReader::openPart(size_t index)
+{
+    partIndex_ = index;
+    spdlog::debug("ManifestReader: opening part {}: '{}'", index + 1, parts_[index]);
+    return reader_.open(parts_[index]);
+}
+
+std::error_code ManifestReader::readPacket(DataPacket &packet)
+{
+    while (true)
+    {
+        if (!reader_.isOpen())
+        {
+            // Empty manifest: check if parts have been added.
+            if (auto ec = read_listfile_manifest(manifestPath_, parts_))
+                return ec;
+
+            if (parts_.empty())
+                return ListfileError::EndOfFile;
+
+            if (auto ec = openPart(0))
+                return ec;
+        }
+
+        auto ec = reader_.readPacket(packet);
+
+        if (!ec)
+        {
+            ++packetsRead_;
+            return {};
+        }
+
+        if (ec != ListfileError::EndOfFile)
+            return ec;
+
+        if (partIndex_ + 1 >= parts_.size())
+        {
+            // A running readout may have started a new part in the meantime.
+            std::vector<std::string> parts;
+
+            if (read_listfile_manifest(manifestPath_, parts) || parts.size() <= parts_.size())
+                return ListfileError::EndOfFile;
+
+            parts_ = parts;
+
+            // Read the rest of the current part first: it has been finished
+            // before the new part was added to the manifest.
+            ec = reader_.readPacket(packet);
+
+            if (!ec)
+            {
+                ++packetsRead_;
+                return {};
+            }
+
+            if (ec != ListfileError::EndOfFile)
+                return ec;
+        }
+
+        if ((ec = openPart(partIndex_ + 1)))
+            return ec;
+    }
+}
+
+//
+// SplitListfileWriter
+//
+
+SplitListfileWriter::SplitListfileWriter() = default;
+
+SplitListfileWriter::~SplitListfileWriter()
+{
+    close();
+}
+
+std::error_code SplitListfileWriter::open(const std::string &basePath)
+{
+    return open(basePath, Options{});
+}
+
+std::error_code SplitListfileWriter::open(const std::string &basePath, const Options &options)
+{
+    close();
+
+    basePath_ = basePath;
+    options_ = options;
+    parts_.clear();
+    runInfo_.reset();
+    bytesWrittenPrevParts_ = 0u;
+    packetsWrittenPrevParts_ = 0u;
+
+    auto writer = std::make_unique<ListfileWriter>();
+
+    if (!isSplit())
+    {
+        if (auto ec = writer->open(basePath_, options_.listfile))
+            return ec;
+
+        current_ = std::move(writer);
+        return {};
+    }
+
+    const auto partPath = make_listfile_part_path(basePath_, 1);
+
+    if (auto ec = writer->open(partPath, options_.listfile))
+        return ec;
+
+    if (options_.splitSize)
+        writer->preallocate(options_.splitSize);
+
+    parts_.push_back(partPath);
+
+    if (auto ec = write_listfile_manifest(make_listfile_manifest_path(basePath_), parts_))
+        return ec;
+
+    current_ = std::move(writer);
+    partStart_ = Clock::now();
+
+    if (!worker_)
+        worker_ = std::make_unique<util::ThreadPool>(1);
+
+    prepareNextPart();
+    return {};
+}
+
+void SplitListfileWriter::prepareNextPart()
+{
+    const auto path = make_listfile_part_path(basePath_, parts_.size() + 1);
+    const auto options = options_;
+
+    nextPart_ = worker_->submit(
+        [path, options]
+        {
+            auto writer = std::make_unique<ListfileWriter>();
+            auto ec = writer->open(path, options.listfile);
+
+            // Preallocation is an optimization only, e.g. not supported by
+            // all filesystems.
+            if (!ec && options.splitSize)
+            {
+                if (auto ec2 = writer->preallocate(options.splitSize))
+                    spdlog::debug("SplitListfileWriter: could not preallocate '{}': {}", path,
+                                  ec2.message());
+            }
+
+            return PreparedPart(ec, std::move(writer));
+        });
+}
+
+std::error_code SplitListfileWriter::writeRunInfo(const RunInfo &info)
+{
+    if (!current_)
+        return ListfileError::NotOpen;
+
+    runInfo_ = info;
+    return current_->writeRunInfo(info);
+}
+
+std::error_code SplitListfileWriter::writePacket(const DataPacket &packet)
+{
+    if (!current_)
+        return ListfileError::NotOpen;
+
+    if (isSplit()
+        && ((options_.splitSize && current_->bytesWritten() >= options_.splitSize)
+            || (options_.splitTime.count() && Clock::now() - partStart_ >= options_.splitTime)))
+    {
+        if (auto ec = switchPart())
+            return ec;
+    }
+
+    return current_->writePacket(packet);
+}
+
+std::error_code SplitListfileWriter::switchPart()
+{
+    auto [openError, next] = nextPart_.get();
+
+    if (openError)
+        return openError;
+
+    if (auto ec = finishClosing())
+        return ec;
+
+    bytesWrittenPrevParts_ += current_->bytesWritten();
+    packetsWrittenPrevParts_ += current_->packetsWritten();
+    parts_.push_back(next->path());
+
+    // Close the finished part and publish the new one in the background.
+    closing_ = worker_->submit(
+        [prev = std::shared_ptr<ListfileWriter>(std::move(current_)),
+         manifestPath = make_listfile_manifest_path(basePath_), parts = parts_]
+        {
+            auto ec = prev->close();
+
+            if (auto ec2 = write_listfile_manifest(manifestPath, parts); !ec)
+                ec = ec2;
+
+            return ec;
+        });
+
+    current_ = std::move(next);
+    partStart_ = Clock::now();
+    prepareNextPart();
+
+    if (runInfo_)
+        return current_->writeRunInfo(*runInfo_);
+
+    return {};
+}
+
+std::error_code SplitListfileWriter::finishClosing()
+{
+    if (closing_.valid())
+        return closing_.get();
+
+    return {};
+}
+
+std::error_code SplitListfileWriter::flush()
+{
+    if (!current_)
+        return ListfileError::NotOpen;
+
+    return current_->flush();
+}
+
+std::error_code SplitListfileWriter::close()
+{
+    if (!current_)
+        return {};
+
+    auto ec = current_->close();
+    current_.reset();
+
+    if (nextPart_.valid())
+    {
+        // Remove the unused, already created next part.
+        auto next = nextPart_.get().second;
+
+        if (next && next->isOpen())
+        {
+            next->close();
+            std::error_code ec3;
+            fs::remove(next->path(), ec3);
+        }
+    }
+
+    if (auto ec2 = finishClosing(); !ec)
+        ec = ec2;
+
+    return ec;
+}
+
+std::string SplitListfileWriter::path() const
+{
+    return isSplit() ? make_listfile_manifest_path(basePath_) : basePath_;
+}
+
+std::string SplitListfileWriter::currentPartPath() const
+{
+    return current_ ? current_->path() : std::string{};
+}
+
+u64 SplitListfileWriter::bytesWritten() const
+{
+    return bytesWrittenPrevParts_ + (current_ ? current_->bytesWritten() : 0u);
+}
+
+u64 SplitListfileWriter::packetsWritten() const
+{
+    return packetsWrittenPrevParts_ + (current_ ? current_->packetsWritten() : 0u);
+}
+
+}
@@ -0,0 +1,147 @@
+#ifndef __MESYTEC_MCPD_LISTFILE_SPLIT_H__
+#define __MESYTEC_MCPD_LISTFILE_SPLIT_H__
+
+#include <chrono>
+#include <future>
+#include <memory>
+#include <optional>
+#include <string>
+#include <system_error>
+#include <vector>
+
+#include "mcpd_listfile.h"
+#include "mcpd_packet_source.h"
+
+namespace util
+{
+    class ThreadPool;
+}
+
+namespace mesytec::mcpd
+{
+
+// Split listfiles
+//
+// A listfile split into parts is described by a manifest: a text file
+// starting with ManifestMagic followed by the file names of the parts, one per
+// line, in recording order. Part names are relative to the directory of the
+// manifest. For the base path "dir/run1.mcpdlst" the parts are named
+// "dir/run1_part001.mcpdlst", "dir/run1_part002.mcpdlst", ... and the manifest
+// is "dir/run1.mcpdlst.manifest".
+
+static const char ListfileManifestMagic[] = "# mesytec-mcpd listfile manifest 1";
+
+MESYTEC_MCPD_EXPORT std::string make_listfile_part_path(const std::string &basePath, unsigned partNumber);
+MESYTEC_MCPD_EXPORT std::string make_listfile_manifest_path(const std::string &basePath);
+
+// True if the file exists and starts with ListfileManifestMagic.
+MESYTEC_MCPD_EXPORT bool is_listfile_manifest(const std::string &path);
+
+// Reads the part paths from the manifest. The returned paths include the
+// directory of the manifest.
+MESYTEC_MCPD_EXPORT std::error_code read_listfile_manifest(const std::string &path,
+                                                           std::vector<std::string> &parts);
+
+// Replaces the manifest atomically by writing a temporary file and renaming
+// it. Only the file names of the parts are stored.
+MESYTEC_MCPD_EXPORT std::error_code write_listfile_manifest(const std::string &path,
+                                                            const std::vector<std::string> &parts);
+
+// Reads the parts listed in a manifest as one continuous stream. At the end
+// of the last part the manifest is read again so that parts added by a
+// running readout are picked up.
+class MESYTEC_MCPD_EXPORT ManifestReader: public PacketSource
+{
+  public:
+    std::error_code open(const std::string &manifestPath);
+    void close();
+
+    std::error_code readPacket(DataPacket &packet) override;
+    std::error_code rewind() override;
+    u64 packetsRead() const override { return packetsRead_; }
+    const RunInfo *runInfo() const override { return reader_.runInfo(); }
+
+    const std::vector<std::string> &parts() const { return parts_; }
+    // Index into parts() of the part currently being read.
+    size_t currentPart() const { return partIndex_; }
+
+  private:
+    std::error_code openPart(size_t index);
+
+    std::string manifestPath_;
+    std::vector<std::string> parts_;
+    size_t partIndex_ = 0u;
+    ListfileReader reader_;
+    u64 packetsRead_ = 0u;
+};
+
+// Listfile writer switching to a new part file once the current part reaches
+// splitSize bytes or has been written to for splitTime. Parts are only
+// switched between packets. The next part is created, its header written and
+// its space preallocated on a background thread ahead of time; finished parts
+// are closed on the same thread. The receive loop only swaps file handles.
+//
+// Without splitSize and splitTime a single listfile is written to the base
+// path and no manifest is created.
+class MESYTEC_MCPD_EXPORT SplitListfileWriter
+{
+  public:
+    struct Options
+    {
+        ListfileWriter::Options listfile;
+        u64 splitSize = 0u;                 // in bytes, 0 disables
+        std::chrono::seconds splitTime{0};  // 0 disables
+    };
+
+    SplitListfileWriter();
+    ~SplitListfileWriter();
+
+    SplitListfileWriter(const SplitListfileWriter &) = delete;
+    SplitListfileWriter &operator=(const SplitListfileWriter &) = delete;
+
+    std::error_code open(const std::string &basePath);
+    std::error_code open(const std::string &basePath, const Options &options);
+
+    // Writes the run metadata to the current part and to the start of each
+    // following part so that every part is self-describing.
+    std::error_code writeRunInfo(const RunInfo &info);
+
+    std::error_code writePacket(const DataPacket &packet);
+    std::error_code flush();
+    std::error_code close();
+
+    bool isOpen() const { return current_ != nullptr; }
+    bool isSplit() const { return options_.splitSize || options_.splitTime.count(); }
+    const std::string &basePath() const { return basePath_; }
+    // Path of the manifest or of the single listfile if not splitting.
+    std::string path() const;
+    std::string currentPartPath() const;
+    size_t partCount() const { return parts_.size(); }
+    const Options &options() const { return options_; }
+    u64 bytesWritten() const;
+    u64 packetsWritten() const;
+
+  private:
+    using Clock = std::chrono::steady_clock;
+    using PreparedPart = std::pair<std::error_code, std::unique_ptr<ListfileWriter>>;
+
+    void prepareNextPart();
+    std::error_code switchPart();
+    std::error_code finishClosing();
+
+    std::string basePath_;
+    Options options_;
+    std::unique_ptr<ListfileWriter> current_;
+    Clock::time_point partStart_;
+    std::vector<std::string> parts_;
+    u64 bytesWrittenPrevParts_ = 0u;
+    u64 packetsWrittenPrevParts_ = 0u;
+    std::future<PreparedPart> nextPart_;
+    std::future<std::error_code> closing_;
+    std::unique_ptr<util::ThreadPool> worker_;
+    std::optional<RunInfo> runInfo_;
+};
+
+}
+
+#endif /* __MESYTEC_MCPD_LISTFILE_SPLIT_H__ */
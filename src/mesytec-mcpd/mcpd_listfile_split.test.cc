@@ -0,0 +1,114 @@
+#include <gtest/gtest.h>
+
+#include <filesystem>
+#include <unistd.h>
+
+#include "mcpd_listfile_split.h"
+
+using namespace mesytec::mcpd;
+
+namespace
+{
+
+DataPacket make_packet(u16 bufferNumber)
+{
+    DataPacket packet = {};
+    packet.bufferType = McpdDataBufferType;
+    packet.headerLength = 21;
+    packet.bufferLength = packet.headerLength + 30;
+    packet.bufferNumber = bufferNumber;
+    return packet;
+}
+
+struct TempDir
+{
+    std::filesystem::path path;
+
+    TempDir()
+        : path(std::filesystem::temp_directory_path()
+               / ("mcpd-split-test-" + std::to_string(getpid())))
+    {
+        std::filesystem::create_directories(path);
+    }
+
+    ~TempDir() { std::filesystem::remove_all(path); }
+};
+
+} // namespace
+
+TEST(ListfileSplit, PartPaths)
+{
+    ASSERT_EQ(make_listfile_part_path("dir/run1.mcpdlst", 2), "dir/run1_part002.mcpdlst");
+    ASSERT_EQ(make_listfile_manifest_path("dir/run1.mcpdlst"), "dir/run1.mcpdlst.manifest");
+}
+
+TEST(ListfileSplit, SplitBySize)
+{
+    TempDir dir;
+    const auto basePath = (dir.path / "run.mcpdlst").string();
+
+    SplitListfileWriter writer;
+    SplitListfileWriter::Options options;
+    options.listfile.encoding = ListfileEncoding::Packet;
+    options.splitSize = 10000;
+    ASSERT_FALSE(writer.open(basePath, options));
+
+    const u16 PacketCount = 500;
+
+    for (u16 i = 0; i < PacketCount; ++i)
+        ASSERT_FALSE(writer.writePacket(make_packet(i)));
+
+    const size_t partCount = writer.partCount();
+    ASSERT_GT(partCount, 3u);
+    ASSERT_EQ(writer.packetsWritten(), PacketCount);
+    ASSERT_FALSE(writer.close());
+
+    // The pre-opened but unused next part has been removed.
+    ASSERT_FALSE(std::filesystem::exists(make_listfile_part_path(basePath, partCount + 1)));
+
+    std::vector<std::string> parts;
+    ASSERT_FALSE(read_listfile_manifest(make_listfile_manifest_path(basePath), parts));
+    ASSERT_EQ(parts.size(), partCount);
+
+    for (const auto &part: parts)
+        ASSERT_LE(std::filesystem::file_size(part), options.splitSize + sizeof(DataPacket) + 8);
+
+    std::unique_ptr<PacketSource> source;
+    ASSERT_FALSE(open_packet_source(make_listfile_manifest_path(basePath), source));
+
+    for (int pass = 0; pass < 2; ++pass)
+    {
+        DataPacket packet = {};
+
+        for (u16 i = 0; i < PacketCount; ++i)
+        {
+            ASSERT_FALSE(source->readPacket(packet));
+            ASSERT_EQ(packet.bufferNumber, i);
+        }
+
+        ASSERT_EQ(source->readPacket(packet), ListfileError::EndOfFile);
+        ASSERT_EQ(source->packetsRead(), PacketCount);
+        ASSERT_FALSE(source->rewind());
+    }
+}
+
+TEST(ListfileSplit, NoSplit)
+{
+    TempDir dir;
+    const auto basePath = (dir.path / "run.mcpdlst").string();
+
+    SplitListfileWriter writer;
+    ASSERT_FALSE(writer.open(basePath));
+    ASSERT_FALSE(writer.writePacket(make_packet(1)));
+    ASSERT_EQ(writer.path(), basePath);
+    ASSERT_FALSE(writer.close());
+
+    ASSERT_FALSE(std::filesystem::exists(make_listfile_manifest_path(basePath)));
+    ASSERT_EQ(std::filesystem::file_size(basePath), sizeof(DataPacket));
+
+    std::unique_ptr<PacketSource> source;
+    ASSERT_FALSE(open_packet_source(basePath, source));
+    DataPacket packet = {};
+    ASSERT_FALSE(source->readPacket(packet));
+    ASSERT_EQ(packet.bufferNumber, 1);
+}
@@ -0,0 +1,215 @@
+#include "mcpd_mdat.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <spdlog/spdlog.h>
+
+#include "mcpd_listfile.h"
+#include "util/byte_swap.h"
+
+namespace mesytec::mcpd
+{
+
+namespace
+{
+    // Size of the blocks read from the file.
+    const size_t BlockSize = 1u << 20;
+
+    std::error_code errno_error_code(int fallback = EIO)
+    {
+        return std::error_code(errno ? errno : fallback, std::generic_category());
+    }
+
+    int file_seek(std::FILE *f, u64 offset)
+    {
+#ifdef _WIN32
+        return _fseeki64(f, offset, SEEK_SET);
+#else
+        return fseeko(f, offset, SEEK_SET);
+#endif
+    }
+
+    u64 load_u64(const u8 *p)
+    {
+        u64 result = 0u;
+        for (size_t i = 0; i < sizeof(result); ++i)
+            result |= static_cast<u64>(p[i]) << (i * 8);
+        return result;
+    }
+
+    u16 load_u16_be(const u8 *p)
+    {
+        return (static_cast<u16>(p[0]) << 8) | p[1];
+    }
+
+    const size_t NotFound = static_cast<size_t>(-1);
+
+    // Returns the offset of the HeaderSeparator if it is preceded by text
+    // only, otherwise NotFound.
+    size_t find_header_end(const u8 *data, size_t size)
+    {
+        for (size_t i = 0; i + sizeof(u64) <= size; ++i)
+        {
+            if (load_u64(data + i) == mdat::HeaderSeparator)
+                return i;
+
+            const u8 c = data[i];
+
+            if (c < 0x20 && c != '\t' && c != '\n' && c != '\r')
+                return NotFound;
+        }
+
+        return NotFound;
+    }
+
+    size_t read_header(std::FILE *f, std::string &text)
+    {
+        std::vector<u8> buffer(mdat::MaxHeaderSize);
+        buffer.resize(std::fread(buffer.data(), 1, buffer.size(), f));
+
+        auto result = find_header_end(buffer.data(), buffer.size());
+
+        if (result != NotFound)
+            text.assign(buffer.begin(), buffer.begin() + result);
+
+        return result;
+    }
+}
+
+bool is_mdat_file(const std::string &path)
+{
+    auto f = std::fopen(path.c_str(), "rb");
+
+    if (!f)
+        return false;
+
+    std::string text;
+    auto result = read_header(f, text) != NotFound;
+    std::fclose(f);
+    return result;
+}
+
+MdatReader::MdatReader() = default;
+
+MdatReader::~MdatReader()
+{
+    close();
+}
+
+std::error_code MdatReader::open(const std::string &path)
+{
+    close();
+
+    errno = 0;
+    file_ = std::fopen(path.c_str(), "rb");
+
+    if (!file_)
+        return errno_error_code(ENOENT);
+
+    // Data is read in large blocks into buffer_.
+    std::setvbuf(file_, nullptr, _IONBF, 0);
+
+    const auto headerEnd = read_header(file_, headerText_);
+
+    if (headerEnd == NotFound)
+    {
+        close();
+        return ListfileError::InvalidHeader;
+    }
+
+    path_ = path;
+    dataStart_ = headerEnd + sizeof(mdat::HeaderSeparator);
+    buffer_.resize(BlockSize);
+
+    return rewind();
+}
+
+void MdatReader::close()
+{
+    if (file_)
+    {
+        std::fclose(file_);
+        file_ = nullptr;
+    }
+
+    headerText_.clear();
+    buffer_ = {};
+    pos_ = end_ = 0u;
+    packetsRead_ = 0u;
+}
+
+std::error_code MdatReader::rewind()
+{
+    if (!file_)
+        return ListfileError::NotOpen;
+
+    std::clearerr(file_);
+    errno = 0;
+
+    if (file_seek(file_, dataStart_) != 0)
+        return errno_error_code();
+
+    pos_ = end_ = 0u;
+    packetsRead_ = 0u;
+    return {};
+}
+
+size_t MdatReader::fill(size_t size)
+{
+    if (end_ - pos_ >= size)
+        return end_ - pos_;
+
+    std::memmove(buffer_.data(), buffer_.data() + pos_, end_ - pos_);
+    end_ -= pos_;
+    pos_ = 0u;
+
+    // Retry after reaching the end of the file: it may still be written.
+    std::clearerr(file_);
+    end_ += std::fread(buffer_.data() + end_, 1, buffer_.size() - end_, file_);
+
+    return end_;
+}
+
+std::error_code MdatReader::readPacket(DataPacket &packet)
+{
+    if (!file_)
+        return ListfileError::NotOpen;
+
+    if (fill(sizeof(u64)) < sizeof(u64) || load_u64(&buffer_[pos_]) == mdat::ClosingSignature)
+        return ListfileError::EndOfFile;
+
+    const size_t words = load_u16_be(&buffer_[pos_]);
+    const size_t bytes = words * sizeof(u16);
+
+    if (words < sizeof(PacketBase) / sizeof(u16) || bytes > sizeof(DataPacket))
+    {
+        spdlog::error("MdatReader: invalid packet length {} words at packet {}", words, packetsRead_);
+        return ListfileError::CorruptRecord;
+    }
+
+    // A packet is complete once its separator has been written.
+    if (fill(bytes + sizeof(u64)) < bytes + sizeof(u64))
+        return ListfileError::EndOfFile;
+
+    if (load_u64(&buffer_[pos_ + bytes]) != mdat::PacketSeparator)
+    {
+        spdlog::error("MdatReader: expected separator {:#018x} after packet {}, found {:#018x}",
+                      mdat::PacketSeparator, packetsRead_, load_u64(&buffer_[pos_ + bytes]));
+        return ListfileError::CorruptRecord;
+    }
+
+    auto dest = reinterpret_cast<u8 *>(&packet);
+    util::copy_swap_u16(dest, &buffer_[pos_], words);
+    std::memset(dest + bytes, 0, sizeof(DataPacket) - bytes);
+
+    if (packet.headerLength > packet.bufferLength)
+        return ListfileError::CorruptRecord;
+
+    pos_ += bytes + sizeof(u64);
+    ++packetsRead_;
+
+    return {};
+}
+
+}
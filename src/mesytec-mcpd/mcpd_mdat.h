@@ -0,0 +1,81 @@
+#ifndef __MESYTEC_MCPD_MDAT_H__
+#define __MESYTEC_MCPD_MDAT_H__
+
+#include <cstdio>
+#include <string>
+#include <system_error>
+#include <vector>
+
+#include "mcpd_packet_source.h"
+
+namespace mesytec::mcpd
+{
+
+// qmesydaq .mdat listfiles
+//
+// A short text header terminated by HeaderSeparator, followed by the data
+// packets, each one followed by PacketSeparator. The file ends with
+// ClosingSignature. qmesydaq writes everything as big endian 16 bit words:
+// a packet occupies bufferLength words starting with the bufferLength field.
+// The separator values below are the 8 separator bytes read as a little
+// endian u64.
+namespace mdat
+{
+    static const u64 HeaderSeparator = 0xffffaaaa55550000u;
+    static const u64 PacketSeparator = 0xaaaa5555ffff0000u;
+    static const u64 ClosingSignature = 0x00005555aaaaffffu;
+
+    // Maximum size of the text header searched for the HeaderSeparator.
+    static const size_t MaxHeaderSize = 1u << 16;
+}
+
+// True if the file starts with a text header terminated by the mdat
+// HeaderSeparator.
+MESYTEC_MCPD_EXPORT bool is_mdat_file(const std::string &path);
+
+// Reads the data packets of a .mdat file converting them to host byte order.
+// The file is read in large blocks and the byte order of whole packets is
+// swapped at once using SIMD instructions.
+class MESYTEC_MCPD_EXPORT MdatReader: public PacketSource
+{
+  public:
+    MdatReader();
+    ~MdatReader();
+
+    MdatReader(const MdatReader &) = delete;
+    MdatReader &operator=(const MdatReader &) = delete;
+
+    std::error_code open(const std::string &path);
+    void close();
+
+    // Returns ListfileError::EndOfFile at the closing signature or the end of
+    // the file. A partially written last packet is read again by the next
+    // call. ListfileError::CorruptRecord if a packet has an invalid length or
+    // is not followed by a separator.
+    std::error_code readPacket(DataPacket &packet) override;
+    std::error_code rewind() override;
+    u64 packetsRead() const override { return packetsRead_; }
+
+    bool isOpen() const { return file_ != nullptr; }
+    const std::string &path() const { return path_; }
+    // The text header preceding the HeaderSeparator.
+    const std::string &headerText() const { return headerText_; }
+
+  private:
+    // Makes at least size bytes available at pos_ unless the end of the file
+    // is reached. Returns the number of available bytes.
+    size_t fill(size_t size);
+
+    std::FILE *file_ = nullptr;
+    std::string path_;
+    std::string headerText_;
+    u64 dataStart_ = 0u;
+    u64 packetsRead_ = 0u;
+    std::vector<u8> buffer_;
+    size_t pos_ = 0u;
+    size_t end_ = 0u;
+};
+
+}
+
+#endif /* __MESYTEC_MCPD_MDAT_H__ */
@@ -0,0 +1,180 @@
+#include <gtest/gtest.h>
+
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <unistd.h>
+
+#include "mcpd_listfile.h"
+#include "mcpd_mdat.h"
+#include "util/byte_swap.h"
+
+using namespace mesytec::mcpd;
+
+namespace
+{
+
+void put_u64(std::vector<u8> &dest, u64 value)
+{
+    for (size_t i = 0; i < sizeof(value); ++i)
+        dest.push_back(value >> (i * 8));
+}
+
+// Appends the packet as written by qmesydaq: bufferLength big endian words.
+void put_packet(std::vector<u8> &dest, const DataPacket &packet)
+{
+    auto words = reinterpret_cast<const u16 *>(&packet);
+
+    for (size_t i = 0; i < packet.bufferLength; ++i)
+    {
+        dest.push_back(words[i] >> 8);
+        dest.push_back(words[i] & 0xffu);
+    }
+
+    put_u64(dest, mdat::PacketSeparator);
+}
+
+std::vector<DataPacket> make_packets(size_t count)
+{
+    std::vector<DataPacket> result(count);
+
+    for (size_t pi = 0; pi < count; ++pi)
+    {
+        auto &packet = result[pi];
+        packet.bufferType = McpdDataBufferType;
+        packet.headerLength = 21;
+        packet.bufferLength = packet.headerLength + (pi * 37) % (DataPacketMaxDataWords + 1);
+        packet.bufferNumber = pi;
+        packet.runId = 42;
+        packet.deviceStatus = 0x5;
+        packet.deviceId = pi % 4;
+        packet.time[0] = 0x1234 + pi;
+        packet.time[2] = 0xabcd;
+
+        for (int i = 0; i < get_data_length(packet); ++i)
+            packet.data[i] = pi * 1000 + i;
+    }
+
+    return result;
+}
+
+std::string write_file(const std::string &name, const std::vector<u8> &data)
+{
+    const auto path = (std::filesystem::temp_directory_path()
+                       / (name + "-" + std::to_string(getpid()))).string();
+    std::ofstream out(path, std::ios::binary | std::ios::trunc);
+    out.write(reinterpret_cast<const char *>(data.data()), data.size());
+    return path;
+}
+
+} // namespace
+
+TEST(Mdat, CopySwapU16)
+{
+    std::vector<u8> src(200);
+
+    for (size_t i = 0; i < src.size(); ++i)
+        src[i] = i;
+
+    // All lengths around the vector width, unaligned source and destination.
+    for (size_t count = 0; count < 70; ++count)
+    {
+        std::vector<u8> dest(src.size() + 1, 0xff);
+        util::copy_swap_u16(dest.data() + 1, src.data() + 1, count);
+
+        for (size_t i = 0; i < count; ++i)
+        {
+            ASSERT_EQ(dest[1 + i * 2], src[1 + i * 2 + 1]);
+            ASSERT_EQ(dest[1 + i * 2 + 1], src[1 + i * 2]);
+        }
+
+        ASSERT_EQ(dest[1 + count * 2], 0xff);
+
+        auto inplace = src;
+        util::copy_swap_u16(inplace.data() + 1, inplace.data() + 1, count);
+        ASSERT_EQ(std::memcmp(inplace.data() + 1, dest.data() + 1, count * 2), 0);
+    }
+}
+
+TEST(Mdat, ReadPackets)
+{
+    const auto packets = make_packets(100);
+    const std::string header = "mesytec psd listmode data\nheader length: 2 lines\n";
+
+    std::vector<u8> data(header.begin(), header.end());
+    put_u64(data, mdat::HeaderSeparator);
+
+    for (const auto &packet: packets)
+        put_packet(data, packet);
+
+    put_u64(data, mdat::ClosingSignature);
+
+    const auto path = write_file("mcpd-mdat-test", data);
+    ASSERT_TRUE(is_mdat_file(path));
+
+    std::unique_ptr<PacketSource> source;
+    ASSERT_FALSE(open_packet_source(path, source));
+    auto reader = dynamic_cast<MdatReader *>(source.get());
+    ASSERT_NE(reader, nullptr);
+    ASSERT_EQ(reader->headerText(), header);
+
+    for (int pass = 0; pass < 2; ++pass)
+    {
+        for (const auto &expected: packets)
+        {
+            DataPacket packet = {};
+            ASSERT_FALSE(source->readPacket(packet));
+            ASSERT_EQ(std::memcmp(&packet, &expected, sizeof(packet)), 0);
+        }
+
+        DataPacket packet = {};
+        ASSERT_EQ(source->readPacket(packet), ListfileError::EndOfFile);
+        ASSERT_EQ(source->packetsRead(), packets.size());
+        ASSERT_FALSE(source->rewind());
+    }
+
+    std::filesystem::remove(path);
+}
+
+TEST(Mdat, PartialAndCorrupt)
+{
+    const auto packets = make_packets(3);
+
+    std::vector<u8> data;
+    put_u64(data, mdat::HeaderSeparator);
+    put_packet(data, packets[0]);
+    put_packet(data, packets[1]);
+
+    // The second packet is incomplete until its separator is written.
+    auto path = write_file("mcpd-mdat-test", { data.begin(), data.end() - 4 });
+
+    MdatReader reader;
+    DataPacket packet = {};
+    ASSERT_FALSE(reader.open(path));
+    ASSERT_FALSE(reader.readPacket(packet));
+    ASSERT_EQ(reader.readPacket(packet), ListfileError::EndOfFile);
+
+    {
+        std::ofstream out(path, std::ios::binary | std::ios::app);
+        out.write(reinterpret_cast<const char *>(data.data() + data.size() - 4), 4);
+    }
+
+    ASSERT_FALSE(reader.readPacket(packet));
+    ASSERT_EQ(packet.bufferNumber, 1u);
+    ASSERT_EQ(reader.readPacket(packet), ListfileError::EndOfFile);
+
+    // Broken separator
+    data.back() ^= 1;
+    write_file("mcpd-mdat-test", data);
+    ASSERT_FALSE(reader.open(path));
+    ASSERT_FALSE(reader.readPacket(packet));
+    ASSERT_EQ(reader.readPacket(packet), ListfileError::CorruptRecord);
+
+    // Legacy listfiles are binary from the start.
+    write_file("mcpd-mdat-test", { reinterpret_cast<const u8 *>(&packets[1]),
+                                   reinterpret_cast<const u8 *>(&packets[1] + 1) });
+    ASSERT_FALSE(is_mdat_file(path));
+    ASSERT_EQ(reader.open(path), ListfileError::InvalidHeader);
+
+    std::filesystem::remove(path);
+}
@@ -0,0 +1,57 @@
+#include "mcpd_packet_source.h"
+
+#include "mcpd_listfile.h"
+#include "mcpd_listfile_split.h"
+#include "mcpd_mdat.h"
+#include "mcpd_pcap.h"
+
+namespace mesytec::mcpd
+{
+
+PacketSource::~PacketSource() = default;
+
+std::error_code open_packet_source(const std::string &path, std::unique_ptr<PacketSource> &dest)
+{
+    if (is_listfile_manifest(path))
+    {
+        auto reader = std::make_unique<ManifestReader>();
+
+        if (auto ec = reader->open(path))
+            return ec;
+
+        dest = std::move(reader);
+        return {};
+    }
+
+    if (is_mdat_file(path))
+    {
+        auto reader = std::make_unique<MdatReader>();
+
+        if (auto ec = reader->open(path))
+            return ec;
+
+        dest = std::move(reader);
+        return {};
+    }
+
+    if (is_pcap_file(path))
+    {
+        auto reader = std::make_unique<PcapReader>();
+
+        if (auto ec = reader->open(path))
+            return ec;
+
+        dest = std::move(reader);
+        return {};
+    }
+
+    auto reader = std::make_unique<ListfileReader>();
+
+    if (auto ec = reader->open(path))
+        return ec;
+
+    dest = std::move(reader);
+    return {};
+}
+
+}
@@ -0,0 +1,43 @@
+#ifndef __MESYTEC_MCPD_PACKET_SOURCE_H__
+#define __MESYTEC_MCPD_PACKET_SOURCE_H__
+
+#include <memory>
+#include <string>
+#include <system_error>
+
+#include "mcpd_core.h"
+
+namespace mesytec::mcpd
+{
+
+struct RunInfo;
+
+// Sequential source of recorded data packets, e.g. a listfile or a set of
+// split listfiles listed in a manifest.
+class MESYTEC_MCPD_EXPORT PacketSource
+{
+  public:
+    virtual ~PacketSource();
+
+    // Reads the next packet. Returns ListfileError::EndOfFile once no more
+    // packets are available.
+    virtual std::error_code readPacket(DataPacket &packet) = 0;
+
+    // Starts over at the first packet.
+    virtual std::error_code rewind() = 0;
+
+    virtual u64 packetsRead() const = 0;
+
+    // Run metadata recorded with the data or nullptr if not available.
+    virtual const RunInfo *runInfo() const { return nullptr; }
+};
+
+// Opens the file at path as a packet source. Detects legacy and framed
+// listfiles, split listfile manifests, qmesydaq .mdat files and pcap/pcapng
+// network captures (see PcapReader).
+MESYTEC_MCPD_EXPORT std::error_code open_packet_source(const std::string &path,
+                                                       std::unique_ptr<PacketSource> &dest);
+
+}
+
+#endif /* __MESYTEC_MCPD_PACKET_SOURCE_H__ */
@@ -0,0 +1,647 @@
+#include "mcpd_pcap.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cmath>
+#include <cstring>
+#include <spdlog/spdlog.h>
+
+#include "mcpd_listfile.h"
+
+namespace mesytec::mcpd
+{
+
+namespace
+{
+    // Buffer size used for the FILE stream.
+    const size_t BufferSize = 1u << 20;
+
+    const u32 PcapMagicMicros = 0xa1b2c3d4u;
+    const u32 PcapMagicNanos = 0xa1b23c4du;
+    const size_t PcapHeaderSize = 24u;
+    const size_t PcapRecordHeaderSize = 16u;
+    // Largest snap length used by tcpdump and wireshark.
+    const u32 PcapMaxFrameSize = 1u << 18;
+
+    const u32 PcapNgSectionHeader = 0x0a0d0d0au;
+    const u32 PcapNgByteOrderMagic = 0x1a2b3c4du;
+    const u32 PcapNgInterfaceDescription = 1u;
+    const u32 PcapNgObsoletePacket = 2u;
+    const u32 PcapNgSimplePacket = 3u;
+    const u32 PcapNgEnhancedPacket = 6u;
+    const u32 PcapNgMaxBlockSize = 1u << 24;
+    const u16 PcapNgOptionEnd = 0u;
+    const u16 PcapNgOptionTsResol = 9u;
+    const u16 PcapNgOptionTsOffset = 14u;
+
+    // Link-layer header types, see https://www.tcpdump.org/linktypes.html
+    const u32 LinkTypeNull = 0u;
+    const u32 LinkTypeEthernet = 1u;
+    const u32 LinkTypeRawOpenBSD = 12u;
+    const u32 LinkTypeRaw = 101u;
+    const u32 LinkTypeLoop = 108u;
+    const u32 LinkTypeLinuxSll = 113u;
+    const u32 LinkTypeIPv4 = 228u;
+    const u32 LinkTypeLinuxSll2 = 276u;
+
+    const u16 EtherTypeIPv4 = 0x0800u;
+    const u16 EtherTypeVlan = 0x8100u;
+    const u16 EtherTypeQinQ = 0x88a8u;
+    const u16 EtherTypeQinQOld = 0x9100u;
+    const u32 AddressFamilyInet = 2u;
+    const u8 IpProtocolUdp = 17u;
+
+    std::error_code errno_error_code(int fallback = EIO)
+    {
+        return std::error_code(errno ? errno : fallback, std::generic_category());
+    }
+
+    int file_seek(std::FILE *f, u64 offset)
+    {
+#ifdef _WIN32
+        return _fseeki64(f, offset, SEEK_SET);
+#else
+        return fseeko(f, offset, SEEK_SET);
+#endif
+    }
+
+    u32 load_u32_le(const u8 *p)
+    {
+        return p[0] | (p[1] << 8) | (p[2] << 16) | (static_cast<u32>(p[3]) << 24);
+    }
+
+    u32 bswap_32(u32 v)
+    {
+        return ((v & 0xffu) << 24) | ((v & 0xff00u) << 8) | ((v >> 8) & 0xff00u) | (v >> 24);
+    }
+
+    u16 load_u16_be(const u8 *p)
+    {
+        return (p[0] << 8) | p[1];
+    }
+
+    u32 load_u32_be(const u8 *p)
+    {
+        return (static_cast<u32>(p[0]) << 24) | (p[1] << 16) | (p[2] << 8) | p[3];
+    }
+
+    bool is_pcap_magic(u32 magic)
+    {
+        return (magic == PcapMagicMicros || magic == bswap_32(PcapMagicMicros)
+                || magic == PcapMagicNanos || magic == bswap_32(PcapMagicNanos));
+    }
+
+    u64 pow10(unsigned exponent)
+    {
+        u64 result = 1u;
+        while (exponent--)
+            result *= 10u;
+        return result;
+    }
+
+    const u64 NanosPerSecond = 1000000000u;
+}
+
+bool is_pcap_file(const std::string &path)
+{
+    auto f = std::fopen(path.c_str(), "rb");
+
+    if (!f)
+        return false;
+
+    u8 magic[4] = {};
+    const bool result = std::fread(magic, 1, sizeof(magic), f) == sizeof(magic)
+        && (load_u32_le(magic) == PcapNgSectionHeader || is_pcap_magic(load_u32_le(magic)));
+    std::fclose(f);
+    return result;
+}
+
+PcapReader::PcapReader() = default;
+
+PcapReader::~PcapReader()
+{
+    close();
+}
+
+std::error_code PcapReader::open(const std::string &path)
+{
+    return open(path, {});
+}
+
+std::error_code PcapReader::open(const std::string &path, const Options &options)
+{
+    close();
+
+    errno = 0;
+    file_ = std::fopen(path.c_str(), "rb");
+
+    if (!file_)
+        return errno_error_code(ENOENT);
+
+    std::setvbuf(file_, nullptr, _IOFBF, BufferSize);
+
+    u8 header[PcapHeaderSize] = {};
+    const size_t headerSize = std::fread(header, 1, sizeof(header), file_);
+    const u32 magic = headerSize >= 12u ? load_u32_le(header) : 0u;
+
+    if (magic == PcapNgSectionHeader)
+    {
+        // The byte order of each section is given by its header block.
+        const u32 byteOrderMagic = load_u32_le(header + 8);
+
+        if (byteOrderMagic != PcapNgByteOrderMagic
+            && byteOrderMagic != bswap_32(PcapNgByteOrderMagic))
+        {
+            close();
+            return ListfileError::InvalidHeader;
+        }
+
+        pcapng_ = true;
+        dataStart_ = 0u;
+    }
+    else if (headerSize == PcapHeaderSize && is_pcap_magic(magic))
+    {
+        swapped_ = magic != PcapMagicMicros && magic != PcapMagicNanos;
+        pcapInterface_.tsExponent = (magic == PcapMagicNanos || magic == bswap_32(PcapMagicNanos)) ? 9u : 6u;
+        // The upper bits of the link type field may hold FCS information.
+        pcapInterface_.linkType = get32(header + 20) & 0xffffu;
+        dataStart_ = PcapHeaderSize;
+    }
+    else
+    {
+        close();
+        return ListfileError::InvalidHeader;
+    }
+
+    path_ = path;
+    options_ = options;
+
+    return rewind();
+}
+
+void PcapReader::close()
+{
+    if (file_)
+    {
+        std::fclose(file_);
+        file_ = nullptr;
+    }
+
+    pcapng_ = false;
+    swapped_ = false;
+    dataStart_ = offset_ = 0u;
+    pcapInterface_ = {};
+    interfaces_.clear();
+    capture_ = {};
+    counters_ = {};
+}
+
+std::error_code PcapReader::rewind()
+{
+    if (!file_)
+        return ListfileError::NotOpen;
+
+    std::clearerr(file_);
+    errno = 0;
+
+    if (file_seek(file_, dataStart_) != 0)
+        return errno_error_code();
+
+    offset_ = dataStart_;
+    interfaces_.clear();
+    capture_ = {};
+    counters_ = {};
+    return {};
+}
+
+std::error_code PcapReader::readPacket(DataPacket &packet)
+{
+    if (!file_)
+        return ListfileError::NotOpen;
+
+    while (true)
+    {
+        u32 linkType = 0u;
+        u64 timestamp = 0u;
+
+        if (auto ec = readFrame(linkType, timestamp))
+            return ec;
+
+        ++counters_.frames;
+
+        if (handleFrame(linkType, timestamp, packet))
+        {
+            ++counters_.packets;
+            return {};
+        }
+    }
+}
+
+bool PcapReader::read(void *dest, size_t size)
+{
+    return std::fread(dest, 1, size, file_) == size;
+}
+
+u16 PcapReader::get16(const u8 *p) const
+{
+    u16 result = p[0] | (p[1] << 8);
+    return swapped_ ? static_cast<u16>((result << 8) | (result >> 8)) : result;
+}
+
+u32 PcapReader::get32(const u8 *p) const
+{
+    u32 result = load_u32_le(p);
+    return swapped_ ? bswap_32(result) : result;
+}
+
+std::error_code PcapReader::readFrame(u32 &linkType, u64 &timestamp)
+{
+    u64 recordStart = offset_;
+    std::error_code ec;
+
+    if (pcapng_)
+    {
+        bool haveFrame = false;
+
+        while (!haveFrame && !ec)
+        {
+            recordStart = offset_;
+            ec = readPcapNgBlock(linkType, timestamp, haveFrame);
+        }
+    }
+    else
+    {
+        u8 header[PcapRecordHeaderSize];
+
+        if (!read(header, sizeof(header)))
+        {
+            ec = ListfileError::EndOfFile;
+        }
+        else
+        {
+            const u32 seconds = get32(header);
+            const u32 fraction = get32(header + 4);
+            const u32 capturedSize = get32(header + 8);
+
+            if (capturedSize > PcapMaxFrameSize)
+            {
+                spdlog::error("PcapReader: invalid record size {} at offset {}", capturedSize, offset_);
+                return ListfileError::CorruptRecord;
+            }
+
+            frame_.resize(capturedSize);
+
+            if (!read(frame_.data(), frame_.size()))
+            {
+                ec = ListfileError::EndOfFile;
+            }
+            else
+            {
+                linkType = pcapInterface_.linkType;
+                timestamp = seconds * NanosPerSecond
+                    + fraction * pow10(9u - pcapInterface_.tsExponent);
+                offset_ += sizeof(header) + capturedSize;
+            }
+        }
+    }
+
+    if (ec == ListfileError::EndOfFile)
+    {
+        // Go back to the start of a partially written record so that it can
+        // be read once complete.
+        offset_ = recordStart;
+        std::clearerr(file_);
+        file_seek(file_, offset_);
+    }
+
+    return ec;
+}
+
+std::error_code PcapReader::readPcapNgBlock(u32 &linkType, u64 &timestamp, bool &haveFrame)
+{
+    // Every block has at least type, length and trailing length. The third
+    // word of a section header block is its byte order magic.
+    const size_t MinBlockSize = 12u;
+
+    block_.resize(MinBlockSize);
+
+    if (!read(block_.data(), MinBlockSize))
+        return ListfileError::EndOfFile;
+
+    const u32 blockType = load_u32_le(block_.data());
+
+    if (blockType == PcapNgSectionHeader)
+    {
+        const u32 byteOrderMagic = load_u32_le(block_.data() + 8);
+
+        if (byteOrderMagic == PcapNgByteOrderMagic)
+            swapped_ = false;
+        else if (byteOrderMagic == bswap_32(PcapNgByteOrderMagic))
+            swapped_ = true;
+        else
+        {
+            spdlog::error("PcapReader: invalid section header at offset {}", offset_);
+            return ListfileError::CorruptRecord;
+        }
+
+        interfaces_.clear();
+    }
+
+    const u32 blockSize = get32(block_.data() + 4);
+
+    if (blockSize < MinBlockSize || blockSize % 4u || blockSize > PcapNgMaxBlockSize)
+    {
+        spdlog::error("PcapReader: invalid block size {} at offset {}", blockSize, offset_);
+        return ListfileError::CorruptRecord;
+    }
+
+    block_.resize(blockSize);
+
+    if (!read(block_.data() + MinBlockSize, blockSize - MinBlockSize))
+        return ListfileError::EndOfFile;
+
+    if (get32(block_.data() + blockSize - 4) != blockSize)
+    {
+        spdlog::error("PcapReader: block size mismatch at offset {}", offset_);
+        return ListfileError::CorruptRecord;
+    }
+
+    offset_ += blockSize;
+
+    const u8 *body = block_.data() + 8;
+    const size_t bodySize = blockSize - MinBlockSize;
+    const u32 type = get32(block_.data());
+
+    auto set_frame = [&] (const u8 *data, size_t size) -> std::error_code
+    {
+        if (interfaces_.empty())
+        {
+            spdlog::error("PcapReader: packet block without interface at offset {}", offset_ - blockSize);
+            return ListfileError::CorruptRecord;
+        }
+
+        frame_.assign(data, data + size);
+        haveFrame = true;
+        return {};
+    };
+
+    auto to_nanos = [] (const Interface &iface, u64 ts) -> u64
+    {
+        const u64 offset = iface.tsOffset * NanosPerSecond;
+
+        if (iface.tsBinary)
+        {
+            const unsigned e = iface.tsExponent;
+            const u64 seconds = e < 64u ? ts >> e : 0u;
+            const u64 fraction = e < 64u ? ts & ((u64(1) << e) - 1u) : ts;
+            return offset + seconds * NanosPerSecond
+                + static_cast<u64>(std::ldexp(static_cast<double>(fraction), -static_cast<int>(e)) * NanosPerSecond);
+        }
+
+        if (iface.tsExponent <= 9u)
+            return offset + ts * pow10(9u - iface.tsExponent);
+
+        return offset + ts / pow10(std::min(iface.tsExponent - 9u, 19u));
+    };
+
+    if (type == PcapNgInterfaceDescription && bodySize >= 8u)
+    {
+        Interface iface;
+        iface.linkType = get16(body);
+
+        for (size_t pos = 8u; pos + 4u <= bodySize;)
+        {
+            const u16 code = get16(body + pos);
+            const u16 length = get16(body + pos + 2);
+            const u8 *value = body + pos + 4;
+
+            if (code == PcapNgOptionEnd || pos + 4u + length > bodySize)
+                break;
+
+            if (code == PcapNgOptionTsResol && length >= 1u)
+            {
+                iface.tsBinary = value[0] & 0x80u;
+                iface.tsExponent = value[0] & 0x7fu;
+            }
+            else if (code == PcapNgOptionTsOffset && length >= 8u)
+            {
+                const u64 lo = get32(swapped_ ? value + 4 : value);
+                const u64 hi = get32(swapped_ ? value : value + 4);
+                iface.tsOffset = (hi << 32) | lo;
+            }
+
+            pos += 4u + ((length + 3u) & ~3u);
+        }
+
+        interfaces_.push_back(iface);
+    }
+    else if (type == PcapNgEnhancedPacket && bodySize >= 20u)
+    {
+        const u32 ifaceIndex = get32(body);
+        const u64 ts = (static_cast<u64>(get32(body + 4)) << 32) | get32(body + 8);
+        const u32 capturedSize = get32(body + 12);
+
+        if (ifaceIndex >= interfaces_.size() || capturedSize > bodySize - 20u)
+        {
+            spdlog::error("PcapReader: invalid enhanced packet block at offset {}", offset_ - blockSize);
+            return ListfileError::CorruptRecord;
+        }
+
+        linkType = interfaces_[ifaceIndex].linkType;
+        timestamp = to_nanos(interfaces_[ifaceIndex], ts);
+        return set_frame(body + 20, capturedSize);
+    }
+    else if (type == PcapNgObsoletePacket && bodySize >= 20u)
+    {
+        const u16 ifaceIndex = get16(body);
+        const u64 ts = (static_cast<u64>(get32(body + 4)) << 32) | get32(body + 8);
+        const u32 capturedSize = get32(body + 12);
+
+        if (ifaceIndex >= interfaces_.size() || capturedSize > bodySize - 20u)
+        {
+            spdlog::error("PcapReader: invalid packet block at offset {}", offset_ - blockSize);
+            return ListfileError::CorruptRecord;
+        }
+
+        linkType = interfaces_[ifaceIndex].linkType;
+        timestamp = to_nanos(interfaces_[ifaceIndex], ts);
+        return set_frame(body + 20, capturedSize);
+    }
+    else if (type == PcapNgSimplePacket && bodySize >= 4u)
+    {
+        // Simple packet blocks belong to the first interface and carry no
+        // timestamp: keep the one of the previous packet.
+        if (!interfaces_.empty())
+            linkType = interfaces_[0].linkType;
+        timestamp = capture_.timestamp;
+        return set_frame(body + 4, std::min<size_t>(get32(body), bodySize - 4u));
+    }
+
+    // Other blocks (name resolution, statistics, custom, ...) are skipped.
+    return {};
+}
+
+bool PcapReader::handleFrame(u32 linkType, u64 timestamp, DataPacket &packet)
+{
+    const u8 *data = frame_.data();
+    const size_t size = frame_.size();
+    size_t offset = 0u;
+    u16 protocol = 0u;
+
+    switch (linkType)
+    {
+        case LinkTypeEthernet:
+            if (size < 14u)
+                break;
+
+            protocol = load_u16_be(data + 12);
+            offset = 14u;
+
+            while ((protocol == EtherTypeVlan || protocol == EtherTypeQinQ || protocol == EtherTypeQinQOld)
+                   && offset + 4u <= size)
+            {
+                protocol = load_u16_be(data + offset + 2);
+                offset += 4u;
+            }
+            break;
+
+        case LinkTypeLinuxSll:
+            if (size >= 16u)
+            {
+                protocol = load_u16_be(data + 14);
+                offset = 16u;
+            }
+            break;
+
+        case LinkTypeLinuxSll2:
+            if (size >= 20u)
+            {
+                protocol = load_u16_be(data);
+                offset = 20u;
+            }
+            break;
+
+        case LinkTypeRaw:
+        case LinkTypeRawOpenBSD:
+        case LinkTypeIPv4:
+            if (size >= 1u && (data[0] >> 4) == 4u)
+                protocol = EtherTypeIPv4;
+            break;
+
+        // The address family is in the byte order of the capturing host for
+        // DLT_NULL and in network byte order for DLT_LOOP.
+        case LinkTypeNull:
+        case LinkTypeLoop:
+            if (size >= 4u)
+            {
+                const u32 family = linkType == LinkTypeLoop ? load_u32_be(data) : get32(data);
+
+                if (family == AddressFamilyInet)
+                    protocol = EtherTypeIPv4;
+                offset = 4u;
+            }
+            break;
+    }
+
+    if (protocol != EtherTypeIPv4)
+    {
+        ++counters_.otherProtocol;
+        return false;
+    }
+
+    const u8 *ip = data + offset;
+    const size_t ipSize = size - offset;
+
+    if (ipSize < 20u)
+    {
+        ++counters_.truncated;
+        return false;
+    }
+
+    const size_t ipHeaderSize = (ip[0] & 0xfu) * 4u;
+
+    if ((ip[0] >> 4) != 4u || ipHeaderSize < 20u || ip[9] != IpProtocolUdp)
+    {
+        ++counters_.otherProtocol;
+        return false;
+    }
+
+    // More fragments flag or a non-zero fragment offset.
+    if (load_u16_be(ip + 6) & 0x3fffu)
+    {
+        ++counters_.fragments;
+        return false;
+    }
+
+    if (ipSize < ipHeaderSize + 8u)
+    {
+        ++counters_.truncated;
+        return false;
+    }
+
+    const u8 *udp = ip + ipHeaderSize;
+    const u16 srcPort = load_u16_be(udp);
+    const u16 dstPort = load_u16_be(udp + 2);
+    const size_t udpSize = load_u16_be(udp + 4);
+
+    if (!options_.ports.empty()
+        && std::find(options_.ports.begin(), options_.ports.end(), srcPort) == options_.ports.end()
+        && std::find(options_.ports.begin(), options_.ports.end(), dstPort) == options_.ports.end())
+    {
+        ++counters_.otherPort;
+        return false;
+    }
+
+    if (udpSize < 8u)
+    {
+        ++counters_.invalid;
+        return false;
+    }
+
+    if (ipSize < ipHeaderSize + udpSize)
+    {
+        ++counters_.truncated;
+        return false;
+    }
+
+    const u8 *payload = udp + 8;
+    const size_t payloadSize = udpSize - 8u;
+
+    if (payloadSize < sizeof(PacketBase) || payloadSize > sizeof(DataPacket))
+    {
+        ++counters_.invalid;
+        return false;
+    }
+
+    PacketBase base;
+    std::memcpy(&base, payload, sizeof(base));
+
+    if (base.bufferType & CommandPacketBufferType)
+    {
+        ++counters_.commandPackets;
+        return false;
+    }
+
+    if ((base.bufferType != McpdDataBufferType && base.bufferType != MdllDataBufferType)
+        || base.bufferLength * sizeof(u16) > payloadSize
+        || base.headerLength > base.bufferLength)
+    {
+        ++counters_.invalid;
+        return false;
+    }
+
+    auto dest = reinterpret_cast<u8 *>(&packet);
+    std::memcpy(dest, payload, payloadSize);
+    std::memset(dest + payloadSize, 0, sizeof(DataPacket) - payloadSize);
+
+    capture_.timestamp = timestamp;
+    capture_.srcAddr = load_u32_be(ip + 12);
+    capture_.dstAddr = load_u32_be(ip + 16);
+    capture_.srcPort = srcPort;
+    capture_.dstPort = dstPort;
+    capture_.size = payloadSize;
+
+    return true;
+}
+
+}
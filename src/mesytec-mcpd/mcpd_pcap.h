@@ -0,0 +1,120 @@
+#ifndef __MESYTEC_MCPD_PCAP_H__
+#define __MESYTEC_MCPD_PCAP_H__
+
+#include <cstdio>
+#include <string>
+#include <system_error>
+#include <vector>
+
+#include "mcpd_packet_source.h"
+
+namespace mesytec::mcpd
+{
+
+// True if the file is a pcap or pcapng capture file.
+MESYTEC_MCPD_EXPORT bool is_pcap_file(const std::string &path);
+
+// Reads MCPD data packets from network captures, e.g. made with tcpdump or
+// wireshark. Supports pcap (microsecond and nanosecond resolution, either
+// byte order) and pcapng files. No libpcap is required.
+//
+// Ethernet (including VLAN tags), Linux cooked (SLL and SLL2, 'tcpdump -i
+// any'), raw IP and BSD loopback captures are understood. UDP payloads of
+// IPv4 datagrams which look like MCPD or MDLL data packets are returned,
+// everything else is counted and skipped: other protocols, datagrams
+// truncated by the capture snap length, IP fragments and command packets.
+class MESYTEC_MCPD_EXPORT PcapReader: public PacketSource
+{
+  public:
+    struct Options
+    {
+        // UDP ports to extract packets from, matched against source and
+        // destination port. Empty accepts data packets on any port.
+        std::vector<u16> ports;
+    };
+
+    // Capture information of the last packet returned by readPacket().
+    struct CaptureInfo
+    {
+        u64 timestamp = 0u;     // capture time in ns since the unix epoch
+        u32 srcAddr = 0u;       // IPv4 addresses in host byte order
+        u32 dstAddr = 0u;
+        u16 srcPort = 0u;
+        u16 dstPort = 0u;
+        u32 size = 0u;          // UDP payload size in bytes
+    };
+
+    struct Counters
+    {
+        u64 frames = 0u;            // captured frames
+        u64 packets = 0u;           // data packets returned
+        u64 otherProtocol = 0u;     // non IPv4/UDP frames
+        u64 otherPort = 0u;         // UDP datagrams not matching Options::ports
+        u64 truncated = 0u;         // cut by the snap length
+        u64 fragments = 0u;         // IP fragments
+        u64 commandPackets = 0u;
+        u64 invalid = 0u;           // UDP payloads which are not data packets
+    };
+
+    PcapReader();
+    ~PcapReader();
+
+    PcapReader(const PcapReader &) = delete;
+    PcapReader &operator=(const PcapReader &) = delete;
+
+    std::error_code open(const std::string &path);
+    std::error_code open(const std::string &path, const Options &options);
+    void close();
+
+    // Returns the next data packet or ListfileError::EndOfFile. A partially
+    // written last record is read again by the next call.
+    std::error_code readPacket(DataPacket &packet) override;
+    std::error_code rewind() override;
+    u64 packetsRead() const override { return counters_.packets; }
+
+    bool isOpen() const { return file_ != nullptr; }
+    bool isPcapNg() const { return pcapng_; }
+    const std::string &path() const { return path_; }
+    const CaptureInfo &lastCapture() const { return capture_; }
+    const Counters &counters() const { return counters_; }
+
+  private:
+    struct Interface
+    {
+        u32 linkType = 0u;
+        // Timestamp resolution: units per second is 10^tsExponent or, if
+        // tsBinary is set, 2^tsExponent.
+        u8 tsExponent = 6u;
+        bool tsBinary = false;
+        u64 tsOffset = 0u;      // seconds
+    };
+
+    // Reads the next captured frame into frame_. Returns EndOfFile at the end
+    // of the file, seeking back to the start of an incomplete record.
+    std::error_code readFrame(u32 &linkType, u64 &timestamp);
+    std::error_code readPcapNgBlock(u32 &linkType, u64 &timestamp, bool &haveFrame);
+    // Copies the UDP payload of frame_ to packet. Returns false and updates
+    // the counters if the frame is skipped.
+    bool handleFrame(u32 linkType, u64 timestamp, DataPacket &packet);
+    bool read(void *dest, size_t size);
+    u16 get16(const u8 *p) const;
+    u32 get32(const u8 *p) const;
+
+    std::FILE *file_ = nullptr;
+    std::string path_;
+    Options options_;
+    bool pcapng_ = false;
+    bool swapped_ = false;      // file byte order differs from the host
+    u64 dataStart_ = 0u;
+    u64 offset_ = 0u;
+    Interface pcapInterface_;   // pcap: the single interface
+    std::vector<Interface> interfaces_; // pcapng: interfaces of the current section
+    std::vector<u8> frame_;
+    std::vector<u8> block_;
+    CaptureInfo capture_;
+    Counters counters_;
+};
+
+}
+
+#endif /* __MESYTEC_MCPD_PCAP_H__ */
@@ -0,0 +1,336 @@
+#include <gtest/gtest.h>
+
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <unistd.h>
+
+#include "mcpd_listfile.h"
+#include "mcpd_pcap.h"
+
+using namespace mesytec::mcpd;
+
+namespace
+{
+
+void put_u16(std::vector<u8> &dest, u16 value, bool bigEndian)
+{
+    for (size_t i = 0; i < sizeof(value); ++i)
+        dest.push_back(value >> ((bigEndian ? sizeof(value) - 1 - i : i) * 8));
+}
+
+void put_u32(std::vector<u8> &dest, u32 value, bool bigEndian)
+{
+    for (size_t i = 0; i < sizeof(value); ++i)
+        dest.push_back(value >> ((bigEndian ? sizeof(value) - 1 - i : i) * 8));
+}
+
+DataPacket make_packet(u16 bufferNumber, u16 bufferType = McpdDataBufferType)
+{
+    DataPacket packet = {};
+    packet.bufferType = bufferType;
+    packet.headerLength = 21;
+    packet.bufferLength = packet.headerLength + 3 * (bufferNumber + 1);
+    packet.bufferNumber = bufferNumber;
+    packet.deviceId = 3;
+
+    for (int i = 0; i < get_data_length(packet); ++i)
+        packet.data[i] = bufferNumber * 100 + i;
+
+    return packet;
+}
+
+// IPv4 and UDP headers followed by the packet. Checksums are not verified by
+// the reader and left at zero.
+std::vector<u8> make_udp(const DataPacket &packet, u16 srcPort, u16 dstPort, u16 fragment = 0)
+{
+    const size_t payloadSize = get_packet_size(packet);
+    std::vector<u8> result;
+
+    result.push_back(0x45); // version 4, 20 byte header
+    result.push_back(0);
+    put_u16(result, 20 + 8 + payloadSize, true);
+    put_u16(result, 0x1234, true);
+    put_u16(result, fragment, true);
+    result.push_back(64);
+    result.push_back(17);
+    put_u16(result, 0, true);
+    put_u32(result, 0xc0a8a864, true); // 192.168.168.100
+    put_u32(result, 0xc0a8a801, true);
+    put_u16(result, srcPort, true);
+    put_u16(result, dstPort, true);
+    put_u16(result, 8 + payloadSize, true);
+    put_u16(result, 0, true);
+
+    auto bytes = reinterpret_cast<const u8 *>(&packet);
+    result.insert(result.end(), bytes, bytes + payloadSize);
+    return result;
+}
+
+std::vector<u8> make_ethernet(const std::vector<u8> &payload, u16 etherType = 0x0800, bool vlan = false)
+{
+    std::vector<u8> result(12, 0xaa);
+
+    if (vlan)
+    {
+        put_u16(result, 0x8100, true);
+        put_u16(result, 42, true);
+    }
+
+    put_u16(result, etherType, true);
+    result.insert(result.end(), payload.begin(), payload.end());
+    return result;
+}
+
+std::vector<u8> make_sll2(const std::vector<u8> &payload)
+{
+    std::vector<u8> result;
+    put_u16(result, 0x0800, true);
+    result.resize(20);
+    result.insert(result.end(), payload.begin(), payload.end());
+    return result;
+}
+
+struct Frame
+{
+    std::vector<u8> data;
+    u64 timestamp; // ns
+    size_t capturedSize = static_cast<size_t>(-1);
+};
+
+std::vector<u8> make_pcap(const std::vector<Frame> &frames, u32 linkType, bool nanos, bool bigEndian)
+{
+    std::vector<u8> result;
+    put_u32(result, nanos ? 0xa1b23c4d : 0xa1b2c3d4, bigEndian);
+    put_u16(result, 2, bigEndian);
+    put_u16(result, 4, bigEndian);
+    put_u32(result, 0, bigEndian);
+    put_u32(result, 0, bigEndian);
+    put_u32(result, 65535, bigEndian);
+    put_u32(result, linkType, bigEndian);
+
+    for (const auto &frame: frames)
+    {
+        const size_t size = std::min(frame.capturedSize, frame.data.size());
+        put_u32(result, frame.timestamp / 1000000000u, bigEndian);
+        put_u32(result, (frame.timestamp % 1000000000u) / (nanos ? 1 : 1000), bigEndian);
+        put_u32(result, size, bigEndian);
+        put_u32(result, frame.data.size(), bigEndian);
+        result.insert(result.end(), frame.data.begin(), frame.data.begin() + size);
+    }
+
+    return result;
+}
+
+void put_block(std::vector<u8> &dest, u32 type, const std::vector<u8> &body, bool bigEndian)
+{
+    const size_t padded = (body.size() + 3) & ~3u;
+    put_u32(dest, type, bigEndian);
+    put_u32(dest, 12 + padded, bigEndian);
+    dest.insert(dest.end(), body.begin(), body.end());
+    dest.resize(dest.size() + padded - body.size());
+    put_u32(dest, 12 + padded, bigEndian);
+}
+
+// One section with a nanosecond resolution SLL2 interface.
+std::vector<u8> make_pcapng(const std::vector<Frame> &frames, bool bigEndian)
+{
+    std::vector<u8> result, body;
+
+    put_u32(body, 0x1a2b3c4d, bigEndian);
+    put_u16(body, 1, bigEndian);
+    put_u16(body, 0, bigEndian);
+    put_u32(body, 0xffffffff, bigEndian);
+    put_u32(body, 0xffffffff, bigEndian);
+    put_block(result, 0x0a0d0d0a, body, bigEndian);
+
+    body.clear();
+    put_u16(body, 276, bigEndian);
+    put_u16(body, 0, bigEndian);
+    put_u32(body, 0, bigEndian);
+    put_u16(body, 9, bigEndian); // if_tsresol
+    put_u16(body, 1, bigEndian);
+    put_u32(body, 9, false);     // value byte followed by padding
+    put_u16(body, 0, bigEndian);
+    put_u16(body, 0, bigEndian);
+    put_block(result, 1, body, bigEndian);
+
+    for (const auto &frame: frames)
+    {
+        body.clear();
+        put_u32(body, 0, bigEndian);
+        put_u32(body, frame.timestamp >> 32, bigEndian);
+        put_u32(body, frame.timestamp & 0xffffffffu, bigEndian);
+        put_u32(body, frame.data.size(), bigEndian);
+        put_u32(body, frame.data.size(), bigEndian);
+        body.insert(body.end(), frame.data.begin(), frame.data.end());
+        put_block(result, 6, body, bigEndian);
+
+        // Interface statistics blocks are skipped.
+        put_block(result, 5, std::vector<u8>(12), bigEndian);
+    }
+
+    return result;
+}
+
+std::string write_file(const std::string &name, const std::vector<u8> &data)
+{
+    const auto path = (std::filesystem::temp_directory_path()
+                       / (name + "-" + std::to_string(getpid()))).string();
+    std::ofstream out(path, std::ios::binary | std::ios::trunc);
+    out.write(reinterpret_cast<const char *>(data.data()), data.size());
+    return path;
+}
+
+void expect_packet(const DataPacket &packet, const DataPacket &expected)
+{
+    ASSERT_EQ(std::memcmp(&packet, &expected, sizeof(packet)), 0);
+}
+
+} // namespace
+
+TEST(Pcap, EthernetCapture)
+{
+    const u64 t0 = 1700000000u * 1000000000ull;
+    const auto p0 = make_packet(0);
+    const auto p1 = make_packet(1, MdllDataBufferType);
+    const auto p2 = make_packet(2);
+
+    std::vector<Frame> frames =
+    {
+        { make_ethernet(make_udp(p0, 54321, 54321)), t0 + 1000 },
+        { make_ethernet(std::vector<u8>(28), 0x0806), t0 + 2000 },                          // ARP
+        { make_ethernet(make_udp(make_packet(9, CommandPacketBufferType), 54321, 54321)), t0 + 3000 },
+        { make_ethernet(make_udp(p1, 54322, 60000), 0x0800, true), t0 + 4000 },             // VLAN
+        { make_ethernet(make_udp(make_packet(10), 9999, 9999)), t0 + 5000 },                // other port
+        { make_ethernet(make_udp(make_packet(11), 54321, 54321, 0x2000)), t0 + 6000 },      // fragment
+        { make_ethernet(make_udp(make_packet(12), 54321, 54321)), t0 + 7000, 100 },         // snap length
+        { make_ethernet(make_udp(p2, 54321, 54321)), t0 + 8000 },
+    };
+
+    for (bool bigEndian: { false, true })
+    {
+        const auto path = write_file("mcpd-pcap-test", make_pcap(frames, 1, false, bigEndian));
+        ASSERT_TRUE(is_pcap_file(path));
+
+        PcapReader::Options options;
+        options.ports = { 54321, 54322 };
+        PcapReader reader;
+        ASSERT_FALSE(reader.open(path, options));
+        ASSERT_FALSE(reader.isPcapNg());
+
+        for (int pass = 0; pass < 2; ++pass)
+        {
+            DataPacket packet = {};
+            ASSERT_FALSE(reader.readPacket(packet));
+            expect_packet(packet, p0);
+            ASSERT_EQ(reader.lastCapture().timestamp, t0 + 1000);
+            ASSERT_EQ(reader.lastCapture().srcAddr, 0xc0a8a864u);
+            ASSERT_EQ(reader.lastCapture().size, get_packet_size(p0));
+
+            ASSERT_FALSE(reader.readPacket(packet));
+            expect_packet(packet, p1);
+            ASSERT_EQ(reader.lastCapture().timestamp, t0 + 4000);
+            ASSERT_EQ(reader.lastCapture().srcPort, 54322u);
+            ASSERT_EQ(reader.lastCapture().dstPort, 60000u);
+
+            ASSERT_FALSE(reader.readPacket(packet));
+            expect_packet(packet, p2);
+
+            ASSERT_EQ(reader.readPacket(packet), ListfileError::EndOfFile);
+
+            const auto &counters = reader.counters();
+            ASSERT_EQ(counters.frames, frames.size());
+            ASSERT_EQ(counters.packets, 3u);
+            ASSERT_EQ(reader.packetsRead(), 3u);
+            ASSERT_EQ(counters.otherProtocol, 1u);
+            ASSERT_EQ(counters.commandPackets, 1u);
+            ASSERT_EQ(counters.otherPort, 1u);
+            ASSERT_EQ(counters.fragments, 1u);
+            ASSERT_EQ(counters.truncated, 1u);
+            ASSERT_EQ(counters.invalid, 0u);
+            ASSERT_FALSE(reader.rewind());
+        }
+
+        // Without a port filter the packet on port 9999 is returned as well.
+        std::unique_ptr<PacketSource> source;
+        ASSERT_FALSE(open_packet_source(path, source));
+        ASSERT_NE(dynamic_cast<PcapReader *>(source.get()), nullptr);
+
+        DataPacket packet = {};
+        while (!source->readPacket(packet)) ;
+        ASSERT_EQ(source->packetsRead(), 4u);
+
+        std::filesystem::remove(path);
+    }
+}
+
+TEST(Pcap, PcapNgCapture)
+{
+    const u64 t0 = 1700000000123456789ull;
+    std::vector<Frame> frames;
+
+    for (u16 i = 0; i < 5; ++i)
+        frames.push_back({ make_sll2(make_udp(make_packet(i), 54321, 54321)), t0 + i * 100 });
+
+    for (bool bigEndian: { false, true })
+    {
+        const auto data = make_pcapng(frames, bigEndian);
+
+        // The last packet block is incomplete until the file is appended to.
+        const size_t lastBlockEnd = data.size() - 24;
+        const auto path = write_file("mcpd-pcap-test", { data.begin(), data.begin() + lastBlockEnd - 10 });
+        ASSERT_TRUE(is_pcap_file(path));
+
+        PcapReader reader;
+        ASSERT_FALSE(reader.open(path));
+        ASSERT_TRUE(reader.isPcapNg());
+
+        DataPacket packet = {};
+
+        for (u16 i = 0; i < 4; ++i)
+        {
+            ASSERT_FALSE(reader.readPacket(packet));
+            expect_packet(packet, make_packet(i));
+            ASSERT_EQ(reader.lastCapture().timestamp, t0 + i * 100);
+        }
+
+        ASSERT_EQ(reader.readPacket(packet), ListfileError::EndOfFile);
+
+        {
+            std::ofstream out(path, std::ios::binary | std::ios::app);
+            out.write(reinterpret_cast<const char *>(data.data() + lastBlockEnd - 10),
+                      data.size() - lastBlockEnd + 10);
+        }
+
+        ASSERT_FALSE(reader.readPacket(packet));
+        expect_packet(packet, make_packet(4));
+        ASSERT_EQ(reader.lastCapture().timestamp, t0 + 400);
+        ASSERT_EQ(reader.readPacket(packet), ListfileError::EndOfFile);
+        ASSERT_EQ(reader.counters().frames, 5u);
+
+        std::filesystem::remove(path);
+    }
+}
+
+TEST(Pcap, InvalidFiles)
+{
+    const auto packet = make_packet(0);
+    const auto path = write_file("mcpd-pcap-test", { reinterpret_cast<const u8 *>(&packet),
+                                                    reinterpret_cast<const u8 *>(&packet + 1) });
+    ASSERT_FALSE(is_pcap_file(path));
+
+    PcapReader reader;
+    ASSERT_EQ(reader.open(path), ListfileError::InvalidHeader);
+
+    // Record larger than any snap length
+    auto data = make_pcap({ { make_ethernet(make_udp(packet, 54321, 54321)), 0u } }, 1, true, false);
+    data[24 + 8 + 2] = 0xff;
+    write_file("mcpd-pcap-test", data);
+
+    DataPacket dest = {};
+    ASSERT_FALSE(reader.open(path));
+    ASSERT_EQ(reader.readPacket(dest), ListfileError::CorruptRecord);
+
+    std::filesystem::remove(path);
+}
@@ -35,6 +35,18 @@ bool WorkerBase::start()
 
     resetCounters();
     *readoutException_.lock() = nullptr;
+    stopRequested_ = false;
+
+    if (!shmRingName_.empty())
+    {
+        shmRing_ = std::make_unique<ShmPacketRingWriter>();
+
+        if (auto ec = shmRing_->create(shmRingName_, shmRingSlots_))
+        {
+            shmRing_.reset();
+            throw std::system_error(ec, "start: shared memory ring " + shmRingName_);
+        }
+    }
 
     std::promise<bool> promise;
     auto f = promise.get_future();
@@ -82,6 +94,7 @@ bool WorkerBase::stop(bool immediate)
         return false;
     }
 
+    stopRequested_ = true;
     queue_.attr("shutdown")(immediate);
 
     if (workerThread_.joinable())
@@ -109,6 +122,9 @@ void WorkerBase::workerLoop_(std::promise<bool> promise)
         spdlog::error("{}: worker loop exiting with exception: {}", PRETTY_FUNCTION, e.what());
         *readoutException_.lock() = std::current_exception();
     }
+
+    // Readers of the ring consume the remaining packets, then stop.
+    shmRing_.reset();
 }
 
 bool WorkerBase::isRunning() const
@@ -135,6 +151,90 @@ void WorkerBase::rethrowException()
     }
 }
 
+void WorkerBase::setShmHistos(const std::string &shmName, unsigned publishInterval_ms)
+{
+    std::lock_guard<std::mutex> lock(startStopMutex_);
+
+    if (isRunning_())
+        throw std::runtime_error("setShmHistos: worker is running");
+
+    shmHistos_.reset();
+
+    if (shmName.empty())
+        return;
+
+    auto histos = std::make_unique<ShmLiveHistos>(shmName);
+
+    if (auto ec = histos->publish())
+        throw std::system_error(ec, "setShmHistos: " + shmName);
+
+    shmHistos_ = std::move(histos);
+    shmPublishInterval_ = std::chrono::milliseconds(publishInterval_ms);
+    tShmPublish_ = std::chrono::steady_clock::now();
+}
+
+void WorkerBase::setShmRing(const std::string &shmName, size_t slotCount)
+{
+    std::lock_guard<std::mutex> lock(startStopMutex_);
+
+    if (isRunning_())
+        throw std::runtime_error("setShmRing: worker is running");
+
+    shmRingName_ = shmName;
+    shmRingSlots_ = slotCount;
+}
+
+void WorkerBase::setEventFilter(const std::string &expression)
+{
+    std::lock_guard<std::mutex> lock(startStopMutex_);
+
+    if (isRunning_())
+        throw std::runtime_error("setEventFilter: worker is running");
+
+    if (expression.empty())
+        eventFilter_.reset();
+    else
+        eventFilter_ = std::make_unique<EventFilter>(expression);
+}
+
+bool WorkerBase::filterPacket_(DataPacket &packet, u32 srcAddr)
+{
+    if (!eventFilter_
+        || (packet.bufferType != McpdDataBufferType && packet.bufferType != MdllDataBufferType))
+        return true;
+
+    const u64 eventsIn = eventFilter_->counters().eventsIn;
+    const size_t eventsKept = eventFilter_->filterPacket(packet, packet);
+    const u64 packetEvents = eventFilter_->counters().eventsIn - eventsIn;
+
+    getCounters_().lock()->eventsFiltered += packetEvents - eventsKept;
+
+    if (eventsKept > 0 || packetEvents == 0)
+        return true;
+
+    getDeviceStats_().lock()->handlePacket(srcAddr, packet, get_packet_size(packet));
+    return false;
+}
+
+void WorkerBase::handleShmHistos_(const DataPacket *packet, bool force)
+{
+    if (!shmHistos_)
+        return;
+
+    if (packet)
+        shmHistos_->processPacket(*packet);
+
+    const auto now = std::chrono::steady_clock::now();
+
+    if (force || now - tShmPublish_ >= shmPublishInterval_)
+    {
+        if (auto ec = shmHistos_->publish())
+            spdlog::warn("{}: error publishing shared memory histograms: {}", PRETTY_FUNCTION,
+                         ec.message());
+        tShmPublish_ = now;
+    }
+}
+
 Readout::Readout(int listenPort, size_t queueSize)
     : WorkerBase(queueSize)
     , listenPort_(listenPort)
@@ -211,7 +311,6 @@ void Readout::workerLoop(std::promise<bool> promise)
         return;
     }
 
-    // TODO: calculate packet loss and update counters.packetsLost
     try
     {
         while (true)
@@ -234,16 +333,39 @@ void Readout::workerLoop(std::promise<bool> promise)
                         throw std::system_error(ec);
 
                     getCounters_().lock()->timeouts++;
+                    handleShmHistos_(nullptr);
+                }
+                else if (!filterPacket_(augPacket->packet, ntohl(srcAddr.sin_addr.s_addr)))
+                {
+                    augPacket = std::nullopt;
                 }
                 else
                 {
                     augPacket->srcAddr = ntohl(srcAddr.sin_addr.s_addr);
                     augPacket->srcPort = ntohs(srcAddr.sin_port);
+                    bytesTransferred = std::min(bytesTransferred, get_packet_size(augPacket->packet));
 
-                    auto counters = getCounters_().lock();
-                    counters->packets++;
-                    counters->bytes += sizeof(augPacket->packet);
-                    counters->events += get_event_count(augPacket->packet);
+                    writeShmRing_(augPacket->packet, bytesTransferred, augPacket->srcAddr,
+                                  augPacket->srcPort);
+
+                    u64 packetsLost = 0u;
+
+                    {
+                        auto deviceStats = getDeviceStats_().lock();
+                        deviceStats->handlePacket(augPacket->srcAddr, augPacket->packet,
+                                                  bytesTransferred);
+                        packetsLost = deviceStats->totalPacketsLost();
+                    }
+
+                    {
+                        auto counters = getCounters_().lock();
+                        counters->packets++;
+                        counters->bytes += sizeof(augPacket->packet);
+                        counters->events += get_event_count(augPacket->packet);
+                        counters->packetsLost = packetsLost;
+                    }
+
+                    handleShmHistos_(&augPacket->packet);
                 }
             }
 
@@ -274,6 +396,7 @@ void Readout::workerLoop(std::promise<bool> promise)
         }
 
         cleanup();
+        handleShmHistos_(nullptr, true);
     }
     catch (const std::exception &e)
     {
@@ -295,6 +418,37 @@ Replay::Replay(const std::string &filename, size_t queueSize)
 {
 }
 
+void Replay::setPacing(double speed, double packetRate)
+{
+    if (isRunning())
+        throw std::runtime_error("setPacing: worker is running");
+
+    pacerOptions_.speed = speed;
+    pacerOptions_.packetRate = packetRate;
+}
+
+void Replay::setSendTo(const std::string &destination)
+{
+    if (isRunning())
+        throw std::runtime_error("setSendTo: worker is running");
+
+    ForwardDestination dest;
+
+    if (!destination.empty() && parse_forward_destination(destination, dest))
+        throw std::invalid_argument("setSendTo: invalid destination '" + destination + "'");
+
+    sendTo_ = destination;
+}
+
+void Replay::setFollow(bool follow, double idleTimeout)
+{
+    if (isRunning())
+        throw std::runtime_error("setFollow: worker is running");
+
+    follow_ = follow;
+    followIdleTimeout_ = idleTimeout;
+}
+
 void Replay::workerLoop(std::promise<bool> promise)
 {
     spdlog::debug("entering {}", PRETTY_FUNCTION);
@@ -303,15 +457,50 @@ void Replay::workerLoop(std::promise<bool> promise)
     py::gil_scoped_acquire gil_acquire;
     py::object pyqueue = py::module_::import("queue");
 
+    auto pacerOptions = pacerOptions_;
+    std::unique_ptr<PacketForwarder> sender;
+
     try
     {
         py::gil_scoped_release gil_release;
 
-        if (!inputFile_.is_open())
+        if (!sendTo_.empty())
         {
-            inputFile_.open(filename_, std::ios::in | std::ios::binary);
-            if (!inputFile_)
+            ForwardDestination dest;
+            parse_forward_destination(sendTo_, dest);
+            sender = std::make_unique<PacketForwarder>();
+
+            if (auto ec = sender->start({ dest }))
+                throw std::system_error(ec, "send to " + sendTo_);
+
+            if (pacerOptions.speed <= 0.0 && pacerOptions.packetRate <= 0.0)
+                pacerOptions.speed = 1.0;
+        }
+
+        // Recreate the input if the follow setting changed since the last run.
+        if (inputFile_ && follow_ != (dynamic_cast<ListfileFollower *>(inputFile_.get()) != nullptr))
+            inputFile_.reset();
+
+        if (!inputFile_)
+        {
+            std::error_code ec;
+
+            if (follow_)
+            {
+                ListfileFollower::Options options;
+                options.idleTimeout = std::chrono::milliseconds(
+                    static_cast<s64>(followIdleTimeout_ * 1000.0));
+                auto follower = std::make_unique<ListfileFollower>();
+                ec = follower->open(filename_, options);
+                inputFile_ = std::move(follower);
+            }
+            else
+                ec = open_packet_source(filename_, inputFile_);
+
+            if (ec)
             {
+                inputFile_.reset();
+
                 if (!std::filesystem::exists(filename_))
                 {
                     throw std::runtime_error(
@@ -319,18 +508,17 @@ void Replay::workerLoop(std::promise<bool> promise)
                 }
 
                 throw std::runtime_error(
-                    fmt::format("Failed to open input file '{}' for reading {}", filename_,
-                                std::strerror(errno)));
+                    fmt::format("Failed to open input file '{}' for reading: {}", filename_,
+                                ec.message()));
             }
-            inputFile_.exceptions(std::ios::badbit);
             spdlog::debug("{}: opened input file '{}'", PRETTY_FUNCTION, filename_);
         }
         else
         {
             spdlog::debug("{}: input file '{}' already open, reopening", PRETTY_FUNCTION,
                           filename_);
-            inputFile_.clear();
-            inputFile_.seekg(0);
+            if (auto ec = inputFile_->rewind())
+                throw std::system_error(ec, "rewind " + filename_);
         }
 
         promise.set_value(true); // unblock the caller waiting for startup to complete
@@ -344,34 +532,94 @@ void Replay::workerLoop(std::promise<bool> promise)
 
     spdlog::info("{}: replaying from file '{}'", PRETTY_FUNCTION, filename_);
 
-    // TODO: calculate packet loss (recording time loss, not replay loss) and update
-    // counters.packetsLost
+    ReplayPacer pacer(pacerOptions);
+
     try
     {
         while (true)
         {
             AugmentedDataPacket augPacket = {};
+            bool waiting = false;
             auto bytesRead = getCounters_().lock()->bytes;
             auto mbRead = bytesRead / (1024.0 * 1024.0);
             spdlog::debug(
-                "{}: reading packet from file '{}', eof={}, totalBytesRead={} MB ({} bytes)",
-                PRETTY_FUNCTION, filename_, inputFile_.eof(), mbRead, bytesRead);
+                "{}: reading packet from file '{}', totalBytesRead={} MB ({} bytes)",
+                PRETTY_FUNCTION, filename_, mbRead, bytesRead);
 
             {
                 py::gil_scoped_release gil_release;
-                inputFile_.read(reinterpret_cast<char *>(&augPacket.packet),
-                                sizeof(augPacket.packet));
 
-                if (inputFile_.eof())
+                auto ec = inputFile_->readPacket(augPacket.packet);
+
+                if (ec == std::errc::timed_out)
+                {
+                    waiting = true;
+                    getCounters_().lock()->timeouts++;
+                    handleShmHistos_(nullptr);
+                }
+                else if (ec)
                 {
+                    if (ec != ListfileError::EndOfFile)
+                        spdlog::error("{}: error reading from '{}': {}", PRETTY_FUNCTION,
+                                      filename_, ec.message());
                     spdlog::info("{}: reached end of file, exiting replay loop", PRETTY_FUNCTION);
                     break;
                 }
+            }
 
-                auto counters = getCounters_().lock();
-                counters->packets++;
-                counters->bytes += sizeof(augPacket.packet);
-                counters->events += get_event_count(augPacket.packet);
+            if (waiting)
+            {
+                // Following a file: enqueue None to detect the queue shutdown.
+                try
+                {
+                    getQueue().attr("put")(py::none(), true);
+                }
+                catch (py::error_already_set &e)
+                {
+                    if (e.matches(pyqueue.attr("ShutDown")))
+                        break;
+                    throw;
+                }
+
+                continue;
+            }
+
+            {
+                py::gil_scoped_release gil_release;
+
+                if (pacer.isEnabled() && !pacer.wait(augPacket.packet, stopRequested_))
+                    break;
+
+                if (!filterPacket_(augPacket.packet))
+                    continue;
+
+                if (sender)
+                {
+                    while (!sender->forward(&augPacket.packet, get_packet_size(augPacket.packet)))
+                        std::this_thread::sleep_for(std::chrono::microseconds(100));
+                }
+
+                writeShmRing_(augPacket.packet, sizeof(augPacket.packet));
+
+                // Packet loss at recording time: listfiles do not contain the
+                // source address, so demultiplex by deviceId only.
+                u64 packetsLost = 0u;
+
+                {
+                    auto deviceStats = getDeviceStats_().lock();
+                    deviceStats->handlePacket(0u, augPacket.packet, sizeof(augPacket.packet));
+                    packetsLost = deviceStats->totalPacketsLost();
+                }
+
+                {
+                    auto counters = getCounters_().lock();
+                    counters->packets++;
+                    counters->bytes += sizeof(augPacket.packet);
+                    counters->events += get_event_count(augPacket.packet);
+                    counters->packetsLost = packetsLost;
+                }
+
+                handleShmHistos_(&augPacket.packet);
             }
 
             spdlog::debug("{}: read packet from file, bytesTransferred={}", PRETTY_FUNCTION,
@@ -397,6 +645,143 @@ void Replay::workerLoop(std::promise<bool> promise)
         throw; // WorkerBase handles it
     }
 
+    {
+        py::gil_scoped_release gil_release;
+        handleShmHistos_(nullptr, true);
+
+        if (sender)
+            sender->stop();
+    }
+
+    spdlog::debug("shutting down queue and exiting {}", PRETTY_FUNCTION);
+    getQueue().attr("shutdown")(false);
+}
+
+ShmRingReadout::ShmRingReadout(const std::string &shmName, size_t queueSize, bool fromOldest)
+    : WorkerBase(queueSize)
+    , shmName_(shmName)
+    , fromOldest_(fromOldest)
+{
+}
+
+void ShmRingReadout::workerLoop(std::promise<bool> promise)
+{
+    spdlog::debug("entering {}", PRETTY_FUNCTION);
+
+    // Hold the GIL. We'll release it when it's not needed.
+    py::gil_scoped_acquire gil_acquire;
+    py::object pyqueue = py::module_::import("queue");
+
+    {
+        py::gil_scoped_release gil_release;
+
+        if (auto ec = reader_.open(shmName_, fromOldest_))
+        {
+            spdlog::warn("{}: failed to attach to shared memory ring '{}': {}", PRETTY_FUNCTION,
+                         shmName_, ec.message());
+            promise.set_exception(std::make_exception_ptr(std::system_error(ec, shmName_)));
+            return;
+        }
+
+        spdlog::info("{}: reading packets from shared memory ring '{}'", PRETTY_FUNCTION,
+                     shmName_);
+        promise.set_value(true); // unblock the caller waiting for startup to complete
+    }
+
+    while (true)
+    {
+        std::optional<AugmentedDataPacket> augPacket = AugmentedDataPacket{};
+        bool finished = false;
+
+        {
+            py::gil_scoped_release gil_release;
+            ShmPacketRingReader::PacketInfo info;
+
+            const bool havePacket =
+                reader_.read(&augPacket->packet, sizeof(augPacket->packet), 100, &info);
+
+            if (havePacket && !filterPacket_(augPacket->packet, info.srcAddr))
+            {
+                augPacket = std::nullopt;
+                getCounters_().lock()->overruns = reader_.overruns();
+            }
+            else if (havePacket)
+            {
+                augPacket->srcAddr = info.srcAddr;
+                augPacket->srcPort = info.srcPort;
+                info.size = std::min(info.size, get_packet_size(augPacket->packet));
+
+                writeShmRing_(augPacket->packet, info.size, info.srcAddr, info.srcPort);
+
+                u64 packetsLost = 0u;
+
+                {
+                    auto deviceStats = getDeviceStats_().lock();
+                    deviceStats->handlePacket(augPacket->srcAddr, augPacket->packet, info.size);
+                    packetsLost = deviceStats->totalPacketsLost();
+                }
+
+                {
+                    auto counters = getCounters_().lock();
+                    counters->packets++;
+                    counters->bytes += info.size;
+                    counters->events += get_event_count(augPacket->packet);
+                    counters->packetsLost = packetsLost;
+                    counters->overruns = reader_.overruns();
+                }
+
+                handleShmHistos_(&augPacket->packet);
+            }
+            else
+            {
+                augPacket = std::nullopt;
+                finished = reader_.isFinished();
+
+                {
+                    auto counters = getCounters_().lock();
+                    counters->timeouts++;
+                    counters->overruns = reader_.overruns();
+                }
+
+                handleShmHistos_(nullptr);
+            }
+        }
+
+        if (finished)
+        {
+            spdlog::info("{}: shared memory ring '{}' closed by the writer", PRETTY_FUNCTION,
+                         shmName_);
+            break;
+        }
+
+        try
+        {
+            assert(PyGILState_Check());
+            // Blocking: a slow consumer shows up as ring overruns. None is
+            // enqueued on timeouts to detect the queue shutdown.
+            if (augPacket.has_value())
+                getQueue().attr("put")(std::move(augPacket.value()), true);
+            else
+                getQueue().attr("put")(py::none(), true);
+        }
+        catch (py::error_already_set &e)
+        {
+            if (!e.matches(pyqueue.attr("ShutDown")))
+                throw;
+
+            if (augPacket.has_value())
+                getCounters_().lock()->packetsDropped++;
+            break;
+        }
+    }
+
+    reader_.close();
+
+    {
+        py::gil_scoped_release gil_release;
+        handleShmHistos_(nullptr, true);
+    }
+
     spdlog::debug("shutting down queue and exiting {}", PRETTY_FUNCTION);
     getQueue().attr("shutdown")(false);
 }
@@ -1,6 +1,8 @@
 #ifndef E7B93B2B_DB43_49A2_A29F_480864086D05
 #define E7B93B2B_DB43_49A2_A29F_480864086D05
 
+#include <atomic>
+#include <chrono>
 #include <condition_variable>
 #include <exception>
 #include <fstream>
@@ -27,6 +29,8 @@ struct Counters
     u64 events = 0u;
     u64 packetsLost = 0u;
     u64 packetsDropped = 0u;
+    u64 overruns = 0u; // ShmRingReadout: packets lost because the reader fell behind
+    u64 eventsFiltered = 0u; // events removed by the event filter
 };
 
 const size_t DefaultQueueSize = 1000;
@@ -75,11 +79,59 @@ class WorkerBase
     py::object getQueue() const { return queue_; }
 
     Counters getCounters() const { return *counters_.lock(); }
-    void resetCounters() { *counters_.lock() = Counters{}; }
+    void resetCounters()
+    {
+        *counters_.lock() = Counters{};
+        deviceStats_.lock()->clear();
+    }
+
+    // Per (srcAddr, deviceId) counters in the order the devices were first seen.
+    std::vector<DeviceCounters> getDeviceCounters() const { return deviceStats_.lock()->devices(); }
+
+    // Publishes live histograms of all packets handled by the worker to the
+    // named shared memory segment, see ShmLiveHistos. An empty name disables
+    // publishing. Throws if the worker is running.
+    void setShmHistos(const std::string &shmName, unsigned publishInterval_ms = 40u);
+
+    // Copies all packets handled by the worker into the named shared memory
+    // packet ring, see ShmPacketRingWriter. The ring is created by start()
+    // and closed when the worker stops, which lets attached readers finish.
+    // An empty name disables the ring. Throws if the worker is running.
+    void setShmRing(const std::string &shmName, size_t slotCount = shm_ring::DefaultSlotCount);
+
+    // Only passes on events matching the filter expression, see EventFilter.
+    // Packets left without events are dropped. An empty expression disables
+    // filtering. Throws std::invalid_argument on syntax errors and if the
+    // worker is running.
+    void setEventFilter(const std::string &expression);
 
   protected:
     virtual void workerLoop(std::promise<bool> promise) = 0;
+
+    // To be called by workerLoop() implementations without holding the GIL.
+    // Histograms the packet if non-null and publishes the shared memory
+    // histograms when the publish interval has elapsed or if force is set.
+    void handleShmHistos_(const DataPacket *packet, bool force = false);
+
+    // To be called by workerLoop() implementations for each packet.
+    void writeShmRing_(const DataPacket &packet, size_t size, u32 srcAddr = 0u, u16 srcPort = 0u)
+    {
+        if (shmRing_)
+            shmRing_->write(&packet, size, srcAddr, srcPort);
+    }
+
+    // To be called by workerLoop() implementations for each packet before
+    // any other processing. Filters the events of the packet in place and
+    // returns false if the packet should be dropped. Dropped packets are
+    // still passed to the device stats so they do not count as lost.
+    bool filterPacket_(DataPacket &packet, u32 srcAddr = 0u);
+
     locked_ptr<Counters> &getCounters_() { return counters_; }
+    locked_ptr<DeviceStatsTable> &getDeviceStats_() { return deviceStats_; }
+
+    // Set by stop() before shutting down the queue. Lets workerLoop()
+    // implementations interrupt waits which do not involve the queue.
+    std::atomic<bool> stopRequested_ = false;
 
   private:
     void workerLoop_(std::promise<bool> promise);
@@ -93,6 +145,7 @@ class WorkerBase
     std::thread workerThread_;
 
     mutable locked_ptr<Counters> counters_ = locked_ptr<Counters>(std::in_place);
+    mutable locked_ptr<DeviceStatsTable> deviceStats_ = locked_ptr<DeviceStatsTable>(std::in_place);
 
     mutable locked_ptr<std::exception_ptr> readoutException_ =
         locked_ptr<std::exception_ptr>(std::in_place);
@@ -100,6 +153,16 @@ class WorkerBase
     mutable std::mutex startStopMutex_;
 
     py::object queue_; // our queue.Queue instance
+
+    std::unique_ptr<ShmLiveHistos> shmHistos_;
+    std::chrono::milliseconds shmPublishInterval_ = {};
+    std::chrono::steady_clock::time_point tShmPublish_ = {};
+
+    std::string shmRingName_;
+    size_t shmRingSlots_ = shm_ring::DefaultSlotCount;
+    std::unique_ptr<ShmPacketRingWriter> shmRing_;
+
+    std::unique_ptr<EventFilter> eventFilter_;
 };
 
 class Readout: public WorkerBase
@@ -122,12 +185,53 @@ class Replay: public WorkerBase
     explicit Replay(const std::string &filename,
                     size_t queueSize = DefaultQueueSize);
 
+    // Real-time replay paced by the packet header timestamps (speed > 0) or at
+    // a fixed packet rate, see ReplayPacer. Both 0 disables pacing. Throws if
+    // the worker is running.
+    void setPacing(double speed, double packetRate = 0.0);
+
+    // Additionally sends the replayed packets as UDP datagrams to the given
+    // destination, "host[:port][/dev=id,...][/type=bufferType,...]". Pacing
+    // defaults to the recorded speed. An empty string disables sending.
+    // Throws if the worker is running.
+    void setSendTo(const std::string &destination);
+
+    // Follow the file while it is being written instead of stopping at its
+    // end, see ListfileFollower. With idleTimeout > 0 (seconds) the replay
+    // ends once no new data arrived for that long. None is put into the queue
+    // while waiting for data. Throws if the worker is running.
+    void setFollow(bool follow, double idleTimeout = 0.0);
+
   protected:
     void workerLoop(std::promise<bool> promise) override;
 
   private:
     std::string filename_;
-    std::ifstream inputFile_;
+    std::unique_ptr<PacketSource> inputFile_;
+    ReplayPacer::Options pacerOptions_;
+    std::string sendTo_;
+    bool follow_ = false;
+    double followIdleTimeout_ = 0.0;
+};
+
+// Attaches to a shared memory packet ring written by another process, e.g.
+// 'mcpd-cli readout --shm-ring' or a Readout with setShmRing(), and puts the
+// packets into the queue. Packets lost because this reader fell behind are
+// counted in Counters::overruns, the writer is never blocked. The queue is
+// shut down once the writer closes the ring.
+class ShmRingReadout: public WorkerBase
+{
+  public:
+    explicit ShmRingReadout(const std::string &shmName, size_t queueSize = DefaultQueueSize,
+                            bool fromOldest = false);
+
+  protected:
+    void workerLoop(std::promise<bool> promise) override;
+
+  private:
+    std::string shmName_;
+    bool fromOldest_ = false;
+    ShmPacketRingReader reader_;
 };
 
 } // namespace mesytec::mcpd::py_lib
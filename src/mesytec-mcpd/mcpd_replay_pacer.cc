@@ -0,0 +1,107 @@
+#include "mcpd_replay_pacer.h"
+
+#include <algorithm>
+#include <thread>
+
+namespace mesytec::mcpd
+{
+
+ReplayPacer::ReplayPacer() = default;
+
+ReplayPacer::ReplayPacer(const Options &options)
+    : options_(options)
+{
+}
+
+ReplayPacer::Clock::time_point ReplayPacer::schedule(const DataPacket &packet)
+{
+    return schedule(packet.deviceId, get_header_timestamp(packet));
+}
+
+ReplayPacer::Clock::time_point ReplayPacer::schedule(u64 timestamp)
+{
+    return schedule(ExternalSource, timestamp);
+}
+
+ReplayPacer::Clock::time_point ReplayPacer::schedule(size_t source, u64 timestamp)
+{
+    if (!started_)
+    {
+        started_ = true;
+        tStart_ = Clock::now();
+        packetCount_ = 0u;
+        recordedTime_ = 0u;
+        sources_ = {};
+    }
+
+    const u64 packetNumber = packetCount_++;
+
+    if (options_.packetRate > 0.0)
+    {
+        return tStart_ + std::chrono::round<Clock::duration>(
+                             std::chrono::duration<double>(packetNumber / options_.packetRate));
+    }
+
+    if (options_.speed <= 0.0)
+        return Clock::now();
+
+    auto &src = sources_[source];
+
+    if (!src.seen)
+    {
+        // The device clocks are unrelated: start at the current replay time.
+        src.seen = true;
+        src.lastTimestamp = timestamp;
+        src.recordedTime = recordedTime_;
+    }
+    else if (timestamp > src.lastTimestamp)
+    {
+        src.recordedTime += std::min(timestamp - src.lastTimestamp, options_.maxGap);
+        src.lastTimestamp = timestamp;
+    }
+    else if (src.lastTimestamp - timestamp > options_.maxGap)
+    {
+        // Timestamp reset, e.g. the next run: continue from here.
+        src.lastTimestamp = timestamp;
+    }
+
+    recordedTime_ = std::max(recordedTime_, src.recordedTime);
+
+    // Timestamps are in units of 100 ns.
+    const double seconds = src.recordedTime * 1e-7 / options_.speed;
+
+    return tStart_ + std::chrono::round<Clock::duration>(std::chrono::duration<double>(seconds));
+}
+
+bool ReplayPacer::wait(const DataPacket &packet, const std::atomic<bool> &quit)
+{
+    return sleepUntil(schedule(packet), quit);
+}
+
+bool ReplayPacer::wait(u64 timestamp, const std::atomic<bool> &quit)
+{
+    return sleepUntil(schedule(timestamp), quit);
+}
+
+bool ReplayPacer::sleepUntil(Clock::time_point t, const std::atomic<bool> &quit)
+{
+    // Long gaps and slow replays would otherwise block for up to maxGap / speed.
+    while (!quit)
+    {
+        const auto now = Clock::now();
+
+        if (now >= t)
+            return true;
+
+        std::this_thread::sleep_for(std::min<Clock::duration>(t - now, MaxWaitSlice));
+    }
+
+    return false;
+}
+
+void ReplayPacer::reset()
+{
+    started_ = false;
+}
+
+}
@@ -0,0 +1,90 @@
+#ifndef __MESYTEC_MCPD_REPLAY_PACER_H__
+#define __MESYTEC_MCPD_REPLAY_PACER_H__
+
+#include <array>
+#include <atomic>
+#include <chrono>
+
+#include "mcpd_core.h"
+
+namespace mesytec::mcpd
+{
+
+// Computes when recorded packets are due during a real-time replay.
+//
+// With speed > 0 the pacing follows the packet header timestamps: the time
+// between two packets is the difference of their timestamps divided by
+// speed. The clocks of different devices need not be synchronized: each
+// device id is followed separately, starting at the replay time reached when
+// its first packet is seen. Packets with a timestamp lower than the highest
+// timestamp seen so far from the same device are due immediately. Gaps
+// longer than maxGap, e.g. between runs, are shortened to maxGap. A jump back
+// by more than maxGap is taken as a timestamp reset.
+//
+// With packetRate > 0 packets are due at a fixed rate, speed is ignored.
+class MESYTEC_MCPD_EXPORT ReplayPacer
+{
+  public:
+    using Clock = std::chrono::steady_clock;
+
+    struct Options
+    {
+        double speed = 0.0;         // multiple of the recorded speed
+        double packetRate = 0.0;    // packets per second
+        u64 maxGap = 10000000u;     // in timestamp units (100 ns), default 1 s
+    };
+
+    ReplayPacer();
+    explicit ReplayPacer(const Options &options);
+
+    // True if either speed or packetRate is set.
+    bool isEnabled() const { return options_.speed > 0.0 || options_.packetRate > 0.0; }
+
+    // Returns the point in time at which the packet is due. The first packet
+    // is due immediately. Must be called once per packet in replay order.
+    Clock::time_point schedule(const DataPacket &packet);
+
+    // Same as above using the given timestamp in units of 100 ns instead of
+    // the packet header timestamp, e.g. the capture time of network captures.
+    // All such timestamps are taken from one clock, separate from the device
+    // clocks.
+    Clock::time_point schedule(u64 timestamp);
+
+    // Sleeps until the packet is due or quit is set, whichever comes first.
+    // The flag is checked at least every MaxWaitSlice. Returns false if the
+    // wait was interrupted.
+    bool wait(const DataPacket &packet, const std::atomic<bool> &quit);
+    bool wait(u64 timestamp, const std::atomic<bool> &quit);
+
+    static constexpr std::chrono::milliseconds MaxWaitSlice{100};
+
+    // Starts over: the next packet is due immediately.
+    void reset();
+
+    const Options &options() const { return options_; }
+
+  private:
+    struct TimeSource
+    {
+        bool seen = false;
+        u64 lastTimestamp = 0u; // highest timestamp seen
+        u64 recordedTime = 0u;  // recorded time elapsed since the first packet, gaps shortened
+    };
+
+    // One per device id plus one for the timestamps passed to schedule(u64).
+    static const size_t ExternalSource = 256u;
+
+    Clock::time_point schedule(size_t source, u64 timestamp);
+    static bool sleepUntil(Clock::time_point t, const std::atomic<bool> &quit);
+
+    Options options_;
+    bool started_ = false;
+    Clock::time_point tStart_;
+    u64 packetCount_ = 0u;
+    u64 recordedTime_ = 0u;     // highest recorded time of all sources
+    std::array<TimeSource, ExternalSource + 1> sources_;
+};
+
+}
+
+#endif /* __MESYTEC_MCPD_REPLAY_PACER_H__ */
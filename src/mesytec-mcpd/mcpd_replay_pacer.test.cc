@@ -0,0 +1,122 @@
+#include <gtest/gtest.h>
+
+#include <thread>
+
+#include "mcpd_replay_pacer.h"
+
+using namespace mesytec::mcpd;
+using namespace std::chrono_literals;
+
+namespace
+{
+
+DataPacket make_packet(u64 timestamp)
+{
+    DataPacket packet = {};
+    packet.time[0] = timestamp & 0xffffu;
+    packet.time[1] = (timestamp >> 16) & 0xffffu;
+    packet.time[2] = (timestamp >> 32) & 0xffffu;
+    return packet;
+}
+
+} // namespace
+
+TEST(ReplayPacer, Disabled)
+{
+    ReplayPacer pacer;
+    ASSERT_FALSE(pacer.isEnabled());
+
+    auto t = pacer.schedule(make_packet(0));
+    ASSERT_LE(t, ReplayPacer::Clock::now());
+}
+
+TEST(ReplayPacer, FollowsTimestamps)
+{
+    ReplayPacer::Options options;
+    options.speed = 2.0;
+    options.maxGap = 20000000u; // 2 s
+    ReplayPacer pacer(options);
+    ASSERT_TRUE(pacer.isEnabled());
+
+    const u64 ts0 = 1000000u;
+    auto t0 = pacer.schedule(make_packet(ts0));
+    // 100 ms recorded, replayed at 2x
+    ASSERT_EQ(pacer.schedule(make_packet(ts0 + 1000000u)) - t0, 50ms);
+    // Out of order packets do not move the time backwards.
+    ASSERT_EQ(pacer.schedule(make_packet(ts0 + 500000u)) - t0, 50ms);
+    ASSERT_EQ(pacer.schedule(make_packet(ts0 + 2000000u)) - t0, 100ms);
+    // A 10 s gap is shortened to 2 s.
+    ASSERT_EQ(pacer.schedule(make_packet(ts0 + 102000000u)) - t0, 1100ms);
+    // As is a timestamp reset.
+    ASSERT_EQ(pacer.schedule(make_packet(0u)) - t0, 1100ms);
+    ASSERT_EQ(pacer.schedule(make_packet(ts0 + 104000000u)) - t0, 2100ms);
+}
+
+TEST(ReplayPacer, FixedRate)
+{
+    ReplayPacer::Options options;
+    options.packetRate = 1000.0;
+    options.speed = 1.0; // ignored
+    ReplayPacer pacer(options);
+
+    auto t0 = pacer.schedule(make_packet(0u));
+    ASSERT_EQ(pacer.schedule(make_packet(100000000u)) - t0, 1ms);
+    ASSERT_EQ(pacer.schedule(make_packet(0u)) - t0, 2ms);
+
+    pacer.reset();
+    auto t1 = pacer.schedule(make_packet(0u));
+    ASSERT_GE(t1, t0);
+    ASSERT_EQ(pacer.schedule(make_packet(0u)) - t1, 1ms);
+}
+
+TEST(ReplayPacer, UnsyncedDevices)
+{
+    ReplayPacer::Options options;
+    options.speed = 1.0;
+    ReplayPacer pacer(options);
+
+    // Two devices with unrelated clocks, interleaved in the file.
+    auto packetA = make_packet(1000000000u);
+    packetA.deviceId = 0;
+    auto packetB = make_packet(5000000000u);
+    packetB.deviceId = 1;
+
+    auto t0 = pacer.schedule(packetA);
+    ASSERT_EQ(pacer.schedule(packetB) - t0, 0ms);
+
+    for (int i = 1; i <= 10; ++i)
+    {
+        // 1 ms per step on both devices.
+        packetA = make_packet(1000000000u + i * 10000u);
+        packetB = make_packet(5000000000u + i * 10000u);
+        packetB.deviceId = 1;
+
+        ASSERT_EQ(pacer.schedule(packetA) - t0, i * 1ms);
+        ASSERT_EQ(pacer.schedule(packetB) - t0, i * 1ms);
+    }
+
+    // A device appearing later starts at the current replay time.
+    auto packetC = make_packet(42u);
+    packetC.deviceId = 2;
+    ASSERT_EQ(pacer.schedule(packetC) - t0, 10ms);
+    packetC = make_packet(42u + 20000u);
+    packetC.deviceId = 2;
+    ASSERT_EQ(pacer.schedule(packetC) - t0, 12ms);
+}
+
+TEST(ReplayPacer, WaitIsInterruptible)
+{
+    ReplayPacer::Options options;
+    options.speed = 0.001;
+    ReplayPacer pacer(options);
+    std::atomic<bool> quit(false);
+
+    ASSERT_TRUE(pacer.wait(make_packet(0u), quit));
+
+    // Due in 1000 s.
+    std::thread stopper([&quit] { std::this_thread::sleep_for(50ms); quit = true; });
+    const auto t0 = ReplayPacer::Clock::now();
+    ASSERT_FALSE(pacer.wait(make_packet(10000000u), quit));
+    ASSERT_LT(ReplayPacer::Clock::now() - t0, 50ms + 2 * ReplayPacer::MaxWaitSlice);
+    stopper.join();
+}
@@ -0,0 +1,358 @@
+#include "mcpd_run_info.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <ctime>
+#include <spdlog/spdlog.h>
+
+#include "git_version.h"
+#include "mcpd_functions.h"
+
+namespace mesytec::mcpd
+{
+
+namespace
+{
+    // Version of the serialized form. Increment when changing the layout of
+    // existing fields. New fields are appended at the end.
+    const u16 SerializedVersion = 1u;
+
+    // McpdRunInfo flags
+    const u8 HasVersion = 1u << 0;
+    const u8 HasBusCapabilities = 1u << 1;
+    const u8 HasParams = 1u << 2;
+
+    class Serializer
+    {
+      public:
+        explicit Serializer(std::vector<u8> &dest): dest_(dest) {}
+
+        template<typename T> void put(T value)
+        {
+            for (size_t i = 0; i < sizeof(T); ++i)
+                dest_.push_back(static_cast<u8>(static_cast<u64>(value) >> (i * 8)));
+        }
+
+        void put(const std::string &str)
+        {
+            put(static_cast<u16>(std::min(str.size(), size_t{0xffffu})));
+            dest_.insert(dest_.end(), str.begin(), str.begin() + std::min(str.size(), size_t{0xffffu}));
+        }
+
+      private:
+        std::vector<u8> &dest_;
+    };
+
+    class Deserializer
+    {
+      public:
+        Deserializer(const u8 *data, size_t size): data_(data), size_(size) {}
+
+        // Returns false once the input is exhausted. dest is zeroed in that
+        // case.
+        template<typename T> bool get(T &dest)
+        {
+            u64 value = 0u;
+
+            if (size_ - pos_ < sizeof(T))
+            {
+                pos_ = size_;
+                ok_ = false;
+                dest = {};
+                return false;
+            }
+
+            for (size_t i = 0; i < sizeof(T); ++i)
+                value |= static_cast<u64>(data_[pos_++]) << (i * 8);
+
+            dest = static_cast<T>(value);
+            return true;
+        }
+
+        bool get(std::string &dest)
+        {
+            u16 size = 0u;
+
+            if (!get(size) || size_ - pos_ < size)
+            {
+                ok_ = false;
+                return false;
+            }
+
+            dest.assign(reinterpret_cast<const char *>(data_ + pos_), size);
+            pos_ += size;
+            return true;
+        }
+
+        bool ok() const { return ok_; }
+
+      private:
+        const u8 *data_;
+        size_t size_;
+        size_t pos_ = 0u;
+        bool ok_ = true;
+    };
+
+    void log_query_error(const char *what, u8 mcpdId, const std::error_code &ec)
+    {
+        spdlog::warn("run info: error reading {} of mcpd {}: {}", what, mcpdId, ec.message());
+    }
+
+    std::string format_unix_time_ms(u64 ms)
+    {
+        std::time_t t = static_cast<std::time_t>(ms / 1000u);
+        std::tm tm = {};
+#ifdef _WIN32
+        gmtime_s(&tm, &t);
+#else
+        gmtime_r(&t, &tm);
+#endif
+        char buffer[32];
+        std::strftime(buffer, sizeof(buffer), "%Y-%m-%dT%H:%M:%S", &tm);
+        return fmt::format("{}.{:03}Z", buffer, ms % 1000u);
+    }
+}
+
+const McpdRunInfo *RunInfo::findMcpd(u8 mcpdId) const
+{
+    for (const auto &mcpd: mcpds)
+    {
+        if (mcpd.mcpdId == mcpdId)
+            return &mcpd;
+    }
+
+    return nullptr;
+}
+
+RunInfo make_run_info()
+{
+    RunInfo result;
+    result.startTime = std::chrono::duration_cast<std::chrono::milliseconds>(
+                           std::chrono::system_clock::now().time_since_epoch())
+                           .count();
+    result.libraryVersion = library_version();
+    return result;
+}
+
+std::error_code query_mcpd_run_info(int sock, u8 mcpdId, McpdRunInfo &dest)
+{
+    dest = {};
+    dest.mcpdId = mcpdId;
+
+    if (auto ec = mcpd_get_version(sock, mcpdId, dest.version))
+        return ec;
+
+    dest.hasVersion = true;
+
+    if (auto ec = mcpd_get_bus_capabilities(sock, mcpdId, dest.busCapabilities))
+        log_query_error("bus capabilities", mcpdId, ec);
+    else
+        dest.hasBusCapabilities = true;
+
+    if (auto ec = mcpd_get_all_parameters(sock, mcpdId, dest.params))
+        log_query_error("parameters", mcpdId, ec);
+    else
+        dest.hasParams = true;
+
+    std::array<u16, McpdBusCount> busses = {};
+
+    if (auto ec = mcpd_scan_busses(sock, mcpdId, busses))
+    {
+        log_query_error("connected modules", mcpdId, ec);
+        return {};
+    }
+
+    for (size_t bus = 0; bus < busses.size(); ++bus)
+    {
+        if (!busses[bus])
+            continue;
+
+        MpsdParameters params = {};
+
+        if (auto ec = mpsd_get_params(sock, mcpdId, bus, params))
+        {
+            spdlog::warn("run info: error reading parameters of mpsd {} on mcpd {}: {}", bus,
+                         mcpdId, ec.message());
+            continue;
+        }
+
+        dest.mpsds.push_back(params);
+    }
+
+    return {};
+}
+
+std::vector<u8> serialize_run_info(const RunInfo &info)
+{
+    std::vector<u8> result;
+    Serializer out(result);
+
+    out.put(SerializedVersion);
+    out.put(static_cast<u8>(info.hasRunId));
+    out.put(info.runId);
+    out.put(info.startTime);
+    out.put(info.libraryVersion);
+    out.put(static_cast<u16>(info.mcpds.size()));
+
+    for (const auto &mcpd: info.mcpds)
+    {
+        u8 flags = (mcpd.hasVersion ? HasVersion : 0u)
+            | (mcpd.hasBusCapabilities ? HasBusCapabilities : 0u)
+            | (mcpd.hasParams ? HasParams : 0u);
+
+        out.put(mcpd.mcpdId);
+        out.put(flags);
+        out.put(mcpd.address);
+        out.put(mcpd.version.cpu[0]);
+        out.put(mcpd.version.cpu[1]);
+        out.put(mcpd.version.fpga[0]);
+        out.put(mcpd.version.fpga[1]);
+        out.put(mcpd.busCapabilities.available);
+        out.put(mcpd.busCapabilities.selected);
+
+        const auto &p = mcpd.params;
+        for (auto v: p.adc) out.put(v);
+        for (auto v: p.dac) out.put(v);
+        out.put(p.ttlOut);
+        out.put(p.ttlIn);
+        for (auto v: p.eventCounters) out.put(v);
+        for (const auto &param: p.params)
+            for (auto v: param) out.put(v);
+
+        out.put(static_cast<u8>(mcpd.mpsds.size()));
+
+        for (const auto &mpsd: mcpd.mpsds)
+        {
+            out.put(mpsd.mpsdId);
+            out.put(mpsd.busTxCaps);
+            out.put(mpsd.txFormat);
+            out.put(mpsd.firmwareRevision);
+        }
+    }
+
+    return result;
+}
+
+bool deserialize_run_info(const u8 *data, size_t size, RunInfo &dest)
+{
+    Deserializer in(data, size);
+    RunInfo result;
+    u16 version = 0u;
+    u8 hasRunId = 0u;
+    u16 mcpdCount = 0u;
+
+    in.get(version);
+
+    if (!in.ok() || version == 0u || version > SerializedVersion)
+        return false;
+
+    in.get(hasRunId);
+    in.get(result.runId);
+    in.get(result.startTime);
+    in.get(result.libraryVersion);
+    in.get(mcpdCount);
+    result.hasRunId = hasRunId;
+
+    for (u16 mi = 0; in.ok() && mi < mcpdCount; ++mi)
+    {
+        McpdRunInfo mcpd;
+        u8 flags = 0u;
+        u8 mpsdCount = 0u;
+
+        in.get(mcpd.mcpdId);
+        in.get(flags);
+        in.get(mcpd.address);
+        in.get(mcpd.version.cpu[0]);
+        in.get(mcpd.version.cpu[1]);
+        in.get(mcpd.version.fpga[0]);
+        in.get(mcpd.version.fpga[1]);
+        in.get(mcpd.busCapabilities.available);
+        in.get(mcpd.busCapabilities.selected);
+
+        auto &p = mcpd.params;
+        for (auto &v: p.adc) in.get(v);
+        for (auto &v: p.dac) in.get(v);
+        in.get(p.ttlOut);
+        in.get(p.ttlIn);
+        for (auto &v: p.eventCounters) in.get(v);
+        for (auto &param: p.params)
+            for (auto &v: param) in.get(v);
+
+        in.get(mpsdCount);
+
+        for (u8 i = 0; in.ok() && i < mpsdCount; ++i)
+        {
+            MpsdParameters mpsd = {};
+            in.get(mpsd.mpsdId);
+            in.get(mpsd.busTxCaps);
+            in.get(mpsd.txFormat);
+            in.get(mpsd.firmwareRevision);
+            mcpd.mpsds.push_back(mpsd);
+        }
+
+        mcpd.hasVersion = flags & HasVersion;
+        mcpd.hasBusCapabilities = flags & HasBusCapabilities;
+        mcpd.hasParams = flags & HasParams;
+        result.mcpds.emplace_back(std::move(mcpd));
+    }
+
+    if (!in.ok())
+        return false;
+
+    dest = std::move(result);
+    return true;
+}
+
+std::string to_string(const RunInfo &info)
+{
+    std::string result;
+
+    result += fmt::format("start time: {}\n", format_unix_time_ms(info.startTime));
+
+    if (info.hasRunId)
+        result += fmt::format("runId: {}\n", info.runId);
+
+    result += fmt::format("recorded with: mesytec-mcpd {}\n", info.libraryVersion);
+
+    for (const auto &mcpd: info.mcpds)
+    {
+        result += fmt::format("mcpd {}", mcpd.mcpdId);
+
+        if (!mcpd.address.empty())
+            result += fmt::format(" ({})", mcpd.address);
+
+        result += ":\n";
+
+        if (mcpd.hasVersion)
+            result += fmt::format("  version: cpu {}.{}, fpga {}.{}\n", mcpd.version.cpu[0],
+                                  mcpd.version.cpu[1], mcpd.version.fpga[0], mcpd.version.fpga[1]);
+
+        if (mcpd.hasBusCapabilities)
+            result += fmt::format("  bus capabilities: available={} ({}), selected={} ({})\n",
+                                  mcpd.busCapabilities.available,
+                                  bus_capabilities_to_string(mcpd.busCapabilities.available),
+                                  mcpd.busCapabilities.selected,
+                                  bus_capabilities_to_string(mcpd.busCapabilities.selected));
+
+        if (mcpd.hasParams)
+        {
+            const auto &p = mcpd.params;
+            result += fmt::format("  ADC: {} {}, DAC: {} {}, TTL out: {}, TTL in: {}\n", p.adc[0],
+                                  p.adc[1], p.dac[0], p.dac[1], p.ttlOut, p.ttlIn);
+
+            for (size_t pi = 0; pi < McpdParamCount; ++pi)
+                result += fmt::format("  Parameter{}: {}\n", pi, to_48bit_value(p.params[pi]));
+        }
+
+        for (const auto &mpsd: mcpd.mpsds)
+            result += fmt::format("  mpsd {}: busTxCapabilities={}, txFormat={} ({}), "
+                                  "firmwareRevision={:#06x}\n",
+                                  mpsd.mpsdId, mpsd.busTxCaps, mpsd.txFormat,
+                                  bus_capabilities_to_string(mpsd.txFormat), mpsd.firmwareRevision);
+    }
+
+    return result;
+}
+
+}
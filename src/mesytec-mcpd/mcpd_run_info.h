@@ -0,0 +1,68 @@
+#ifndef __MESYTEC_MCPD_RUN_INFO_H__
+#define __MESYTEC_MCPD_RUN_INFO_H__
+
+#include <string>
+#include <system_error>
+#include <vector>
+
+#include "mcpd_core.h"
+
+namespace mesytec::mcpd
+{
+
+// Run metadata
+//
+// A snapshot of the device configuration taken once at the start of a
+// readout. It is stored as the first record of framed listfiles so that replay
+// tools know the device ids, bus tx formats and firmware versions without
+// inspecting the data packets.
+
+// Configuration of one MCPD and the MPSD modules connected to it. The has*
+// flags are set for the parts which could be read from the device.
+struct MESYTEC_MCPD_EXPORT McpdRunInfo
+{
+    u8 mcpdId = 0u;
+    std::string address;
+    bool hasVersion = false;
+    McpdVersionInfo version = {};
+    bool hasBusCapabilities = false;
+    BusCapabilities busCapabilities = {};
+    bool hasParams = false;
+    McpdParams params = {};
+    // Modules found by scanning the busses.
+    std::vector<MpsdParameters> mpsds;
+};
+
+struct MESYTEC_MCPD_EXPORT RunInfo
+{
+    bool hasRunId = false;      // set if the readout set the runId
+    u16 runId = 0u;
+    u64 startTime = 0u;         // unix time in milliseconds
+    std::string libraryVersion;
+    std::vector<McpdRunInfo> mcpds;
+
+    const McpdRunInfo *findMcpd(u8 mcpdId) const;
+};
+
+// Returns a RunInfo with startTime set to the current time and the library
+// version filled in.
+MESYTEC_MCPD_EXPORT RunInfo make_run_info();
+
+// Reads version, bus capabilities and parameters of the MCPD and the
+// parameters of all MPSDs found on its busses. Queries which fail after the
+// device answered the version request are logged and skipped, leaving the
+// corresponding has* flag unset. Returns an error if the version cannot be
+// read, e.g. because the device is not reachable.
+MESYTEC_MCPD_EXPORT std::error_code query_mcpd_run_info(int sock, u8 mcpdId, McpdRunInfo &dest);
+
+// Compact little endian binary form stored in listfiles. Unknown trailing
+// data written by newer versions is ignored when reading.
+MESYTEC_MCPD_EXPORT std::vector<u8> serialize_run_info(const RunInfo &info);
+MESYTEC_MCPD_EXPORT bool deserialize_run_info(const u8 *data, size_t size, RunInfo &dest);
+
+// Multi-line human readable description.
+MESYTEC_MCPD_EXPORT std::string to_string(const RunInfo &info);
+
+}
+
+#endif /* __MESYTEC_MCPD_RUN_INFO_H__ */
@@ -0,0 +1,130 @@
+#include <gtest/gtest.h>
+
+#include <filesystem>
+#include <unistd.h>
+
+#include "mcpd_listfile.h"
+#include "mcpd_listfile_split.h"
+#include "mcpd_run_info.h"
+
+using namespace mesytec::mcpd;
+
+namespace
+{
+
+RunInfo make_test_run_info()
+{
+    auto info = make_run_info();
+    info.hasRunId = true;
+    info.runId = 42;
+
+    McpdRunInfo mcpd;
+    mcpd.mcpdId = 3;
+    mcpd.address = "192.168.168.121";
+    mcpd.hasVersion = true;
+    mcpd.version = { { 10, 2 }, { 4, 1 } };
+    mcpd.hasBusCapabilities = true;
+    mcpd.busCapabilities = { 7, 2 };
+    mcpd.hasParams = true;
+    mcpd.params.adc[1] = 1234;
+    mcpd.params.params[3][2] = 0xbeef;
+    mcpd.mpsds.push_back({ 0, 7, 2, 0x0105 });
+    mcpd.mpsds.push_back({ 5, 3, 1, 0x0104 });
+    info.mcpds.push_back(mcpd);
+
+    return info;
+}
+
+void expect_equal(const RunInfo &a, const RunInfo &b)
+{
+    EXPECT_EQ(serialize_run_info(a), serialize_run_info(b));
+    EXPECT_EQ(a.runId, b.runId);
+    EXPECT_EQ(a.startTime, b.startTime);
+    ASSERT_EQ(a.mcpds.size(), b.mcpds.size());
+    EXPECT_EQ(a.mcpds[0].address, b.mcpds[0].address);
+    ASSERT_EQ(a.mcpds[0].mpsds.size(), b.mcpds[0].mpsds.size());
+    EXPECT_EQ(a.mcpds[0].mpsds[1].txFormat, b.mcpds[0].mpsds[1].txFormat);
+}
+
+} // namespace
+
+TEST(RunInfo, SerializeRoundtrip)
+{
+    const auto info = make_test_run_info();
+    auto data = serialize_run_info(info);
+
+    RunInfo decoded;
+    ASSERT_TRUE(deserialize_run_info(data.data(), data.size(), decoded));
+    expect_equal(info, decoded);
+    ASSERT_NE(decoded.findMcpd(3), nullptr);
+    ASSERT_EQ(decoded.findMcpd(4), nullptr);
+
+    // Trailing data from newer versions is ignored, truncated data rejected.
+    data.push_back(0xff);
+    ASSERT_TRUE(deserialize_run_info(data.data(), data.size(), decoded));
+    ASSERT_FALSE(deserialize_run_info(data.data(), data.size() - 10, decoded));
+}
+
+TEST(RunInfo, StoredInListfiles)
+{
+    const auto dir = std::filesystem::temp_directory_path()
+        / ("mcpd-run-info-test-" + std::to_string(getpid()));
+    std::filesystem::create_directories(dir);
+    const auto info = make_test_run_info();
+
+    DataPacket packet = {};
+    packet.bufferType = McpdDataBufferType;
+    packet.headerLength = 21;
+    packet.bufferLength = packet.headerLength + 30;
+
+    for (auto compression: { ListfileCompression::None, ListfileCompression::Lz4 })
+    {
+        const auto basePath = (dir / (std::string("run_") + to_string(compression) + ".mcpdlst")).string();
+
+        SplitListfileWriter writer;
+        SplitListfileWriter::Options options;
+        options.listfile.encoding = ListfileEncoding::Packet;
+        options.listfile.compression = compression;
+        options.listfile.blockSize = 1024;
+        options.splitSize = 1000;
+        ASSERT_FALSE(writer.open(basePath, options));
+        ASSERT_FALSE(writer.writeRunInfo(info));
+
+        for (u16 i = 0; i < 300; ++i)
+        {
+            packet.bufferNumber = i;
+            ASSERT_FALSE(writer.writePacket(packet));
+        }
+
+        ASSERT_FALSE(writer.close());
+        ASSERT_GT(writer.partCount(), 1u);
+
+        // Each part starts with the run info.
+        std::vector<std::string> parts;
+        ASSERT_FALSE(read_listfile_manifest(writer.path(), parts));
+
+        for (const auto &part: parts)
+        {
+            ListfileReader reader;
+            ASSERT_FALSE(reader.open(part));
+            ASSERT_NE(reader.runInfo(), nullptr);
+            expect_equal(info, *reader.runInfo());
+        }
+
+        std::unique_ptr<PacketSource> source;
+        ASSERT_FALSE(open_packet_source(writer.path(), source));
+        ASSERT_NE(source->runInfo(), nullptr);
+
+        while (!source->readPacket(packet)) {}
+
+        ASSERT_EQ(source->packetsRead(), 300u);
+    }
+
+    // Legacy listfiles cannot store records.
+    ListfileWriter legacy;
+    ASSERT_FALSE(legacy.open((dir / "legacy.mcpdlst").string()));
+    ASSERT_EQ(legacy.writeRunInfo(info), ListfileError::RecordsNotSupported);
+    legacy.close();
+
+    std::filesystem::remove_all(dir);
+}
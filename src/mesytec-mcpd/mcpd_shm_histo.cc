@@ -0,0 +1,472 @@
+#include "mcpd_shm_histo.h"
+
+#include <cstring>
+#include <new>
+#include <stdexcept>
+#include <thread>
+#include <spdlog/spdlog.h> // for fmt::
+
+#include "mcpd_coincidence.h"
+#include "util/shared_memory.h"
+
+namespace mesytec::mcpd
+{
+
+namespace
+{
+    inline size_t align8(size_t size) { return (size + 7u) & ~size_t(7u); }
+
+    inline ShmHistoEntry *entries(ShmHistoSegmentHeader *header)
+    {
+        return reinterpret_cast<ShmHistoEntry *>(header + 1);
+    }
+
+    inline const ShmHistoEntry *entries(const ShmHistoSegmentHeader *header)
+    {
+        return reinterpret_cast<const ShmHistoEntry *>(header + 1);
+    }
+
+    // Marks a segment left behind by another writer, e.g. a crashed readout
+    // process, as closed so that its readers reopen.
+    void close_existing_segment(const std::string &name)
+    {
+        void *mem = nullptr;
+        size_t size = 0;
+
+        if (util::open_shared_memory(name, true, &mem, &size))
+            return;
+
+        auto header = reinterpret_cast<ShmHistoSegmentHeader *>(mem);
+
+        if (size >= sizeof(ShmHistoSegmentHeader)
+            && std::memcmp(header->magic, shm_histo::Magic, sizeof(shm_histo::Magic)) == 0)
+        {
+            header->state.store(shm_histo::Closed, std::memory_order_release);
+        }
+
+        util::unmap_shared_memory(mem, size);
+    }
+}
+
+//
+// ShmHistoWriter
+//
+
+ShmHistoWriter::~ShmHistoWriter()
+{
+    close();
+}
+
+std::error_code ShmHistoWriter::create(const std::string &name, const std::vector<ShmHistoInfo> &histos)
+{
+    close();
+
+    for (const auto &info: histos)
+    {
+        if (info.name.size() > shm_histo::MaxNameLength || info.dims < 1 || info.dims > 2)
+            return std::make_error_code(std::errc::invalid_argument);
+    }
+
+    size_t size = align8(sizeof(ShmHistoSegmentHeader) + histos.size() * sizeof(ShmHistoEntry));
+    std::vector<u64> offsets;
+
+    for (const auto &info: histos)
+    {
+        offsets.push_back(size);
+        size += align8(info.size() * sizeof(u32));
+    }
+
+    close_existing_segment(name);
+
+    void *mem = nullptr;
+
+    if (auto ec = util::create_shared_memory(name, size, &mem))
+        return ec;
+
+    // The segment is zero filled on creation.
+    auto header = new (mem) ShmHistoSegmentHeader{};
+    std::memcpy(header->magic, shm_histo::Magic, sizeof(shm_histo::Magic));
+    header->version = shm_histo::Version;
+    header->histoCount = histos.size();
+    header->segmentSize = size;
+
+    for (size_t i = 0; i < histos.size(); ++i)
+    {
+        const auto &info = histos[i];
+        auto &entry = entries(header)[i];
+        std::strncpy(entry.name, info.name.c_str(), shm_histo::MaxNameLength);
+        entry.dims = info.dims;
+        entry.xBins = info.xAxis.bins;
+        entry.xShift = info.xAxis.shift;
+        entry.yBins = info.dims > 1 ? info.yAxis.bins : 1u;
+        entry.yShift = info.dims > 1 ? info.yAxis.shift : 0u;
+        entry.dataOffset = offsets[i];
+    }
+
+    header->state.store(shm_histo::Active, std::memory_order_release);
+
+    name_ = name;
+    histos_ = histos;
+    header_ = header;
+    size_ = size;
+
+    spdlog::debug("created shared memory histogram segment '{}': {} histograms, {} bytes",
+                  name_, histos_.size(), size_);
+
+    return {};
+}
+
+void ShmHistoWriter::close()
+{
+    if (!header_)
+        return;
+
+    header_->state.store(shm_histo::Closed, std::memory_order_release);
+    util::unmap_shared_memory(header_, size_);
+    util::unlink_shared_memory(name_);
+
+    header_ = nullptr;
+    size_ = 0u;
+    histos_.clear();
+}
+
+void ShmHistoWriter::beginUpdate()
+{
+    const u64 seq = header_->sequence.load(std::memory_order_relaxed);
+    header_->sequence.store(seq + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+}
+
+void ShmHistoWriter::endUpdate()
+{
+    const u64 seq = header_->sequence.load(std::memory_order_relaxed);
+    header_->publishCount.fetch_add(1, std::memory_order_relaxed);
+    header_->sequence.store(seq + 1, std::memory_order_release);
+}
+
+u32 *ShmHistoWriter::data(size_t index)
+{
+    return reinterpret_cast<u32 *>(
+        reinterpret_cast<u8 *>(header_) + entries(header_)[index].dataOffset);
+}
+
+void ShmHistoWriter::setOverflow(size_t index, u64 overflow)
+{
+    entries(header_)[index].overflow = overflow;
+}
+
+void ShmHistoWriter::copy(size_t index, const Histo1D<u32> &histo)
+{
+    if (histo.size() != histos_.at(index).size())
+        throw std::invalid_argument("ShmHistoWriter::copy: size mismatch");
+
+    std::memcpy(data(index), histo.data().data(), histo.size() * sizeof(u32));
+    setOverflow(index, histo.overflow());
+}
+
+void ShmHistoWriter::copy(size_t index, const Histo2D<u32> &histo)
+{
+    if (histo.size() != histos_.at(index).size())
+        throw std::invalid_argument("ShmHistoWriter::copy: size mismatch");
+
+    std::memcpy(data(index), histo.data().data(), histo.size() * sizeof(u32));
+    setOverflow(index, histo.overflow());
+}
+
+//
+// ShmHistoReader
+//
+
+ShmHistoReader::~ShmHistoReader()
+{
+    close();
+}
+
+std::error_code ShmHistoReader::open(const std::string &name)
+{
+    close();
+
+    void *mem = nullptr;
+    size_t size = 0;
+
+    if (auto ec = util::open_shared_memory(name, false, &mem, &size))
+        return ec;
+
+    header_ = reinterpret_cast<const ShmHistoSegmentHeader *>(mem);
+    size_ = size;
+
+    const bool headerValid = size >= sizeof(ShmHistoSegmentHeader)
+        && std::memcmp(header_->magic, shm_histo::Magic, sizeof(shm_histo::Magic)) == 0
+        && header_->version == shm_histo::Version
+        && header_->segmentSize == size
+        && sizeof(ShmHistoSegmentHeader) + header_->histoCount * sizeof(ShmHistoEntry) <= size;
+
+    if (!headerValid)
+    {
+        close();
+        return std::make_error_code(std::errc::invalid_argument);
+    }
+
+    for (size_t i = 0; i < header_->histoCount; ++i)
+    {
+        const auto &entry = entries(header_)[i];
+
+        ShmHistoInfo info;
+        info.name = std::string(entry.name, strnlen(entry.name, sizeof(entry.name)));
+        info.dims = entry.dims;
+        info.xAxis = { entry.xBins, entry.xShift };
+        info.yAxis = { entry.yBins, entry.yShift };
+
+        if (entry.dataOffset + info.size() * sizeof(u32) > size)
+        {
+            close();
+            return std::make_error_code(std::errc::invalid_argument);
+        }
+
+        histos_.emplace_back(std::move(info));
+        dataOffsets_.push_back(entry.dataOffset);
+    }
+
+    return {};
+}
+
+void ShmHistoReader::close()
+{
+    util::unmap_shared_memory(header_, size_);
+
+    header_ = nullptr;
+    size_ = 0u;
+    histos_.clear();
+    dataOffsets_.clear();
+}
+
+bool ShmHistoReader::isStale() const
+{
+    return !header_ || header_->state.load(std::memory_order_acquire) != shm_histo::Active;
+}
+
+s64 ShmHistoReader::find(const std::string &name) const
+{
+    for (size_t i = 0; i < histos_.size(); ++i)
+    {
+        if (histos_[i].name == name)
+            return i;
+    }
+
+    return -1;
+}
+
+u64 ShmHistoReader::publishCount() const
+{
+    return header_ ? header_->publishCount.load(std::memory_order_acquire) : 0u;
+}
+
+bool ShmHistoReader::read(size_t index, u32 *dest, u64 *overflow, unsigned maxRetries) const
+{
+    if (!header_ || index >= histos_.size())
+        return false;
+
+    const auto src = reinterpret_cast<const u8 *>(header_) + dataOffsets_[index];
+    const size_t bytes = histos_[index].size() * sizeof(u32);
+    const auto &entry = entries(header_)[index];
+
+    for (unsigned attempt = 0; attempt < maxRetries; ++attempt)
+    {
+        const u64 seq0 = header_->sequence.load(std::memory_order_acquire);
+
+        if (seq0 & 1u)
+        {
+            std::this_thread::yield();
+            continue;
+        }
+
+        std::memcpy(dest, src, bytes);
+        const u64 ov = entry.overflow;
+
+        std::atomic_thread_fence(std::memory_order_acquire);
+
+        if (header_->sequence.load(std::memory_order_relaxed) == seq0)
+        {
+            if (overflow)
+                *overflow = ov;
+            return true;
+        }
+    }
+
+    return false;
+}
+
+bool ShmHistoReader::read(size_t index, std::vector<u32> &dest, u64 *overflow, unsigned maxRetries) const
+{
+    if (index >= histos_.size())
+        return false;
+
+    dest.resize(histos_[index].size());
+    return read(index, dest.data(), overflow, maxRetries);
+}
+
+//
+// ShmLiveHistos
+//
+
+ShmLiveHistos::ShmLiveHistos(const std::string &shmName)
+    : shmName_(shmName)
+    , channelTable_(LinearChannelCount)
+    , mdllTable_(256)
+{
+}
+
+ShmLiveHistos::ChannelHistos *ShmLiveHistos::getChannel(u32 channelIndex)
+{
+    auto &entry = channelTable_[channelIndex];
+
+    if (!entry)
+    {
+        namespace ec = event_constants;
+
+        entry = std::make_unique<ChannelHistos>();
+        entry->amplitude = Histo1D<u32>(HistoAxis{ 1u << ec::neutron::AmplitudeBits, 0 });
+        entry->position = Histo1D<u32>(HistoAxis{ 1u << ec::neutron::PositionBits, 0 });
+        channels_.push_back(channelIndex);
+        layoutChanged_ = true;
+    }
+
+    return entry.get();
+}
+
+ShmLiveHistos::MdllHistos *ShmLiveHistos::getMdll(u8 deviceId)
+{
+    auto &entry = mdllTable_[deviceId];
+
+    if (!entry)
+    {
+        namespace mn = event_constants::mdll_neutron;
+
+        const HistoAxis xAxis{ 1u << mn::xPosBits, 0 };
+        const HistoAxis yAxis{ 1u << mn::yPosBits, 0 };
+
+        entry = std::make_unique<MdllHistos>();
+        entry->amplitude = Histo1D<u32>(HistoAxis{ 1u << mn::AmplitudeBits, 0 });
+        entry->x = Histo1D<u32>(xAxis);
+        entry->y = Histo1D<u32>(yAxis);
+        entry->xy = Histo2D<u32>(xAxis, yAxis);
+        mdlls_.push_back(deviceId);
+        layoutChanged_ = true;
+    }
+
+    return entry.get();
+}
+
+void ShmLiveHistos::processPacket(const DataPacket &packet)
+{
+    batch_.clear();
+    decode_events(packet, batch_);
+    process(batch_);
+}
+
+void ShmLiveHistos::process(const EventBatch &batch)
+{
+    ChannelHistos *channel = nullptr;
+    u32 lastIndex = ~0u;
+
+    for (size_t i = 0; i < batch.size(); ++i)
+    {
+        if (batch.type[i] == EventType::Neutron)
+        {
+            const u32 index = linear_channel_index(batch.deviceId[i], batch.address[i], batch.channel[i]);
+
+            // Consecutive events often come from the same channel.
+            if (index != lastIndex)
+            {
+                channel = getChannel(index);
+                lastIndex = index;
+            }
+
+            channel->amplitude.fill(batch.amplitude[i]);
+            channel->position.fill(batch.position[i]);
+        }
+        else if (batch.type[i] == EventType::MdllNeutron)
+        {
+            auto mdll = getMdll(batch.deviceId[i]);
+            mdll->amplitude.fill(batch.amplitude[i]);
+            mdll->x.fill(batch.position[i]);
+            mdll->y.fill(batch.yPosition[i]);
+            mdll->xy.fill(batch.position[i], batch.yPosition[i]);
+        }
+    }
+}
+
+std::error_code ShmLiveHistos::publish()
+{
+    if (layoutChanged_ || !writer_.isOpen())
+    {
+        std::vector<ShmHistoInfo> infos;
+
+        for (u32 index: channels_)
+        {
+            const auto prefix = fmt::format("mcpd{}_mpsd{}_channel{}_",
+                                            index >> 8, (index >> 5) & 0x7u, index & 0x1fu);
+            const auto &histos = *channelTable_[index];
+            infos.push_back({ prefix + "amplitude", 1, histos.amplitude.axis() });
+            infos.push_back({ prefix + "position", 1, histos.position.axis() });
+        }
+
+        for (u8 id: mdlls_)
+        {
+            const auto prefix = fmt::format("mdll{}_", id);
+            const auto &histos = *mdllTable_[id];
+            infos.push_back({ prefix + "amplitude", 1, histos.amplitude.axis() });
+            infos.push_back({ prefix + "x", 1, histos.x.axis() });
+            infos.push_back({ prefix + "y", 1, histos.y.axis() });
+            infos.push_back({ prefix + "xy", 2, histos.xy.xAxis(), histos.xy.yAxis() });
+        }
+
+        if (auto ec = writer_.create(shmName_, infos))
+            return ec;
+
+        layoutChanged_ = false;
+    }
+
+    writer_.beginUpdate();
+
+    size_t histoIndex = 0;
+
+    for (u32 index: channels_)
+    {
+        const auto &histos = *channelTable_[index];
+        writer_.copy(histoIndex++, histos.amplitude);
+        writer_.copy(histoIndex++, histos.position);
+    }
+
+    for (u8 id: mdlls_)
+    {
+        const auto &histos = *mdllTable_[id];
+        writer_.copy(histoIndex++, histos.amplitude);
+        writer_.copy(histoIndex++, histos.x);
+        writer_.copy(histoIndex++, histos.y);
+        writer_.copy(histoIndex++, histos.xy);
+    }
+
+    writer_.endUpdate();
+
+    return {};
+}
+
+void ShmLiveHistos::clear()
+{
+    for (u32 index: channels_)
+    {
+        channelTable_[index]->amplitude.clear();
+        channelTable_[index]->position.clear();
+    }
+
+    for (u8 id: mdlls_)
+    {
+        mdllTable_[id]->amplitude.clear();
+        mdllTable_[id]->x.clear();
+        mdllTable_[id]->y.clear();
+        mdllTable_[id]->xy.clear();
+    }
+}
+
+}
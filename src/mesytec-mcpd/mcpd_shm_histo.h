@@ -0,0 +1,224 @@
+#ifndef __MESYTEC_MCPD_SHM_HISTO_H__
+#define __MESYTEC_MCPD_SHM_HISTO_H__
+
+#include <atomic>
+#include <memory>
+#include <string>
+#include <system_error>
+#include <vector>
+
+#include "mcpd_histo.h"
+
+namespace mesytec::mcpd
+{
+
+// Live histograms in a named POSIX shared memory segment.
+//
+// A single writer (the readout process) periodically copies its histograms
+// into the segment. Any number of local readers can map the segment
+// read-only and take consistent snapshots of single histograms without
+// decoding any data themselves.
+//
+// Consistency is provided by a seqlock: the writer increments the sequence
+// number before and after updating the histogram contents. Readers copy the
+// data and retry if the sequence number was odd or changed during the copy.
+// Readers never block the writer.
+//
+// The histogram layout is fixed for the lifetime of a segment. To change the
+// layout the writer marks the old segment as closed and creates a new one
+// under the same name. Readers detect this via ShmHistoReader::isStale() and
+// reopen.
+//
+// Segment layout:
+//   ShmHistoSegmentHeader
+//   ShmHistoEntry[histoCount]
+//   u32 data of each histogram, 8 byte aligned, at ShmHistoEntry::dataOffset
+namespace shm_histo
+{
+    static const char Magic[8] = { 'M', 'C', 'P', 'D', 'H', 'S', 'T', '\0' };
+    static const u32 Version = 1u;
+    static const size_t MaxNameLength = 63u;
+
+    enum SegmentState: u32
+    {
+        Active = 1u,
+        Closed = 2u,
+    };
+}
+
+struct ShmHistoSegmentHeader
+{
+    char magic[8];
+    u32 version;
+    u32 histoCount;
+    u64 segmentSize;
+    std::atomic<u32> state;         // shm_histo::SegmentState
+    u32 reserved;
+    std::atomic<u64> sequence;      // seqlock, odd while the writer updates
+    std::atomic<u64> publishCount;  // number of completed updates
+};
+
+struct ShmHistoEntry
+{
+    char name[shm_histo::MaxNameLength + 1];
+    u32 dims;                   // 1 or 2
+    u32 xBins;
+    u32 xShift;
+    u32 yBins;                  // 1 for 1D histograms
+    u32 yShift;
+    u32 reserved;
+    u64 dataOffset;             // byte offset from the start of the segment
+    u64 overflow;               // written inside the seqlock
+};
+
+static_assert(std::atomic<u64>::is_always_lock_free,
+              "the shared memory seqlock requires lock-free 64-bit atomics");
+
+struct MESYTEC_MCPD_EXPORT ShmHistoInfo
+{
+    std::string name;
+    u32 dims = 1u;
+    HistoAxis xAxis = {};
+    HistoAxis yAxis = { 1u, 0u };
+
+    // Number of u32 bins, row major for 2D histograms.
+    size_t size() const { return static_cast<size_t>(xAxis.bins) * (dims > 1 ? yAxis.bins : 1u); }
+};
+
+class MESYTEC_MCPD_EXPORT ShmHistoWriter
+{
+  public:
+    ShmHistoWriter() = default;
+    ~ShmHistoWriter();
+
+    ShmHistoWriter(const ShmHistoWriter &) = delete;
+    ShmHistoWriter &operator=(const ShmHistoWriter &) = delete;
+
+    // Creates the named segment, e.g. "/mcpd-histos", with the given layout.
+    // An existing segment of the same name is replaced. If this writer
+    // already had a segment open it is closed first.
+    std::error_code create(const std::string &name, const std::vector<ShmHistoInfo> &histos);
+
+    // Marks the segment as closed so that readers reopen, then unmaps and
+    // unlinks it.
+    void close();
+
+    bool isOpen() const { return header_ != nullptr; }
+    const std::string &name() const { return name_; }
+    const std::vector<ShmHistoInfo> &histos() const { return histos_; }
+    size_t segmentSize() const { return size_; }
+
+    // Histogram contents and overflow counters may only be modified between
+    // beginUpdate() and endUpdate().
+    void beginUpdate();
+    void endUpdate();
+
+    u32 *data(size_t index);
+    void setOverflow(size_t index, u64 overflow);
+
+    // Copy helpers. The histogram must have the size of the layout entry.
+    void copy(size_t index, const Histo1D<u32> &histo);
+    void copy(size_t index, const Histo2D<u32> &histo);
+
+  private:
+    std::string name_;
+    std::vector<ShmHistoInfo> histos_;
+    ShmHistoSegmentHeader *header_ = nullptr;
+    size_t size_ = 0u;
+};
+
+class MESYTEC_MCPD_EXPORT ShmHistoReader
+{
+  public:
+    ShmHistoReader() = default;
+    ~ShmHistoReader();
+
+    ShmHistoReader(const ShmHistoReader &) = delete;
+    ShmHistoReader &operator=(const ShmHistoReader &) = delete;
+
+    // Maps the named segment read-only and reads its layout.
+    std::error_code open(const std::string &name);
+    void close();
+
+    bool isOpen() const { return header_ != nullptr; }
+
+    // True if the writer closed or replaced the segment. Call open() again to
+    // pick up the new segment.
+    bool isStale() const;
+
+    const std::vector<ShmHistoInfo> &histos() const { return histos_; }
+
+    // Returns the index of the named histogram or -1.
+    s64 find(const std::string &name) const;
+
+    // Number of completed writer updates. Can be used to skip redrawing.
+    u64 publishCount() const;
+
+    // Copies a consistent snapshot of the histogram into dest which must have
+    // room for histos()[index].size() bins. Returns false if the writer was
+    // updating during all maxRetries attempts.
+    bool read(size_t index, u32 *dest, u64 *overflow = nullptr, unsigned maxRetries = 1000u) const;
+    bool read(size_t index, std::vector<u32> &dest, u64 *overflow = nullptr,
+              unsigned maxRetries = 1000u) const;
+
+  private:
+    const ShmHistoSegmentHeader *header_ = nullptr;
+    size_t size_ = 0u;
+    std::vector<ShmHistoInfo> histos_;
+    std::vector<u64> dataOffsets_;
+};
+
+// The standard set of live histograms: amplitude and position of each MCPD
+// channel and amplitude, x, y and xy position of each MDLL. Histograms are
+// created when a channel or device is first seen. Channel histograms are
+// named "mcpd<id>_mpsd<id>_channel<n>_amplitude" and "..._position", like
+// the ROOT histograms of mcpd-cli. MDLL histograms are named
+// "mdll<id>_amplitude", "_x", "_y" and "_xy" and do not match the ROOT names.
+//
+// The histograms accumulate in process memory. publish() copies them to the
+// shared memory segment, recreating it if the layout changed.
+class MESYTEC_MCPD_EXPORT ShmLiveHistos
+{
+  public:
+    explicit ShmLiveHistos(const std::string &shmName);
+
+    void processPacket(const DataPacket &packet);
+    void process(const EventBatch &batch);
+
+    std::error_code publish();
+
+    void clear();
+
+    const ShmHistoWriter &writer() const { return writer_; }
+
+  private:
+    struct ChannelHistos
+    {
+        Histo1D<u32> amplitude;
+        Histo1D<u32> position;
+    };
+
+    struct MdllHistos
+    {
+        Histo1D<u32> amplitude;
+        Histo1D<u32> x;
+        Histo1D<u32> y;
+        Histo2D<u32> xy;
+    };
+
+    ChannelHistos *getChannel(u32 channelIndex);
+    MdllHistos *getMdll(u8 deviceId);
+
+    std::string shmName_;
+    ShmHistoWriter writer_;
+    EventBatch batch_;
+    std::vector<std::unique_ptr<ChannelHistos>> channelTable_; // indexed by linear_channel_index()
+    std::vector<u32> channels_;                                // channels in order of creation
+    std::vector<std::unique_ptr<MdllHistos>> mdllTable_;       // indexed by device id
+    std::vector<u8> mdlls_;
+    bool layoutChanged_ = true;
+};
+
+}
+
+#endif /* __MESYTEC_MCPD_SHM_HISTO_H__ */
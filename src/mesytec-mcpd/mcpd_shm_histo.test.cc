@@ -0,0 +1,133 @@
+#include <gtest/gtest.h>
+
+#include <unistd.h>
+
+#include "mcpd_shm_histo.h"
+
+using namespace mesytec::mcpd;
+
+namespace
+{
+
+std::string test_shm_name(const char *suffix)
+{
+    return "/mcpd-test-" + std::to_string(getpid()) + "-" + suffix;
+}
+
+} // namespace
+
+TEST(ShmHisto, WriteRead)
+{
+    const auto name = test_shm_name("rw");
+
+    std::vector<ShmHistoInfo> infos = {
+        { "h1", 1, { 16, 0 } },
+        { "h2", 2, { 4, 0 }, { 8, 1 } },
+    };
+
+    ShmHistoWriter writer;
+    ASSERT_FALSE(writer.create(name, infos));
+
+    ShmHistoReader reader;
+    ASSERT_FALSE(reader.open(name));
+    ASSERT_EQ(reader.histos().size(), 2u);
+    ASSERT_EQ(reader.histos()[0].name, "h1");
+    ASSERT_EQ(reader.histos()[0].size(), 16u);
+    ASSERT_EQ(reader.histos()[1].dims, 2u);
+    ASSERT_EQ(reader.histos()[1].yAxis, (HistoAxis{ 8, 1 }));
+    ASSERT_EQ(reader.histos()[1].size(), 32u);
+    ASSERT_EQ(reader.find("h2"), 1);
+    ASSERT_EQ(reader.find("nope"), -1);
+    ASSERT_FALSE(reader.isStale());
+    ASSERT_EQ(reader.publishCount(), 0u);
+
+    Histo1D<u32> h1({ 16, 0 });
+    h1.fill(3);
+    h1.fill(3);
+    h1.fill(100);
+
+    Histo2D<u32> h2({ 4, 0 }, { 8, 1 });
+    h2.fill(1, 5);
+
+    const auto &expected1 = static_cast<const Histo1D<u32> &>(h1).data();
+    const auto &expected2 = static_cast<const Histo2D<u32> &>(h2).data();
+
+    writer.beginUpdate();
+    writer.copy(0, h1);
+    writer.copy(1, h2);
+    writer.endUpdate();
+
+    ASSERT_EQ(reader.publishCount(), 1u);
+
+    std::vector<u32> data;
+    u64 overflow = 0;
+    ASSERT_TRUE(reader.read(0, data, &overflow));
+    ASSERT_EQ(data, expected1);
+    ASSERT_EQ(overflow, 1u);
+
+    ASSERT_TRUE(reader.read(1, data));
+    ASSERT_EQ(data, expected2);
+    ASSERT_EQ(data[2 * 4 + 1], 1u);
+
+    // A reader never gets a snapshot while an update is in progress.
+    writer.beginUpdate();
+    ASSERT_FALSE(reader.read(0, data, nullptr, 10));
+    writer.endUpdate();
+    ASSERT_TRUE(reader.read(0, data, nullptr, 10));
+
+    ASSERT_THROW(writer.copy(0, h2), std::invalid_argument);
+
+    writer.close();
+    ASSERT_TRUE(reader.isStale());
+
+    // The mapping stays valid after the writer is gone.
+    ASSERT_TRUE(reader.read(0, data));
+    ASSERT_EQ(data, expected1);
+
+    ASSERT_TRUE(reader.open(name));
+}
+
+TEST(ShmHisto, LiveHistosRecreateOnLayoutChange)
+{
+    const auto name = test_shm_name("live");
+
+    ShmLiveHistos live(name);
+    ASSERT_FALSE(live.publish());
+
+    ShmHistoReader reader;
+    ASSERT_FALSE(reader.open(name));
+    ASSERT_TRUE(reader.histos().empty());
+
+    EventBatch batch;
+    DecodedEvent event = {};
+    event.type = EventType::Neutron;
+    event.deviceId = 1;
+    event.neutron.mpsdId = 2;
+    event.neutron.channel = 3;
+    event.neutron.amplitude = 10;
+    event.neutron.position = 20;
+    batch.push_back(event);
+
+    live.process(batch);
+    ASSERT_FALSE(live.publish());
+    ASSERT_TRUE(reader.isStale());
+
+    ASSERT_FALSE(reader.open(name));
+    ASSERT_EQ(reader.histos().size(), 2u);
+
+    auto index = reader.find("mcpd1_mpsd2_channel3_amplitude");
+    ASSERT_GE(index, 0);
+
+    std::vector<u32> data;
+    ASSERT_TRUE(reader.read(index, data));
+    ASSERT_EQ(data.size(), 1024u);
+    ASSERT_EQ(data[10], 1u);
+
+    // Same layout: the segment is updated in place.
+    live.process(batch);
+    ASSERT_FALSE(live.publish());
+    ASSERT_FALSE(reader.isStale());
+    ASSERT_TRUE(reader.read(index, data));
+    ASSERT_EQ(data[10], 2u);
+    ASSERT_EQ(reader.publishCount(), 2u);
+}
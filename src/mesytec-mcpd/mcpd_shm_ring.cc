@@ -0,0 +1,297 @@
+#include "mcpd_shm_ring.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <new>
+#include <thread>
+#include <spdlog/spdlog.h>
+
+#include "util/shared_memory.h"
+
+namespace mesytec::mcpd
+{
+
+namespace
+{
+    inline size_t align8(size_t size) { return (size + 7u) & ~size_t(7u); }
+
+    inline size_t round_up_pow2(size_t value)
+    {
+        size_t result = 1u;
+        while (result < value)
+            result <<= 1;
+        return result;
+    }
+
+    template<typename Header>
+    inline auto slot_ptr(Header *header, u64 packetNumber)
+    {
+        using Byte = std::conditional_t<std::is_const_v<Header>, const u8, u8>;
+        using Slot = std::conditional_t<std::is_const_v<Header>, const ShmRingSlotHeader, ShmRingSlotHeader>;
+
+        auto base = reinterpret_cast<Byte *>(header) + align8(sizeof(ShmRingHeader));
+        return reinterpret_cast<Slot *>(
+            base + (packetNumber & (header->slotCount - 1)) * header->slotStride);
+    }
+}
+
+//
+// ShmPacketRingWriter
+//
+
+ShmPacketRingWriter::~ShmPacketRingWriter()
+{
+    close();
+}
+
+std::error_code ShmPacketRingWriter::create(const std::string &name, size_t slotCount,
+                                            size_t maxPacketSize)
+{
+    close();
+
+    slotCount = round_up_pow2(std::max(slotCount, size_t(2)));
+    const size_t slotStride = align8(sizeof(ShmRingSlotHeader) + maxPacketSize);
+    const size_t size = align8(sizeof(ShmRingHeader)) + slotCount * slotStride;
+
+    // Let readers of a ring left behind by another writer finish.
+    {
+        void *mem = nullptr;
+        size_t oldSize = 0;
+
+        if (!util::open_shared_memory(name, true, &mem, &oldSize))
+        {
+            auto header = reinterpret_cast<ShmRingHeader *>(mem);
+
+            if (oldSize >= sizeof(ShmRingHeader)
+                && std::memcmp(header->magic, shm_ring::Magic, sizeof(shm_ring::Magic)) == 0)
+            {
+                header->state.store(shm_ring::Closed, std::memory_order_release);
+            }
+
+            util::unmap_shared_memory(mem, oldSize);
+        }
+    }
+
+    void *mem = nullptr;
+
+    if (auto ec = util::create_shared_memory(name, size, &mem))
+        return ec;
+
+    // The segment is zero filled on creation, so all slot sequence numbers
+    // start out as 0 (never written).
+    auto header = new (mem) ShmRingHeader{};
+    std::memcpy(header->magic, shm_ring::Magic, sizeof(shm_ring::Magic));
+    header->version = shm_ring::Version;
+    header->segmentSize = size;
+    header->slotCount = slotCount;
+    header->slotStride = slotStride;
+    header->maxPacketSize = maxPacketSize;
+    header->state.store(shm_ring::Active, std::memory_order_release);
+
+    name_ = name;
+    header_ = header;
+    size_ = size;
+
+    spdlog::debug("created shared memory packet ring '{}': {} slots of {} bytes, {} bytes total",
+                  name_, slotCount, slotStride, size_);
+
+    return {};
+}
+
+void ShmPacketRingWriter::close()
+{
+    if (!header_)
+        return;
+
+    header_->state.store(shm_ring::Closed, std::memory_order_release);
+    util::unmap_shared_memory(header_, size_);
+    util::unlink_shared_memory(name_);
+
+    header_ = nullptr;
+    size_ = 0u;
+}
+
+void ShmPacketRingWriter::write(const void *packet, size_t size, u32 srcAddr, u16 srcPort)
+{
+    const u64 packetNumber = header_->writeIndex.load(std::memory_order_relaxed);
+    auto slot = slot_ptr(header_, packetNumber);
+
+    slot->sequence.store(2 * packetNumber + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+
+    slot->size = static_cast<u32>(size);
+    slot->srcAddr = srcAddr;
+    slot->srcPort = srcPort;
+    std::memcpy(reinterpret_cast<u8 *>(slot + 1), packet, std::min(size, static_cast<size_t>(header_->maxPacketSize)));
+
+    slot->sequence.store(2 * packetNumber + 2, std::memory_order_release);
+    header_->writeIndex.store(packetNumber + 1, std::memory_order_release);
+}
+
+u64 ShmPacketRingWriter::packetsWritten() const
+{
+    return header_ ? header_->writeIndex.load(std::memory_order_relaxed) : 0u;
+}
+
+//
+// ShmPacketRingReader
+//
+
+ShmPacketRingReader::~ShmPacketRingReader()
+{
+    close();
+}
+
+std::error_code ShmPacketRingReader::open(const std::string &name, bool fromOldest)
+{
+    close();
+
+    void *mem = nullptr;
+    size_t size = 0;
+
+    if (auto ec = util::open_shared_memory(name, false, &mem, &size))
+        return ec;
+
+    auto header = reinterpret_cast<const ShmRingHeader *>(mem);
+
+    const bool headerValid = size >= sizeof(ShmRingHeader)
+        && std::memcmp(header->magic, shm_ring::Magic, sizeof(shm_ring::Magic)) == 0
+        && header->version == shm_ring::Version
+        && header->segmentSize == size
+        && header->slotCount && (header->slotCount & (header->slotCount - 1)) == 0
+        && header->slotStride >= sizeof(ShmRingSlotHeader) + header->maxPacketSize
+        && align8(sizeof(ShmRingHeader)) + header->slotCount * header->slotStride <= size;
+
+    if (!headerValid)
+    {
+        util::unmap_shared_memory(mem, size);
+        return std::make_error_code(std::errc::invalid_argument);
+    }
+
+    header_ = header;
+    size_ = size;
+
+    const u64 writeIndex = header_->writeIndex.load(std::memory_order_acquire);
+
+    if (fromOldest)
+        next_ = writeIndex > header_->slotCount ? writeIndex - header_->slotCount : 0u;
+    else
+        next_ = writeIndex;
+
+    overruns_ = 0u;
+    packetsRead_ = 0u;
+
+    return {};
+}
+
+void ShmPacketRingReader::close()
+{
+    util::unmap_shared_memory(header_, size_);
+    header_ = nullptr;
+    size_ = 0u;
+}
+
+bool ShmPacketRingReader::tryRead(void *dest, size_t maxSize, PacketInfo *info)
+{
+    while (true)
+    {
+        const u64 writeIndex = header_->writeIndex.load(std::memory_order_acquire);
+
+        if (next_ >= writeIndex)
+            return false;
+
+        // Lapped by the writer: the oldest packets are gone.
+        if (writeIndex - next_ > header_->slotCount)
+        {
+            overruns_ += writeIndex - next_ - header_->slotCount;
+            next_ = writeIndex - header_->slotCount;
+        }
+
+        auto slot = slot_ptr(header_, next_);
+        const u64 expected = 2 * next_ + 2;
+
+        if (slot->sequence.load(std::memory_order_acquire) != expected)
+        {
+            // Overwritten since writeIndex was loaded.
+            ++overruns_;
+            ++next_;
+            continue;
+        }
+
+        const size_t packetSize = slot->size;
+        const u32 srcAddr = slot->srcAddr;
+        const u16 srcPort = slot->srcPort;
+        const size_t copySize = std::min({ packetSize, maxSize, static_cast<size_t>(header_->maxPacketSize) });
+        std::memcpy(dest, reinterpret_cast<const u8 *>(slot + 1), copySize);
+
+        std::atomic_thread_fence(std::memory_order_acquire);
+
+        if (slot->sequence.load(std::memory_order_relaxed) != expected)
+        {
+            // Overwritten during the copy.
+            ++overruns_;
+            ++next_;
+            continue;
+        }
+
+        if (info)
+            *info = { packetSize, srcAddr, srcPort };
+
+        ++next_;
+        ++packetsRead_;
+        return true;
+    }
+}
+
+bool ShmPacketRingReader::read(void *dest, size_t maxSize, unsigned timeout_ms, PacketInfo *info)
+{
+    if (!header_)
+        return false;
+
+    if (tryRead(dest, maxSize, info))
+        return true;
+
+    const auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(timeout_ms);
+    unsigned spins = 0;
+
+    // Poll: spin briefly to keep latency low under load, then back off.
+    while (!isFinished())
+    {
+        if (spins < 64)
+        {
+            ++spins;
+            std::this_thread::yield();
+        }
+        else
+        {
+            std::this_thread::sleep_for(std::chrono::microseconds(200));
+        }
+
+        if (tryRead(dest, maxSize, info))
+            return true;
+
+        if (std::chrono::steady_clock::now() >= deadline)
+            break;
+    }
+
+    return false;
+}
+
+bool ShmPacketRingReader::isFinished() const
+{
+    return !header_
+        || (header_->state.load(std::memory_order_acquire) != shm_ring::Active
+            && next_ >= header_->writeIndex.load(std::memory_order_acquire));
+}
+
+u64 ShmPacketRingReader::backlog() const
+{
+    if (!header_)
+        return 0u;
+
+    const u64 writeIndex = header_->writeIndex.load(std::memory_order_acquire);
+    return writeIndex > next_ ? writeIndex - next_ : 0u;
+}
+
+}
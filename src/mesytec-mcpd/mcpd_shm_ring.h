@@ -0,0 +1,148 @@
+#ifndef __MESYTEC_MCPD_SHM_RING_H__
+#define __MESYTEC_MCPD_SHM_RING_H__
+
+#include <atomic>
+#include <string>
+#include <system_error>
+
+#include "mcpd_core.h"
+
+namespace mesytec::mcpd
+{
+
+// Single producer, multi consumer packet ring in a named POSIX shared memory
+// segment. Used to fan out the raw packet stream of one receiving process to
+// any number of local consumers, e.g. a listfile writer, an online
+// histogrammer and a Python analysis.
+//
+// The writer never waits for readers. Each slot is protected by its own
+// sequence number (seqlock): it is odd while the writer copies a packet into
+// the slot and 2 * (packetNumber + 1) afterwards. A reader that falls more
+// than slotCount packets behind, or whose slot was overwritten during the
+// copy, skips the lost packets and counts them as overruns.
+//
+// Segment layout:
+//   ShmRingHeader
+//   slotCount * slotStride bytes, each slot starting with a ShmRingSlotHeader
+namespace shm_ring
+{
+    static const char Magic[8] = { 'M', 'C', 'P', 'D', 'R', 'N', 'G', '\0' };
+    static const u32 Version = 1u;
+    static const size_t DefaultSlotCount = 4096u;
+
+    enum SegmentState: u32
+    {
+        Active = 1u,
+        Closed = 2u,
+    };
+}
+
+struct ShmRingHeader
+{
+    char magic[8];
+    u32 version;
+    std::atomic<u32> state;         // shm_ring::SegmentState
+    u64 segmentSize;
+    u64 slotCount;                  // power of two
+    u64 slotStride;                 // bytes per slot including the slot header
+    u64 maxPacketSize;
+    std::atomic<u64> writeIndex;    // number of packets written
+};
+
+struct ShmRingSlotHeader
+{
+    std::atomic<u64> sequence;
+    u32 size;
+    u32 srcAddr;
+    u16 srcPort;
+    u16 reserved0;
+    u32 reserved1;
+};
+
+class MESYTEC_MCPD_EXPORT ShmPacketRingWriter
+{
+  public:
+    ShmPacketRingWriter() = default;
+    ~ShmPacketRingWriter();
+
+    ShmPacketRingWriter(const ShmPacketRingWriter &) = delete;
+    ShmPacketRingWriter &operator=(const ShmPacketRingWriter &) = delete;
+
+    // Creates the named ring, replacing an existing one. slotCount is rounded
+    // up to a power of two.
+    std::error_code create(const std::string &name, size_t slotCount = shm_ring::DefaultSlotCount,
+                           size_t maxPacketSize = sizeof(DataPacket));
+
+    // Marks the ring closed so that readers stop after consuming the
+    // remaining packets, then unmaps and unlinks it.
+    void close();
+
+    bool isOpen() const { return header_ != nullptr; }
+
+    // Copies the packet into the next slot. Packets larger than maxPacketSize
+    // are truncated.
+    void write(const void *packet, size_t size, u32 srcAddr = 0u, u16 srcPort = 0u);
+
+    u64 packetsWritten() const;
+
+  private:
+    std::string name_;
+    ShmRingHeader *header_ = nullptr;
+    size_t size_ = 0u;
+};
+
+class MESYTEC_MCPD_EXPORT ShmPacketRingReader
+{
+  public:
+    struct PacketInfo
+    {
+        size_t size = 0u;   // original packet size
+        u32 srcAddr = 0u;
+        u16 srcPort = 0u;
+    };
+
+    ShmPacketRingReader() = default;
+    ~ShmPacketRingReader();
+
+    ShmPacketRingReader(const ShmPacketRingReader &) = delete;
+    ShmPacketRingReader &operator=(const ShmPacketRingReader &) = delete;
+
+    // Attaches to the named ring. By default reading starts with the next
+    // packet written. If fromOldest is set reading starts with the oldest
+    // packet still held by the ring.
+    std::error_code open(const std::string &name, bool fromOldest = false);
+    void close();
+
+    bool isOpen() const { return header_ != nullptr; }
+
+    // Copies the next packet to dest, at most maxSize bytes. Waits up to
+    // timeout_ms for a packet to arrive. Returns false on timeout or if the
+    // writer closed the ring and all packets have been consumed.
+    bool read(void *dest, size_t maxSize, unsigned timeout_ms, PacketInfo *info = nullptr);
+
+    // True once the writer closed the ring and all packets were consumed.
+    bool isFinished() const;
+
+    // Number of packets lost because this reader fell behind.
+    u64 overruns() const { return overruns_; }
+
+    // Number of packets read.
+    u64 packetsRead() const { return packetsRead_; }
+
+    // Number of packets written but not yet read. Can exceed the slot count
+    // if packets were lost.
+    u64 backlog() const;
+
+  private:
+    bool tryRead(void *dest, size_t maxSize, PacketInfo *info);
+
+    const ShmRingHeader *header_ = nullptr;
+    size_t size_ = 0u;
+    u64 next_ = 0u;
+    u64 overruns_ = 0u;
+    u64 packetsRead_ = 0u;
+};
+
+}
+
+#endif /* __MESYTEC_MCPD_SHM_RING_H__ */
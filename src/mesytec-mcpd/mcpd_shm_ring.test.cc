@@ -0,0 +1,124 @@
+#include <gtest/gtest.h>
+
+#include <thread>
+#include <unistd.h>
+
+#include "mcpd_shm_ring.h"
+
+using namespace mesytec::mcpd;
+
+namespace
+{
+
+std::string test_shm_name(const char *suffix)
+{
+    return "/mcpd-test-" + std::to_string(getpid()) + "-" + suffix;
+}
+
+} // namespace
+
+TEST(ShmPacketRing, WriteRead)
+{
+    const auto name = test_shm_name("ring");
+
+    ShmPacketRingWriter writer;
+    ASSERT_FALSE(writer.create(name, 8, 16));
+
+    ShmPacketRingReader reader1;
+    ASSERT_FALSE(reader1.open(name));
+
+    u32 value = 0;
+    ASSERT_FALSE(reader1.read(&value, sizeof(value), 0));
+
+    for (u32 i = 0; i < 4; ++i)
+        writer.write(&i, sizeof(i), 0x0a000001, 1000 + i);
+
+    // A second reader attached later starts at the current write position.
+    ShmPacketRingReader reader2;
+    ASSERT_FALSE(reader2.open(name));
+    ASSERT_EQ(reader2.backlog(), 0u);
+
+    // Starting from the oldest packet gets everything still in the ring.
+    ShmPacketRingReader reader3;
+    ASSERT_FALSE(reader3.open(name, true));
+    ASSERT_EQ(reader3.backlog(), 4u);
+
+    ShmPacketRingReader::PacketInfo info;
+
+    for (u32 i = 0; i < 4; ++i)
+    {
+        ASSERT_TRUE(reader1.read(&value, sizeof(value), 0, &info));
+        ASSERT_EQ(value, i);
+        ASSERT_EQ(info.size, sizeof(u32));
+        ASSERT_EQ(info.srcAddr, 0x0a000001u);
+        ASSERT_EQ(info.srcPort, 1000 + i);
+    }
+
+    ASSERT_FALSE(reader1.read(&value, sizeof(value), 1));
+    ASSERT_EQ(reader1.packetsRead(), 4u);
+    ASSERT_EQ(reader1.overruns(), 0u);
+
+    // reader2 falls behind by more than the ring size.
+    for (u32 i = 4; i < 24; ++i)
+        writer.write(&i, sizeof(i));
+
+    ASSERT_TRUE(reader2.read(&value, sizeof(value), 0));
+    ASSERT_EQ(value, 16u); // 24 - 8 slots
+    ASSERT_EQ(reader2.overruns(), 12u);
+
+    writer.close();
+
+    // Remaining packets can be consumed after the writer is gone.
+    u32 count = 0;
+    while (reader2.read(&value, sizeof(value), 1000))
+        ++count;
+
+    ASSERT_EQ(count, 7u);
+    ASSERT_TRUE(reader2.isFinished());
+}
+
+TEST(ShmPacketRing, ConcurrentReader)
+{
+    const auto name = test_shm_name("ring-mt");
+    const u32 PacketCount = 100000;
+
+    ShmPacketRingWriter writer;
+    ASSERT_FALSE(writer.create(name, 64, 64));
+
+    ShmPacketRingReader reader;
+    ASSERT_FALSE(reader.open(name));
+
+    std::thread writerThread([&]
+    {
+        u32 packet[16] = {};
+
+        for (u32 i = 0; i < PacketCount; ++i)
+        {
+            std::fill(std::begin(packet), std::end(packet), i);
+            writer.write(packet, sizeof(packet));
+        }
+
+        writer.close();
+    });
+
+    u32 packet[16] = {};
+    u32 last = 0;
+    u64 received = 0;
+
+    while (reader.read(packet, sizeof(packet), 1000))
+    {
+        // Packets are never torn and arrive in order.
+        for (auto v: packet)
+            EXPECT_EQ(v, packet[0]);
+
+        if (received)
+            EXPECT_GT(packet[0], last);
+
+        last = packet[0];
+        ++received;
+    }
+
+    writerThread.join();
+
+    ASSERT_EQ(received + reader.overruns(), PacketCount);
+}
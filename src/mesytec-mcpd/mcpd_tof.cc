@@ -0,0 +1,134 @@
+#include "mcpd_tof.h"
+
+#include <algorithm>
+#include <stdexcept>
+
+namespace mesytec::mcpd
+{
+
+TofHistogrammer::TofHistogrammer()
+    : TofHistogrammer(Options{})
+{
+}
+
+TofHistogrammer::TofHistogrammer(const Options &options)
+    : options_(options)
+{
+    if (!options_.bins)
+        throw std::invalid_argument("TofHistogrammer: bins must be > 0");
+
+    if (!options_.binWidth)
+        throw std::invalid_argument("TofHistogrammer: binWidth must be > 0");
+
+    if (options_.positionBins < 1 || options_.positionBins > (1u << event_constants::neutron::PositionBits))
+        throw std::invalid_argument("TofHistogrammer: positionBins must be in [1, 1024]");
+
+    channelRows_.resize(LinearChannelCount, -1);
+}
+
+void TofHistogrammer::processPacket(const DataPacket &packet)
+{
+    batch_.clear();
+    decode_events(packet, batch_);
+    process(batch_);
+}
+
+void TofHistogrammer::process(const EventBatch &batch)
+{
+    const size_t count = batch.size();
+    const u32 bins = options_.bins;
+    const u32 positionBins = options_.positionBins;
+
+    for (size_t i = 0; i < count; ++i)
+    {
+        const auto type = batch.type[i];
+        const u8 deviceId = batch.deviceId[i];
+
+        if (type == EventType::Trigger)
+        {
+            if (batch.address[i] == options_.triggerId && batch.channel[i] == options_.dataId)
+            {
+                lastTrigger_[deviceId] = batch.timestamp[i];
+                hasTrigger_[deviceId] = true;
+                ++counters_.triggers;
+            }
+            continue;
+        }
+
+        ++counters_.neutrons;
+
+        if (!hasTrigger_[deviceId])
+        {
+            ++counters_.noTrigger;
+            continue;
+        }
+
+        const u64 ts = batch.timestamp[i];
+
+        if (ts < lastTrigger_[deviceId] + options_.offset)
+        {
+            ++counters_.underflow;
+            continue;
+        }
+
+        const u64 bin = (ts - lastTrigger_[deviceId] - options_.offset) / options_.binWidth;
+
+        if (bin >= bins)
+        {
+            ++counters_.overflow;
+            continue;
+        }
+
+        const u32 channel = type == EventType::Neutron
+            ? linear_channel_index(deviceId, batch.address[i], batch.channel[i])
+            : linear_channel_index(deviceId, 0, 0);
+
+        s32 firstRow = channelRows_[channel];
+
+        if (firstRow < 0)
+            firstRow = allocateChannel(channel);
+
+        const u32 pixel = (static_cast<u32>(batch.position[i]) * positionBins)
+            >> event_constants::neutron::PositionBits;
+
+        ++data_[(firstRow + pixel) * static_cast<size_t>(bins) + bin];
+        ++counters_.filled;
+    }
+}
+
+s64 TofHistogrammer::findRow(u32 channel, u32 pixel) const
+{
+    if (channel >= channelRows_.size() || pixel >= options_.positionBins || channelRows_[channel] < 0)
+        return -1;
+
+    return channelRows_[channel] + pixel;
+}
+
+void TofHistogrammer::reset()
+{
+    counters_ = {};
+    lastTrigger_ = {};
+    hasTrigger_ = {};
+    std::fill(channelRows_.begin(), channelRows_.end(), -1);
+    rowChannels_.clear();
+    rowPixels_.clear();
+    data_.clear();
+}
+
+size_t TofHistogrammer::allocateChannel(u32 channel)
+{
+    const size_t firstRow = rowChannels_.size();
+
+    for (u32 pixel = 0; pixel < options_.positionBins; ++pixel)
+    {
+        rowChannels_.push_back(channel);
+        rowPixels_.push_back(pixel);
+    }
+
+    data_.resize(rowChannels_.size() * static_cast<size_t>(options_.bins));
+    channelRows_[channel] = static_cast<s32>(firstRow);
+
+    return firstRow;
+}
+
+}
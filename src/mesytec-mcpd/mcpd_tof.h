@@ -0,0 +1,100 @@
+#ifndef __MESYTEC_MCPD_TOF_H__
+#define __MESYTEC_MCPD_TOF_H__
+
+#include <array>
+#include <vector>
+
+#include "mcpd_coincidence.h"
+#include "mcpd_event_batch.h"
+
+namespace mesytec::mcpd
+{
+
+// Trigger referenced time-of-flight histogramming.
+//
+// Keeps track of the last trigger event with the configured triggerId and
+// dataId for each device and histograms every neutron of that device by its
+// time since that trigger. Triggers are usually routed from chopper or
+// monitor inputs via mcpd_setup_cell().
+//
+// Histograms are stored per channel (linear_channel_index()) or, if
+// positionBins > 1, per pixel: the 10 bit position of each channel is
+// divided into positionBins pixels. MDLL neutrons use the channel index of
+// their device (mpsdId=0, channel=0) and their x position.
+//
+// All histograms live in a single flat u32 array. Rows of bins are allocated
+// the first time a channel is hit, all pixels of a channel are allocated
+// together and are adjacent in memory.
+class MESYTEC_MCPD_EXPORT TofHistogrammer
+{
+  public:
+    struct Options
+    {
+        u8 triggerId = 0u;
+        u8 dataId = 0u;
+        u32 bins = 1000u;
+        u64 binWidth = 10u;     // In timestamp units (100 ns).
+        u64 offset = 0u;        // TOF of the lower edge of the first bin.
+        u32 positionBins = 1u;  // 1: per channel histograms, up to 1024: per pixel histograms.
+    };
+
+    struct Counters
+    {
+        u64 neutrons = 0u;
+        u64 triggers = 0u;      // matching trigger events
+        u64 noTrigger = 0u;     // neutrons seen before the first trigger of their device
+        u64 underflow = 0u;
+        u64 overflow = 0u;
+        u64 filled = 0u;
+    };
+
+    TofHistogrammer();
+    explicit TofHistogrammer(const Options &options);
+
+    // Batch decodes the packet and processes its events.
+    void processPacket(const DataPacket &packet);
+
+    // Events of each device must be in time order.
+    void process(const EventBatch &batch);
+
+    const Options &options() const { return options_; }
+    const Counters &counters() const { return counters_; }
+
+    // Number of allocated histogram rows. Each row has options().bins entries.
+    size_t rowCount() const { return rowChannels_.size(); }
+
+    // Flat storage: rowCount() * bins counts, row major.
+    const std::vector<u32> &data() const { return data_; }
+
+    const u32 *row(size_t rowIndex) const { return data_.data() + rowIndex * options_.bins; }
+
+    // Linear channel index and pixel number of the given row.
+    u32 rowChannel(size_t rowIndex) const { return rowChannels_[rowIndex]; }
+    u32 rowPixel(size_t rowIndex) const { return rowPixels_[rowIndex]; }
+
+    // Returns the row index for the channel/pixel or -1 if the channel was not hit yet.
+    s64 findRow(u32 channel, u32 pixel = 0) const;
+
+    // Lower edge of the given bin in timestamp units.
+    u64 binLowEdge(u32 bin) const { return options_.offset + bin * options_.binWidth; }
+
+    // Clears counters, histograms and the trigger state.
+    void reset();
+
+  private:
+    size_t allocateChannel(u32 channel);
+
+    Options options_;
+    Counters counters_;
+    EventBatch batch_;
+    std::array<u64, 256> lastTrigger_ = {};
+    std::array<bool, 256> hasTrigger_ = {};
+    std::vector<s32> channelRows_;  // LinearChannelCount entries, first row of each channel or -1
+    std::vector<u32> rowChannels_;
+    std::vector<u32> rowPixels_;
+    std::vector<u32> data_;
+};
+
+}
+
+#endif /* __MESYTEC_MCPD_TOF_H__ */
@@ -0,0 +1,102 @@
+#include <gtest/gtest.h>
+
+#include "mcpd_tof.h"
+
+using namespace mesytec::mcpd;
+
+namespace
+{
+
+DecodedEvent make_trigger(u64 ts, u8 deviceId, u8 triggerId, u8 dataId)
+{
+    DecodedEvent event = {};
+    event.type = EventType::Trigger;
+    event.deviceId = deviceId;
+    event.trigger.triggerId = triggerId;
+    event.trigger.dataId = dataId;
+    event.timestamp = ts;
+    return event;
+}
+
+DecodedEvent make_neutron(u64 ts, u8 deviceId, u8 mpsdId, u8 channel, u16 position = 0)
+{
+    DecodedEvent event = {};
+    event.type = EventType::Neutron;
+    event.deviceId = deviceId;
+    event.neutron.mpsdId = mpsdId;
+    event.neutron.channel = channel;
+    event.neutron.position = position;
+    event.timestamp = ts;
+    return event;
+}
+
+} // namespace
+
+TEST(TofHistogrammer, PerChannel)
+{
+    TofHistogrammer::Options options;
+    options.triggerId = 1;
+    options.dataId = 2;
+    options.bins = 10;
+    options.binWidth = 5;
+    options.offset = 10;
+    TofHistogrammer tof(options);
+
+    EventBatch batch;
+    batch.push_back(make_neutron(50, 0, 1, 3));          // before any trigger
+    batch.push_back(make_trigger(100, 0, 1, 2));
+    batch.push_back(make_trigger(105, 0, 1, 3));         // other dataId, ignored
+    batch.push_back(make_neutron(105, 0, 1, 3));         // tof=5: underflow
+    batch.push_back(make_neutron(112, 0, 1, 3));         // tof=12: bin 0
+    batch.push_back(make_neutron(134, 0, 1, 3));         // tof=34: bin 4
+    batch.push_back(make_neutron(136, 0, 2, 0));         // tof=36: bin 5, other channel
+    batch.push_back(make_neutron(161, 0, 1, 3));         // tof=61: overflow
+    batch.push_back(make_neutron(120, 1, 1, 3));         // device 1 has no trigger yet
+    batch.push_back(make_trigger(200, 0, 1, 2));
+    batch.push_back(make_neutron(214, 0, 1, 3));         // tof=14: bin 0
+
+    tof.process(batch);
+
+    const auto &counters = tof.counters();
+    ASSERT_EQ(counters.triggers, 2u);
+    ASSERT_EQ(counters.neutrons, 8u);
+    ASSERT_EQ(counters.noTrigger, 2u);
+    ASSERT_EQ(counters.underflow, 1u);
+    ASSERT_EQ(counters.overflow, 1u);
+    ASSERT_EQ(counters.filled, 4u);
+
+    ASSERT_EQ(tof.rowCount(), 2u);
+    auto row = tof.findRow(linear_channel_index(0, 1, 3));
+    ASSERT_EQ(row, 0);
+    ASSERT_EQ(tof.row(row)[0], 2u);
+    ASSERT_EQ(tof.row(row)[4], 1u);
+    ASSERT_EQ(tof.row(tof.findRow(linear_channel_index(0, 2, 0)))[5], 1u);
+    ASSERT_EQ(tof.findRow(linear_channel_index(1, 1, 3)), -1);
+    ASSERT_EQ(tof.binLowEdge(4), 30u);
+}
+
+TEST(TofHistogrammer, PerPixel)
+{
+    TofHistogrammer::Options options;
+    options.bins = 4;
+    options.binWidth = 1;
+    options.positionBins = 4;
+    TofHistogrammer tof(options);
+
+    EventBatch batch;
+    batch.push_back(make_trigger(0, 7, 0, 0));
+    batch.push_back(make_neutron(1, 7, 0, 0, 0));
+    batch.push_back(make_neutron(2, 7, 0, 0, 1023));
+    batch.push_back(make_neutron(3, 7, 0, 0, 512));
+
+    tof.process(batch);
+
+    const u32 channel = linear_channel_index(7, 0, 0);
+    ASSERT_EQ(tof.rowCount(), 4u);
+    ASSERT_EQ(tof.data().size(), 16u);
+    ASSERT_EQ(tof.row(tof.findRow(channel, 0))[1], 1u);
+    ASSERT_EQ(tof.row(tof.findRow(channel, 3))[2], 1u);
+    ASSERT_EQ(tof.row(tof.findRow(channel, 2))[3], 1u);
+    ASSERT_EQ(tof.rowPixel(3), 3u);
+    ASSERT_EQ(tof.rowChannel(3), channel);
+}
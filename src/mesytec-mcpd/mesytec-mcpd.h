@@ -2,8 +2,30 @@
 #define __MESYTEC_MCPD_H__
 
 #include "git_version.h"
+#include "mcpd_coincidence.h"
 #include "mcpd_core.h"
+#include "mcpd_device_stats.h"
+#include "mcpd_event_archive.h"
+#include "mcpd_event_batch.h"
+#include "mcpd_event_codec.h"
+#include "mcpd_event_filter.h"
+#include "mcpd_event_merger.h"
+#include "mcpd_event_sort.h"
+#include "mcpd_flight_recorder.h"
+#include "mcpd_forwarder.h"
 #include "mcpd_functions.h"
+#include "mcpd_histo.h"
+#include "mcpd_listfile.h"
+#include "mcpd_listfile_follow.h"
+#include "mcpd_listfile_split.h"
+#include "mcpd_mdat.h"
+#include "mcpd_packet_source.h"
+#include "mcpd_pcap.h"
+#include "mcpd_replay_pacer.h"
+#include "mcpd_run_info.h"
+#include "mcpd_shm_histo.h"
+#include "mcpd_shm_ring.h"
+#include "mcpd_tof.h"
 #include "mdll_functions.h"
 #include "util/pretty_function.h"
 
@@ -32,6 +32,77 @@ void init_logging()
 
 using namespace py_lib;
 
+namespace
+{
+
+// Calls f with a pointer to the EventBatch column with the given name.
+template<typename F>
+void with_batch_column(const std::string &name, F &&f)
+{
+    if (name == "timestamp")
+        f(&EventBatch::timestamp);
+    else if (name == "device_id")
+        f(&EventBatch::deviceId);
+    else if (name == "address")
+        f(&EventBatch::address);
+    else if (name == "channel")
+        f(&EventBatch::channel);
+    else if (name == "amplitude")
+        f(&EventBatch::amplitude);
+    else if (name == "position")
+        f(&EventBatch::position);
+    else if (name == "y_position")
+        f(&EventBatch::yPosition);
+    else if (name == "value")
+        f(&EventBatch::value);
+    else
+        throw py::value_error("unknown EventBatch column '" + name + "'");
+}
+
+template<typename T>
+py::array_t<T> to_array(const std::vector<T> &v)
+{
+    return py::array_t<T>(v.size(), v.data()); // copies
+}
+
+event_archive::Column archive_column(const std::string &name)
+{
+    auto column = event_archive::find_column(name);
+    if (column == event_archive::ColumnCount)
+        throw py::value_error("unknown event archive column '" + name + "'");
+    return column;
+}
+
+// Converts {column name: (min, max)} into chunk selection predicates.
+std::vector<event_archive::RangePredicate> archive_predicates(const py::dict &filters)
+{
+    std::vector<event_archive::RangePredicate> result;
+
+    for (const auto &kv: filters)
+    {
+        auto range = kv.second.cast<std::pair<u64, u64>>();
+        result.push_back({ archive_column(kv.first.cast<std::string>()), range.first, range.second });
+    }
+
+    return result;
+}
+
+// numpy array of the raw column values. If base is given the array is a view
+// of the mapped archive data which keeps base alive, otherwise a copy.
+py::array archive_column_array(const void *data, size_t size, event_archive::Column column,
+                               py::handle base = {})
+{
+    switch (event_archive::column_size(column))
+    {
+        case 1: return py::array_t<u8>(size, static_cast<const u8 *>(data), base);
+        case 2: return py::array_t<u16>(size, static_cast<const u16 *>(data), base);
+        case 4: return py::array_t<u32>(size, static_cast<const u32 *>(data), base);
+        default: return py::array_t<u64>(size, static_cast<const u64 *>(data), base);
+    }
+}
+
+} // namespace
+
 void init_py_module(py::module_ &m)
 {
     m.doc() = "driver library for the mesytec PSD system (MCPD, MPSD, MDLL) - python bindings";
@@ -198,6 +269,8 @@ void init_py_module(py::module_ &m)
         .def_readonly("events", &Counters::events)
         .def_readonly("packets_lost", &Counters::packetsLost)
         .def_readonly("packets_dropped", &Counters::packetsDropped)
+        .def_readonly("overruns", &Counters::overruns)
+        .def_readonly("events_filtered", &Counters::eventsFiltered)
         .def("__repr__", [] (const Counters &counters)
              {
                  return "mesytec_mcpd_py.Counters(packets=" + std::to_string(counters.packets)
@@ -205,9 +278,522 @@ void init_py_module(py::module_ &m)
                      + ", timeouts=" + std::to_string(counters.timeouts)
                      + ", events=" + std::to_string(counters.events)
                      + ", packets_lost=" + std::to_string(counters.packetsLost)
-                     + ", packets_dropped=" + std::to_string(counters.packetsDropped) + ")";
+                     + ", packets_dropped=" + std::to_string(counters.packetsDropped)
+                     + ", overruns=" + std::to_string(counters.overruns)
+                     + ", events_filtered=" + std::to_string(counters.eventsFiltered) + ")";
              });
 
+    py::class_<DeviceCounters>(m, "DeviceCounters")
+        .def(py::init<>())
+        .def_readonly("src_addr", &DeviceCounters::srcAddr)
+        .def_readonly("device_id", &DeviceCounters::deviceId)
+        .def_readonly("packets", &DeviceCounters::packets)
+        .def_readonly("bytes", &DeviceCounters::bytes)
+        .def_readonly("events", &DeviceCounters::events)
+        .def_readonly("events_by_type", &DeviceCounters::eventsByType)
+        .def_readonly("packets_lost", &DeviceCounters::packetsLost)
+        .def_readonly("out_of_order", &DeviceCounters::outOfOrder)
+        .def_readonly("last_buffer_number", &DeviceCounters::lastBufferNumber)
+        .def_readonly("last_header_timestamp", &DeviceCounters::lastHeaderTimestamp)
+        .def("__repr__", [] (const DeviceCounters &dc)
+             {
+                 return "mesytec_mcpd_py.DeviceCounters(src_addr=" + format_ipv4(dc.srcAddr)
+                     + ", device_id=" + std::to_string(dc.deviceId)
+                     + ", packets=" + std::to_string(dc.packets)
+                     + ", events=" + std::to_string(dc.events)
+                     + ", packets_lost=" + std::to_string(dc.packetsLost) + ")";
+             });
+
+    py::class_<EventMerger::Counters>(m, "EventMergerCounters")
+        .def_readonly("events_in", &EventMerger::Counters::eventsIn)
+        .def_readonly("events_out", &EventMerger::Counters::eventsOut)
+        .def_readonly("late_events", &EventMerger::Counters::lateEvents)
+        .def_readonly("forced_events", &EventMerger::Counters::forcedEvents)
+        .def_readonly("stalled_source_skips", &EventMerger::Counters::stalledSourceSkips);
+
+    py::class_<EventMerger>(m, "EventMerger")
+        .def(py::init([] (u64 maxSourceLag, size_t maxBufferedEvents)
+                      {
+                          EventMerger::Options options;
+                          options.maxSourceLag = maxSourceLag;
+                          options.maxBufferedEvents = maxBufferedEvents;
+                          return std::make_unique<EventMerger>(options);
+                      }),
+             py::arg("max_source_lag") = EventMerger::Options{}.maxSourceLag,
+             py::arg("max_buffered_events") = EventMerger::Options{}.maxBufferedEvents)
+        .def("push_packet", &EventMerger::pushPacket, py::arg("source"), py::arg("packet"))
+        .def("push", [] (EventMerger &merger, size_t source, const std::vector<DecodedEvent> &events)
+             {
+                 merger.push(source, events);
+             }, py::arg("source"), py::arg("events"))
+        .def("pop", [] (EventMerger &merger)
+             {
+                 std::vector<DecodedEvent> result;
+                 merger.pop(result);
+                 return result;
+             })
+        .def("finish", [] (EventMerger &merger)
+             {
+                 std::vector<DecodedEvent> result;
+                 merger.finish(result);
+                 return result;
+             })
+        .def("watermark", &EventMerger::watermark)
+        .def("buffered_events", &EventMerger::bufferedEvents)
+        .def("source_count", &EventMerger::sourceCount)
+        .def("get_counters", &EventMerger::counters);
+
+    py::class_<CoincidenceHit>(m, "CoincidenceHit")
+        .def_readonly("channel", &CoincidenceHit::channel)
+        .def_readonly("dt", &CoincidenceHit::dt)
+        .def_readonly("amplitude", &CoincidenceHit::amplitude)
+        .def_readonly("position", &CoincidenceHit::position)
+        .def_readonly("device_id", &CoincidenceHit::deviceId)
+        .def_readonly("mpsd_id", &CoincidenceHit::mpsdId)
+        .def_readonly("mpsd_channel", &CoincidenceHit::mpsdChannel);
+
+    py::class_<CoincidenceRecord>(m, "CoincidenceRecord")
+        .def_readonly("timestamp", &CoincidenceRecord::timestamp)
+        .def_readonly("duration", &CoincidenceRecord::duration)
+        .def_readonly("first_hit", &CoincidenceRecord::firstHit)
+        .def_readonly("multiplicity", &CoincidenceRecord::multiplicity)
+        .def("__repr__", [] (const CoincidenceRecord &record)
+             {
+                 return "mesytec_mcpd_py.CoincidenceRecord(timestamp=" + std::to_string(record.timestamp)
+                     + ", duration=" + std::to_string(record.duration)
+                     + ", multiplicity=" + std::to_string(record.multiplicity) + ")";
+             });
+
+    py::class_<CoincidenceOutput>(m, "CoincidenceOutput")
+        .def(py::init<>())
+        .def_readonly("records", &CoincidenceOutput::records)
+        .def_readonly("hits", &CoincidenceOutput::hits)
+        .def("clear", &CoincidenceOutput::clear);
+
+    py::class_<CoincidenceFinder::Counters>(m, "CoincidenceCounters")
+        .def_readonly("events_in", &CoincidenceFinder::Counters::eventsIn)
+        .def_readonly("hits", &CoincidenceFinder::Counters::hits)
+        .def_readonly("ignored_events", &CoincidenceFinder::Counters::ignoredEvents)
+        .def_readonly("unordered_events", &CoincidenceFinder::Counters::unorderedEvents)
+        .def_readonly("groups", &CoincidenceFinder::Counters::groups)
+        .def_readonly("records", &CoincidenceFinder::Counters::records)
+        .def_readonly("oversized_groups", &CoincidenceFinder::Counters::oversizedGroups);
+
+    py::class_<CoincidenceFinder>(m, "CoincidenceFinder")
+        .def(py::init([] (u64 window, int maxChannelDistance, unsigned minMultiplicity,
+                          unsigned maxMultiplicity, size_t maxGroupSize,
+                          const std::vector<s32> &channelMap)
+                      {
+                          CoincidenceFinder::Options options;
+                          options.window = window;
+                          options.maxChannelDistance = maxChannelDistance;
+                          options.minMultiplicity = minMultiplicity;
+                          options.maxMultiplicity = maxMultiplicity;
+                          options.maxGroupSize = maxGroupSize;
+                          options.channelMap = channelMap;
+                          return std::make_unique<CoincidenceFinder>(options);
+                      }),
+             py::arg("window") = CoincidenceFinder::Options{}.window,
+             py::arg("max_channel_distance") = CoincidenceFinder::Options{}.maxChannelDistance,
+             py::arg("min_multiplicity") = CoincidenceFinder::Options{}.minMultiplicity,
+             py::arg("max_multiplicity") = CoincidenceFinder::Options{}.maxMultiplicity,
+             py::arg("max_group_size") = CoincidenceFinder::Options{}.maxGroupSize,
+             py::arg("channel_map") = std::vector<s32>{})
+        .def("process", [] (CoincidenceFinder &finder, const std::vector<DecodedEvent> &events)
+             {
+                 CoincidenceOutput out;
+                 finder.process(events, out);
+                 return out;
+             }, py::arg("events"))
+        .def("finish", [] (CoincidenceFinder &finder)
+             {
+                 CoincidenceOutput out;
+                 finder.finish(out);
+                 return out;
+             })
+        .def("multiplicity_histogram", [] (const CoincidenceFinder &finder)
+             {
+                 const auto &histo = finder.multiplicityHistogram();
+                 return py::array_t<u64>(histo.size(), histo.data()); // copies
+             })
+        .def("get_counters", &CoincidenceFinder::counters)
+        .def("reset", &CoincidenceFinder::reset);
+
+    m.def("linear_channel_index", &linear_channel_index,
+          py::arg("device_id"), py::arg("mpsd_id"), py::arg("channel"));
+    m.attr("linear_channel_count") = LinearChannelCount;
+
+    py::class_<TofHistogrammer::Counters>(m, "TofCounters")
+        .def_readonly("neutrons", &TofHistogrammer::Counters::neutrons)
+        .def_readonly("triggers", &TofHistogrammer::Counters::triggers)
+        .def_readonly("no_trigger", &TofHistogrammer::Counters::noTrigger)
+        .def_readonly("underflow", &TofHistogrammer::Counters::underflow)
+        .def_readonly("overflow", &TofHistogrammer::Counters::overflow)
+        .def_readonly("filled", &TofHistogrammer::Counters::filled);
+
+    py::class_<TofHistogrammer>(m, "TofHistogrammer")
+        .def(py::init([] (u8 triggerId, u8 dataId, u32 bins, u64 binWidth, u64 offset, u32 positionBins)
+                      {
+                          TofHistogrammer::Options options;
+                          options.triggerId = triggerId;
+                          options.dataId = dataId;
+                          options.bins = bins;
+                          options.binWidth = binWidth;
+                          options.offset = offset;
+                          options.positionBins = positionBins;
+                          return std::make_unique<TofHistogrammer>(options);
+                      }),
+             py::arg("trigger_id") = 0, py::arg("data_id") = 0,
+             py::arg("bins") = TofHistogrammer::Options{}.bins,
+             py::arg("bin_width") = TofHistogrammer::Options{}.binWidth,
+             py::arg("offset") = 0, py::arg("position_bins") = 1)
+        .def("process_packet", &TofHistogrammer::processPacket, py::arg("packet"))
+        .def("process_events", [] (TofHistogrammer &tof, const std::vector<DecodedEvent> &events)
+             {
+                 EventBatch batch;
+                 batch.reserve(events.size());
+                 for (const auto &event: events)
+                     batch.push_back(event);
+                 tof.process(batch);
+             }, py::arg("events"))
+        // Returns a copy of all histograms as a 2D (rows, bins) array.
+        .def("histograms", [] (const TofHistogrammer &tof)
+             {
+                 const auto &data = tof.data();
+                 py::array_t<u32> result({ tof.rowCount(), static_cast<size_t>(tof.options().bins) });
+                 std::copy(data.begin(), data.end(), result.mutable_data());
+                 return result;
+             })
+        .def("row_channels", [] (const TofHistogrammer &tof)
+             {
+                 std::vector<u32> result;
+                 for (size_t i = 0; i < tof.rowCount(); ++i)
+                     result.push_back(tof.rowChannel(i));
+                 return result;
+             })
+        .def("row_pixels", [] (const TofHistogrammer &tof)
+             {
+                 std::vector<u32> result;
+                 for (size_t i = 0; i < tof.rowCount(); ++i)
+                     result.push_back(tof.rowPixel(i));
+                 return result;
+             })
+        .def("find_row", &TofHistogrammer::findRow, py::arg("channel"), py::arg("pixel") = 0)
+        .def("bin_low_edge", &TofHistogrammer::binLowEdge, py::arg("bin"))
+        .def("get_counters", &TofHistogrammer::counters)
+        .def("reset", &TofHistogrammer::reset);
+
+    py::class_<EventBatch>(m, "EventBatch")
+        .def(py::init<>())
+        .def("decode_packet", [] (EventBatch &batch, const DataPacket &packet)
+             {
+                 return decode_events(packet, batch);
+             }, py::arg("packet"), "Decodes and appends all events of the packet.")
+        .def("clear", &EventBatch::clear)
+        .def("__len__", &EventBatch::size)
+        .def("event", &EventBatch::event, py::arg("index"))
+        // Column accessors return copies.
+        .def_property_readonly("timestamp", [] (const EventBatch &b) { return to_array(b.timestamp); })
+        .def_property_readonly("device_id", [] (const EventBatch &b) { return to_array(b.deviceId); })
+        .def_property_readonly("type", [] (const EventBatch &b)
+             {
+                 py::array_t<u8> result(b.size());
+                 std::transform(b.type.begin(), b.type.end(), result.mutable_data(),
+                                [] (EventType t) { return static_cast<u8>(t); });
+                 return result;
+             })
+        .def_property_readonly("address", [] (const EventBatch &b) { return to_array(b.address); })
+        .def_property_readonly("channel", [] (const EventBatch &b) { return to_array(b.channel); })
+        .def_property_readonly("amplitude", [] (const EventBatch &b) { return to_array(b.amplitude); })
+        .def_property_readonly("position", [] (const EventBatch &b) { return to_array(b.position); })
+        .def_property_readonly("y_position", [] (const EventBatch &b) { return to_array(b.yPosition); })
+        .def_property_readonly("value", [] (const EventBatch &b) { return to_array(b.value); });
+
+    // Columnar event archives. Column data is memory mapped: 'column' returns
+    // numpy views without copying, only the pages of the accessed columns are
+    // read from disk. Filters are dicts of column name to an inclusive
+    // (min, max) range and select the chunks whose value ranges intersect
+    // all of them.
+    py::class_<EventArchiveReader>(m, "EventArchiveReader")
+        .def(py::init([] (const std::string &path)
+             {
+                 auto reader = std::make_unique<EventArchiveReader>();
+                 if (auto ec = reader->open(path))
+                     throw std::system_error(ec, "EventArchiveReader: " + path);
+                 return reader;
+             }), py::arg("path"))
+        .def_property_readonly("event_count", &EventArchiveReader::eventCount)
+        .def_property_readonly("chunk_count", &EventArchiveReader::chunkCount)
+        .def_property_readonly_static("columns", [] (py::object)
+             {
+                 std::vector<std::string> result;
+                 for (u8 c = 0; c < event_archive::ColumnCount; ++c)
+                     result.emplace_back(event_archive::column_name(static_cast<event_archive::Column>(c)));
+                 return result;
+             })
+        .def("chunk_event_count", [] (const EventArchiveReader &r, size_t chunk)
+             {
+                 if (chunk >= r.chunkCount())
+                     throw py::index_error("chunk index out of range");
+                 return r.chunk(chunk).eventCount;
+             }, py::arg("chunk"))
+        .def("chunk_stats", [] (const EventArchiveReader &r, size_t chunk)
+             {
+                 if (chunk >= r.chunkCount())
+                     throw py::index_error("chunk index out of range");
+                 py::dict result;
+                 for (u8 c = 0; c < event_archive::ColumnCount; ++c)
+                 {
+                     const auto &info = r.chunk(chunk).columns[c];
+                     result[event_archive::column_name(static_cast<event_archive::Column>(c))] =
+                         py::make_tuple(info.min, info.max);
+                 }
+                 return result;
+             }, py::arg("chunk"), "Returns {column name: (min, max)} of the chunk.")
+        .def("select_chunks", [] (const EventArchiveReader &r, const py::dict &filters)
+             {
+                 return r.selectChunks(archive_predicates(filters));
+             }, py::arg("filters"))
+        .def("column", [] (py::object self, size_t chunk, const std::string &name)
+             {
+                 const auto &r = self.cast<const EventArchiveReader &>();
+                 if (chunk >= r.chunkCount())
+                     throw py::index_error("chunk index out of range");
+                 const auto column = archive_column(name);
+                 return archive_column_array(r.columnData(chunk, column), r.chunk(chunk).eventCount,
+                                             column, self);
+             }, py::arg("chunk"), py::arg("name"), "Read-only view of a column of a chunk.")
+        .def("read_columns", [] (const EventArchiveReader &r, const std::vector<std::string> &names,
+                                 const py::dict &filters)
+             {
+                 const auto chunks = r.selectChunks(archive_predicates(filters));
+                 py::dict result;
+
+                 for (const auto &name: names)
+                 {
+                     const auto column = archive_column(name);
+                     py::list parts;
+
+                     for (auto chunk: chunks)
+                         parts.append(archive_column_array(r.columnData(chunk, column),
+                                                           r.chunk(chunk).eventCount, column));
+
+                     result[py::str(name)] = parts.empty()
+                         ? archive_column_array(nullptr, 0, column)
+                         : py::module_::import("numpy").attr("concatenate")(parts);
+                 }
+
+                 return result;
+             }, py::arg("names"), py::arg("filters") = py::dict(),
+             "Returns {name: array} with the columns of all chunks selected by filters. The "
+             "arrays are copies. Events of the selected chunks are not filtered individually.")
+        .def("read_chunk", [] (const EventArchiveReader &r, size_t chunk)
+             {
+                 if (chunk >= r.chunkCount())
+                     throw py::index_error("chunk index out of range");
+                 EventBatch result;
+                 r.readChunk(chunk, result);
+                 return result;
+             }, py::arg("chunk"));
+
+    m.def("write_event_archive", [] (const std::string &listfilePath, const std::string &outputPath,
+                                     u32 chunkSize)
+          {
+              std::unique_ptr<PacketSource> input;
+              if (auto ec = open_packet_source(listfilePath, input))
+                  throw std::system_error(ec, "write_event_archive: " + listfilePath);
+
+              EventArchiveWriter::Options options;
+              options.chunkSize = chunkSize;
+              u64 eventCount = 0u;
+              std::error_code ec;
+              {
+                  py::gil_scoped_release gil_release;
+                  ec = write_event_archive(*input, outputPath, options, &eventCount);
+              }
+
+              if (ec)
+                  throw std::system_error(ec, "write_event_archive: " + outputPath);
+
+              return eventCount;
+          }, py::arg("listfile_path"), py::arg("output_path"),
+          py::arg("chunk_size") = EventArchiveWriter::Options{}.chunkSize,
+          "Decodes a listfile or split listfile manifest into a columnar event archive. "
+          "Returns the number of events written.");
+
+    py::class_<EventFilter::Counters>(m, "EventFilterCounters")
+        .def_readonly("packets_in", &EventFilter::Counters::packetsIn)
+        .def_readonly("packets_out", &EventFilter::Counters::packetsOut)
+        .def_readonly("events_in", &EventFilter::Counters::eventsIn)
+        .def_readonly("events_out", &EventFilter::Counters::eventsOut);
+
+    py::class_<EventFilter>(m, "EventFilter")
+        .def(py::init<>())
+        .def(py::init<const std::string &>(), py::arg("expression"),
+             "Compiles the filter expression, e.g. "
+             "'mpsd in 0..3 and amplitude > 100 or type == trigger'. Raises ValueError on "
+             "syntax errors.")
+        .def("matches_all", &EventFilter::matchesAll)
+        .def("evaluate", [] (EventFilter &filter, const EventBatch &batch)
+             {
+                 std::vector<u8> mask;
+                 filter.evaluate(batch, mask);
+                 return to_array(mask);
+             }, py::arg("batch"), "Returns a uint8 array with 1 for each matching event.")
+        .def("filter", [] (EventFilter &filter, const EventBatch &batch)
+             {
+                 EventBatch result;
+                 filter.filter(batch, result);
+                 return result;
+             }, py::arg("batch"), "Returns a new EventBatch containing the matching events.")
+        .def("filter_packet", [] (EventFilter &filter, const DataPacket &packet)
+             {
+                 DataPacket result = {};
+                 filter.filterPacket(packet, result);
+                 return result;
+             }, py::arg("packet"), "Returns a copy of the packet containing only the matching events.")
+        .def("get_counters", &EventFilter::counters)
+        .def("reset_counters", &EventFilter::resetCounters)
+        .def("__str__", &EventFilter::toString);
+
+    py::class_<HistoAxis>(m, "HistoAxis")
+        .def(py::init<>())
+        .def(py::init([] (u32 bins, u32 shift) { return HistoAxis{ bins, shift }; }),
+             py::arg("bins"), py::arg("shift") = 0)
+        .def_readwrite("bins", &HistoAxis::bins)
+        .def_readwrite("shift", &HistoAxis::shift)
+        .def("range", &HistoAxis::range)
+        .def("__repr__", [] (const HistoAxis &a)
+             {
+                 return "mesytec_mcpd_py.HistoAxis(bins=" + std::to_string(a.bins)
+                     + ", shift=" + std::to_string(a.shift) + ")";
+             });
+
+    m.def("make_axis_for_bits", &make_axis_for_bits, py::arg("value_bits"), py::arg("bin_bits"));
+
+    // 1D histograms use u64 counters, 2D histograms u32 counters. 'values'
+    // returns a numpy view of the histogram storage without copying.
+    using PyHisto1D = Histo1D<u64>;
+    using PyHisto2D = Histo2D<u32>;
+
+    py::class_<PyHisto1D>(m, "Histo1D")
+        .def(py::init<const HistoAxis &>(), py::arg("axis"))
+        .def("fill", [] (PyHisto1D &h, u64 value) { h.fill(value); }, py::arg("value"))
+        .def("fill_array", [] (PyHisto1D &h, py::array_t<u64, py::array::c_style | py::array::forcecast> values)
+             {
+                 h.fill(values.data(), values.size());
+             }, py::arg("values"))
+        .def("fill_column", [] (PyHisto1D &h, const EventBatch &batch, const std::string &column, EventType type)
+             {
+                 with_batch_column(column, [&] (auto ptr) { fill_column(h, batch, ptr, type); });
+             }, py::arg("batch"), py::arg("column"), py::arg("event_type") = EventType::Neutron)
+        .def("merge", &PyHisto1D::merge, py::arg("other"))
+        .def("clear", &PyHisto1D::clear)
+        .def("axis", &PyHisto1D::axis)
+        .def("overflow", &PyHisto1D::overflow)
+        .def_property_readonly("values", [] (py::object self)
+             {
+                 auto &h = self.cast<PyHisto1D &>();
+                 return py::array_t<u64>(h.size(), h.data(), self);
+             });
+
+    py::class_<PyHisto2D>(m, "Histo2D")
+        .def(py::init<const HistoAxis &, const HistoAxis &>(), py::arg("x_axis"), py::arg("y_axis"))
+        .def("fill", [] (PyHisto2D &h, u64 x, u64 y) { h.fill(x, y); }, py::arg("x"), py::arg("y"))
+        .def("fill_arrays", [] (PyHisto2D &h,
+                                py::array_t<u64, py::array::c_style | py::array::forcecast> xs,
+                                py::array_t<u64, py::array::c_style | py::array::forcecast> ys)
+             {
+                 if (xs.size() != ys.size())
+                     throw py::value_error("x and y arrays differ in size");
+                 h.fill(xs.data(), ys.data(), xs.size());
+             }, py::arg("xs"), py::arg("ys"))
+        .def("fill_columns", [] (PyHisto2D &h, const EventBatch &batch, const std::string &xColumn,
+                                 const std::string &yColumn, EventType type)
+             {
+                 with_batch_column(xColumn, [&] (auto xPtr)
+                 {
+                     with_batch_column(yColumn, [&] (auto yPtr)
+                     {
+                         fill_columns(h, batch, xPtr, yPtr, type);
+                     });
+                 });
+             }, py::arg("batch"), py::arg("x_column"), py::arg("y_column"),
+             py::arg("event_type") = EventType::MdllNeutron)
+        .def("merge", &PyHisto2D::merge, py::arg("other"))
+        .def("clear", &PyHisto2D::clear)
+        .def("x_axis", &PyHisto2D::xAxis)
+        .def("y_axis", &PyHisto2D::yAxis)
+        .def("overflow", &PyHisto2D::overflow)
+        // Shape is (y bins, x bins).
+        .def_property_readonly("values", [] (py::object self)
+             {
+                 auto &h = self.cast<PyHisto2D &>();
+                 return py::array_t<u32>({ static_cast<size_t>(h.yAxis().bins),
+                                           static_cast<size_t>(h.xAxis().bins) },
+                                         h.data(), self);
+             });
+
+    py::class_<ShmHistoInfo>(m, "ShmHistoInfo")
+        .def_readonly("name", &ShmHistoInfo::name)
+        .def_readonly("dims", &ShmHistoInfo::dims)
+        .def_readonly("x_axis", &ShmHistoInfo::xAxis)
+        .def_readonly("y_axis", &ShmHistoInfo::yAxis)
+        .def("size", &ShmHistoInfo::size);
+
+    py::class_<ShmHistoReader>(m, "ShmHistoReader")
+        .def(py::init<>())
+        .def(py::init([] (const std::string &name)
+             {
+                 auto reader = std::make_unique<ShmHistoReader>();
+                 if (auto ec = reader->open(name))
+                     throw std::system_error(ec, "ShmHistoReader: " + name);
+                 return reader;
+             }), py::arg("name"))
+        .def("open", [] (ShmHistoReader &r, const std::string &name)
+             {
+                 if (auto ec = r.open(name))
+                     throw std::system_error(ec, "ShmHistoReader: " + name);
+             }, py::arg("name"))
+        .def("close", &ShmHistoReader::close)
+        .def("is_open", &ShmHistoReader::isOpen)
+        .def("is_stale", &ShmHistoReader::isStale)
+        .def("histos", &ShmHistoReader::histos)
+        .def("find", &ShmHistoReader::find, py::arg("name"))
+        .def("publish_count", &ShmHistoReader::publishCount)
+        // Returns a consistent snapshot as a new array, shape (y bins, x bins)
+        // for 2D histograms, or None if the writer was busy.
+        .def("read", [] (const ShmHistoReader &r, size_t index) -> py::object
+             {
+                 if (index >= r.histos().size())
+                     throw py::index_error("histogram index out of range");
+
+                 const auto &info = r.histos()[index];
+                 py::array_t<u32> result = info.dims > 1
+                     ? py::array_t<u32>({ static_cast<size_t>(info.yAxis.bins),
+                                          static_cast<size_t>(info.xAxis.bins) })
+                     : py::array_t<u32>(info.size());
+
+                 bool ok = false;
+                 {
+                     py::gil_scoped_release gil_release;
+                     ok = r.read(index, result.mutable_data());
+                 }
+
+                 return ok ? py::object(result) : py::object(py::none());
+             }, py::arg("index"));
+
+    py::class_<ShmLiveHistos>(m, "ShmLiveHistos")
+        .def(py::init<const std::string &>(), py::arg("shm_name"))
+        .def("process_packet", &ShmLiveHistos::processPacket, py::arg("packet"))
+        .def("process", &ShmLiveHistos::process, py::arg("batch"))
+        .def("publish", [] (ShmLiveHistos &h)
+             {
+                 if (auto ec = h.publish())
+                     throw std::system_error(ec, "ShmLiveHistos::publish");
+             })
+        .def("clear", &ShmLiveHistos::clear);
+
     py::class_<WorkerBase>(m, "WorkerBase")
         .def("start", &WorkerBase::start)
         .def("stop", &WorkerBase::stop, py::arg("immediate") = false)
@@ -215,7 +801,21 @@ void init_py_module(py::module_ &m)
         .def("has_exception", &WorkerBase::hasException)
         .def("rethrow_exception", &WorkerBase::rethrowException)
         .def("get_queue", &WorkerBase::getQueue)
-        .def("get_counters", &WorkerBase::getCounters);
+        .def("get_counters", &WorkerBase::getCounters)
+        .def("get_device_counters", &WorkerBase::getDeviceCounters)
+        .def("set_shm_histos", &WorkerBase::setShmHistos, py::arg("shm_name"),
+             py::arg("publish_interval_ms") = 40u,
+             "Publish live histograms of the processed packets to the named shared memory "
+             "segment. An empty name disables publishing. Call while the worker is stopped.")
+        .def("set_shm_ring", &WorkerBase::setShmRing, py::arg("shm_name"),
+             py::arg("slot_count") = shm_ring::DefaultSlotCount,
+             "Copy the processed packets into the named shared memory packet ring for other "
+             "local consumers. The ring exists while the worker is running. An empty name "
+             "disables the ring. Call while the worker is stopped.")
+        .def("set_event_filter", &WorkerBase::setEventFilter, py::arg("expression"),
+             "Only pass on events matching the filter expression, see EventFilter. Packets "
+             "left without events are dropped. An empty expression disables filtering. Call "
+             "while the worker is stopped.");
 
     py::class_<Readout, WorkerBase>(m, "Readout")
         .def(py::init<int, size_t>(), py::arg("listenPort") = McpdDefaultPort,
@@ -225,7 +825,26 @@ void init_py_module(py::module_ &m)
         .def(py::init<size_t>(), py::arg("queue_size") = py_lib::DefaultQueueSize)
         .def(py::init<const std::string &, size_t>(),
              py::arg("filename"),
-             py::arg("queue_size") = py_lib::DefaultQueueSize);
+             py::arg("queue_size") = py_lib::DefaultQueueSize)
+        .def("set_pacing", &Replay::setPacing, py::arg("speed"), py::arg("packet_rate") = 0.0,
+             "Replay in real time at speed times the recorded speed (from the packet header "
+             "timestamps) or at a fixed packet rate. 0 for both disables pacing.")
+        .def("set_send_to", &Replay::setSendTo, py::arg("destination"),
+             "Also send the replayed packets as UDP datagrams to "
+             "'host[:port][/dev=id,...][/type=bufferType,...]'. An empty string disables "
+             "sending.")
+        .def("set_follow", &Replay::setFollow, py::arg("follow") = true,
+             py::arg("idle_timeout") = 0.0,
+             "Follow the listfile while it is being written instead of stopping at its end. "
+             "None is put into the queue while waiting for data. With idle_timeout > 0 the "
+             "replay ends once no new data arrived for that many seconds.");
+
+    py::class_<ShmRingReadout, WorkerBase>(m, "ShmRingReadout")
+        .def(py::init<const std::string &, size_t, bool>(), py::arg("shm_name"),
+             py::arg("queue_size") = py_lib::DefaultQueueSize, py::arg("from_oldest") = false,
+             "Read packets from a shared memory packet ring written by another process, e.g. "
+             "'mcpd-cli readout --shm-ring'. Packets lost because the reader fell behind are "
+             "counted in Counters.overruns.");
 
     // Event field constants (maximum values)
     namespace ec = event_constants;
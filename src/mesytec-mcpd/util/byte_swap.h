@@ -0,0 +1,59 @@
+#ifndef B8D2F4A6_3C1E_4B7D_A9E0_5F6C7D8E9A12
+#define B8D2F4A6_3C1E_4B7D_A9E0_5F6C7D8E9A12
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define UTIL_BYTE_SWAP_SSE2
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#define UTIL_BYTE_SWAP_NEON
+#endif
+
+namespace util
+{
+
+// Copies count 16 bit words from src to dest swapping the bytes of each word.
+// src and dest may be unaligned and may be the same buffer but must not
+// overlap otherwise. Uses SSE2 (part of the x86-64 baseline) or NEON, 16
+// words per iteration.
+inline void copy_swap_u16(void *dest, const void *src, size_t count)
+{
+    auto d = static_cast<uint8_t *>(dest);
+    auto s = static_cast<const uint8_t *>(src);
+    size_t i = 0;
+
+#if defined(UTIL_BYTE_SWAP_SSE2)
+    for (; i + 16 <= count; i += 16)
+    {
+        auto a = _mm_loadu_si128(reinterpret_cast<const __m128i *>(s + i * 2));
+        auto b = _mm_loadu_si128(reinterpret_cast<const __m128i *>(s + i * 2 + 16));
+        a = _mm_or_si128(_mm_slli_epi16(a, 8), _mm_srli_epi16(a, 8));
+        b = _mm_or_si128(_mm_slli_epi16(b, 8), _mm_srli_epi16(b, 8));
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(d + i * 2), a);
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(d + i * 2 + 16), b);
+    }
+#elif defined(UTIL_BYTE_SWAP_NEON)
+    for (; i + 16 <= count; i += 16)
+    {
+        auto a = vld1q_u8(s + i * 2);
+        auto b = vld1q_u8(s + i * 2 + 16);
+        vst1q_u8(d + i * 2, vrev16q_u8(a));
+        vst1q_u8(d + i * 2 + 16, vrev16q_u8(b));
+    }
+#endif
+
+    for (; i < count; ++i)
+    {
+        const uint8_t lo = s[i * 2];
+        d[i * 2] = s[i * 2 + 1];
+        d[i * 2 + 1] = lo;
+    }
+}
+
+}
+
+#endif /* B8D2F4A6_3C1E_4B7D_A9E0_5F6C7D8E9A12 */
@@ -0,0 +1,215 @@
+#include "lz4_block.h"
+
+#include <cstring>
+#include <memory>
+
+namespace util
+{
+
+namespace
+{
+    const size_t MinMatch = 4;
+    const size_t LastLiterals = 5;  // the last 5 bytes are always literals
+    const size_t MfLimit = 12;      // the last match starts at least 12 bytes before the end
+    const size_t MaxOffset = 65535;
+    const unsigned HashLog = 14;
+
+    inline uint32_t read32(const uint8_t *p)
+    {
+        uint32_t result;
+        std::memcpy(&result, p, sizeof(result));
+        return result;
+    }
+
+    inline uint32_t hash_sequence(uint32_t sequence)
+    {
+        return (sequence * 2654435761u) >> (32 - HashLog);
+    }
+
+    // Writes the 255 continuation bytes of a literal or match length.
+    inline uint8_t *write_length(uint8_t *op, size_t length)
+    {
+        while (length >= 255)
+        {
+            *op++ = 255;
+            length -= 255;
+        }
+
+        *op++ = static_cast<uint8_t>(length);
+        return op;
+    }
+
+    inline bool read_length(const uint8_t *&ip, const uint8_t *iend, size_t &length)
+    {
+        uint8_t b = 0;
+
+        do
+        {
+            if (ip == iend)
+                return false;
+
+            b = *ip++;
+            length += b;
+        } while (b == 255);
+
+        return true;
+    }
+}
+
+size_t lz4_compress(const uint8_t *src, size_t srcSize, uint8_t *dst, size_t dstCapacity)
+{
+    uint8_t *op = dst;
+    uint8_t *const oend = dst + dstCapacity;
+    size_t anchor = 0u;
+
+    // Emits a sequence of the literals [anchor, literalEnd) followed by a
+    // match. matchLength == 0 emits the final literals only sequence.
+    auto emit = [&](size_t literalEnd, size_t offset, size_t matchLength) -> bool
+    {
+        const size_t litLength = literalEnd - anchor;
+        const size_t worstCase = 1 + litLength / 255 + 1 + litLength + 2 + matchLength / 255 + 1;
+
+        if (static_cast<size_t>(oend - op) < worstCase)
+            return false;
+
+        uint8_t *token = op++;
+        *token = (litLength >= 15 ? 15 : litLength) << 4;
+
+        if (litLength >= 15)
+            op = write_length(op, litLength - 15);
+
+        std::memcpy(op, src + anchor, litLength);
+        op += litLength;
+
+        if (!matchLength)
+            return true;
+
+        *op++ = offset & 0xffu;
+        *op++ = offset >> 8;
+
+        const size_t ml = matchLength - MinMatch;
+        *token |= ml >= 15 ? 15 : ml;
+
+        if (ml >= 15)
+            op = write_length(op, ml - 15);
+
+        return true;
+    };
+
+    if (srcSize > MfLimit)
+    {
+        auto table = std::make_unique<uint32_t[]>(1u << HashLog);
+        const size_t matchStartLimit = srcSize - MfLimit;
+        const size_t matchEndLimit = srcSize - LastLiterals;
+        size_t ip = 0u;
+
+        while (ip <= matchStartLimit)
+        {
+            const uint32_t sequence = read32(src + ip);
+            const uint32_t h = hash_sequence(sequence);
+            const size_t candidate = table[h];
+            table[h] = ip;
+
+            if (candidate < ip && ip - candidate <= MaxOffset && read32(src + candidate) == sequence)
+            {
+                size_t start = ip;
+                size_t ref = candidate;
+
+                while (start > anchor && ref > 0 && src[start - 1] == src[ref - 1])
+                {
+                    --start;
+                    --ref;
+                }
+
+                size_t end = ip + MinMatch;
+
+                while (end < matchEndLimit && src[end] == src[ref + (end - start)])
+                    ++end;
+
+                if (!emit(start, start - ref, end - start))
+                    return 0u;
+
+                anchor = ip = end;
+
+                if (ip <= matchStartLimit)
+                    table[hash_sequence(read32(src + ip - 2))] = ip - 2;
+            }
+            else
+            {
+                // Skip faster through incompressible data.
+                ip += 1 + ((ip - anchor) >> 6);
+            }
+        }
+    }
+
+    if (!emit(srcSize, 0u, 0u))
+        return 0u;
+
+    return op - dst;
+}
+
+bool lz4_decompress(const uint8_t *src, size_t srcSize, uint8_t *dst, size_t dstSize)
+{
+    const uint8_t *ip = src;
+    const uint8_t *const iend = src + srcSize;
+    uint8_t *op = dst;
+    uint8_t *const oend = dst + dstSize;
+
+    while (true)
+    {
+        if (ip == iend)
+            return false;
+
+        const uint8_t token = *ip++;
+        size_t litLength = token >> 4;
+
+        if (litLength == 15 && !read_length(ip, iend, litLength))
+            return false;
+
+        if (litLength > static_cast<size_t>(iend - ip) || litLength > static_cast<size_t>(oend - op))
+            return false;
+
+        std::memcpy(op, ip, litLength);
+        ip += litLength;
+        op += litLength;
+
+        // The last sequence consists of literals only.
+        if (ip == iend)
+            return op == oend;
+
+        if (iend - ip < 2)
+            return false;
+
+        const size_t offset = ip[0] | (ip[1] << 8);
+        ip += 2;
+
+        if (offset == 0 || offset > static_cast<size_t>(op - dst))
+            return false;
+
+        size_t matchLength = token & 0xfu;
+
+        if (matchLength == 15 && !read_length(ip, iend, matchLength))
+            return false;
+
+        matchLength += MinMatch;
+
+        if (matchLength > static_cast<size_t>(oend - op))
+            return false;
+
+        const uint8_t *match = op - offset;
+
+        if (offset >= matchLength)
+        {
+            std::memcpy(op, match, matchLength);
+            op += matchLength;
+        }
+        else
+        {
+            // Overlapping copy repeating the last 'offset' bytes.
+            for (size_t i = 0; i < matchLength; ++i)
+                *op++ = *match++;
+        }
+    }
+}
+
+}
@@ -0,0 +1,38 @@
+#ifndef C3E9A1F0_7D2B_4E6A_8B5C_2F4D6E8A0B13
+#define C3E9A1F0_7D2B_4E6A_8B5C_2F4D6E8A0B13
+
+#include <cstddef>
+#include <cstdint>
+
+#include "mesytec-mcpd_export.h"
+
+namespace util
+{
+
+// Compressor and decompressor for the LZ4 block format
+// (https://github.com/lz4/lz4/blob/dev/doc/lz4_Block_format.md).
+//
+// Output is compatible with LZ4_decompress_safe() and vice versa. The
+// compressor is a simple greedy single pass matcher similar to LZ4's fast
+// mode: lower ratio than lz4hc but compresses at several hundred MB/s.
+
+// Maximum compressed size for input of the given size.
+inline size_t lz4_compress_bound(size_t srcSize)
+{
+    return srcSize + srcSize / 255 + 16;
+}
+
+// Compresses srcSize bytes from src into dst. Returns the compressed size or 0
+// if dstCapacity is too small. With dstCapacity >= lz4_compress_bound(srcSize)
+// compression always succeeds.
+MESYTEC_MCPD_EXPORT size_t lz4_compress(const uint8_t *src, size_t srcSize, uint8_t *dst,
+                                        size_t dstCapacity);
+
+// Decompresses a block which must expand to exactly dstSize bytes. Returns
+// false on malformed input. Never reads or writes out of bounds.
+MESYTEC_MCPD_EXPORT bool lz4_decompress(const uint8_t *src, size_t srcSize, uint8_t *dst,
+                                        size_t dstSize);
+
+}
+
+#endif /* C3E9A1F0_7D2B_4E6A_8B5C_2F4D6E8A0B13 */
@@ -0,0 +1,93 @@
+#include <gtest/gtest.h>
+#include "lz4_block.h"
+
+#include <cstring>
+#include <random>
+#include <vector>
+
+namespace
+{
+
+std::vector<uint8_t> roundtrip(const std::vector<uint8_t> &input)
+{
+    std::vector<uint8_t> compressed(util::lz4_compress_bound(input.size()));
+    const size_t size = util::lz4_compress(input.data(), input.size(), compressed.data(), compressed.size());
+    EXPECT_GT(size, 0u);
+    compressed.resize(size);
+
+    std::vector<uint8_t> output(input.size());
+    EXPECT_TRUE(util::lz4_decompress(compressed.data(), compressed.size(), output.data(), output.size()));
+    EXPECT_EQ(input, output);
+    return compressed;
+}
+
+}
+
+TEST(Lz4Block, Roundtrip)
+{
+    std::mt19937 rng(1);
+
+    for (size_t size: { 0, 1, 12, 13, 100, 65536, 300000 })
+    {
+        std::vector<uint8_t> random(size);
+        std::vector<uint8_t> repetitive(size);
+        std::vector<uint8_t> zeroes(size);
+
+        for (size_t i = 0; i < size; ++i)
+        {
+            random[i] = rng();
+            repetitive[i] = (i % 1000) < 500 ? i % 7 : rng() % 4;
+        }
+
+        roundtrip(random);
+        roundtrip(repetitive);
+        auto compressed = roundtrip(zeroes);
+
+        if (size >= 1000)
+            ASSERT_LT(compressed.size(), size / 100);
+    }
+}
+
+TEST(Lz4Block, DecompressReference)
+{
+    // Output of LZ4_compress_default() from the reference implementation.
+    const uint8_t compressed[] =
+    {
+        0xdf, 0x6d, 0x65, 0x73, 0x79, 0x74, 0x65, 0x63, 0x20, 0x6d, 0x63, 0x70, 0x64, 0x20,
+        0x0d, 0x00, 0x07, 0x8f, 0x6c, 0x69, 0x73, 0x74, 0x66, 0x69, 0x6c, 0x65, 0x09, 0x00,
+        0x00, 0xa0, 0x30, 0x31, 0x32, 0x33, 0x34, 0x35, 0x36, 0x37, 0x38, 0x39
+    };
+
+    const char expected[] =
+        "mesytec mcpd mesytec mcpd mesytec mcpd listfile listfile listfile 0123456789";
+
+    std::vector<uint8_t> output(sizeof(expected) - 1);
+    ASSERT_TRUE(util::lz4_decompress(compressed, sizeof(compressed), output.data(), output.size()));
+    ASSERT_EQ(std::memcmp(output.data(), expected, output.size()), 0);
+}
+
+TEST(Lz4Block, MalformedInput)
+{
+    std::vector<uint8_t> input(10000);
+
+    for (size_t i = 0; i < input.size(); ++i)
+        input[i] = i % 13;
+
+    auto compressed = roundtrip(input);
+    std::vector<uint8_t> output(input.size());
+
+    for (size_t size = 0; size < compressed.size(); ++size)
+        ASSERT_FALSE(util::lz4_decompress(compressed.data(), size, output.data(), output.size()));
+
+    // Wrong expected size.
+    ASSERT_FALSE(util::lz4_decompress(compressed.data(), compressed.size(), output.data(), output.size() - 1));
+
+    std::mt19937 rng(2);
+
+    for (int i = 0; i < 1000; ++i)
+    {
+        auto corrupted = compressed;
+        corrupted[rng() % corrupted.size()] = rng();
+        util::lz4_decompress(corrupted.data(), corrupted.size(), output.data(), output.size());
+    }
+}
@@ -0,0 +1,196 @@
+#include "shared_memory.h"
+
+#include <cstring>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace util
+{
+
+#ifndef _WIN32
+
+namespace
+{
+    inline std::error_code errno_error_code()
+    {
+        return std::error_code(errno, std::system_category());
+    }
+}
+
+std::error_code create_shared_memory(const std::string &name, size_t size, void **mem)
+{
+    shm_unlink(name.c_str());
+
+    int fd = shm_open(name.c_str(), O_RDWR | O_CREAT | O_EXCL, 0644);
+
+    if (fd < 0)
+        return errno_error_code();
+
+    if (ftruncate(fd, size) != 0)
+    {
+        auto ec = errno_error_code();
+        close(fd);
+        shm_unlink(name.c_str());
+        return ec;
+    }
+
+    void *result = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    auto ec = result == MAP_FAILED ? errno_error_code() : std::error_code{};
+    close(fd); // the mapping keeps the object alive
+
+    if (ec)
+    {
+        shm_unlink(name.c_str());
+        return ec;
+    }
+
+    *mem = result;
+    return {};
+}
+
+std::error_code open_shared_memory(const std::string &name, bool writable, void **mem, size_t *size)
+{
+    int fd = shm_open(name.c_str(), writable ? O_RDWR : O_RDONLY, 0);
+
+    if (fd < 0)
+        return errno_error_code();
+
+    struct stat st = {};
+
+    if (fstat(fd, &st) != 0)
+    {
+        auto ec = errno_error_code();
+        close(fd);
+        return ec;
+    }
+
+    if (st.st_size == 0)
+    {
+        close(fd);
+        return std::make_error_code(std::errc::invalid_argument);
+    }
+
+    void *result = mmap(nullptr, st.st_size, writable ? PROT_READ | PROT_WRITE : PROT_READ,
+                        MAP_SHARED, fd, 0);
+    auto ec = result == MAP_FAILED ? errno_error_code() : std::error_code{};
+    close(fd);
+
+    if (ec)
+        return ec;
+
+    *mem = result;
+    *size = st.st_size;
+    return {};
+}
+
+void unmap_shared_memory(const void *mem, size_t size)
+{
+    if (mem)
+        munmap(const_cast<void *>(mem), size);
+}
+
+void unlink_shared_memory(const std::string &name)
+{
+    shm_unlink(name.c_str());
+}
+
+std::error_code map_file(const std::string &path, const void **mem, size_t *size)
+{
+    int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+
+    if (fd < 0)
+        return errno_error_code();
+
+    struct stat st = {};
+
+    if (fstat(fd, &st) != 0)
+    {
+        auto ec = errno_error_code();
+        close(fd);
+        return ec;
+    }
+
+    if (st.st_size == 0)
+    {
+        close(fd);
+        return std::make_error_code(std::errc::invalid_argument);
+    }
+
+    void *result = mmap(nullptr, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    auto ec = result == MAP_FAILED ? errno_error_code() : std::error_code{};
+    close(fd);
+
+    if (ec)
+        return ec;
+
+    *mem = result;
+    *size = st.st_size;
+    return {};
+}
+
+std::error_code allocate_pages(size_t size, void **mem, bool *hugePages)
+{
+    void *result = MAP_FAILED;
+    *hugePages = false;
+
+#if defined(MAP_HUGETLB) && defined(MAP_POPULATE)
+    if (size % HugePageSize == 0)
+    {
+        result = mmap(nullptr, size, PROT_READ | PROT_WRITE,
+                      MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB | MAP_POPULATE, -1, 0);
+        *hugePages = result != MAP_FAILED;
+    }
+#endif
+
+    if (result == MAP_FAILED)
+    {
+        result = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+
+        if (result == MAP_FAILED)
+            return errno_error_code();
+
+        // Populate after madvise() so that the pages are allocated as
+        // transparent huge pages if possible.
+#ifdef MADV_HUGEPAGE
+        madvise(result, size, MADV_HUGEPAGE);
+#endif
+        std::memset(result, 0, size);
+    }
+
+    *mem = result;
+    return {};
+}
+
+#else // _WIN32
+
+std::error_code create_shared_memory(const std::string &, size_t, void **)
+{
+    return std::make_error_code(std::errc::function_not_supported);
+}
+
+std::error_code open_shared_memory(const std::string &, bool, void **, size_t *)
+{
+    return std::make_error_code(std::errc::function_not_supported);
+}
+
+void unmap_shared_memory(const void *, size_t) {}
+void unlink_shared_memory(const std::string &) {}
+
+std::error_code map_file(const std::string &, const void **, size_t *)
+{
+    return std::make_error_code(std::errc::function_not_supported);
+}
+
+std::error_code allocate_pages(size_t, void **, bool *)
+{
+    return std::make_error_code(std::errc::function_not_supported);
+}
+
+#endif
+
+}
@@ -0,0 +1,45 @@
+#ifndef A7C4E1D2_5B3F_4C8E_9F21_6D0B8E3A47C5
+#define A7C4E1D2_5B3F_4C8E_9F21_6D0B8E3A47C5
+
+#include <string>
+#include <system_error>
+
+#include "mesytec-mcpd_export.h"
+
+namespace util
+{
+
+// Thin wrappers around POSIX named shared memory (shm_open() and mmap()).
+// Under windows all functions fail with std::errc::function_not_supported.
+
+// Creates a new zero filled shared memory object of the given size, replacing
+// an existing object of the same name, and maps it read-write.
+MESYTEC_MCPD_EXPORT std::error_code create_shared_memory(const std::string &name, size_t size,
+                                                         void **mem);
+
+// Maps an existing shared memory object. The size of the object is stored in
+// *size.
+MESYTEC_MCPD_EXPORT std::error_code open_shared_memory(const std::string &name, bool writable,
+                                                       void **mem, size_t *size);
+
+MESYTEC_MCPD_EXPORT void unmap_shared_memory(const void *mem, size_t size);
+
+// Removes the name. Existing mappings stay valid.
+MESYTEC_MCPD_EXPORT void unlink_shared_memory(const std::string &name);
+
+// Maps a regular file read-only. Unmap with unmap_shared_memory(). Empty
+// files fail with std::errc::invalid_argument.
+MESYTEC_MCPD_EXPORT std::error_code map_file(const std::string &path, const void **mem, size_t *size);
+
+// Allocates zero filled private memory, backed by huge pages if the system
+// has some reserved (Linux MAP_HUGETLB), otherwise by normal pages with
+// transparent huge pages requested. The pages are populated up front so that
+// first use does not fault. *hugePages is set if explicit huge pages are used.
+// Free with unmap_shared_memory(). Use multiples of HugePageSize for size.
+static const size_t HugePageSize = 2u << 20;
+
+MESYTEC_MCPD_EXPORT std::error_code allocate_pages(size_t size, void **mem, bool *hugePages);
+
+}
+
+#endif /* A7C4E1D2_5B3F_4C8E_9F21_6D0B8E3A47C5 */
@@ -0,0 +1,100 @@
+#ifndef E41B7C93_2A6D_4F8E_9C05_7B3D1A9E6F24
+#define E41B7C93_2A6D_4F8E_9C05_7B3D1A9E6F24
+
+#include <algorithm>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+namespace util
+{
+
+// Fixed number of worker threads executing submitted tasks in FIFO order. The
+// destructor finishes all queued tasks before joining the workers.
+class ThreadPool
+{
+  public:
+    explicit ThreadPool(size_t threadCount)
+    {
+        for (size_t i = 0; i < std::max(threadCount, size_t(1)); ++i)
+            workers_.emplace_back([this] { workerLoop(); });
+    }
+
+    ~ThreadPool()
+    {
+        {
+            std::unique_lock<std::mutex> lock(mutex_);
+            quit_ = true;
+        }
+
+        cv_.notify_all();
+
+        for (auto &t: workers_)
+            t.join();
+    }
+
+    ThreadPool(const ThreadPool &) = delete;
+    ThreadPool &operator=(const ThreadPool &) = delete;
+
+    template <typename F> auto submit(F &&f) -> std::future<std::invoke_result_t<F>>
+    {
+        using Result = std::invoke_result_t<F>;
+        auto task = std::make_shared<std::packaged_task<Result()>>(std::forward<F>(f));
+        auto result = task->get_future();
+
+        {
+            std::unique_lock<std::mutex> lock(mutex_);
+            tasks_.emplace_back([task] { (*task)(); });
+        }
+
+        cv_.notify_one();
+        return result;
+    }
+
+    size_t size() const { return workers_.size(); }
+
+    // Default worker count for CPU bound tasks: the number of hardware threads
+    // limited to maxThreads.
+    static size_t defaultThreadCount(size_t maxThreads)
+    {
+        return std::max(size_t(1), std::min(size_t(std::thread::hardware_concurrency()), maxThreads));
+    }
+
+  private:
+    void workerLoop()
+    {
+        while (true)
+        {
+            std::function<void()> task;
+
+            {
+                std::unique_lock<std::mutex> lock(mutex_);
+                cv_.wait(lock, [this] { return quit_ || !tasks_.empty(); });
+
+                if (tasks_.empty())
+                    return;
+
+                task = std::move(tasks_.front());
+                tasks_.pop_front();
+            }
+
+            task();
+        }
+    }
+
+    std::vector<std::thread> workers_;
+    std::deque<std::function<void()>> tasks_;
+    std::mutex mutex_;
+    std::condition_variable cv_;
+    bool quit_ = false;
+};
+
+}
+
+#endif /* E41B7C93_2A6D_4F8E_9C05_7B3D1A9E6F24 */
@@ -0,0 +1,132 @@
+#ifndef D2D3EB920_23A2_4928_BB95_0FAC6A10DA97
+#define D2D3EB920_23A2_4928_BB95_0FAC6A10DA97
+
+#include <algorithm>
+#include <cstdint>
+#include <limits>
+#include <vector>
+
+namespace util
+{
+
+// Streaming downsampler for value-over-time data using a fixed number of
+// equal width time buckets. Each bucket keeps min, max, sum and count of the
+// values that fell into it.
+//
+// The time range covered by the buckets starts at the first sample. When a
+// sample falls beyond the last bucket, adjacent buckets are merged pairwise
+// and the bucket width is doubled until the sample fits. Memory usage is
+// therefore constant (maxBuckets) no matter how long the input runs, while
+// the resolution degrades gracefully.
+//
+// Samples are expected to arrive roughly in time order. Samples older than
+// the first one are accounted to the first bucket.
+class TimeBucketDownsampler
+{
+  public:
+    struct Bucket
+    {
+        double min = std::numeric_limits<double>::max();
+        double max = std::numeric_limits<double>::lowest();
+        double sum = 0.0;
+        uint64_t count = 0u;
+
+        double mean() const { return count ? sum / count : 0.0; }
+
+        void add(double value)
+        {
+            min = std::min(min, value);
+            max = std::max(max, value);
+            sum += value;
+            ++count;
+        }
+
+        void merge(const Bucket &o)
+        {
+            min = std::min(min, o.min);
+            max = std::max(max, o.max);
+            sum += o.sum;
+            count += o.count;
+        }
+    };
+
+    // maxBuckets is rounded up to an even number >= 2. initialWidth is the
+    // starting bucket width in time units.
+    explicit TimeBucketDownsampler(size_t maxBuckets = 4096u, uint64_t initialWidth = 1u)
+        : buckets_(std::max(maxBuckets + (maxBuckets & 1u), size_t(2)))
+        , initialWidth_(std::max(initialWidth, uint64_t(1)))
+        , width_(initialWidth_)
+    {
+    }
+
+    void add(uint64_t time, double value)
+    {
+        if (!samples_++)
+            origin_ = time;
+
+        const uint64_t offset = time > origin_ ? time - origin_ : 0u;
+
+        while (offset / width_ >= buckets_.size())
+            compact();
+
+        buckets_[offset / width_].add(value);
+    }
+
+    // Start time of the given bucket.
+    uint64_t bucketTime(size_t index) const { return origin_ + index * width_; }
+
+    // Center time of the given bucket.
+    double bucketCenter(size_t index) const { return bucketTime(index) + width_ * 0.5; }
+
+    uint64_t bucketWidth() const { return width_; }
+    size_t maxBuckets() const { return buckets_.size(); }
+    uint64_t sampleCount() const { return samples_; }
+    const std::vector<Bucket> &buckets() const { return buckets_; }
+
+    // Number of buckets in use, i.e. up to and including the last non-empty one.
+    size_t usedBuckets() const
+    {
+        for (size_t i = buckets_.size(); i > 0; --i)
+        {
+            if (buckets_[i - 1].count)
+                return i;
+        }
+
+        return 0u;
+    }
+
+    // Removes all samples and restores the initial bucket width.
+    void clear()
+    {
+        std::fill(buckets_.begin(), buckets_.end(), Bucket{});
+        width_ = initialWidth_;
+        samples_ = 0u;
+        origin_ = 0u;
+    }
+
+  private:
+    void compact()
+    {
+        const size_t half = buckets_.size() / 2;
+
+        for (size_t i = 0; i < half; ++i)
+        {
+            Bucket merged = buckets_[2 * i];
+            merged.merge(buckets_[2 * i + 1]);
+            buckets_[i] = merged;
+        }
+
+        std::fill(buckets_.begin() + half, buckets_.end(), Bucket{});
+        width_ *= 2;
+    }
+
+    std::vector<Bucket> buckets_;
+    uint64_t initialWidth_;
+    uint64_t width_;
+    uint64_t origin_ = 0u;
+    uint64_t samples_ = 0u;
+};
+
+}
+
+#endif /* D2D3EB920_23A2_4928_BB95_0FAC6A10DA97 */
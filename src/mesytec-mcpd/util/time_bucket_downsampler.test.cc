@@ -0,0 +1,78 @@
+#include <gtest/gtest.h>
+#include "time_bucket_downsampler.h"
+
+TEST(TimeBucketDownsampler, Buckets)
+{
+    util::TimeBucketDownsampler ds(4, 10);
+
+    ds.add(100, 1.0);
+    ds.add(105, 3.0);
+    ds.add(139, 5.0);
+
+    ASSERT_EQ(ds.bucketWidth(), 10u);
+    ASSERT_EQ(ds.usedBuckets(), 4u);
+    ASSERT_EQ(ds.buckets()[0].count, 2u);
+    ASSERT_DOUBLE_EQ(ds.buckets()[0].mean(), 2.0);
+    ASSERT_DOUBLE_EQ(ds.buckets()[0].min, 1.0);
+    ASSERT_DOUBLE_EQ(ds.buckets()[0].max, 3.0);
+    ASSERT_EQ(ds.bucketTime(3), 130u);
+
+    // Does not fit into 4 buckets of width 10: buckets are merged pairwise.
+    ds.add(140, 7.0);
+
+    ASSERT_EQ(ds.bucketWidth(), 20u);
+    ASSERT_EQ(ds.buckets()[0].count, 2u);
+    ASSERT_EQ(ds.buckets()[1].count, 1u);
+    ASSERT_EQ(ds.buckets()[2].count, 1u);
+    ASSERT_EQ(ds.sampleCount(), 4u);
+}
+
+TEST(TimeBucketDownsampler, BoundedMemory)
+{
+    util::TimeBucketDownsampler ds(64);
+    uint64_t count = 0;
+
+    for (uint64_t t = 0; t < 1000000; t += 3)
+    {
+        ds.add(t, t % 100);
+        ++count;
+    }
+
+    ASSERT_EQ(ds.maxBuckets(), 64u);
+    ASSERT_LE(ds.usedBuckets(), 64u);
+    ASSERT_GE(ds.bucketWidth() * 64, 1000000u - 3);
+
+    uint64_t total = 0;
+    for (const auto &bucket: ds.buckets())
+    {
+        total += bucket.count;
+        if (bucket.count)
+        {
+            ASSERT_GE(bucket.min, 0.0);
+            ASSERT_LE(bucket.max, 99.0);
+        }
+    }
+
+    ASSERT_EQ(total, count);
+}
+
+TEST(TimeBucketDownsampler, ClearRestoresInitialWidth)
+{
+    util::TimeBucketDownsampler ds(4, 10);
+
+    ds.add(0, 1.0);
+    ds.add(1000, 1.0);
+    ASSERT_GT(ds.bucketWidth(), 10u);
+
+    ds.clear();
+
+    ASSERT_EQ(ds.bucketWidth(), 10u);
+    ASSERT_EQ(ds.sampleCount(), 0u);
+    ASSERT_EQ(ds.usedBuckets(), 0u);
+
+    ds.add(500, 2.0);
+    ds.add(515, 4.0);
+    ASSERT_EQ(ds.bucketWidth(), 10u);
+    ASSERT_EQ(ds.bucketTime(1), 510u);
+    ASSERT_EQ(ds.buckets()[1].count, 1u);
+}
@@ -533,5 +533,71 @@ std::error_code receive_one_packet(int sockfd, u8 *dest, size_t size,
 }
 #endif
 
+#if defined(SOCKET_PLATFORM_POSIX) && defined(__linux__)
+std::error_code send_datagrams(
+    int sockfd, const UdpDatagram *datagrams, size_t count, size_t &datagramsSent)
+{
+    static const size_t BatchSize = 64;
+
+    datagramsSent = 0u;
+
+    while (datagramsSent < count)
+    {
+        const size_t batchSize = std::min(count - datagramsSent, BatchSize);
+        mmsghdr msgs[BatchSize];
+        iovec iovecs[BatchSize];
+
+        for (size_t i = 0; i < batchSize; ++i)
+        {
+            auto &dg = datagrams[datagramsSent + i];
+            iovecs[i].iov_base = const_cast<u8 *>(dg.data);
+            iovecs[i].iov_len = dg.size;
+            msgs[i] = {};
+            msgs[i].msg_hdr.msg_name = const_cast<sockaddr_in *>(&dg.dest);
+            msgs[i].msg_hdr.msg_namelen = sizeof(dg.dest);
+            msgs[i].msg_hdr.msg_iov = &iovecs[i];
+            msgs[i].msg_hdr.msg_iovlen = 1;
+        }
+
+        int res = ::sendmmsg(sockfd, msgs, batchSize, 0);
+
+        if (res < 0)
+        {
+            if (errno == EINTR)
+                continue;
+
+            return std::error_code(errno, std::system_category());
+        }
+
+        datagramsSent += res;
+    }
+
+    return {};
+}
+#else
+std::error_code send_datagrams(
+    int sockfd, const UdpDatagram *datagrams, size_t count, size_t &datagramsSent)
+{
+    for (datagramsSent = 0u; datagramsSent < count; ++datagramsSent)
+    {
+        auto &dg = datagrams[datagramsSent];
+
+        auto res = ::sendto(sockfd, reinterpret_cast<const char *>(dg.data), dg.size, 0,
+                            reinterpret_cast<const sockaddr *>(&dg.dest), sizeof(dg.dest));
+
+        if (res < 0)
+        {
+#ifdef SOCKET_PLATFORM_WINDOWS
+            return SocketErrorCode::GenericSocketError;
+#else
+            return std::error_code(errno, std::system_category());
+#endif
+        }
+    }
+
+    return {};
+}
+#endif
+
 }
 }
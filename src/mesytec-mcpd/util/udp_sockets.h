@@ -70,6 +70,20 @@ MESYTEC_MCPD_EXPORT std::error_code receive_one_packet(
     int sockfd, u8 *dest, size_t maxSize, size_t &bytesTransferred,
     int timeout_ms, sockaddr_in *src_addr = nullptr);
 
+struct UdpDatagram
+{
+    const u8 *data;
+    size_t size;
+    sockaddr_in dest;
+};
+
+// Sends count datagrams through the unconnected socket, using as few system
+// calls as possible (sendmmsg() under linux). On return datagramsSent holds
+// the number of datagrams sent. If an error occurs it refers to
+// datagrams[datagramsSent], the remaining datagrams have not been sent.
+MESYTEC_MCPD_EXPORT std::error_code send_datagrams(
+    int sockfd, const UdpDatagram *datagrams, size_t count, size_t &datagramsSent);
+
 inline std::string format_ipv4(u32 a)
 {
     std::stringstream ss;